@@ -12,17 +12,20 @@
 #include "io/PPMFile.h"
 #include "io/HDR.h"
 #include "renderer/Renderer.h"
+#include "renderer/WavefrontRenderer.h"
+#include "renderer/PPMRenderer.h"
 #include "film/FrameBuffer.h"
 #include "scene/dynamic/DynamicScene.h"
 #include "utility/MemoryUsage.h"
 #include "preview/PreviewWindow.h"
 #include "photonmapping/PhotonMapBuilder.h"
+#include "photonmapping/RadianceCache.h"
 
-Scene buildScene(const std::string& sceneFile, bool soupify, float imageAspectRatio)
+Scene buildScene(const std::string& sceneFile, bool soupify, bool quantizeMeshes, const BVHBuildSettings& bvhSettings, float imageAspectRatio)
 {
     std::cout << "Loading scene data." << std::endl;
 
-    auto gltfScene = loadGLTFScene(sceneFile, imageAspectRatio);
+    auto gltfScene = loadGLTFScene(sceneFile, imageAspectRatio, quantizeMeshes);
 
     Statistics::Collector collector;
     if(soupify)
@@ -38,7 +41,7 @@ Scene buildScene(const std::string& sceneFile, bool soupify, float imageAspectRa
 	std::cout << "Building scene." << std::endl;
     auto memUsageBefore = getMemoryUsage();
 	auto start = std::chrono::high_resolution_clock::now();
-	auto renderableScene = gltfScene.build(&collector);
+	auto renderableScene = gltfScene.build(&collector, bvhSettings);
 	auto finish = std::chrono::high_resolution_clock::now();
     auto memUsageDelta = getMemoryUsage() - memUsageBefore;
 	double duration = std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count() / 1000.0;
@@ -76,11 +79,25 @@ int main(int argc, char** argv)
         ("pmmode", po::value<std::string>()->default_value("none"), "Set the photonmapping algorithm to be used. ('none', 'caustics' or 'full')")
         ("pmdepth", po::value<int>()->default_value(0), "Set the path depth at which the photon map is used")
         ("pmfile", po::value<std::string>()->default_value(""), "The path of the photonmap file. (used for savepm and loadpm)")
-        ("pmrayspointlamp", po::value<unsigned long>()->default_value(1E7), "Amount of rays to trace from each point light during photonmapping (influences, but does not equal photon count)")
-        ("pmraysarealamp", po::value<unsigned long>()->default_value(1E7), "Amount of rays to trace from each area light during photonmapping (influences, but does not equal photon count)")
+        ("pmradiancecache", po::value<uint32_t>()->default_value(0), "Precompute the photon map radiance at every n-th photon, paths that read from the photon map then use the nearest precomputed value instead of a density estimate. With savepm and loadpm, the precomputed radiance is stored in the photon map file path + '.radiance' (0 disables)")
+        ("pmrayspointlamp", po::value<unsigned long>()->default_value(1E7), "Amount of rays to trace per point light during photonmapping, the rays of all lights are distributed over the lights by power (influences, but does not equal photon count)")
+        ("pmraysarealamp", po::value<unsigned long>()->default_value(1E7), "Amount of rays to trace per area light during photonmapping, the rays of all lights are distributed over the lights by power (influences, but does not equal photon count)")
         ("soupify", "Use single layer BVH instead of two-layer. Results in higher memory usage and longer scene build, but might produce faster render")
+        ("quantizemeshes", "Store mesh normals as 2x16-bit octahedral vectors and texture coordinates as half floats. Reduces memory usage at a small loss of precision")
+        ("bvhbuilder", po::value<std::string>()->default_value("sweep"), "BVH construction algorithm. ('sweep': full SAH sweep over sorted shapes, 'binned': binned SAH, faster to build on large scenes, 'sbvh': binned SAH with spatial splits, for scenes with large overlapping triangles)")
+        ("sbvhoverlap", po::value<float>()->default_value(1E-5f), "SBVH overlap budget: spatial splits are only considered for nodes whose children overlap by more than this fraction of the scene surface area")
+        ("bvhcache", po::value<std::string>()->default_value(""), "Directory in which built BVHs are stored and reused on later runs with the same geometry. (empty: disabled)")
+        ("renderer", po::value<std::string>()->default_value("pathtracer"), "Rendering engine. ('pathtracer': samples the paths of each pixel one by one, 'wavefront': advances the paths of many pixels together, tracing rays in large sorted batches, 'ppm': stochastic progressive photon mapping, alternates camera passes with passes of ppmphotons photons that are dropped after each pass, memory use does not grow with the photon count)")
+        ("ppmpasses", po::value<int>()->default_value(64), "Number of passes of the ppm renderer")
+        ("ppmphotons", po::value<unsigned long>()->default_value(1E5), "Amount of rays to trace per light in each pass of the ppm renderer")
+        ("sampler", po::value<std::string>()->default_value("sobol"), "Source of the random decisions of the renderer. ('sobol': Owen-scrambled Sobol sequence per pixel, reaches the same noise level with fewer samples, 'random': independent random values)")
+        ("lightsampling", po::value<std::string>()->default_value("alternate"), "How diffuse and glossy surfaces find the light arriving at them. ('alternate': each bounce either samples a light or continues the path, 'mis': each bounce samples a light and continues the path, combined with multiple importance sampling, reaches the same noise level with fewer material samples)")
+        ("seed", po::value<uint32_t>()->default_value(0), "Seed of all random decisions of the render and the photon tracer. Renders with the same seed and settings are identical, regardless of thread count and tiling")
         ("aageometry", po::value<int>()->default_value(4), "Geometry AA modifier: Higher means more rays from the camera")
         ("aamaterial", po::value<int>()->default_value(4), "Material AA modifier: Higher means more rays from the first hitpoint with a non-zero variance material")
+        ("noisethreshold", po::value<float>()->default_value(0.0f), "Adaptive sampling: keep adding camera rays to a pixel until the relative standard error of its luminance is below this value. (0 disables adaptive sampling)")
+        ("maxsamples", po::value<int>()->default_value(256), "Adaptive sampling: maximum amount of camera rays per pixel")
+        ("timebudget", po::value<float>()->default_value(0.0f), "Adaptive sampling: stop adding camera rays to pixels after this many seconds of rendering. (0 disables the budget)")
         ("preview", po::bool_switch(&previewEnabled), "If enabled, a preview window will open that displays the image as its being rendered")
         ("perffci", po::value<std::string>()->default_value(""), "If set, renders an exr with performance data for each pixel at the specified path")
 		;
@@ -206,6 +223,7 @@ int main(int argc, char** argv)
     }
 
     int pmdepth = vm["pmdepth"].as<int>();
+    uint32_t pmradiancecache = vm["pmradiancecache"].as<uint32_t>();
 
     PhotonMapMode photonMappingMode = PhotonMapMode::none;
     const auto& pmmodeString = vm["pmmode"].as<std::string>();
@@ -225,6 +243,72 @@ int main(int argc, char** argv)
         return -1;
     }
 
+    const auto& rendererString = vm["renderer"].as<std::string>();
+    if(rendererString != "pathtracer" && rendererString != "wavefront" && rendererString != "ppm")
+    {
+        std::cerr << "Invalid renderer!" << std::endl;
+        return -1;
+    }
+
+    SamplerType samplerType;
+    const auto& samplerString = vm["sampler"].as<std::string>();
+    if(samplerString == "sobol")
+    {
+        samplerType = SamplerType::sobol;
+    }
+    else if(samplerString == "random")
+    {
+        samplerType = SamplerType::random;
+    }
+    else
+    {
+        std::cerr << "Invalid sampler!" << std::endl;
+        return -1;
+    }
+
+    LightSamplingMode lightSamplingMode;
+    const auto& lightSamplingString = vm["lightsampling"].as<std::string>();
+    if(lightSamplingString == "alternate")
+    {
+        lightSamplingMode = LightSamplingMode::alternate;
+    }
+    else if(lightSamplingString == "mis")
+    {
+        lightSamplingMode = LightSamplingMode::mis;
+    }
+    else
+    {
+        std::cerr << "Invalid light sampling mode!" << std::endl;
+        return -1;
+    }
+
+    BVHBuildSettings bvhSettings;
+    const auto& bvhBuilderString = vm["bvhbuilder"].as<std::string>();
+    if(bvhBuilderString == "binned")
+    {
+        bvhSettings.strategy = BVHBuildStrategy::BinnedSAH;
+    }
+    else if(bvhBuilderString == "sbvh")
+    {
+        bvhSettings.strategy = BVHBuildStrategy::SpatialSplitSAH;
+    }
+    else if(bvhBuilderString != "sweep")
+    {
+        std::cerr << "Invalid BVH builder!" << std::endl;
+        return -1;
+    }
+    bvhSettings.spatialSplitOverlapBudget = vm["sbvhoverlap"].as<float>();
+    if(bvhSettings.spatialSplitOverlapBudget < 0)
+    {
+        std::cerr << "Invalid SBVH overlap budget!" << std::endl;
+        return -1;
+    }
+    const auto& bvhCacheDir = vm["bvhcache"].as<std::string>();
+    if(!bvhCacheDir.empty())
+    {
+        bvhSettings.cacheDirectory = PathResolver::get().resolve(bvhCacheDir).string();
+    }
+
     int aageometry = vm["aageometry"].as<int>();
     int aamaterial = vm["aamaterial"].as<int>();
     if(aageometry <= 0 || aamaterial <= 0)
@@ -233,6 +317,17 @@ int main(int argc, char** argv)
         return -1;
     }
 
+    float noisethreshold = vm["noisethreshold"].as<float>();
+    int maxsamples = vm["maxsamples"].as<int>();
+    float timebudget = vm["timebudget"].as<float>();
+    if(noisethreshold < 0 || maxsamples <= 0 || timebudget < 0)
+    {
+        std::cerr << "Invalid adaptive sampling settings!" << std::endl;
+        return -1;
+    }
+
+    uint32_t seed = vm["seed"].as<uint32_t>();
+
     unsigned long pmrayspointlamp = vm["pmrayspointlamp"].as<unsigned long>();
     unsigned long pmraysarealamp = vm["pmraysarealamp"].as<unsigned long>();
     if(pmrayspointlamp <= 0 || pmraysarealamp <= 0)
@@ -280,7 +375,7 @@ int main(int argc, char** argv)
 		// Build scene
         std::cout << "Loading scene." << std::endl;
         auto memUsageBefore = getMemoryUsage();
-		auto scene = buildScene(sceneFile, vm.count("soupify"), static_cast<float>(width)/height);
+		auto scene = buildScene(sceneFile, vm.count("soupify"), vm.count("quantizemeshes"), bvhSettings, static_cast<float>(width)/height);
         auto memUsageDelta = getMemoryUsage() - memUsageBefore;
         std::cout << "Scene loaded, total memory delta = " << memUsageDelta << " bytes" << std::endl;
 
@@ -299,28 +394,92 @@ int main(int argc, char** argv)
             if(loadPhotonMapFromFile)
             {
                 std::cout << "Loading photon map..." << std::endl;
-                std::fstream in(photonMapFilePath, std::fstream::in | std::fstream::binary);
-                photonMap = PhotonMap::deserialize(in);
+                try
+                {
+                    photonMap = PhotonMap::load(photonMapFilePath.string());
+                }catch(const std::runtime_error& err)
+                {
+                    std::cerr << err.what() << std::endl;
+                    return -1;
+                }
                 std::cout << "Loaded " << photonMap.getSize() << " photons" << std::endl;
+
+                // Sequences may reuse one photon map for frames in which the scene changed, so this is not an error
+                if(photonMap.getInfo().sceneHash != scene.getContentHash())
+                {
+                    std::cerr << "Warning: the photon map was built for a scene with other geometry or lights" << std::endl;
+                }
+                if(photonMap.getInfo().mode != photonMappingMode)
+                {
+                    std::cerr << "Warning: the photon map was built for another photon mapping mode" << std::endl;
+                }
             }
             else
             {
                 std::cout << "Building photon map..." << std::endl;
 
-                photonMap = PhotonMapBuilder::buildPhotonMap(scene, photonMappingMode, pmraysarealamp, pmrayspointlamp, progressPrinter);
+                photonMap = PhotonMapBuilder::buildPhotonMap(scene, photonMappingMode, pmraysarealamp, pmrayspointlamp, progressPrinter, seed);
             }
 
             if(savePhotonMapToFile)
             {
                 std::cout << "Saving photon map..." << std::endl;
-                std::fstream out(photonMapFilePath, std::fstream::out | std::fstream::binary);
-                photonMap.serialize(out);
+                try
+                {
+                    photonMap.save(photonMapFilePath.string());
+                }catch(const std::runtime_error& err)
+                {
+                    std::cerr << err.what() << std::endl;
+                }
+            }
+
+            if(pmradiancecache > 0)
+            {
+                const auto radianceFilePath = photonMapFilePath.string() + ".radiance";
+                std::optional<PhotonMap> radianceCache;
+                if(loadPhotonMapFromFile && std::filesystem::is_regular_file(radianceFilePath))
+                {
+                    std::cout << "Loading precomputed photon radiance..." << std::endl;
+                    try
+                    {
+                        auto cache = PhotonMap::load(radianceFilePath);
+                        if(RadianceCache::isBuiltFrom(cache, photonMap, pmradiancecache))
+                        {
+                            radianceCache = std::move(cache);
+                        }
+                        else
+                        {
+                            std::cerr << "Warning: the precomputed photon radiance does not match the photon map, it is recomputed" << std::endl;
+                        }
+                    }catch(const std::runtime_error& err)
+                    {
+                        std::cerr << err.what() << std::endl;
+                    }
+                }
+
+                if(!radianceCache.has_value())
+                {
+                    std::cout << "Precomputing photon radiance..." << std::endl;
+                    radianceCache = RadianceCache::build(photonMap, pmradiancecache, progressPrinter);
+                    if(savePhotonMapToFile)
+                    {
+                        try
+                        {
+                            radianceCache->save(radianceFilePath);
+                        }catch(const std::runtime_error& err)
+                        {
+                            std::cerr << err.what() << std::endl;
+                        }
+                    }
+                }
+                scene.setRadianceCache(std::move(radianceCache));
             }
 
             scene.setPhotonMap(std::move(photonMap));
             scene.setPhotonMapMode(photonMappingMode);
         }
         scene.setPhotonMapDepth(pmdepth);
+        scene.setLightSamplingMode(lightSamplingMode);
 
 		auto start = std::chrono::high_resolution_clock::now();
 
@@ -329,11 +488,41 @@ int main(int argc, char** argv)
 		RenderSettings settings;
 		settings.geometryAAModifier = aageometry;
         settings.materialAAModifier = aamaterial;
+        settings.noiseThreshold = noisethreshold;
+        settings.maxSamplesPerPixel = maxsamples;
+        settings.timeBudget = timebudget;
+        settings.sampler = samplerType;
+        settings.seed = seed;
         std::cout << "Geometry AA level = " << settings.geometryAAModifier << std::endl;
         std::cout << "Material AA level = " << settings.materialAAModifier << std::endl;
-		//PPMRenderer renderer;
-		Renderer renderer;
-		renderer.render(scene, *buffer, perfFCI, tile, settings, progressPrinter, true);
+        if(settings.noiseThreshold > 0)
+        {
+            std::cout << "Adaptive sampling: noise threshold = " << settings.noiseThreshold << ", max samples per pixel = " << settings.maxSamplesPerPixel;
+            if(settings.timeBudget > 0)
+            {
+                std::cout << ", time budget = " << settings.timeBudget << "s";
+            }
+            std::cout << std::endl;
+        }
+		std::unique_ptr<Renderer> renderer;
+		if(rendererString == "wavefront")
+		{
+			renderer = std::make_unique<WavefrontRenderer>();
+		}
+		else if(rendererString == "ppm")
+		{
+			auto ppmRenderer = std::make_unique<PPMRenderer>();
+			ppmRenderer->passCount = vm["ppmpasses"].as<int>();
+			ppmRenderer->photonsPerAreaLight = vm["ppmphotons"].as<unsigned long>();
+			ppmRenderer->photonsPerPointLight = vm["ppmphotons"].as<unsigned long>();
+			std::cout << "Progressive photon mapping: " << ppmRenderer->passCount << " passes" << std::endl;
+			renderer = std::move(ppmRenderer);
+		}
+		else
+		{
+			renderer = std::make_unique<Renderer>();
+		}
+		renderer->render(scene, *buffer, perfFCI, tile, settings, progressPrinter, true);
         std::cout << "Done" << std::endl;
 
 		auto finish = std::chrono::high_resolution_clock::now();
@@ -26,7 +26,7 @@ void PerspectiveCamera::pointAt(Point worldSpaceTarget, Vector3 up)
 Ray PerspectiveCamera::generateRay(const Vector2& pixel, int xResolution, int yResolution, int aaLevel, int sampleI) const
 {
     float apertureSamplesPerSensorSample = this->aperture > 0 ? std::min(8, aaLevel/2) : 1.0f; //Fairly arbitrary
-    auto sample = pixel + sampleUniformStratifiedSquare(aaLevel/apertureSamplesPerSensorSample, sampleI/apertureSamplesPerSensorSample);
+    Vector2 sample = pixel + sampleUniformStratifiedSquare(aaLevel/apertureSamplesPerSensorSample, sampleI/apertureSamplesPerSensorSample);
 	auto height = yResolution * width / xResolution;
 	auto u = this->width * (sample.x() / xResolution - 0.5);
 	auto v = -height * (sample.y() / yResolution - 0.5);
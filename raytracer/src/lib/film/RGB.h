@@ -149,6 +149,12 @@ public:
 		return this->blue;
 	}
 
+    // Relative luminance (Rec. 709 weights)
+    component getLuminance() const
+    {
+        return (0.2126f * this->red) + (0.7152f * this->green) + (0.0722f * this->blue);
+    }
+
 private:
     component red;
     component green;
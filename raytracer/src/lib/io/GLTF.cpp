@@ -26,38 +26,108 @@
 #include "material/PositionMaterial.h"
 #include "material/Texture.h"
 #include "HDR.h"
+#include "utility/MappedFile.h"
+#include <filesystem>
+#include <limits>
 
 namespace {
 
-template <typename T>
-void loadIndicesImpl(tinygltf::Model& file, tinygltf::Accessor& accessor, std::vector<std::array<uint32_t, 3>>& indices)
+// Raw contents of the glTF buffers, in the same order as tinygltf::Model::buffers.
+// The binary chunk of a GLB file is read in place from the MappedFile, see getBuffers.
+using BufferTable = std::vector<std::pair<const unsigned char*, size_t>>;
+
+BufferTable getBuffers(tinygltf::Model& file, const MappedFile& glb)
 {
+	BufferTable buffers;
+	for (auto& buffer : file.buffers)
+	{
+		buffers.emplace_back(buffer.data.data(), buffer.data.size());
+	}
+
+	// Only the first buffer can refer to the binary chunk, which follows the JSON chunk.
+	if (file.buffers.empty() || !file.buffers[0].uri.empty())
+	{
+		return buffers;
+	}
+	const auto* bytes = reinterpret_cast<const unsigned char*>(glb.getData());
+	uint32_t jsonLength;
+	memcpy(&jsonLength, bytes + 12, sizeof(jsonLength));
+	const size_t binStart = 20 + size_t(jsonLength) + 8;
+	const size_t byteLength = file.buffers[0].data.size();
+	if (binStart + byteLength > glb.getSize())
+	{
+		throw std::runtime_error("Invalid GLB binary chunk");
+	}
+
+	// tiny_gltf copied the chunk into the buffer, that copy is no longer needed once the images are decoded.
+	std::vector<unsigned char>().swap(file.buffers[0].data);
+	buffers[0] = std::make_pair(bytes + binStart, byteLength);
+	return buffers;
+}
+
+struct MeshSource
+{
+	BufferTable buffers;
+	// Store normals and texture coordinates quantized, see TriangleMeshData::quantizeAttributes
+	bool quantizeAttributes;
+};
+
+// Location of the elements of an accessor in its buffer.
+struct AccessorRange
+{
+	const unsigned char* data;
+	size_t count;
+	size_t stride;
+};
+
+AccessorRange getAccessorRange(tinygltf::Model& file, const BufferTable& buffers, tinygltf::Accessor& accessor, size_t elementSize)
+{
+	if (accessor.bufferView == -1)
+	{
+		throw std::runtime_error("Accessors without buffer view are not supported");
+	}
+
 	auto& bufferView = file.bufferViews[accessor.bufferView];
 	const auto start = bufferView.byteOffset + accessor.byteOffset;
-	const auto end = bufferView.byteLength + bufferView.byteOffset;
 	auto stride = bufferView.byteStride;
 	if (stride == 0)
 	{
-		stride = sizeof(T);
+		stride = elementSize;
+	}
+
+	const auto& buffer = buffers[bufferView.buffer];
+	const size_t byteLength = accessor.count == 0 ? 0 : (accessor.count - 1) * stride + elementSize;
+	if (start + byteLength > bufferView.byteOffset + bufferView.byteLength || start + byteLength > buffer.second)
+	{
+		throw std::runtime_error("Accessor exceeds its buffer");
+	}
+	return AccessorRange { buffer.first + start, accessor.count, stride };
+}
+
+template <typename T>
+void loadIndicesImpl(const AccessorRange& range, std::vector<std::array<uint32_t, 3>>& indices)
+{
+	indices.resize(range.count / 3);
+
+	// Tightly packed 32-bit indices already have the memory layout of the triangle array
+	if (sizeof(T) == sizeof(uint32_t) && range.stride == sizeof(T))
+	{
+		memcpy(indices.data(), range.data, indices.size() * sizeof(indices[0]));
+		return;
 	}
 
-	auto& buffer = file.buffers[bufferView.buffer];
-	std::array<uint32_t, 3> curTriangle;
-	auto j = 0;
-	for (auto i = start; i < end; i += stride)
+	for (size_t i = 0; i < indices.size(); i++)
 	{
-		T val;
-		memcpy(&val, &buffer.data[i], sizeof(val));
-		curTriangle[j] = val;
-		j = (j + 1) % 3;
-		if (j == 0)
+		for (size_t j = 0; j < 3; j++)
 		{
-			indices.push_back(curTriangle);
+			T val;
+			memcpy(&val, range.data + (3 * i + j) * range.stride, sizeof(val));
+			indices[i][j] = val;
 		}
 	}
 }
 
-void loadIndices(tinygltf::Model& file, tinygltf::Accessor& accessor, std::vector<std::array<uint32_t, 3>>& indices)
+void loadIndices(tinygltf::Model& file, const BufferTable& buffers, tinygltf::Accessor& accessor, std::vector<std::array<uint32_t, 3>>& indices)
 {
 	if (accessor.type != TINYGLTF_TYPE_SCALAR)
 	{
@@ -68,71 +138,58 @@ void loadIndices(tinygltf::Model& file, tinygltf::Accessor& accessor, std::vecto
 	{
 	case TINYGLTF_COMPONENT_TYPE_INT:
 	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-		loadIndicesImpl<unsigned int>(file, accessor, indices);
+		loadIndicesImpl<unsigned int>(getAccessorRange(file, buffers, accessor, sizeof(unsigned int)), indices);
 		break;
 	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
 	case TINYGLTF_COMPONENT_TYPE_SHORT:
-		loadIndicesImpl<unsigned short>(file, accessor, indices);
+		loadIndicesImpl<unsigned short>(getAccessorRange(file, buffers, accessor, sizeof(unsigned short)), indices);
 		break;
 	case TINYGLTF_COMPONENT_TYPE_BYTE:
 	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-		loadIndicesImpl<unsigned char>(file, accessor, indices);
+		loadIndicesImpl<unsigned char>(getAccessorRange(file, buffers, accessor, sizeof(unsigned char)), indices);
 		break;
 	default:
 		throw std::runtime_error("Unsupported index component type");
 	}
 }
 
+// Loads float vectors with the same memory layout as VectorType.
 template<typename VectorType>
-void loadVec3s(tinygltf::Model& file, tinygltf::Accessor& accessor, std::vector<VectorType>& vectors)
+void loadFloatVectors(tinygltf::Model& file, const BufferTable& buffers, tinygltf::Accessor& accessor, std::vector<VectorType>& vectors)
 {
-	if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT || accessor.type != TINYGLTF_TYPE_VEC3)
+	const auto range = getAccessorRange(file, buffers, accessor, sizeof(VectorType));
+	vectors.resize(range.count);
+	if (range.stride == sizeof(VectorType))
 	{
-		throw std::runtime_error("Unsupported vector accessor");
+		memcpy(static_cast<void*>(vectors.data()), range.data, range.count * sizeof(VectorType));
+		return;
 	}
 
-	auto& bufferView = file.bufferViews[accessor.bufferView];
-	const auto start = bufferView.byteOffset + accessor.byteOffset;
-	const auto end = bufferView.byteLength + bufferView.byteOffset;
-	auto stride = bufferView.byteStride;
-	if (stride == 0)
+	for (size_t i = 0; i < range.count; i++)
 	{
-		stride = sizeof(float[3]);
+		memcpy(static_cast<void*>(vectors[i].data()), range.data + i * range.stride, sizeof(VectorType));
 	}
+}
 
-	auto& buffer = file.buffers[bufferView.buffer];
-	for (auto i = start; i < end; i += stride)
+template<typename VectorType>
+void loadVec3s(tinygltf::Model& file, const BufferTable& buffers, tinygltf::Accessor& accessor, std::vector<VectorType>& vectors)
+{
+	static_assert(sizeof(VectorType) == sizeof(float[3]));
+	if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT || accessor.type != TINYGLTF_TYPE_VEC3)
 	{
-		float coord[3];
-		memcpy(coord, &buffer.data[i], sizeof(coord));
-		vectors.emplace_back(coord[0], coord[1], coord[2]);
+		throw std::runtime_error("Unsupported vector accessor");
 	}
+	loadFloatVectors(file, buffers, accessor, vectors);
 }
 
-void loadVec2s(tinygltf::Model & file, tinygltf::Accessor & accessor, std::vector<Vector2> & vectors)
+void loadVec2s(tinygltf::Model& file, const BufferTable& buffers, tinygltf::Accessor& accessor, std::vector<Vector2>& vectors)
 {
+	static_assert(sizeof(Vector2) == sizeof(float[2]));
 	if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT || accessor.type != TINYGLTF_TYPE_VEC2)
 	{
 		throw std::runtime_error("Unsupported vector accessor");
 	}
-
-	auto& bufferView = file.bufferViews[accessor.bufferView];
-	const auto start = bufferView.byteOffset + accessor.byteOffset;
-	const auto end = bufferView.byteLength + bufferView.byteOffset;
-	auto stride = bufferView.byteStride;
-	if (stride == 0)
-	{
-		stride = sizeof(float[2]);
-	}
-
-	auto& buffer = file.buffers[bufferView.buffer];
-	for (auto i = start; i < end; i += stride)
-	{
-		float x, y;
-		memcpy(&x, &buffer.data[i], sizeof(float));
-		memcpy(&y, &buffer.data[i + sizeof(float)], sizeof(float));
-		vectors.emplace_back(x, y);
-	}
+	loadFloatVectors(file, buffers, accessor, vectors);
 }
 
 const tinygltf::Value* tryGetExtras(const tinygltf::Node* node)
@@ -201,36 +258,34 @@ RGB getColorOrDefault(const tinygltf::Value* extras, const std::string &paramNam
     return defaultVal;
 }
 
-std::shared_ptr<TriangleMesh> loadPrimitiveShape(tinygltf::Model& file, tinygltf::Primitive& primitive)
+std::shared_ptr<TriangleMesh> loadPrimitiveShape(tinygltf::Model& file, const MeshSource& meshSource, tinygltf::Primitive& primitive)
 {
 	if (primitive.mode != TINYGLTF_MODE_TRIANGLES)
 	{
 		throw std::runtime_error("Unsupported primitive type");
 	}
 
-	std::vector<Point> vertices;
-	std::vector<std::array<uint32_t, 3>> indices;
-	std::vector<Vector3> normals;
-	std::vector<Vector2> texCoords;
+	// The mesh data is filled in place, the buffers are converted in bulk.
+	auto data = std::make_shared<TriangleMeshData>();
 
 	if (primitive.indices != -1)
 	{
 		auto& indicesAcc = file.accessors[primitive.indices];
-		loadIndices(file, indicesAcc, indices);
+		loadIndices(file, meshSource.buffers, indicesAcc, data->vertexIndices);
 	}
 
 	std::map<std::string, int>::iterator vertPosEntry;
 	if ((vertPosEntry = primitive.attributes.find("POSITION")) != primitive.attributes.end())
 	{
 		auto& vertPos = file.accessors[vertPosEntry->second];
-		loadVec3s(file, vertPos, vertices);
+		loadVec3s(file, meshSource.buffers, vertPos, data->vertices);
 	}
 
 	std::map<std::string, int>::iterator vertNormEntry;
 	if ((vertNormEntry = primitive.attributes.find("NORMAL")) != primitive.attributes.end())
 	{
 		auto& vertNorm = file.accessors[vertNormEntry->second];
-		loadVec3s(file, vertNorm, normals);
+		loadVec3s(file, meshSource.buffers, vertNorm, data->normals);
 	}
 	else
 	{
@@ -241,17 +296,16 @@ std::shared_ptr<TriangleMesh> loadPrimitiveShape(tinygltf::Model& file, tinygltf
 	if ((vertTexCoordEntry = primitive.attributes.find("TEXCOORD_0")) != primitive.attributes.end())
 	{
 		auto& vertTexCoord = file.accessors[vertTexCoordEntry->second];
-		loadVec2s(file, vertTexCoord, texCoords);
+		loadVec2s(file, meshSource.buffers, vertTexCoord, data->texCoords);
 	}
 
-	if(texCoords.empty())
+	// glTF attributes always share the vertex indices, so normalIndices and texCoordIndices stay empty.
+	if (meshSource.quantizeAttributes)
 	{
-        return std::make_shared<TriangleMesh>(vertices, indices, normals, indices, texCoords, std::vector<std::array<uint32_t,3>>());
-	}
-	else
-    {
-        return std::make_shared<TriangleMesh>(vertices, indices, normals, indices, texCoords, indices);
+		data->quantizeAttributes();
 	}
+	const auto triangleCount = data->vertexIndices.size();
+	return std::make_shared<TriangleMesh>(std::move(data), 0, triangleCount);
 }
 
 struct VideoFrameDefinition
@@ -454,14 +508,14 @@ std::shared_ptr<IMaterial> loadMaterial(tinygltf::Model& file, tinygltf::Materia
     return resultMaterial;
 }
 
-std::unique_ptr<Model> loadPrimitive(tinygltf::Model& file, tinygltf::Primitive& primitive, tinygltf::Value& nodeProps,
+std::unique_ptr<Model> loadPrimitive(tinygltf::Model& file, const MeshSource& meshSource, tinygltf::Primitive& primitive, tinygltf::Value& nodeProps,
         std::map<tinygltf::Primitive*, std::shared_ptr<TriangleMesh>>& meshCache, std::map<int32_t, std::shared_ptr<IMaterial>>& materialCache)
 {
     std::shared_ptr<TriangleMesh> shape;
     auto shapeIt = meshCache.find(&primitive);
     if(shapeIt == meshCache.end())
     {
-        shape = loadPrimitiveShape(file, primitive);
+        shape = loadPrimitiveShape(file, meshSource, primitive);
         meshCache[&primitive] = shape;
     }
     else
@@ -494,7 +548,7 @@ std::unique_ptr<Model> loadPrimitive(tinygltf::Model& file, tinygltf::Primitive&
 	return std::make_unique<Model>(shape, mat);
 }
 
-std::unique_ptr<DynamicSceneNode> loadNode(tinygltf::Model& file, int nodeI, float imageAspectRatio,
+std::unique_ptr<DynamicSceneNode> loadNode(tinygltf::Model& file, const MeshSource& meshSource, int nodeI, float imageAspectRatio,
        std::map<tinygltf::Primitive*, std::shared_ptr<TriangleMesh>>& meshCache, std::map<int32_t, std::shared_ptr<IMaterial>>& materialCache, tinygltf::Node* parent = nullptr)
 {
 	auto& node = file.nodes[nodeI];
@@ -536,7 +590,7 @@ std::unique_ptr<DynamicSceneNode> loadNode(tinygltf::Model& file, int nodeI, flo
             throw std::runtime_error("Invalid area light definition");
         }
 
-        auto prim = loadPrimitiveShape(file, meshDef.primitives[0]);
+        auto prim = loadPrimitiveShape(file, meshSource, meshDef.primitives[0]);
         auto primData = prim->getData();
         if (primData.vertices.size() != 3 || primData.vertexIndices.size() != 1)
         {
@@ -577,7 +631,7 @@ std::unique_ptr<DynamicSceneNode> loadNode(tinygltf::Model& file, int nodeI, flo
 
 		if (meshDef.primitives.size() == 1)
 		{
-			result->model = loadPrimitive(file, meshDef.primitives[0], node.extras, meshCache, materialCache);
+			result->model = loadPrimitive(file, meshSource, meshDef.primitives[0], node.extras, meshCache, materialCache);
 		}
 		else
 		{
@@ -585,7 +639,7 @@ std::unique_ptr<DynamicSceneNode> loadNode(tinygltf::Model& file, int nodeI, flo
 			{
 				auto child = std::make_unique<DynamicSceneNode>();
 				child->transform = Transformation::IDENTITY;
-				child->model = loadPrimitive(file, primitive, node.extras, meshCache, materialCache);
+				child->model = loadPrimitive(file, meshSource, primitive, node.extras, meshCache, materialCache);
 				result->children.push_back(std::move(child));
 			}
 		}
@@ -630,7 +684,7 @@ std::unique_ptr<DynamicSceneNode> loadNode(tinygltf::Model& file, int nodeI, flo
 
 	for (auto subNodeI : node.children)
 	{
-		result->children.push_back(loadNode(file, subNodeI, imageAspectRatio, meshCache, materialCache, &node));
+		result->children.push_back(loadNode(file, meshSource, subNodeI, imageAspectRatio, meshCache, materialCache, &node));
 	}
 
 	return result;
@@ -669,14 +723,23 @@ void loadEnvironmentInfo(const tinygltf::Scene& gltfScene, DynamicScene& outputS
 
 }
 
-DynamicScene loadGLTFScene(const std::string& file, float imageAspectRatio)
+DynamicScene loadGLTFScene(const std::string& file, float imageAspectRatio, bool quantizeMeshAttributes)
 {
 	tinygltf::Model model;
 	tinygltf::TinyGLTF loader;
 	std::string err;
 	std::string warn;
 
-	bool ret = loader.LoadBinaryFromFile(&model, &err, &warn, file);
+	// The file is mapped instead of read where the platform supports it (see MappedFile), tiny_gltf only parses the
+	// scene description and decodes the images. Mesh data is read from the mapping directly, see getBuffers.
+	// The GLB header stores the file size in 32 bits, so larger files are not valid GLB files.
+	MappedFile glb(file);
+	if (glb.getSize() > std::numeric_limits<uint32_t>::max())
+	{
+		throw std::runtime_error("GLB file " + file + " is larger than 4 GB, the maximum size of the GLB format; store the mesh data in external .bin buffers instead");
+	}
+	const auto baseDir = std::filesystem::path(file).parent_path().string();
+	bool ret = loader.LoadBinaryFromMemory(&model, &err, &warn, reinterpret_cast<const unsigned char*>(glb.getData()), static_cast<uint32_t>(glb.getSize()), baseDir);
 
 	if (!warn.empty()) {
 		printf("GLTF warning: %s\n", warn.c_str());
@@ -689,6 +752,7 @@ DynamicScene loadGLTFScene(const std::string& file, float imageAspectRatio)
 	if (!ret) {
 		throw std::runtime_error("Failed to load gltf");
 	}
+	MeshSource meshSource { getBuffers(model, glb), quantizeMeshAttributes };
 
     std::map<tinygltf::Primitive*, std::shared_ptr<TriangleMesh>> meshCache{};
     std::map<int32_t, std::shared_ptr<IMaterial>> materialCache{};
@@ -697,7 +761,7 @@ DynamicScene loadGLTFScene(const std::string& file, float imageAspectRatio)
 	scene.root = std::make_unique<DynamicSceneNode>();
 	for (auto nodeI : model.scenes[model.defaultScene].nodes)
 	{
-		scene.root->children.push_back(loadNode(model, nodeI, imageAspectRatio, meshCache, materialCache));
+		scene.root->children.push_back(loadNode(model, meshSource, nodeI, imageAspectRatio, meshCache, materialCache));
 	}
 	loadEnvironmentInfo(model.scenes[model.defaultScene], scene);
 
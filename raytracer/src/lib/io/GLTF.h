@@ -2,4 +2,4 @@
 
 #include "scene/dynamic/DynamicScene.h"
 
-DynamicScene loadGLTFScene(const std::string& file, float imageAspectRatio);
\ No newline at end of file
+DynamicScene loadGLTFScene(const std::string& file, float imageAspectRatio, bool quantizeMeshAttributes = false);
\ No newline at end of file
@@ -26,6 +26,11 @@ Point AreaLight::generateRandomPoint() const
 Point AreaLight::generateStratifiedJitteredRandomPoint(int level, int i) const noexcept
 {
     assert(i < level);
+    if(Rand::hasStratifiedSequence())
+    {
+        // The sample sequence is stratified already
+        return generateRandomPoint();
+    }
 
 	int n = sqrt(level);
 	Vector3 v1 = (c - a) / n;
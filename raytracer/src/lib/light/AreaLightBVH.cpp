@@ -0,0 +1,132 @@
+#include "AreaLightBVH.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include "math/Triangle.h"
+
+namespace
+{
+    constexpr unsigned int MaxDepth = 64;
+    constexpr size_t MaxLeafSize = 2;
+
+    // Bounds of the light, padded a little because area lights are flat: axis aligned lights have empty boxes otherwise.
+    AABB getBounds(const AreaLight& light)
+    {
+        const Point start = light.a.cwiseMin(light.b).cwiseMin(light.c);
+        const Point end = light.a.cwiseMax(light.b).cwiseMax(light.c);
+        const float padding = 1e-4f * std::max((end - start).maxCoeff(), 1.0f);
+        return AABB(Point(start.array() - padding), Point(end.array() + padding));
+    }
+
+    Point getCentroid(const AreaLight& light)
+    {
+        return Point((light.a + light.b + light.c) / 3.0f);
+    }
+}
+
+AreaLightBVH::AreaLightBVH(const std::vector<std::unique_ptr<AreaLight>>& areaLights)
+{
+    std::vector<std::pair<const AreaLight*, uint32_t>> validLights;
+    for(uint32_t i = 0; i < areaLights.size(); i++)
+    {
+        if(!hasNaN(areaLights[i]->getNormal()))
+        {
+            validLights.emplace_back(&*areaLights[i], i);
+        }
+    }
+
+    if(!validLights.empty())
+    {
+        nodes.reserve(2 * validLights.size());
+        build(validLights, 0, validLights.size(), 0);
+    }
+
+    // The leaves refer to ranges of the lights in the order of the build
+    for(const auto& [light, index] : validLights)
+    {
+        lights.push_back(light);
+        lightIndices.push_back(index);
+    }
+}
+
+uint32_t AreaLightBVH::build(std::vector<std::pair<const AreaLight*, uint32_t>>& entries, size_t start, size_t end, unsigned int depth)
+{
+    const auto nodeIndex = static_cast<uint32_t>(nodes.size());
+
+    AABB bounds = getBounds(*entries[start].first);
+    AABB centroidBounds(getCentroid(*entries[start].first), getCentroid(*entries[start].first));
+    for(size_t i = start + 1; i < end; i++)
+    {
+        bounds = bounds.merge(getBounds(*entries[i].first));
+        const Point centroid = getCentroid(*entries[i].first);
+        centroidBounds = centroidBounds.merge(AABB(centroid, centroid));
+    }
+
+    if(end - start <= MaxLeafSize || depth + 1 >= MaxDepth)
+    {
+        nodes.push_back(AreaLightBVHNode{bounds, static_cast<uint32_t>(start), static_cast<uint32_t>(end - start)});
+        return nodeIndex;
+    }
+
+    // Median split along the axis with the largest spread of centroids
+    int axis;
+    (centroidBounds.getEnd() - centroidBounds.getStart()).maxCoeff(&axis);
+    const size_t mid = start + ((end - start) / 2);
+    std::nth_element(entries.begin() + start, entries.begin() + mid, entries.begin() + end, [axis](const auto& a, const auto& b)
+    {
+        return getCentroid(*a.first)[axis] < getCentroid(*b.first)[axis];
+    });
+
+    nodes.push_back(AreaLightBVHNode{bounds, 0, 0});
+    build(entries, start, mid, depth + 1);
+    const uint32_t secondChild = build(entries, mid, end, depth + 1);
+    nodes[nodeIndex].first = secondChild;
+    return nodeIndex;
+}
+
+std::optional<AreaLightBVH::Hit> AreaLightBVH::traceRay(const Ray& ray, float maxT) const
+{
+    if(nodes.empty())
+    {
+        return std::nullopt;
+    }
+
+    std::optional<Hit> bestHit;
+    float bestT = maxT;
+
+    std::array<uint32_t, MaxDepth> stack;
+    size_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while(stackSize > 0)
+    {
+        const uint32_t nodeIndex = stack[--stackSize];
+        const AreaLightBVHNode& node = nodes[nodeIndex];
+
+        float t0, t1;
+        if(!node.bounds.getIntersections(ray, t0, t1) || t1 < 0 || t0 >= bestT)
+        {
+            continue;
+        }
+
+        if(node.count > 0)
+        {
+            for(uint32_t i = node.first; i < node.first + node.count; i++)
+            {
+                const AreaLight& light = *lights[i];
+                Triangle::TriangleIntersection intersection;
+                if(Triangle::intersect(ray, light.a, light.b, light.c, intersection) && intersection.t < bestT)
+                {
+                    bestT = static_cast<float>(intersection.t);
+                    bestHit = Hit{&light, lightIndices[i], bestT};
+                }
+            }
+        }
+        else
+        {
+            stack[stackSize++] = node.first;
+            stack[stackSize++] = nodeIndex + 1;
+        }
+    }
+    return bestHit;
+}
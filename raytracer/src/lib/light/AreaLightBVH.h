@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "math/Ray.h"
+#include "shape/AABB.h"
+#include "AreaLight.h"
+
+struct AreaLightBVHNode
+{
+    AABB bounds;
+    // Leaf: the lights [first, first + count) of AreaLightBVH::getLights(). Inner node: count is 0, first is the index
+    // of the second child, the first child is stored right after the node.
+    uint32_t first;
+    uint32_t count;
+};
+
+/*
+ * Bounding volume hierarchy over the area lights of a scene, to find the emitter a ray hits without testing every light.
+ * Area lights are kept out of the scene BVH because they are not occluders: they are only visible to rays that look
+ * for emission, not to shadow rays.
+ */
+class AreaLightBVH
+{
+public:
+    struct Hit
+    {
+        const AreaLight* light;
+        uint32_t index; // Index of the light in the area light list of the scene
+        float t;
+    };
+
+    AreaLightBVH() = default;
+    explicit AreaLightBVH(const std::vector<std::unique_ptr<AreaLight>>& areaLights);
+
+    bool isEmpty() const
+    {
+        return nodes.empty();
+    }
+
+    const std::vector<const AreaLight*>& getLights() const
+    {
+        return lights;
+    }
+
+    const std::vector<AreaLightBVHNode>& getNodes() const
+    {
+        return nodes;
+    }
+
+    // Closest light hit by the ray that is closer than maxT.
+    std::optional<Hit> traceRay(const Ray& ray, float maxT = INFINITY) const;
+
+private:
+    std::vector<const AreaLight*> lights;
+    std::vector<uint32_t> lightIndices; // Index in the area light list of the scene of each light in lights
+    std::vector<AreaLightBVHNode> nodes;
+
+    uint32_t build(std::vector<std::pair<const AreaLight*, uint32_t>>& entries, size_t start, size_t end, unsigned int depth);
+};
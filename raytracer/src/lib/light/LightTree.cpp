@@ -0,0 +1,417 @@
+#include "LightTree.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <Eigen/Geometry>
+#include "math/Constants.h"
+
+namespace
+{
+    constexpr float OneMinusEpsilon = 0x1.fffffep-1f;
+    constexpr unsigned int MaxDepth = 64;
+    constexpr unsigned int BucketCount = 12;
+
+    float safeSqrt(float x)
+    {
+        return std::sqrt(std::max(0.0f, x));
+    }
+
+    float safeAcos(float x)
+    {
+        return std::acos(std::clamp(x, -1.0f, 1.0f));
+    }
+
+    // cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of the angles a and b
+    float cosSubClamped(float sinA, float cosA, float sinB, float cosB)
+    {
+        return cosA > cosB ? 1.0f : (cosA * cosB) + (sinA * sinB);
+    }
+
+    float sinSubClamped(float sinA, float cosA, float sinB, float cosB)
+    {
+        return cosA > cosB ? 0.0f : (sinA * cosB) - (cosA * sinB);
+    }
+
+    Point getCenter(const AABB& box)
+    {
+        return Point((box.getStart() + box.getEnd()) / 2.0f);
+    }
+
+    // Cosine of the half angle of the cone of directions from point to the bounding sphere of box
+    float getCosSubtendedAngle(const AABB& box, const Point& point)
+    {
+        const Point center = getCenter(box);
+        const float radiusSqr = (box.getEnd() - center).squaredNorm();
+        const float distanceSqr = (point - center).squaredNorm();
+        if(distanceSqr <= radiusSqr)
+        {
+            return -1.0f;
+        }
+        return safeSqrt(1.0f - (radiusSqr / distanceSqr));
+    }
+
+    // Build cost of a node with the given bounds, the surface area orientation heuristic of PBRT v4.
+    // extentRatio penalizes splits along the short axes of the parent bounds.
+    float getCost(const LightBounds& b, float extentRatio)
+    {
+        const float normalAngle = safeAcos(b.cosNormalAngle);
+        const float emissionAngle = safeAcos(b.cosEmissionAngle);
+        const float totalAngle = std::min(normalAngle + emissionAngle, static_cast<float>(PI));
+        const float sinNormalAngle = safeSqrt(1.0f - (b.cosNormalAngle * b.cosNormalAngle));
+        const float solidAngleMeasure = static_cast<float>(2.0 * PI) * (1.0f - b.cosNormalAngle) +
+            static_cast<float>(PI / 2.0) * ((2.0f * totalAngle * sinNormalAngle) - std::cos(normalAngle - (2.0f * totalAngle))
+                - (2.0f * normalAngle * sinNormalAngle) + b.cosNormalAngle);
+        return b.intensity * solidAngleMeasure * extentRatio * static_cast<float>(b.bounds.getSurfaceArea());
+    }
+}
+
+float LightBounds::importance(const Point& point, const Vector3& normal) const
+{
+    const Point center = getCenter(bounds);
+    const Vector3 diagonal = bounds.getEnd() - bounds.getStart();
+    const float distanceSqr = std::max((point - center).squaredNorm(), diagonal.norm() / 2.0f);
+    if(distanceSqr == 0)
+    {
+        return 0;
+    }
+
+    // Angle between the emission cone and the direction to the point, minus the angle the bounds span from the point
+    Vector3 toPoint = point - center;
+    const float toPointLength = toPoint.norm();
+    toPoint = toPointLength > 0 ? Vector3(toPoint / toPointLength) : direction;
+    const float cosToPoint = direction.dot(toPoint);
+    const float sinToPoint = safeSqrt(1.0f - (cosToPoint * cosToPoint));
+
+    const float cosBounds = getCosSubtendedAngle(bounds, point);
+    const float sinBounds = safeSqrt(1.0f - (cosBounds * cosBounds));
+
+    const float sinNormalAngle = safeSqrt(1.0f - (cosNormalAngle * cosNormalAngle));
+    const float cosOutside = cosSubClamped(sinToPoint, cosToPoint, sinNormalAngle, cosNormalAngle);
+    const float sinOutside = sinSubClamped(sinToPoint, cosToPoint, sinNormalAngle, cosNormalAngle);
+    const float cosClosest = cosSubClamped(sinOutside, cosOutside, sinBounds, cosBounds);
+    if(cosClosest <= cosEmissionAngle)
+    {
+        return 0;
+    }
+
+    float result = intensity * cosClosest / distanceSqr;
+
+    // Cosine at the receiver, both sides are accepted as the receiver may transmit light
+    if(normal.squaredNorm() > 0)
+    {
+        const float cosReceiver = std::abs(toPoint.dot(normal));
+        const float sinReceiver = safeSqrt(1.0f - (cosReceiver * cosReceiver));
+        result *= cosSubClamped(sinReceiver, cosReceiver, sinBounds, cosBounds);
+    }
+    return std::max(result, 0.0f);
+}
+
+LightBounds LightBounds::merge(const LightBounds& a, const LightBounds& b)
+{
+    if(a.intensity == 0)
+    {
+        return b;
+    }
+    if(b.intensity == 0)
+    {
+        return a;
+    }
+
+    // Smallest cone around both normal cones
+    Vector3 mergedDirection = a.direction;
+    float cosMergedAngle;
+    const float angleA = safeAcos(a.cosNormalAngle);
+    const float angleB = safeAcos(b.cosNormalAngle);
+    const float angleBetween = safeAcos(a.direction.dot(b.direction));
+    if(std::min(angleBetween + angleB, static_cast<float>(PI)) <= angleA)
+    {
+        cosMergedAngle = a.cosNormalAngle;
+    }
+    else if(std::min(angleBetween + angleA, static_cast<float>(PI)) <= angleB)
+    {
+        mergedDirection = b.direction;
+        cosMergedAngle = b.cosNormalAngle;
+    }
+    else
+    {
+        const float mergedAngle = (angleA + angleBetween + angleB) / 2.0f;
+        const Vector3 rotationAxis = a.direction.cross(b.direction);
+        if(mergedAngle >= PI || rotationAxis.squaredNorm() == 0)
+        {
+            cosMergedAngle = -1.0f;
+        }
+        else
+        {
+            Eigen::AngleAxisf rotation(mergedAngle - angleA, rotationAxis.normalized());
+            mergedDirection = rotation * a.direction;
+            cosMergedAngle = std::cos(mergedAngle);
+        }
+    }
+
+    LightBounds result;
+    result.bounds = a.bounds.merge(b.bounds);
+    result.direction = mergedDirection;
+    result.intensity = a.intensity + b.intensity;
+    result.cosNormalAngle = cosMergedAngle;
+    result.cosEmissionAngle = std::min(a.cosEmissionAngle, b.cosEmissionAngle);
+    return result;
+}
+
+LightTree::LightTree(const std::vector<std::unique_ptr<PointLight>>& pointLights, const std::vector<std::unique_ptr<AreaLight>>& areaLights)
+{
+    std::vector<std::pair<uint32_t, LightBounds>> leaves;
+    float totalPower = 0;
+    auto addLight = [&](LightType type, uint32_t index, float power, const LightBounds& bounds)
+    {
+        // Lights that emit nothing are never sampled
+        if(!(power > 0))
+        {
+            return;
+        }
+        totalPower += power;
+        powerCdf.push_back(totalPower);
+        leaves.emplace_back(static_cast<uint32_t>(lights.size()), bounds);
+        lights.push_back(Light{type, index});
+    };
+
+    for(uint32_t i = 0; i < pointLights.size(); i++)
+    {
+        const auto& light = *pointLights[i];
+        const float power = static_cast<float>(light.intensity * light.color.getLuminance());
+
+        // Emits equally in all directions
+        LightBounds bounds;
+        bounds.bounds = AABB(light.pos, light.pos);
+        bounds.intensity = power / static_cast<float>(4.0 * PI);
+        bounds.cosNormalAngle = -1.0f;
+        bounds.cosEmissionAngle = 0.0f;
+        addLight(LightType::point, i, power, bounds);
+    }
+
+    areaLightIndices.assign(areaLights.size(), NoLight);
+    for(uint32_t i = 0; i < areaLights.size(); i++)
+    {
+        const auto& light = *areaLights[i];
+        const float power = static_cast<float>(light.intensity * light.color.getLuminance());
+        const Vector3 normal = light.getNormal();
+        if(hasNaN(normal))
+        {
+            continue;
+        }
+
+        // Lambertian emitter on the side of the normal, the radiant intensity along the normal is power / pi
+        LightBounds bounds;
+        bounds.bounds = AABB(light.a, light.a).merge(AABB(light.b, light.b)).merge(AABB(light.c, light.c));
+        bounds.direction = normal;
+        bounds.intensity = power / static_cast<float>(PI);
+        bounds.cosNormalAngle = 1.0f;
+        bounds.cosEmissionAngle = 0.0f;
+        if(power > 0)
+        {
+            areaLightIndices[i] = static_cast<uint32_t>(lights.size());
+        }
+        addLight(LightType::area, i, power, bounds);
+    }
+
+    if(leaves.empty())
+    {
+        return;
+    }
+    lightPaths.resize(lights.size());
+    nodes.reserve((2 * leaves.size()) - 1);
+    build(leaves, 0, leaves.size(), 0, 0);
+}
+
+uint32_t LightTree::build(std::vector<std::pair<uint32_t, LightBounds>>& leaves, size_t start, size_t end, uint64_t path, unsigned int depth)
+{
+    const auto nodeIndex = static_cast<uint32_t>(nodes.size());
+    if(end - start == 1)
+    {
+        nodes.push_back(LightTreeNode{leaves[start].second, leaves[start].first, true});
+        lightPaths[leaves[start].first] = path;
+        return nodeIndex;
+    }
+
+    LightBounds bounds;
+    AABB centroidBounds(getCenter(leaves[start].second.bounds), getCenter(leaves[start].second.bounds));
+    for(size_t i = start; i < end; i++)
+    {
+        bounds = LightBounds::merge(bounds, leaves[i].second);
+        const Point centroid = getCenter(leaves[i].second.bounds);
+        centroidBounds = centroidBounds.merge(AABB(centroid, centroid));
+    }
+
+    // Find the bucket split with the lowest cost over all axes
+    float bestCost = INFINITY;
+    int bestAxis = -1;
+    unsigned int bestSplit = 0;
+    const Vector3 extent = bounds.bounds.getEnd() - bounds.bounds.getStart();
+    const Vector3 centroidExtent = centroidBounds.getEnd() - centroidBounds.getStart();
+    const bool canUseBuckets = depth + 1 < MaxDepth / 2;
+    for(int axis = 0; axis < 3 && canUseBuckets; axis++)
+    {
+        if(!(centroidExtent[axis] > 0))
+        {
+            continue;
+        }
+
+        auto getBucket = [&](const LightBounds& lightBounds)
+        {
+            const float offset = (getCenter(lightBounds.bounds)[axis] - centroidBounds.getStart()[axis]) / centroidExtent[axis];
+            return std::min(static_cast<unsigned int>(offset * BucketCount), BucketCount - 1);
+        };
+
+        std::array<LightBounds, BucketCount> buckets {};
+        for(size_t i = start; i < end; i++)
+        {
+            auto& bucket = buckets[getBucket(leaves[i].second)];
+            bucket = LightBounds::merge(bucket, leaves[i].second);
+        }
+
+        const float extentRatio = extent.maxCoeff() / std::max(extent[axis], 1e-12f);
+        for(unsigned int split = 1; split < BucketCount; split++)
+        {
+            LightBounds below, above;
+            for(unsigned int i = 0; i < split; i++)
+            {
+                below = LightBounds::merge(below, buckets[i]);
+            }
+            for(unsigned int i = split; i < BucketCount; i++)
+            {
+                above = LightBounds::merge(above, buckets[i]);
+            }
+            if(below.intensity == 0 || above.intensity == 0)
+            {
+                continue;
+            }
+            const float cost = getCost(below, extentRatio) + getCost(above, extentRatio);
+            if(cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = split;
+            }
+        }
+    }
+
+    size_t mid;
+    if(bestAxis >= 0)
+    {
+        const int axis = bestAxis;
+        auto midIt = std::partition(leaves.begin() + start, leaves.begin() + end, [&](const auto& leaf)
+        {
+            const float offset = (getCenter(leaf.second.bounds)[axis] - centroidBounds.getStart()[axis]) / centroidExtent[axis];
+            return std::min(static_cast<unsigned int>(offset * BucketCount), BucketCount - 1) < bestSplit;
+        });
+        mid = std::distance(leaves.begin(), midIt);
+    }
+    else
+    {
+        // All lights are at the same position or the tree is getting too deep, split in halves
+        mid = (start + end) / 2;
+        const int axis = static_cast<int>(std::distance(centroidExtent.data(), std::max_element(centroidExtent.data(), centroidExtent.data() + 3)));
+        std::nth_element(leaves.begin() + start, leaves.begin() + mid, leaves.begin() + end, [axis](const auto& a, const auto& b)
+        {
+            return getCenter(a.second.bounds)[axis] < getCenter(b.second.bounds)[axis];
+        });
+    }
+
+    nodes.push_back(LightTreeNode{bounds, 0, false});
+    build(leaves, start, mid, path, depth + 1);
+    const uint32_t secondChild = build(leaves, mid, end, path | (uint64_t(1) << depth), depth + 1);
+    nodes[nodeIndex].childOrLight = secondChild;
+    return nodeIndex;
+}
+
+std::optional<LightTree::SampledLight> LightTree::sample(const Point& point, const Vector3& normal, float u) const
+{
+    if(nodes.empty())
+    {
+        return std::nullopt;
+    }
+
+    uint32_t nodeIndex = 0;
+    float probability = 1.0f;
+    while(!nodes[nodeIndex].isLeaf)
+    {
+        const uint32_t firstChild = nodeIndex + 1;
+        const uint32_t secondChild = nodes[nodeIndex].childOrLight;
+        const float firstImportance = nodes[firstChild].bounds.importance(point, normal);
+        const float secondImportance = nodes[secondChild].bounds.importance(point, normal);
+        if(firstImportance == 0 && secondImportance == 0)
+        {
+            return std::nullopt;
+        }
+
+        // Pick a child proportional to its importance, and reuse u for the next choice
+        const float firstProbability = firstImportance / (firstImportance + secondImportance);
+        if(u < firstProbability)
+        {
+            nodeIndex = firstChild;
+            probability *= firstProbability;
+            u = std::min(u / firstProbability, OneMinusEpsilon);
+        }
+        else
+        {
+            nodeIndex = secondChild;
+            probability *= 1.0f - firstProbability;
+            u = std::min((u - firstProbability) / (1.0f - firstProbability), OneMinusEpsilon);
+        }
+    }
+
+    // A single light in the tree is not tested above
+    if(nodeIndex == 0 && nodes[0].bounds.importance(point, normal) == 0)
+    {
+        return std::nullopt;
+    }
+    return SampledLight{lights[nodes[nodeIndex].childOrLight], probability};
+}
+
+float LightTree::getProbability(const Point& point, const Vector3& normal, size_t lightIndex) const
+{
+    uint64_t path = lightPaths[lightIndex];
+    uint32_t nodeIndex = 0;
+    float probability = 1.0f;
+    while(!nodes[nodeIndex].isLeaf)
+    {
+        const uint32_t firstChild = nodeIndex + 1;
+        const uint32_t secondChild = nodes[nodeIndex].childOrLight;
+        const float firstImportance = nodes[firstChild].bounds.importance(point, normal);
+        const float secondImportance = nodes[secondChild].bounds.importance(point, normal);
+        if(firstImportance == 0 && secondImportance == 0)
+        {
+            return 0;
+        }
+
+        const bool takeSecond = (path & 1) != 0;
+        probability *= (takeSecond ? secondImportance : firstImportance) / (firstImportance + secondImportance);
+        nodeIndex = takeSecond ? secondChild : firstChild;
+        path >>= 1;
+    }
+    if(nodeIndex == 0 && nodes[0].bounds.importance(point, normal) == 0)
+    {
+        return 0;
+    }
+    return probability;
+}
+
+float LightTree::getAreaLightProbability(const Point& point, const Vector3& normal, uint32_t areaLightIndex) const
+{
+    const uint32_t lightIndex = areaLightIndices[areaLightIndex];
+    return lightIndex == NoLight ? 0.0f : getProbability(point, normal, lightIndex);
+}
+
+std::optional<LightTree::SampledLight> LightTree::sampleByPower(float u) const
+{
+    if(powerCdf.empty())
+    {
+        return std::nullopt;
+    }
+
+    const float totalPower = powerCdf.back();
+    const auto it = std::upper_bound(powerCdf.begin(), powerCdf.end(), u * totalPower);
+    const size_t lightIndex = std::min(static_cast<size_t>(std::distance(powerCdf.begin(), it)), lights.size() - 1);
+    const float power = powerCdf[lightIndex] - (lightIndex == 0 ? 0.0f : powerCdf[lightIndex - 1]);
+    return SampledLight{lights[lightIndex], power / totalPower};
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "math/Vector3.h"
+#include "shape/AABB.h"
+#include "PointLight.h"
+#include "AreaLight.h"
+
+/*
+ * Conservative bounds on the emission of a set of lights: the region the lights are in, the total radiant intensity,
+ * and a cone around direction that contains the normals of all lights (cosNormalAngle) plus the angle by which the
+ * emission spreads out around these normals (cosEmissionAngle).
+ */
+struct LightBounds
+{
+    AABB bounds;
+    Vector3 direction = Vector3(0, 0, 1);
+    float intensity = 0;
+    float cosNormalAngle = 1;
+    float cosEmissionAngle = 1;
+
+    // Upper bound of the contribution of the lights to a point with surface normal normal, up to a constant factor.
+    // The normal may be zero if the receiver has no orientation.
+    float importance(const Point& point, const Vector3& normal) const;
+
+    static LightBounds merge(const LightBounds& a, const LightBounds& b);
+};
+
+struct LightTreeNode
+{
+    LightBounds bounds;
+    // Leaf: index of the light in LightTree::getLights(). Inner node: index of the second child, the first child is
+    // stored right after the node.
+    uint32_t childOrLight;
+    bool isLeaf;
+};
+
+/*
+ * Bounding volume hierarchy over the point and area lights of a scene, used to pick a light with a probability
+ * roughly proportional to its contribution to a point (Conty Estevez & Kulla 2018, "Importance Sampling of Many
+ * Lights With Adaptive Tree Splitting", as in PBRT v4).
+ * The tree also holds the distribution of the emitted power over the lights, to distribute photons.
+ */
+class LightTree
+{
+public:
+    enum class LightType
+    {
+        point,
+        area
+    };
+
+    struct Light
+    {
+        LightType type;
+        uint32_t index; // Index in the point or area light list of the scene
+    };
+
+    struct SampledLight
+    {
+        Light light;
+        float probability;
+    };
+
+    LightTree() = default;
+    LightTree(const std::vector<std::unique_ptr<PointLight>>& pointLights, const std::vector<std::unique_ptr<AreaLight>>& areaLights);
+
+    bool isEmpty() const
+    {
+        return nodes.empty();
+    }
+
+    const std::vector<Light>& getLights() const
+    {
+        return lights;
+    }
+
+    const std::vector<LightTreeNode>& getNodes() const
+    {
+        return nodes;
+    }
+
+    // Picks a light for the given point and normal with uniform value u. Returns nothing if no light can contribute.
+    std::optional<SampledLight> sample(const Point& point, const Vector3& normal, float u) const;
+    // Probability with which sample() picks the light with the given index in getLights().
+    float getProbability(const Point& point, const Vector3& normal, size_t lightIndex) const;
+    // Probability with which sample() picks the area light with the given index in the area light list of the scene.
+    float getAreaLightProbability(const Point& point, const Vector3& normal, uint32_t areaLightIndex) const;
+
+    // Picks a light with a probability proportional to its emitted power, with uniform value u.
+    std::optional<SampledLight> sampleByPower(float u) const;
+
+private:
+    static constexpr uint32_t NoLight = UINT32_MAX;
+
+    std::vector<Light> lights;
+    std::vector<LightTreeNode> nodes;
+    // Path from the root to the leaf of each light, bit i is set if the second child is taken at depth i.
+    std::vector<uint64_t> lightPaths;
+    // Index in lights of each area light of the scene, NoLight if the light is not in the tree.
+    std::vector<uint32_t> areaLightIndices;
+    // Cumulative emitted power of the lights, in the order of lights.
+    std::vector<float> powerCdf;
+
+    uint32_t build(std::vector<std::pair<uint32_t, LightBounds>>& leaves, size_t start, size_t end, uint64_t path, unsigned int depth);
+};
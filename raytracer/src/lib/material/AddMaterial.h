@@ -2,7 +2,7 @@
 
 #include "IMaterial.h"
 
-class AddMaterial : public IMaterial
+class AddMaterial final : public IMaterial
 {
 public:
     void sampleTransport(TransportBuildContext &ctx) const override;
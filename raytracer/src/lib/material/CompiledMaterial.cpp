@@ -0,0 +1,280 @@
+#include "CompiledMaterial.h"
+#include "math/FastRandom.h"
+#include <cassert>
+#include <type_traits>
+
+namespace
+{
+    struct MixMetaData
+    {
+        bool choseFirst;
+    };
+
+    struct CompositeMetaData
+    {
+        uint32_t node;
+    };
+
+    // Variance of a material that samples both a and b
+    MaterialVariance combineVariance(MaterialVariance a, MaterialVariance b)
+    {
+        if(a == MaterialVariance::always || b == MaterialVariance::always)
+        {
+            return MaterialVariance::always;
+        }
+        if(a == MaterialVariance::none && b == MaterialVariance::none)
+        {
+            return MaterialVariance::none;
+        }
+        return MaterialVariance::perNode;
+    }
+
+    // Variance of a material that samples either a or b, depending on the hit
+    MaterialVariance unionVariance(MaterialVariance a, MaterialVariance b)
+    {
+        return a == b ? a : MaterialVariance::perNode;
+    }
+}
+
+CompiledMaterial::CompiledMaterial(const IMaterial* material) : root(material)
+{
+    if(material != nullptr)
+    {
+        compile(material, traits);
+    }
+}
+
+uint32_t CompiledMaterial::compile(const IMaterial* material, MaterialTraits& materialTraits)
+{
+    const auto index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back(material);
+    materialTraits = material->getTraits();
+
+    if(auto* diffuse = dynamic_cast<const DiffuseMaterial*>(material))
+    {
+        nodes[index] = diffuse;
+    }
+    else if(auto* glossy = dynamic_cast<const GlossyMaterial*>(material))
+    {
+        nodes[index] = glossy;
+    }
+    else if(auto* glass = dynamic_cast<const GlassMaterial*>(material))
+    {
+        nodes[index] = glass;
+    }
+    else if(auto* emissive = dynamic_cast<const EmissiveMaterial*>(material))
+    {
+        nodes[index] = emissive;
+    }
+    else if(auto* transparent = dynamic_cast<const TransparentMaterial*>(material))
+    {
+        nodes[index] = transparent;
+    }
+    else if(auto* photonIndicator = dynamic_cast<const PhotonIndicatorMaterial*>(material))
+    {
+        nodes[index] = photonIndicator;
+    }
+    else if(auto* normal = dynamic_cast<const NormalMaterial*>(material))
+    {
+        nodes[index] = normal;
+    }
+    else if(auto* position = dynamic_cast<const PositionMaterial*>(material))
+    {
+        nodes[index] = position;
+    }
+    else if(auto* texCoord = dynamic_cast<const TexCoordMaterial*>(material))
+    {
+        nodes[index] = texCoord;
+    }
+    else if(dynamic_cast<const ConstMixMaterial*>(material) != nullptr || dynamic_cast<const FresnelMixMaterial*>(material) != nullptr)
+    {
+        const auto* mix = static_cast<const MixMaterial*>(material);
+        MaterialTraits firstTraits;
+        MaterialTraits secondTraits;
+        const uint32_t first = compile(mix->first.get(), firstTraits);
+        const uint32_t second = compile(mix->second.get(), secondTraits);
+
+        MixNode node{{}, first, second};
+        MaterialVariance variance;
+        if(auto* constMix = dynamic_cast<const ConstMixMaterial*>(mix))
+        {
+            // Same as MixMaterial::hasVariance, with a mix factor that does not depend on the hit
+            node.material = constMix;
+            const float mixFactor = static_cast<float>(constMix->mixFactor);
+            variance = mixFactor == 0.0f ? firstTraits.variance
+                     : mixFactor == 1.0f ? secondTraits.variance
+                     : MaterialVariance::always;
+        }
+        else
+        {
+            node.material = static_cast<const FresnelMixMaterial*>(mix);
+            variance = firstTraits.variance == MaterialVariance::always && secondTraits.variance == MaterialVariance::always
+                     ? MaterialVariance::always : MaterialVariance::perNode;
+        }
+        nodes[index] = node;
+        materialTraits = MaterialTraits{variance, firstTraits.isEmissive && secondTraits.isEmissive, firstTraits.isSpecular && secondTraits.isSpecular};
+    }
+    else if(auto* add = dynamic_cast<const AddMaterial*>(material))
+    {
+        MaterialTraits firstTraits;
+        MaterialTraits secondTraits;
+        const uint32_t first = compile(add->first.get(), firstTraits);
+        const uint32_t second = compile(add->second.get(), secondTraits);
+        nodes[index] = AddNode{first, second};
+        materialTraits = MaterialTraits{combineVariance(firstTraits.variance, secondTraits.variance),
+                                        firstTraits.isEmissive && secondTraits.isEmissive, firstTraits.isSpecular && secondTraits.isSpecular};
+    }
+    else if(auto* composite = dynamic_cast<const CompositeMaterial*>(material))
+    {
+        CompositeNode node{composite, {}};
+        std::optional<MaterialTraits> compositeTraits;
+        for(const auto& entry : composite->getMaterialMapping())
+        {
+            if(entry.second == nullptr)
+            {
+                node.entries.push_back(NoNode);
+                continue;
+            }
+            MaterialTraits entryTraits;
+            node.entries.push_back(compile(entry.second.get(), entryTraits));
+            compositeTraits = !compositeTraits.has_value() ? entryTraits : MaterialTraits{
+                unionVariance(compositeTraits->variance, entryTraits.variance),
+                compositeTraits->isEmissive && entryTraits.isEmissive,
+                compositeTraits->isSpecular && entryTraits.isSpecular
+            };
+        }
+        nodes[index] = std::move(node);
+        materialTraits = compositeTraits.value_or(MaterialTraits{});
+    }
+    return index;
+}
+
+void CompiledMaterial::sampleTransport(uint32_t node, TransportBuildContext& ctx) const
+{
+    std::visit([this, &ctx](const auto& n)
+    {
+        using T = std::decay_t<decltype(n)>;
+        if constexpr(std::is_same_v<T, MixNode>)
+        {
+            auto& transport = ctx.getCurNode();
+            auto* meta = transport.metadata.alloc<MixMetaData>();
+            meta->choseFirst = Rand::unit() > std::visit([&transport](const auto* mix){ return mix->calcMixFactor(transport.hit); }, n.material);
+            transport.metadata.branch(meta->choseFirst);
+            sampleTransport(meta->choseFirst ? n.first : n.second, ctx);
+            transport.metadata.up();
+        }
+        else if constexpr(std::is_same_v<T, AddNode>)
+        {
+            sampleTransport(n.first, ctx);
+            sampleTransport(n.second, ctx);
+        }
+        else if constexpr(std::is_same_v<T, CompositeNode>)
+        {
+            auto& metatree = ctx.getCurNode().metadata;
+            auto* meta = metatree.tryRead<CompositeMetaData>();
+            if(meta == nullptr)
+            {
+                meta = metatree.alloc<CompositeMetaData>();
+                meta->node = findCompositeEntry(n, ctx.getCurNode().hit);
+            }
+            metatree.branch(0);
+            sampleTransport(meta->node, ctx);
+            metatree.up();
+        }
+        else
+        {
+            n->sampleTransport(ctx);
+        }
+    }, nodes[node]);
+}
+
+RGB CompiledMaterial::bsdf(uint32_t node, const Scene& scene, const std::vector<TransportNode>& path, int curI, TransportNode& curNode, const RGB& incomingEnergy) const
+{
+    return std::visit([&](const auto& n)
+    {
+        using T = std::decay_t<decltype(n)>;
+        if constexpr(std::is_same_v<T, MixNode>)
+        {
+            auto* meta = curNode.metadata.tryRead<MixMetaData>();
+            curNode.metadata.branch(meta->choseFirst);
+            RGB result = bsdf(meta->choseFirst ? n.first : n.second, scene, path, curI, curNode, incomingEnergy);
+            curNode.metadata.up();
+            return result;
+        }
+        else if constexpr(std::is_same_v<T, AddNode>)
+        {
+            return bsdf(n.first, scene, path, curI, curNode, incomingEnergy) + bsdf(n.second, scene, path, curI, curNode, incomingEnergy);
+        }
+        else if constexpr(std::is_same_v<T, CompositeNode>)
+        {
+            auto* meta = curNode.metadata.tryRead<CompositeMetaData>();
+            curNode.metadata.branch(0);
+            RGB result = bsdf(meta->node, scene, path, curI, curNode, incomingEnergy);
+            curNode.metadata.up();
+            return result;
+        }
+        else
+        {
+            return n->bsdf(scene, path, curI, curNode, incomingEnergy);
+        }
+    }, nodes[node]);
+}
+
+std::tuple<Vector3, RGB, float> CompiledMaterial::interactPhoton(uint32_t node, const SceneRayHitInfo& hit, const RGB& incomingEnergy) const
+{
+    return std::visit([&](const auto& n)
+    {
+        using T = std::decay_t<decltype(n)>;
+        if constexpr(std::is_same_v<T, MixNode>)
+        {
+            const bool choseFirst = Rand::unit() > std::visit([&hit](const auto* mix){ return mix->calcMixFactor(hit); }, n.material);
+            return interactPhoton(choseFirst ? n.first : n.second, hit, incomingEnergy);
+        }
+        else if constexpr(std::is_same_v<T, AddNode>)
+        {
+            return interactPhoton(n.first, hit, incomingEnergy);
+        }
+        else if constexpr(std::is_same_v<T, CompositeNode>)
+        {
+            return interactPhoton(findCompositeEntry(n, hit), hit, incomingEnergy);
+        }
+        else
+        {
+            return n->interactPhoton(hit, incomingEnergy);
+        }
+    }, nodes[node]);
+}
+
+bool CompiledMaterial::hasVariance(uint32_t node, const std::vector<TransportNode>& path, int curI, const Scene& scene) const
+{
+    return std::visit([&](const auto& n)
+    {
+        using T = std::decay_t<decltype(n)>;
+        if constexpr(std::is_same_v<T, MixNode>)
+        {
+            const float mixFactor = std::visit([&](const auto* mix){ return mix->calcMixFactor(path[curI].hit); }, n.material);
+            bool noVariance = (mixFactor == 0.0f && !hasVariance(n.first, path, curI, scene))
+                    || (mixFactor == 1.0f && !hasVariance(n.second, path, curI, scene));
+            return !noVariance;
+        }
+        else if constexpr(std::is_same_v<T, AddNode>)
+        {
+            return hasVariance(n.first, path, curI, scene) || hasVariance(n.second, path, curI, scene);
+        }
+        else if constexpr(std::is_same_v<T, CompositeNode>)
+        {
+            return hasVariance(findCompositeEntry(n, path[curI].hit), path, curI, scene);
+        }
+        else
+        {
+            return n->hasVariance(path, curI, scene);
+        }
+    }, nodes[node]);
+}
+
+uint32_t CompiledMaterial::findCompositeEntry(const CompositeNode& composite, const SceneRayHitInfo& hit) const
+{
+    const uint32_t entry = composite.material->findEntryIndex(hit);
+    assert(entry != UINT32_MAX && composite.entries[entry] != NoNode);
+    return composite.entries[entry];
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <optional>
+#include <variant>
+#include <vector>
+#include "IMaterial.h"
+#include "DiffuseMaterial.h"
+#include "GlossyMaterial.h"
+#include "GlassMaterial.h"
+#include "EmissiveMaterial.h"
+#include "TransparentMaterial.h"
+#include "PhotonIndicatorMaterial.h"
+#include "NormalMaterial.h"
+#include "PositionMaterial.h"
+#include "TexCoordMaterial.h"
+#include "MixMaterial.h"
+#include "FresnelMixMaterial.h"
+#include "AddMaterial.h"
+#include "CompositeMaterial.h"
+
+/*
+ * Material of a model, prepared for the render loop when the scene is built.
+ * The material graph is flattened into an array of nodes, the root material is the first node. The material types are
+ * final and the nodes store them by type, so a node is called with a switch and direct calls instead of virtual calls.
+ * The nodes of the materials that combine other materials refer to the nodes of their children by index.
+ * Materials of other types are called through IMaterial, together with the materials they combine.
+ * The traits of the whole graph are cached, hasVariance is only evaluated if the traits leave it open.
+ */
+class CompiledMaterial
+{
+public:
+    explicit CompiledMaterial(const IMaterial* material = nullptr);
+
+    void sampleTransport(TransportBuildContext& ctx) const
+    {
+        sampleTransport(0, ctx);
+    }
+
+    RGB bsdf(const Scene& scene, const std::vector<TransportNode>& path, int curI, TransportNode& curNode, const RGB& incomingEnergy) const
+    {
+        return bsdf(0, scene, path, curI, curNode, incomingEnergy);
+    }
+
+    std::tuple<Vector3, RGB, float> interactPhoton(const SceneRayHitInfo& hit, const RGB& incomingEnergy) const
+    {
+        return interactPhoton(0, hit, incomingEnergy);
+    }
+
+    bool hasVariance(const std::vector<TransportNode>& path, int curI, const Scene& scene) const
+    {
+        switch(traits.variance)
+        {
+            case MaterialVariance::none: return false;
+            case MaterialVariance::always: return true;
+            default: return hasVariance(0, path, curI, scene);
+        }
+    }
+
+    const MaterialTraits& getTraits() const
+    {
+        return traits;
+    }
+
+    // Address of the root material, identifies the material code and data that are used when shading.
+    const IMaterial* getMaterial() const
+    {
+        return root;
+    }
+
+    // Type of the root material node. Materials of the same kind run the same code when shading, materials of types
+    // that are not compiled all have kind 0.
+    uint32_t getKind() const
+    {
+        return nodes.empty() ? 0 : static_cast<uint32_t>(nodes[0].index());
+    }
+
+private:
+    struct MixNode
+    {
+        std::variant<const ConstMixMaterial*, const FresnelMixMaterial*> material;
+        uint32_t first;
+        uint32_t second;
+    };
+
+    struct AddNode
+    {
+        uint32_t first;
+        uint32_t second;
+    };
+
+    struct CompositeNode
+    {
+        const CompositeMaterial* material;
+        std::vector<uint32_t> entries; // Node of each entry of the material mapping, NoNode for ranges without material
+    };
+
+    static constexpr uint32_t NoNode = UINT32_MAX;
+
+    using Node = std::variant<
+        const IMaterial*,
+        const DiffuseMaterial*,
+        const GlossyMaterial*,
+        const GlassMaterial*,
+        const EmissiveMaterial*,
+        const TransparentMaterial*,
+        const PhotonIndicatorMaterial*,
+        const NormalMaterial*,
+        const PositionMaterial*,
+        const TexCoordMaterial*,
+        MixNode,
+        AddNode,
+        CompositeNode
+    >;
+
+    std::vector<Node> nodes;
+    const IMaterial* root = nullptr;
+    MaterialTraits traits;
+
+    // Appends the nodes of the material and the materials it combines, returns the index of its node.
+    uint32_t compile(const IMaterial* material, /* OUT */ MaterialTraits& materialTraits);
+
+    void sampleTransport(uint32_t node, TransportBuildContext& ctx) const;
+    RGB bsdf(uint32_t node, const Scene& scene, const std::vector<TransportNode>& path, int curI, TransportNode& curNode, const RGB& incomingEnergy) const;
+    std::tuple<Vector3, RGB, float> interactPhoton(uint32_t node, const SceneRayHitInfo& hit, const RGB& incomingEnergy) const;
+    bool hasVariance(uint32_t node, const std::vector<TransportNode>& path, int curI, const Scene& scene) const;
+
+    uint32_t findCompositeEntry(const CompositeNode& composite, const SceneRayHitInfo& hit) const;
+};
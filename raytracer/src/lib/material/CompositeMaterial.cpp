@@ -64,12 +64,12 @@ IMaterial* CompositeMaterial::findMaterial(uint32_t triangleIndex) const {
     return materialMapping[matI].second.get();
 }
 
-const IMaterial* CompositeMaterial::findMaterial(const SceneRayHitInfo& hit) const
+uint32_t CompositeMaterial::findEntryIndex(const SceneRayHitInfo& hit) const
 {
     auto triangleIdx = hit.triangleIndex;
     if(triangleIdx == UINT32_MAX)
     {
-        return nullptr;
+        return UINT32_MAX;
     }
 
     const auto& triangleMesh = dynamic_cast<const TriangleMesh&>(hit.getModelNode().getData().getShape());
@@ -77,7 +77,18 @@ const IMaterial* CompositeMaterial::findMaterial(const SceneRayHitInfo& hit) con
         triangleIdx = triangleMesh.getData().permutation->at(triangleIdx);
     }
 
-    auto* material = this->findMaterial(triangleIdx);
+    return findListIndex(triangleIdx);
+}
+
+const IMaterial* CompositeMaterial::findMaterial(const SceneRayHitInfo& hit) const
+{
+    auto entryIdx = findEntryIndex(hit);
+    if(entryIdx == UINT32_MAX)
+    {
+        return nullptr;
+    }
+
+    auto* material = materialMapping[entryIdx].second.get();
     assert(material != nullptr);
 
     return material;
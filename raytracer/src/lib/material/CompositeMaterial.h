@@ -4,7 +4,7 @@
 #include <vector>
 #include <memory>
 
-class CompositeMaterial : public IMaterial {
+class CompositeMaterial final : public IMaterial {
 public:
     CompositeMaterial();
 
@@ -16,6 +16,15 @@ public:
 
     void addMaterial(size_t firstTriangleI, size_t length, std::shared_ptr<IMaterial> material);
 
+    // Index of the entry of the material mapping that holds the material of the hit triangle, UINT32_MAX if the hit is not on a triangle.
+    uint32_t findEntryIndex(const SceneRayHitInfo& hit) const;
+
+    // First triangle and material of each range of triangles. Ranges without material have a nullptr entry.
+    const std::vector<std::pair<uint32_t, std::shared_ptr<IMaterial>>>& getMaterialMapping() const
+    {
+        return materialMapping;
+    }
+
 private:
     std::vector<std::pair<uint32_t, std::shared_ptr<IMaterial>>> materialMapping;
 
@@ -9,6 +9,8 @@
 #include "scene/renderable/SceneRayHitInfo.h"
 #include "NormalMapSampler.h"
 #include "NextEventEstimation.h"
+#include "photonmapping/PhotonQueryQueue.h"
+#include "photonmapping/RadianceCache.h"
 
 DiffuseMaterial::DiffuseMaterial() = default;
 
@@ -19,8 +21,112 @@ struct TransportMetaData
     bool photonLightingIsSet;
     bool isPhotonMapRay = false;
     bool isNEERay = false;
+    // Used with LightSamplingMode::mis: the area light hit by the bsdf sampled ray, if any, and the weight of the
+    // light arriving along that ray.
+    const AreaLight* lightHit = nullptr;
+    float bsdfWeight = 0;
+    bool isEnvironmentHit = false; // The bsdf sampled ray left the scene
 };
 
+// Sets photonLighting to the density estimate of the photons nearest to the hit, on the side of the surface the ray
+// came from, scaled by scale. The estimate may be queued, it is then only set once the queue is resolved.
+void gatherPhotonLighting(TransportBuildContext& ctx, const SceneRayHitInfo& hit, float scale, /* OUT */ RGB& photonLighting)
+{
+    const Vector3 dir = -hit.ray.getDirection();
+    if(ctx.photonQueries != nullptr)
+    {
+        ctx.photonQueries->push(hit.getHitpoint(), dir, scale, photonLighting);
+    }
+    else
+    {
+        photonLighting = PhotonQueryQueue::estimate(*ctx.scene.getPhotonMap(), hit.getHitpoint(), dir).scale(scale);
+    }
+}
+
+// Registers a callback that ends the path with the caustics in the photon map if the next node is specular.
+void gatherCausticsAtSpecularHit(TransportBuildContext& ctx, TransportNode& transport, TransportMetaData* meta)
+{
+    ctx.nextNodeCallback = [&transport, &ctx, meta](){
+        if(ctx.getCurNode().specularity > 0.8)
+        {
+            transport.pathTerminationChance = 1.0f;
+            transport.isEmissive = true;
+
+            if(!meta->photonLightingIsSet)
+            {
+                gatherPhotonLighting(ctx, transport.hit, 1.0f, meta->photonLighting);
+                meta->photonLightingIsSet = true;
+            }
+
+            meta->isPhotonMapRay = true;
+        }
+    };
+}
+
+// Samples a light and continues the path in a cosine weighted direction. If that direction hits an area light, the
+// path ends there, and the light is weighted against the light sample with the power heuristic.
+void sampleMISTransport(TransportBuildContext& ctx, TransportNode& transport, const Vector3& normal, TransportMetaData* meta)
+{
+    const Point hitpoint = transport.hit.getHitpoint();
+    meta->isNEERay = false;
+    meta->lightHit = nullptr;
+    meta->bsdfWeight = 0;
+    meta->isEnvironmentHit = false;
+
+    // The shadow ray may be resolved later, it then blacks out the scaled radiance.
+    Vector3 lightDirection;
+    float lightPdf;
+    NextEventEstimation::sample(ctx.scene, hitpoint, normal, ctx.sampleI, ctx.sampleCount, ctx.shadowRays, meta->directLighting, lightDirection, &lightPdf);
+    const float lightCos = std::max(0.0f, normal.dot(lightDirection));
+    meta->directLighting = meta->directLighting.scale(lightCos / PI * powerHeuristic(lightPdf, lightCos / PI));
+
+    // Russian roulette is done here rather than by the path sampler, which would discard the light sampled above
+    const float terminationChance = 0.1f;
+    if(ctx.curI + 1 >= ctx.maxPathLength || Rand::unit() < terminationChance)
+    {
+        transport.pathTerminationChance = 1.0f;
+        transport.isEmissive = true;
+        return;
+    }
+
+    OrthonormalBasis basis(normal);
+    auto localDir = sampleStratifiedCosineWeightedHemisphere(std::sqrt(ctx.sampleCount), ctx.sampleI, 1.0);
+    transport.transportDirection = (basis.getU() * localDir.x()) + (basis.getV() * localDir.y()) + (basis.getW() * localDir.z());
+    // The brdf times the cosine, divided by the pdf of the cosine weighted direction, is the albedo
+    meta->bsdfWeight = 1.0f / (1.0f - terminationChance);
+
+    Ray ray(hitpoint + (transport.transportDirection * 0.0001f), transport.transportDirection);
+    auto result = ctx.scene.traceRay(ray);
+    auto lightHit = ctx.scene.traceAreaLights(ray, result.has_value() ? result->t : INFINITY);
+    const float bsdfPdf = std::max(0.0f, normal.dot(transport.transportDirection)) / PI;
+    if(lightHit.has_value())
+    {
+        meta->lightHit = lightHit->light;
+        meta->bsdfWeight *= powerHeuristic(bsdfPdf, NextEventEstimation::getAreaLightPdf(ctx.scene, hitpoint, normal, ray, *lightHit));
+        transport.pathTerminationChance = 1.0f;
+        transport.isEmissive = true;
+    }
+    else if(!result.has_value())
+    {
+        // The environment, if any, may also have been sampled above
+        meta->isEnvironmentHit = true;
+        meta->bsdfWeight *= powerHeuristic(bsdfPdf, NextEventEstimation::getEnvironmentPdf(ctx.scene, transport.transportDirection));
+        transport.pathTerminationChance = 1.0f;
+        transport.isEmissive = true;
+    }
+    else
+    {
+        ctx.nextHit = result;
+        transport.pathTerminationChance = 0.0f;
+        transport.isEmissive = false;
+
+        if(ctx.scene.getPhotonMapMode() == PhotonMapMode::caustics)
+        {
+            gatherCausticsAtSpecularHit(ctx, transport, meta);
+        }
+    }
+}
+
 void DiffuseMaterial::sampleTransport(TransportBuildContext& ctx) const
 {
     auto& transport = ctx.getCurNode();
@@ -61,24 +167,22 @@ void DiffuseMaterial::sampleTransport(TransportBuildContext& ctx) const
 
         if(!meta->photonLightingIsSet)
         {
-            const auto& photonMap = ctx.scene.getPhotonMap();
-            std::vector<const Photon*> photons(20);
-
-            auto hitpoint = transport.hit.getHitpoint();
-            auto dir = -transport.hit.ray.getDirection();
-            auto [nbPhotonsFound, maxDist] = photonMap->getElementsNearestTo(hitpoint, photons.size(), 1E9, [dir](const Photon& photon){
-                return dir.dot(photon.surfaceNormal) >= 0;
-            }, photons);
-
-            RGB value {};
-            for(unsigned int i = 0; i < nbPhotonsFound; i++)
+            const auto& radianceCache = ctx.scene.getRadianceCache();
+            if(radianceCache.has_value())
             {
-                value += photons[i]->energy;
+                meta->photonLighting = RadianceCache::lookup(*radianceCache, transport.hit.getHitpoint(), -transport.hit.ray.getDirection()).scale(this->diffuseIntensity);
+            }
+            else
+            {
+                gatherPhotonLighting(ctx, transport.hit, this->diffuseIntensity, meta->photonLighting);
             }
-            meta->photonLighting = value.scale(this->diffuseIntensity).divide(PI*maxDist*maxDist).divide(PI);
             meta->photonLightingIsSet = true;
         }
     }
+    else if(ctx.scene.getLightSamplingMode() == LightSamplingMode::mis)
+    {
+        sampleMISTransport(ctx, transport, normal, meta);
+    }
     else
     {
         transport.pathTerminationChance = 0.1f;
@@ -87,7 +191,7 @@ void DiffuseMaterial::sampleTransport(TransportBuildContext& ctx) const
         bool useNextEventEstimation = Rand::unit() > 0.5f;
         if(useNextEventEstimation)
         {
-            meta->directLighting = NextEventEstimation::sample(ctx.scene, transport.hit.getHitpoint(), normal, ctx.sampleI, ctx.sampleCount, transport.transportDirection);
+            NextEventEstimation::sample(ctx.scene, transport.hit.getHitpoint(), normal, ctx.sampleI, ctx.sampleCount, ctx.shadowRays, meta->directLighting, transport.transportDirection);
             transport.pathTerminationChance = 1.0f;
             transport.isEmissive = true;
             meta->isNEERay = true;
@@ -103,35 +207,7 @@ void DiffuseMaterial::sampleTransport(TransportBuildContext& ctx) const
 
             if(ctx.scene.getPhotonMapMode() == PhotonMapMode::caustics)
             {
-                ctx.nextNodeCallback = [&transport, &ctx, meta, normal](){
-                    if(ctx.getCurNode().specularity > 0.8)
-                    {
-                        transport.pathTerminationChance = 1.0f;
-                        transport.isEmissive = true;
-
-                        if(!meta->photonLightingIsSet)
-                        {
-                            const auto& photonMap = ctx.scene.getPhotonMap();
-                            std::vector<const Photon*> photons(20);
-
-                            auto dir = -transport.hit.ray.getDirection();
-                            auto [nbPhotonsFound, maxDist] = photonMap->getElementsNearestTo(transport.hit.getHitpoint(), photons.size(), 1E9, [dir](const Photon& photon)
-                            {
-                                return dir.dot(photon.surfaceNormal) >= 0;
-                            }, photons);
-
-                            RGB value {};
-                            for(unsigned int i = 0; i < nbPhotonsFound; ++i)
-                            {
-                                value += photons[i]->energy;
-                            }
-                            meta->photonLighting = value.divide(PI*(maxDist*maxDist)).divide(PI);
-                            meta->photonLightingIsSet = true;
-                        }
-
-                        meta->isPhotonMapRay = true;
-                    }
-                };
+                gatherCausticsAtSpecularHit(ctx, transport, meta);
             }
         }
     }
@@ -155,7 +231,12 @@ RGB DiffuseMaterial::bsdf(const Scene &scene, const std::vector<TransportNode> &
     {
         auto out = diffuseColor.multiply(meta->photonLighting);
 
-        if(scene.getPhotonMapMode() == PhotonMapMode::caustics)
+        if(scene.getPhotonMapMode() == PhotonMapMode::caustics && scene.getLightSamplingMode() == LightSamplingMode::mis)
+        {
+            // The caustics replace the bsdf sampled light, the sampled light is not affected
+            out = out.add(diffuseColor.multiply(meta->directLighting.scale(this->diffuseIntensity)));
+        }
+        else if(scene.getPhotonMapMode() == PhotonMapMode::caustics)
         {
             //TODO: do we need *4 here? 2 for hemispherical sampling, 2 for separate NEE rays? (or *2*pi ?)
             out = out.scale(2);
@@ -180,6 +261,28 @@ RGB DiffuseMaterial::bsdf(const Scene &scene, const std::vector<TransportNode> &
         //The diffuse BRDF has a correction term of 1/pi to be energy conservant.
         //Finally, applying MC to (direct + indirect) with a 50% chance for each term means each term should be multiplied by 2.
 
+        if(scene.getLightSamplingMode() == LightSamplingMode::mis)
+        {
+            // The sampled light already includes the cosine, the 1/pi of the brdf and its MIS weight
+            RGB value = meta->directLighting;
+            if(meta->lightHit != nullptr)
+            {
+                value += NextEventEstimation::getEmittedRadiance(*meta->lightHit, -curNode.transportDirection).scale(meta->bsdfWeight);
+            }
+            else if(meta->isEnvironmentHit)
+            {
+                if(scene.hasEnvironmentMaterial())
+                {
+                    value += scene.getEnvironmentMaterial().getRadiance(scene, curNode.transportDirection).scale(meta->bsdfWeight);
+                }
+            }
+            else
+            {
+                value += incomingEnergy.scale(meta->bsdfWeight);
+            }
+            return diffuseColor.multiply(value.scale(this->diffuseIntensity));
+        }
+
         double angle = std::max(0.0f, normal.dot(curNode.transportDirection));
         RGB value;
         if(meta->isNEERay)
@@ -4,7 +4,7 @@
 #include "Texture.h"
 #include <memory>
 
-class DiffuseMaterial : public IMaterial
+class DiffuseMaterial final : public IMaterial
 {
 public:
 	DiffuseMaterial();
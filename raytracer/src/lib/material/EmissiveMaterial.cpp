@@ -30,3 +30,8 @@ bool EmissiveMaterial::hasVariance(const std::vector<TransportNode> &path, int c
 {
     return false;
 }
+
+MaterialTraits EmissiveMaterial::getTraits() const
+{
+    return MaterialTraits{MaterialVariance::none, true, false};
+}
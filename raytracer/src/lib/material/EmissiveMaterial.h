@@ -4,7 +4,7 @@
 #include "Texture.h"
 #include <memory>
 
-class EmissiveMaterial : public IMaterial
+class EmissiveMaterial final : public IMaterial
 {
 public:
     EmissiveMaterial();
@@ -14,6 +14,7 @@ public:
 
     std::tuple<Vector3, RGB, float> interactPhoton(const SceneRayHitInfo &hit, const RGB &incomingEnergy) const override;
     bool hasVariance(const std::vector<TransportNode> &path, int curI, const Scene &scene) const override;
+    MaterialTraits getTraits() const override;
 
     RGB color = RGB::BLACK;
     double intensity = 1.0;
@@ -5,4 +5,9 @@ void FlatMaterial::sampleTransport(TransportBuildContext &ctx) const
     auto& transport = ctx.getCurNode();
     transport.pathTerminationChance = 1.0;
     transport.isEmissive = true;
-}
\ No newline at end of file
+}
+
+MaterialTraits FlatMaterial::getTraits() const
+{
+    return MaterialTraits{MaterialVariance::none, true, false};
+}
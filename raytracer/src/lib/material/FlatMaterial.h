@@ -6,4 +6,5 @@ class FlatMaterial : public IMaterial
 {
 public:
     void sampleTransport(TransportBuildContext &ctx) const override;
+    MaterialTraits getTraits() const override;
 };
\ No newline at end of file
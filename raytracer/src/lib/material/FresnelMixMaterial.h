@@ -2,7 +2,7 @@
 
 #include "MixMaterial.h"
 
-class FresnelMixMaterial : public MixMaterial {
+class FresnelMixMaterial final : public MixMaterial {
 public:
     float calcMixFactor(const SceneRayHitInfo &hit) const override;
     float IOR = 1.45f;
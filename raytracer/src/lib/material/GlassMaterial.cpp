@@ -4,7 +4,6 @@
 #include "scene/renderable/SceneRayHitInfo.h"
 #include "math/Vector3.h"
 #include "math/FastRandom.h"
-#include <math/Triangle.h>
 
 using NoLight = bool;
 #pragma pack(push, 1)
@@ -14,7 +13,7 @@ struct TransportMetaData
     float t = 0;
     Vector3 reflectedRayDir;
     Vector3 transmittedRayDir;
-    std::variant<NoLight, AreaLight*, PointLight*> lightHit = false;
+    std::variant<NoLight, const AreaLight*, PointLight*> lightHit = false;
 };
 #pragma pack(pop)
 
@@ -107,14 +106,11 @@ void GlassMaterial::sampleTransport(TransportBuildContext &ctx) const
     auto result = ctx.scene.traceRay(ray);
 
     double bestT = result.has_value() ? result->t : 1E99;
-    for(const auto& light : ctx.scene.getAreaLights())
+    auto lightHit = ctx.scene.traceAreaLights(ray, result.has_value() ? result->t : INFINITY);
+    if(lightHit.has_value())
     {
-        Triangle::TriangleIntersection intersection;
-        bool hasIntersection = Triangle::intersect(ray, light->a, light->b, light->c, intersection);
-        if(hasIntersection && bestT > intersection.t){
-            meta->lightHit = &*light;
-            bestT = intersection.t;
-        }
+        meta->lightHit = lightHit->light;
+        bestT = lightHit->t;
     }
 
     meta->t = bestT;
@@ -148,9 +144,9 @@ RGB GlassMaterial::bsdf(const Scene &scene, const std::vector<TransportNode> &pa
     bool isInternalRay = normal.dot(direction) < 0;
 
     RGB val = incomingEnergy;
-    if(std::holds_alternative<AreaLight*>(meta->lightHit))
+    if(std::holds_alternative<const AreaLight*>(meta->lightHit))
     {
-        const auto& areaLight = *std::get<AreaLight*>(meta->lightHit);
+        const auto& areaLight = *std::get<const AreaLight*>(meta->lightHit);
         auto lightEnergy = areaLight.color * areaLight.intensity;
         auto lightIrradiance = lightEnergy.divide(areaLight.getSurfaceArea());
         auto lightRadiance = lightIrradiance.divide(PI);
@@ -255,3 +251,8 @@ bool GlassMaterial::hasVariance(const std::vector<TransportNode> &path, int curI
 {
     return true;
 }
+
+MaterialTraits GlassMaterial::getTraits() const
+{
+    return MaterialTraits{MaterialVariance::always, false, true};
+}
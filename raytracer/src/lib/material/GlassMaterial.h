@@ -3,7 +3,7 @@
 #include "IMaterial.h"
 #include "film/RGB.h"
 
-class GlassMaterial : public IMaterial
+class GlassMaterial final : public IMaterial
 {
 public:
     void sampleTransport(TransportBuildContext &ctx) const override;
@@ -11,6 +11,7 @@ public:
 
     std::tuple<Vector3, RGB, float> interactPhoton(const SceneRayHitInfo &hit, const RGB &incomingEnergy) const override;
     bool hasVariance(const std::vector<TransportNode> &path, int curI, const Scene &scene) const override;
+    MaterialTraits getTraits() const override;
 
     double ior = 1.0;
     RGB color = RGB(1.0f);
@@ -3,7 +3,6 @@
 #include "scene/renderable/SceneRayHitInfo.h"
 #include "math/OrthonormalBasis.h"
 #include "math/Constants.h"
-#include "math/Triangle.h"
 #include "NormalMapSampler.h"
 #include "math/Sampler.h"
 #include "VNDFGGXSampler.h"
@@ -13,10 +12,12 @@ GlossyMaterial::GlossyMaterial() = default;
 
 struct TransportMetaData
 {
-    AreaLight* lightHit = nullptr; // Used when NEE is disabled
+    const AreaLight* lightHit = nullptr; // Used when NEE is disabled, or with LightSamplingMode::mis
     Vector3 normal;
     RGB neeRadiance;
+    float bsdfWeight = 0; // LightSamplingMode::mis: weight of the light arriving along the bsdf sampled ray
     bool isNEERay = false;
+    bool isEnvironmentHit = false; // LightSamplingMode::mis: the bsdf sampled ray left the scene
 };
 
 Vector3 getPerfectReflectionDir(const Vector3& normal, const Vector3& incomingDir)
@@ -38,6 +39,22 @@ float ggx(const float roughness, const Vector3& v, const Vector3& n, const Vecto
     }
 }
 
+float ggxDistribution(const float roughness, const Vector3& n, const Vector3& m) //normal, micronormal
+{
+    if(m.dot(n) <= 0)
+    {
+        return 0.0f;
+    }
+
+    float theta_m = std::acos(m.dot(n));
+    float aSqr = roughness * roughness;
+    float tan_theta_m = std::tan(theta_m);
+    float cos_theta_m = std::cos(theta_m);
+    float cos_theta_m_sqr = cos_theta_m * cos_theta_m;
+    float x = aSqr + tan_theta_m * tan_theta_m;
+    return aSqr / ((float)M_PI * cos_theta_m_sqr * cos_theta_m_sqr * x * x);
+}
+
 float brdf(const float roughness, const Vector3& i, const Vector3& o, const Vector3& n, const Vector3& m)
 {
     float g = ggx(roughness, i, n, m) * ggx(roughness, o, n, m);
@@ -46,23 +63,103 @@ float brdf(const float roughness, const Vector3& i, const Vector3& o, const Vect
         return 0.0f;
     }
 
-    float d = 0.0f;
-    if(m.dot(n) > 0)
+    float d = ggxDistribution(roughness, n, m);
+    if(d == 0.0f)
     {
-        float theta_m = std::acos(m.dot(n));
-        float aSqr = roughness * roughness;
-        float tan_theta_m = std::tan(theta_m);
-        float cos_theta_m = std::cos(theta_m);
-        float cos_theta_m_sqr = cos_theta_m * cos_theta_m;
-        float x = aSqr + tan_theta_m * tan_theta_m;
-        d = aSqr / ((float)M_PI * cos_theta_m_sqr * cos_theta_m_sqr * x * x);
+        return 0.0f;
     }
-    else
+
+    return g * d / (4.0f * std::abs(i.dot(n)) * std::abs(o.dot(n)));
+}
+
+// Probability density of the reflection direction o of the visible normal sampling below, for the direction i to the viewer
+float vndfPdf(const float roughness, const Vector3& i, const Vector3& o, const Vector3& n)
+{
+    const float cosI = i.dot(n);
+    if(cosI <= 0)
     {
         return 0.0f;
     }
+    const Vector3 m = (i + o).normalized();
+    return ggx(roughness, i, n, m) * ggxDistribution(roughness, n, m) / (4.0f * cosI);
+}
 
-    return g * d / (4.0f * std::abs(i.dot(n)) * std::abs(o.dot(n)));
+// Samples a light and continues the path with a sampled microfacet reflection. If the reflected ray hits an area light,
+// the path ends there, and the light is weighted against the light sample with the power heuristic.
+void sampleMISTransport(TransportBuildContext& ctx, TransportMetaData* meta, float roughness)
+{
+    auto& transport = ctx.getCurNode();
+    const Point hitpoint = transport.hit.getHitpoint();
+    const Vector3 viewDir = -transport.hit.ray.getDirection();
+    meta->isNEERay = false;
+    meta->lightHit = nullptr;
+    meta->bsdfWeight = 0;
+    meta->isEnvironmentHit = false;
+
+    // The shadow ray may be resolved later, it then blacks out the scaled radiance.
+    Vector3 lightDirection;
+    float lightPdf;
+    NextEventEstimation::sample(ctx.scene, hitpoint, meta->normal, ctx.sampleI, ctx.sampleCount, ctx.shadowRays, meta->neeRadiance, lightDirection, &lightPdf);
+    const float lightCos = meta->normal.dot(lightDirection);
+    if(lightCos > 0)
+    {
+        const Vector3 lightMicroNormal = (viewDir + lightDirection).normalized();
+        const float f = brdf(roughness, viewDir, lightDirection, meta->normal, lightMicroNormal);
+        meta->neeRadiance = meta->neeRadiance * (f * lightCos * powerHeuristic(lightPdf, vndfPdf(roughness, viewDir, lightDirection, meta->normal)));
+    }
+    else
+    {
+        meta->neeRadiance = RGB::BLACK;
+    }
+
+    // Russian roulette is done here rather than by the path sampler, which would discard the light sampled above
+    const float terminationChance = 0.2f;
+    if(ctx.curI + 1 >= ctx.maxPathLength || Rand::unit() < terminationChance)
+    {
+        transport.isEmissive = true;
+        transport.pathTerminationChance = 1.0;
+        return;
+    }
+
+    auto randSquare = sampleUniformStratifiedSquare(ctx.sampleCount, ctx.sampleI);
+    Vector3 microfacetNormal = VNDFGGXSampler::sample(meta->normal, viewDir, roughness, randSquare.x(), randSquare.y());
+    microfacetNormal.normalize();
+    transport.transportDirection = getPerfectReflectionDir(microfacetNormal, transport.hit.ray.getDirection());
+    if(transport.transportDirection.dot(transport.hit.normal) < 0)
+    {
+        // Reflected into the geometry, only the sampled light remains
+        transport.isEmissive = true;
+        transport.pathTerminationChance = 1.0;
+        return;
+    }
+    // The brdf times the cosine, divided by the pdf of the sampled direction, is the masking term of the reflection
+    meta->bsdfWeight = ggx(roughness, transport.transportDirection, meta->normal, microfacetNormal) / (1.0f - terminationChance);
+
+    Ray ray(hitpoint + (transport.transportDirection * .001), transport.transportDirection);
+    auto result = ctx.scene.traceRay(ray);
+    auto lightHit = ctx.scene.traceAreaLights(ray, result.has_value() ? result->t : INFINITY);
+    const float bsdfPdf = vndfPdf(roughness, viewDir, transport.transportDirection, meta->normal);
+    if(lightHit.has_value())
+    {
+        meta->lightHit = lightHit->light;
+        meta->bsdfWeight *= powerHeuristic(bsdfPdf, NextEventEstimation::getAreaLightPdf(ctx.scene, hitpoint, meta->normal, ray, *lightHit));
+        transport.isEmissive = true;
+        transport.pathTerminationChance = 1.0;
+    }
+    else if(!result.has_value())
+    {
+        // The environment, if any, may also have been sampled above
+        meta->isEnvironmentHit = true;
+        meta->bsdfWeight *= powerHeuristic(bsdfPdf, NextEventEstimation::getEnvironmentPdf(ctx.scene, transport.transportDirection));
+        transport.isEmissive = true;
+        transport.pathTerminationChance = 1.0;
+    }
+    else
+    {
+        ctx.nextHit = result;
+        transport.isEmissive = false;
+        transport.pathTerminationChance = 0.0;
+    }
 }
 
 void GlossyMaterial::sampleTransport(TransportBuildContext &ctx) const
@@ -86,17 +183,24 @@ void GlossyMaterial::sampleTransport(TransportBuildContext &ctx) const
     }
 
     bool neeEnabled = this->roughness > 0;
+    if(neeEnabled && ctx.scene.getLightSamplingMode() == LightSamplingMode::mis)
+    {
+        sampleMISTransport(ctx, meta, this->roughness);
+        return;
+    }
+
     bool useNEE = neeEnabled && Rand::unit() > 0.5; // Do NEE 50% of the time if roughness > 0
     meta->isNEERay = useNEE;
     meta->lightHit = nullptr;
     if(useNEE)
     {
         //TODO: has a bug, but looks close enough for now.
-        auto radiance = NextEventEstimation::sample(ctx.scene, hitpoint, meta->normal, ctx.sampleI, ctx.sampleCount, transport.transportDirection);
+        // The shadow ray may be resolved later, it then blacks out the scaled radiance.
+        NextEventEstimation::sample(ctx.scene, hitpoint, meta->normal, ctx.sampleI, ctx.sampleCount, ctx.shadowRays, meta->neeRadiance, transport.transportDirection);
         auto microNormal = (-transport.hit.ray.getDirection() + transport.transportDirection).normalized();
         double angle = std::max(0.0f, microNormal.dot(transport.transportDirection));
         auto f = brdf(roughness, -transport.hit.ray.getDirection(), transport.transportDirection, meta->normal, microNormal);
-        meta->neeRadiance = radiance * angle * f;
+        meta->neeRadiance = meta->neeRadiance * angle * f;
         transport.isEmissive = true;
         transport.pathTerminationChance = 1.0;
     }
@@ -125,16 +229,7 @@ void GlossyMaterial::sampleTransport(TransportBuildContext &ctx) const
 
         if(neeEnabled)
         {
-            bool isLightHit = false;
-            for(const auto& light : ctx.scene.getAreaLights())
-            {
-                Triangle::TriangleIntersection intersection;
-                bool hasIntersection = Triangle::intersect(ray, light->a, light->b, light->c, intersection);
-                if(hasIntersection && (!result.has_value() || result->t > intersection.t)){
-                    isLightHit = true;
-                    break;
-                }
-            }
+            bool isLightHit = ctx.scene.traceAreaLights(ray, result.has_value() ? result->t : INFINITY).has_value();
 
             //Black sample on light hit to prevent double counting of lights in NEE and non-NEE
             if(isLightHit)
@@ -153,15 +248,10 @@ void GlossyMaterial::sampleTransport(TransportBuildContext &ctx) const
         }
         else
         {
-            double bestT = result.has_value() ? result->t : 1E99;
-            for(const auto& light : ctx.scene.getAreaLights())
+            auto lightHit = ctx.scene.traceAreaLights(ray, result.has_value() ? result->t : INFINITY);
+            if(lightHit.has_value())
             {
-                Triangle::TriangleIntersection intersection;
-                bool hasIntersection = Triangle::intersect(ray, light->a, light->b, light->c, intersection);
-                if(hasIntersection && bestT > intersection.t){
-                    meta->lightHit = &*light;
-                    bestT = intersection.t;
-                }
+                meta->lightHit = lightHit->light;
             }
 
             if(meta->lightHit == nullptr)
@@ -185,7 +275,27 @@ RGB GlossyMaterial::bsdf(const Scene &scene, const std::vector<TransportNode> &p
     bool neeEnabled = this->roughness > 0;
     RGB radiance = incomingEnergy;
 
-    if(neeEnabled)
+    if(neeEnabled && scene.getLightSamplingMode() == LightSamplingMode::mis)
+    {
+        // The sampled light already includes the brdf, the cosine and its MIS weight
+        radiance = meta->neeRadiance;
+        if(meta->lightHit != nullptr)
+        {
+            radiance += NextEventEstimation::getEmittedRadiance(*meta->lightHit, -curNode.transportDirection).scale(meta->bsdfWeight);
+        }
+        else if(meta->isEnvironmentHit)
+        {
+            if(scene.hasEnvironmentMaterial())
+            {
+                radiance += scene.getEnvironmentMaterial().getRadiance(scene, curNode.transportDirection).scale(meta->bsdfWeight);
+            }
+        }
+        else
+        {
+            radiance += incomingEnergy.scale(meta->bsdfWeight);
+        }
+    }
+    else if(neeEnabled)
     {
         if(meta->isNEERay)
         {
@@ -227,3 +337,8 @@ bool GlossyMaterial::hasVariance(const std::vector<TransportNode> &path, int cur
 {
     return this->roughness > 0.0f;
 }
+
+MaterialTraits GlossyMaterial::getTraits() const
+{
+    return MaterialTraits{this->roughness > 0.0f ? MaterialVariance::always : MaterialVariance::none, false, this->roughness == 0.0f};
+}
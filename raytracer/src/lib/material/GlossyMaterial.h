@@ -4,7 +4,7 @@
 #include "Texture.h"
 #include <memory>
 
-class GlossyMaterial : public IMaterial
+class GlossyMaterial final : public IMaterial
 {
 public:
     GlossyMaterial();
@@ -14,6 +14,7 @@ public:
 
     std::tuple<Vector3, RGB, float> interactPhoton(const SceneRayHitInfo &hit, const RGB &incomingEnergy) const override;
     bool hasVariance(const std::vector<TransportNode> &path, int curI, const Scene &scene) const override;
+    MaterialTraits getTraits() const override;
 
     float roughness = 0.0f;
     std::shared_ptr<TextureUInt8> normalMap;
@@ -10,3 +10,8 @@ bool IMaterial::hasVariance(const std::vector<TransportNode> &path, int curI, co
 {
     return false;
 }
+
+MaterialTraits IMaterial::getTraits() const
+{
+    return MaterialTraits{};
+}
@@ -3,11 +3,13 @@
 #include "scene/renderable/SceneRayHitInfo.h"
 #include "film/RGB.h"
 #include "utility/DynAllocTree.h"
-#include <functional>
+#include "utility/InlineFunction.h"
 #include <optional>
 #include <vector>
 
 class Scene;
+class ShadowRayQueue;
+class PhotonQueryQueue;
 
 enum class TransportType : unsigned char
 {
@@ -28,6 +30,9 @@ public:
     explicit TransportNode(SceneRayHitInfo hit) : hit(std::move(hit)), pathTerminationChance(), transportDirection(), type(), specularity(), isEmissive(), metadata()
         {}
 };
+// Path state is reset and copied for every node of every sample, it must not own heap memory.
+static_assert(std::is_trivially_copyable_v<decltype(TransportNode::metadata)>);
+static_assert(std::is_trivially_destructible_v<TransportNode>);
 
 struct TransportContext
 {
@@ -46,15 +51,39 @@ struct TransportContext
     }
 };
 
+// Called after the next node of the path has been sampled. Captures must be references or pointers.
+using NodeCallback = InlineFunction<void(), 32>;
+
 struct TransportBuildContext : TransportContext
 {
     std::optional<SceneRayHitInfo> nextHit;
-    std::optional<std::function<void()>> nextNodeCallback;
+    std::optional<NodeCallback> nextNodeCallback;
+    // If set, next event estimation queues its shadow rays here instead of tracing them.
+    ShadowRayQueue* shadowRays = nullptr;
+    // If set, photon map lookups are queued here instead of being done right away.
+    PhotonQueryQueue* photonQueries = nullptr;
+    // Maximum amount of nodes in the path. Paths that reach it without ending in an emissive node are discarded.
+    int maxPathLength = 0;
 
     TransportBuildContext(const Scene &scene, std::vector<TransportNode>& path) : TransportContext(scene, path)
     {}
 };
 
+// Whether a material requires more than one sample per path node.
+enum class MaterialVariance : unsigned char
+{
+    none, always,
+    perNode // Depends on the hit or the path, hasVariance() must be called
+};
+
+// Properties of a material that are the same at every hit. The renderer uses them to skip material calls.
+struct MaterialTraits
+{
+    MaterialVariance variance = MaterialVariance::perNode;
+    bool isEmissive = false; // Every hit ends the path
+    bool isSpecular = false; // Every hit has specularity 1
+};
+
 /*
  * Interface to represent materials (BxDFs).
  */
@@ -80,4 +109,7 @@ public:
     virtual std::tuple<Vector3, RGB, float> interactPhoton(const SceneRayHitInfo& hit, const RGB& incomingEnergy) const;
 
     virtual bool hasVariance(const std::vector<TransportNode> &path, int curI, const Scene &scene) const;
+
+    // Must be consistent with sampleTransport and hasVariance. Materials may change until the scene is built.
+    virtual MaterialTraits getTraits() const;
 };
@@ -0,0 +1,11 @@
+#pragma once
+
+// How diffuse and glossy materials estimate the light arriving at a hit.
+enum class LightSamplingMode
+{
+    // Each bounce either samples a light (next event estimation), which ends the path, or samples the bsdf, with equal chance
+    alternate,
+    // Each bounce samples a light and continues the path by sampling the bsdf. Lights found by both strategies are
+    // combined with multiple importance sampling (power heuristic)
+    mis
+};
@@ -16,7 +16,7 @@ public:
     std::shared_ptr<IMaterial> second;
 };
 
-class ConstMixMaterial : public MixMaterial {
+class ConstMixMaterial final : public MixMaterial {
 public:
     float calcMixFactor(const SceneRayHitInfo &hit) const override
     {
@@ -4,29 +4,29 @@
 #include "math/Sampler.h"
 #include "math/Constants.h"
 
+// The visibility of the light is not tested here: the returned radiance only arrives at the hitpoint if nothing
+// intersects visibilityRay before maxT.
+
 // Return radiance from light to hitpoint
-RGB neePointLight(const PointLight& light, const Scene& scene, const Point& hitpoint, const Vector3& normal, /* OUT */ Vector3& lightDirection)
+RGB neePointLight(const PointLight& light, const Point& hitpoint, const Vector3& normal, /* OUT */ Vector3& lightDirection, /* OUT */ Ray& visibilityRay, /* OUT */ float& maxT)
 {
     Vector3 objectToLamp = light.pos - hitpoint;
     auto lampT = objectToLamp.norm();
     objectToLamp.normalize();
     lightDirection = objectToLamp;
 
-    Ray visibilityRay(hitpoint + (objectToLamp * 0.0001f), objectToLamp);
-    bool isVisible = !scene.testVisibility(visibilityRay, lampT).has_value();
+    visibilityRay = Ray(hitpoint + (objectToLamp * 0.0001f), objectToLamp);
+    maxT = lampT;
 
-    if (isVisible)
-    {
-        //auto angle = std::max(0.0f, normal.dot(objectToLamp));
-        auto geometricFactor = 1.0f / (4.0f * PI * (lampT * lampT)); // unit: 1/m^2
+    //auto angle = std::max(0.0f, normal.dot(objectToLamp));
+    auto geometricFactor = 1.0f / (4.0f * PI * (lampT * lampT)); // unit: 1/m^2
 
-        return light.color * (light.intensity * geometricFactor);
-    }
-    return RGB::BLACK;
+    return light.color * (light.intensity * geometricFactor);
 }
 
 // Return radiance*theta_lamp from light to hitpoint, picking a stratified random sample point as representative for the entire light
-RGB neeAreaLight(const AreaLight& light, const Scene& scene, const Point& hitpoint, const Vector3& normal, int sampleI, int sampleCount, /* OUT */ Vector3& lightDirection)
+// pdf receives the probability density per solid angle of the sampled direction.
+RGB neeAreaLight(const AreaLight& light, const Point& hitpoint, const Vector3& normal, int sampleI, int sampleCount, /* OUT */ Vector3& lightDirection, /* OUT */ Ray& visibilityRay, /* OUT */ float& maxT, /* OUT */ float& pdf)
 {
     auto lampPoint = light.generateStratifiedJitteredRandomPoint(sampleCount, sampleI);
     Vector3 objectToLamp = lampPoint - hitpoint;
@@ -34,87 +34,199 @@ RGB neeAreaLight(const AreaLight& light, const Scene& scene, const Point& hitpoi
     objectToLamp.normalize();
     lightDirection = objectToLamp;
 
-    Ray visibilityRay(hitpoint + (objectToLamp * 0.0001f), objectToLamp);
-    bool isVisible = !scene.testVisibility(visibilityRay, lampT).has_value();
-    if (isVisible)
-    {
-        auto lightEnergy = light.color * light.intensity;
-        auto lightIrradiance = lightEnergy.divide(light.getSurfaceArea());
-        auto lightRadiance = lightIrradiance.divide(PI);
+    visibilityRay = Ray(hitpoint + (objectToLamp * 0.0001f), objectToLamp);
+    maxT = lampT;
 
-        //auto surfaceAngle = std::max(0.0f, normal.dot(objectToLamp));
-        auto lampAngle = std::max(0.0f, light.getNormal().dot(-objectToLamp));
-        auto geometricFactor = lampAngle / (lampT * lampT);
+    auto lightEnergy = light.color * light.intensity;
+    auto lightIrradiance = lightEnergy.divide(light.getSurfaceArea());
+    auto lightRadiance = lightIrradiance.divide(PI);
 
-        auto irradianceFromLamp = lightRadiance * geometricFactor;
-        return irradianceFromLamp * light.getSurfaceArea();
-    }
-    return RGB::BLACK;
+    //auto surfaceAngle = std::max(0.0f, normal.dot(objectToLamp));
+    auto lampAngle = std::max(0.0f, light.getNormal().dot(-objectToLamp));
+    auto geometricFactor = lampAngle / (lampT * lampT);
+    pdf = lampAngle > 0 ? 1.0f / (static_cast<float>(light.getSurfaceArea()) * geometricFactor) : 0.0f;
+
+    auto irradianceFromLamp = lightRadiance * geometricFactor;
+    return irradianceFromLamp * light.getSurfaceArea();
 }
 
-RGB neeDirectionalLight(const DirectionalLight& light, const Scene& scene, const Point& hitpoint, const Vector3& normal, int sampleI, int sampleCount, /* OUT */ Vector3& lightDirection)
+RGB neeDirectionalLight(const DirectionalLight& light, const Point& hitpoint, const Vector3& normal, int sampleI, int sampleCount, /* OUT */ Vector3& lightDirection, /* OUT */ Ray& visibilityRay, /* OUT */ float& maxT)
 {
     lightDirection = sampleUniformSteradianSphere(-light.direction, light.angle);
 
-    Ray visibilityRay(hitpoint + (lightDirection * 0.0001f), lightDirection);
-    bool isVisible = !scene.testVisibility(visibilityRay, INFINITY).has_value();
-    if (isVisible)
+    visibilityRay = Ray(hitpoint + (lightDirection * 0.0001f), lightDirection);
+    maxT = INFINITY;
+
+    auto irradianceFromLamp = light.color * light.intensity;
+    return irradianceFromLamp;
+}
+
+// Return radiance from the environment to hitpoint, divided by the pdf of the sampled direction
+RGB neeEnvironment(const Scene& scene, const Point& hitpoint, /* OUT */ Vector3& lightDirection, /* OUT */ Ray& visibilityRay, /* OUT */ float& maxT, /* OUT */ float& pdf)
+{
+    float u1 = Rand::unit();
+    float u2 = Rand::unit();
+    auto radiance = scene.getEnvironmentMaterial().sample(scene, u1, u2, lightDirection, pdf);
+
+    visibilityRay = Ray(hitpoint + (lightDirection * 0.0001f), lightDirection);
+    maxT = INFINITY;
+
+    return pdf > 0 ? radiance.divide(pdf) : RGB::BLACK;
+}
+
+namespace
+{
+    // With alternate light sampling, the environment is already found by the rays that miss the scene
+    bool samplesEnvironment(const Scene& scene)
+    {
+        return scene.getLightSamplingMode() == LightSamplingMode::mis && scene.hasEnvironmentMaterial() && scene.getEnvironmentMaterial().supportsSampling();
+    }
+
+    // Probabilities of sampling a directional light and the environment, the light tree is sampled otherwise.
+    // Each directional light, the environment and the light tree are equally likely.
+    struct StrategyProbabilities
     {
-        auto irradianceFromLamp = light.color * light.intensity;
-        return irradianceFromLamp;
+        float directional;
+        float environment;
+    };
+
+    StrategyProbabilities getStrategyProbabilities(const Scene& scene)
+    {
+        const float directionalLightCount = scene.getDirectionalLights().size();
+        const float environmentCount = samplesEnvironment(scene) ? 1.0f : 0.0f;
+        const float total = directionalLightCount + environmentCount + (scene.getLightTree().isEmpty() ? 0.0f : 1.0f);
+        if(total == 0)
+        {
+            return {0.0f, 0.0f};
+        }
+        return {directionalLightCount / total, environmentCount / total};
     }
-    return RGB::BLACK;
 }
 
 RGB NextEventEstimation::sample(const Scene& scene, const Point& hitpoint, const Vector3& normal, int sampleI, int sampleCount, /* OUT */ Vector3& lightDirection)
 {
-    bool hasPointLights = !scene.getPointLights().empty();
-    bool hasAreaLights = !scene.getAreaLights().empty();
-    bool hasDirectionalLights = !scene.getDirectionalLights().empty();
+    RGB radiance;
+    sample(scene, hitpoint, normal, sampleI, sampleCount, nullptr, radiance, lightDirection);
+    return radiance;
+}
 
+void NextEventEstimation::sample(const Scene& scene, const Point& hitpoint, const Vector3& normal, int sampleI, int sampleCount, ShadowRayQueue* shadowRays, /* OUT */ RGB& radiance, /* OUT */ Vector3& lightDirection, /* OUT */ float* lightPdf)
+{
     /*
-     * To choose a light type, uniformly sample a number in [0;1] and pick corresponding type from diagram below
-     *
-     * ----------------
-     * | PL | AL | DL |
-     * ----------------
-     * 0              1
-     *
-     * Types are removed from the diagram if they are not present in the scene and the space is divided equally amongst all present types.
-     * After sampling, the resulting light intensity is divided by the probability of choosing the light type, as should be done when sampling a sum
+     * Directional lights and the environment are not in the light tree, as they have no position. With probability
+     * directionalLightProbability a directional light is picked uniformly, with probability environmentProbability the
+     * environment is sampled, otherwise the light tree picks a point or area light with a probability that follows its
+     * estimated contribution to the hitpoint.
+     * The resulting light intensity is divided by the probability of choosing the light, as should be done when sampling a sum.
      */
-    float totalAvailableLightTypes = (hasAreaLights ? 1.0f : 0.0f) + (hasPointLights ? 1.0f : 0.0f) + (hasDirectionalLights ? 1.0f : 0.0f);
-    float pointLightProbability = (hasPointLights ? 1.0f : 0.0f) / totalAvailableLightTypes;
-    float areaLightProbability = (hasAreaLights ? 1.0f : 0.0f) / totalAvailableLightTypes;
-    float directionalLightProbability = (hasDirectionalLights ? 1.0f : 0.0f) / totalAvailableLightTypes;
+    const auto& lightTree = scene.getLightTree();
+    const auto& directionalLights = scene.getDirectionalLights();
+    float pdf = 0.0f;
+    if(lightTree.isEmpty() && directionalLights.empty() && !samplesEnvironment(scene))
+    {
+        radiance = RGB::BLACK;
+        lightDirection = normal;
+        if(lightPdf != nullptr)
+        {
+            *lightPdf = pdf;
+        }
+        return;
+    }
+    const float directionalLightCount = directionalLights.size();
+    const auto [directionalLightProbability, environmentProbability] = getStrategyProbabilities(scene);
 
+    Ray visibilityRay;
+    float maxT;
     float choice = Rand::unit();
-    if(choice < pointLightProbability) // Choose point light
+    if(choice < directionalLightProbability) // Choose directional light
     {
-        float chosenLightProbability = 1.0f/scene.getPointLights().size();
-        auto lightIndex = Rand::intInRange(scene.getPointLights().size()-1);
-        const auto& light = *scene.getPointLights()[lightIndex].get();
+        auto lightIndex = std::min(static_cast<size_t>(choice / directionalLightProbability * directionalLightCount), directionalLights.size() - 1);
+        const auto& light = *directionalLights[lightIndex];
 
-        return neePointLight(light, scene, hitpoint, normal, lightDirection).divide(pointLightProbability * chosenLightProbability);
+        radiance = neeDirectionalLight(light, hitpoint, normal, sampleI, sampleCount, lightDirection, visibilityRay, maxT).divide(directionalLightProbability / directionalLightCount);
+        pdf = INFINITY;
     }
-    else if(choice < pointLightProbability + areaLightProbability) // Choose area light
+    else if(choice < directionalLightProbability + environmentProbability) // Choose environment
     {
-        float chosenLightProbability = 1.0f/scene.getAreaLights().size();
-        auto lightIndex = Rand::intInRange(scene.getAreaLights().size()-1);
-        const auto& light = *scene.getAreaLights()[lightIndex].get();
-
-        return neeAreaLight(light, scene, hitpoint, normal, sampleI, sampleCount, lightDirection).divide(areaLightProbability * chosenLightProbability);
+        radiance = neeEnvironment(scene, hitpoint, lightDirection, visibilityRay, maxT, pdf).divide(environmentProbability);
+        pdf *= environmentProbability;
     }
-    else if(hasDirectionalLights)
+    else
     {
-        float chosenLightProbability = 1.0f/scene.getDirectionalLights().size();
-        auto lightIndex = Rand::intInRange(scene.getDirectionalLights().size()-1);
-        const auto& light = *scene.getDirectionalLights()[lightIndex].get();
+        const float treeProbability = 1.0f - directionalLightProbability - environmentProbability;
+        auto treeChoice = std::min((choice - directionalLightProbability - environmentProbability) / treeProbability, 0x1.fffffep-1f);
+        auto sampledLight = lightTree.sample(hitpoint, normal, treeChoice);
+        if(!sampledLight.has_value())
+        {
+            // No light can reach the hitpoint
+            radiance = RGB::BLACK;
+            lightDirection = normal;
+            if(lightPdf != nullptr)
+            {
+                *lightPdf = pdf;
+            }
+            return;
+        }
+
+        float lightProbability = treeProbability * sampledLight->probability;
+        if(sampledLight->light.type == LightTree::LightType::point)
+        {
+            const auto& light = *scene.getPointLights()[sampledLight->light.index];
+            radiance = neePointLight(light, hitpoint, normal, lightDirection, visibilityRay, maxT).divide(lightProbability);
+            pdf = INFINITY;
+        }
+        else
+        {
+            const auto& light = *scene.getAreaLights()[sampledLight->light.index];
+            radiance = neeAreaLight(light, hitpoint, normal, sampleI, sampleCount, lightDirection, visibilityRay, maxT, pdf).divide(lightProbability);
+            pdf *= lightProbability;
+        }
+    }
 
-        return neeDirectionalLight(light, scene, hitpoint, normal, sampleI, sampleCount, lightDirection).divide(directionalLightProbability * chosenLightProbability);
+    if(lightPdf != nullptr)
+    {
+        *lightPdf = pdf;
     }
-    else
+
+    if(shadowRays != nullptr)
+    {
+        shadowRays->push(visibilityRay, maxT, radiance);
+    }
+    else if(scene.testVisibility(visibilityRay, maxT).has_value())
+    {
+        radiance = RGB::BLACK;
+    }
+}
+RGB NextEventEstimation::getEmittedRadiance(const AreaLight& light, const Vector3& direction)
+{
+    if(light.getNormal().dot(direction) <= 0)
     {
         return RGB::BLACK;
     }
-}
\ No newline at end of file
+    auto lightEnergy = light.color * light.intensity;
+    return lightEnergy.divide(light.getSurfaceArea()).divide(PI);
+}
+
+float NextEventEstimation::getAreaLightPdf(const Scene& scene, const Point& hitpoint, const Vector3& normal, const Ray& ray, const AreaLightBVH::Hit& hit)
+{
+    const auto [directionalLightProbability, environmentProbability] = getStrategyProbabilities(scene);
+    const float treeProbability = 1.0f - directionalLightProbability - environmentProbability;
+    const float lightProbability = treeProbability * scene.getLightTree().getAreaLightProbability(hitpoint, normal, hit.index);
+
+    // Density of uniformly sampled points on the light, converted from per area to per solid angle
+    const float lampAngle = std::max(0.0f, hit.light->getNormal().dot(-ray.getDirection()));
+    if(lampAngle <= 0)
+    {
+        return 0.0f;
+    }
+    return lightProbability * (hit.t * hit.t) / (lampAngle * static_cast<float>(hit.light->getSurfaceArea()));
+}
+
+float NextEventEstimation::getEnvironmentPdf(const Scene& scene, const Vector3& direction)
+{
+    if(!samplesEnvironment(scene))
+    {
+        return 0.0f;
+    }
+    return getStrategyProbabilities(scene).environment * scene.getEnvironmentMaterial().getPdf(direction);
+}
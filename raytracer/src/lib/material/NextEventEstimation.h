@@ -1,8 +1,10 @@
 #pragma once
 
+#include <cmath>
 #include "film/RGB.h"
 #include "math/Vector3.h"
 #include "scene/renderable/Scene.h"
+#include "scene/renderable/ShadowRayQueue.h"
 
 class NextEventEstimation {
 public:
@@ -11,4 +13,36 @@ public:
     static RGB sample(
             const Scene& scene, const Point& hitpoint, const Vector3& normal, int sampleI, int sampleCount,
             /* OUT */ Vector3& lightDirection);
+
+    // Same as above, but the radiance is written to radiance. If shadowRays is not null, the visibility of the light
+    // is not tested here: the shadow ray is queued, and radiance is set to black once the queue is resolved if the light
+    // is occluded. radiance must then remain valid until the queue is resolved.
+    // If lightPdf is set, it receives the probability density (per solid angle) of sampling lightDirection, which is
+    // infinite for lights that rays cannot hit (point and directional lights).
+    static void sample(
+            const Scene& scene, const Point& hitpoint, const Vector3& normal, int sampleI, int sampleCount,
+            ShadowRayQueue* shadowRays, /* OUT */ RGB& radiance, /* OUT */ Vector3& lightDirection, /* OUT */ float* lightPdf = nullptr);
+
+    // Radiance emitted by the area light into direction. Area lights only emit on the side of their normal.
+    static RGB getEmittedRadiance(const AreaLight& light, const Vector3& direction);
+
+    // Probability density (per solid angle) with which sample() picks the direction of the ray to the given area light hit.
+    static float getAreaLightPdf(const Scene& scene, const Point& hitpoint, const Vector3& normal, const Ray& ray, const AreaLightBVH::Hit& hit);
+
+    // Probability density (per solid angle) with which sample() picks the given direction to the environment. The
+    // environment is only sampled with LightSamplingMode::mis, if it supports sampling.
+    static float getEnvironmentPdf(const Scene& scene, const Vector3& direction);
 };
+
+// Power heuristic (beta = 2) weight of a sample taken with probability density pdf, when the same sample could also
+// have been taken with density otherPdf by another strategy.
+inline float powerHeuristic(float pdf, float otherPdf)
+{
+    if(std::isinf(pdf))
+    {
+        return 1.0f;
+    }
+    const float pdfSqr = pdf * pdf;
+    const float sum = pdfSqr + (otherPdf * otherPdf);
+    return sum > 0 ? pdfSqr / sum : 0.0f;
+}
@@ -2,7 +2,7 @@
 
 #include "FlatMaterial.h"
 
-class NormalMaterial : public FlatMaterial
+class NormalMaterial final : public FlatMaterial
 {
 public:
 	NormalMaterial();
@@ -11,17 +11,21 @@ void PhotonIndicatorMaterial::sampleTransport(TransportBuildContext &ctx) const
 
 RGB PhotonIndicatorMaterial::bsdf(const Scene &scene, const std::vector<TransportNode> &path, int curI, TransportNode &curNode, const RGB &incomingEnergy) const
 {
-    std::vector<const Photon*> photons(1);
-
     auto dir = -curNode.hit.ray.getDirection();
-    auto [nbPhotonsFound, maxDist] = scene.getPhotonMap()->getElementsNearestTo(curNode.hit.getHitpoint(), photons.size(), 1E9, [dir](const Photon& photon){
-        return dir.dot(photon.surfaceNormal) >= 0;
-    }, photons);
+    PhotonMap::Neighbour nearest;
+    auto nbPhotonsFound = scene.getPhotonMap()->getNearest(curNode.hit.getHitpoint(), 1, 1E9, [dir](const Photon& photon){
+        return dir.dot(photon.getSurfaceNormal()) >= 0;
+    }, &nearest);
 
-    return RGB(maxDist);
+    return RGB(nbPhotonsFound == 0 ? std::numeric_limits<float>::max() : std::sqrt(nearest.sqrDistance));
 }
 
 std::tuple<Vector3, RGB, float> PhotonIndicatorMaterial::interactPhoton(const SceneRayHitInfo &hit, const RGB &incomingEnergy) const
 {
     return std::make_tuple(hit.ray.getDirection(), incomingEnergy, 1.0); //diffuse pass-through
 }
+
+MaterialTraits PhotonIndicatorMaterial::getTraits() const
+{
+    return MaterialTraits{MaterialVariance::none, true, false};
+}
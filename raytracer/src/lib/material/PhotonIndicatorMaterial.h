@@ -2,9 +2,11 @@
 
 #include "IMaterial.h"
 
-class PhotonIndicatorMaterial : public IMaterial
+class PhotonIndicatorMaterial final : public IMaterial
 {
+public:
     void sampleTransport(TransportBuildContext &ctx) const override;
+    MaterialTraits getTraits() const override;
     RGB bsdf(const Scene& scene, const std::vector<TransportNode>& path, int curI, TransportNode& curNode, const RGB& incomingEnergy) const override;
 
     std::tuple<Vector3, RGB, float> interactPhoton(const SceneRayHitInfo &hit, const RGB &incomingEnergy) const override;
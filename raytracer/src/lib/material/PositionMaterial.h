@@ -2,7 +2,7 @@
 
 #include "FlatMaterial.h"
 
-class PositionMaterial : public FlatMaterial
+class PositionMaterial final : public FlatMaterial
 {
 public:
     PositionMaterial();
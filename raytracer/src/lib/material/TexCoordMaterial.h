@@ -2,7 +2,7 @@
 
 #include "FlatMaterial.h"
 
-class TexCoordMaterial : public FlatMaterial
+class TexCoordMaterial final : public FlatMaterial
 {
 public:
 	TexCoordMaterial();
@@ -29,7 +29,7 @@ public:
         auto b = image[offset+2];
         auto a = image[offset+3];
 		auto color = RGB{ (float)r / divisor, (float)g / divisor, (float)b / divisor };
-        return color.pow(this->gamma);
+        return this->gamma == 1.0 ? color : color.pow(this->gamma);
     }
 
     unsigned int getWidth() const
@@ -24,3 +24,8 @@ bool TransparentMaterial::hasVariance(const std::vector<TransportNode> &path, in
 {
     return false;
 }
+
+MaterialTraits TransparentMaterial::getTraits() const
+{
+    return MaterialTraits{MaterialVariance::none, false, true};
+}
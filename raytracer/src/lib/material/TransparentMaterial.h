@@ -2,7 +2,7 @@
 
 #include "IMaterial.h"
 
-class TransparentMaterial : public IMaterial
+class TransparentMaterial final : public IMaterial
 {
 public:
     void sampleTransport(TransportBuildContext &ctx) const override;
@@ -10,4 +10,5 @@ public:
 
     std::tuple<Vector3, RGB, float> interactPhoton(const SceneRayHitInfo &hit, const RGB &incomingEnergy) const override;
     bool hasVariance(const std::vector<TransportNode> &path, int curI, const Scene &scene) const override;
+    MaterialTraits getTraits() const override;
 };
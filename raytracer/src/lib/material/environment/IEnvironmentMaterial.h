@@ -6,4 +6,26 @@ public:
     virtual ~IEnvironmentMaterial() = default;
 
     virtual RGB getRadiance(const Scene& scene, const Vector3& direction) const = 0;
+
+    // Whether next event estimation can sample the environment with sample(). Other environments are only found by
+    // rays that miss the scene.
+    virtual bool supportsSampling() const
+    {
+        return false;
+    }
+
+    // Picks a direction with the uniform values u1 and u2, roughly proportional to the radiance from that direction, and
+    // returns that radiance. pdf receives the probability density (per solid angle) of the direction.
+    virtual RGB sample(const Scene& /*scene*/, float /*u1*/, float /*u2*/, /* OUT */ Vector3& direction, /* OUT */ float& pdf) const
+    {
+        pdf = 0;
+        direction = Vector3(0, 1, 0);
+        return RGB::BLACK;
+    }
+
+    // Probability density (per solid angle) with which sample() picks the direction.
+    virtual float getPdf(const Vector3& /*direction*/) const
+    {
+        return 0;
+    }
 };
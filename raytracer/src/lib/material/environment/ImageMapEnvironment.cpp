@@ -1,22 +1,98 @@
 #include "ImageMapEnvironment.h"
 
+#include <algorithm>
+#include <cmath>
 #include <utility>
+#include "math/Constants.h"
 
-ImageMapEnvironment::ImageMapEnvironment(std::shared_ptr<Texture<float>> environmentMap)
-        : texture(std::move(environmentMap))
-{}
+namespace
+{
+    // Position of the direction in the image, in [0, 1)^2
+    Vector2 getMapPosition(const Vector3& direction)
+    {
+        const float theta = std::acos(std::clamp(direction.y(), -1.0f, 1.0f));
+        const float phi = std::atan2(direction.z(), direction.x());
+        return Vector2(static_cast<float>((phi + PI) / (2.0 * PI)), static_cast<float>(theta / PI));
+    }
+
+    // Converts a density over the image to a density over solid angle, the image covers 2pi x pi radians
+    float toSolidAnglePdf(float mapPdf, float sinTheta)
+    {
+        return sinTheta > 0 ? mapPdf / (2.0f * PI * PI * sinTheta) : 0.0f;
+    }
+}
+
+ImageMapEnvironment::ImageMapEnvironment(const std::shared_ptr<Texture<float>>& environmentMap)
+{
+    auto result = std::make_shared<EnvironmentMap>();
+    result->width = environmentMap->getWidth();
+    result->height = environmentMap->getHeight();
+    result->texels.reserve(result->width * result->height);
+
+    std::vector<float> luminance;
+    luminance.reserve(result->width * result->height);
+    for(unsigned int y = 0; y < result->height; y++)
+    {
+        // Rows near the poles cover a smaller solid angle
+        const float sinTheta = std::sin(PI * (static_cast<float>(y) + 0.5f) / static_cast<float>(result->height));
+        for(unsigned int x = 0; x < result->width; x++)
+        {
+            const RGB& texel = result->texels.emplace_back(environmentMap->get(x, y));
+            luminance.push_back(static_cast<float>(texel.getLuminance()) * sinTheta);
+        }
+    }
+    result->distribution = PiecewiseConstant2D(luminance, result->width, result->height);
+    map = std::move(result);
+}
 
 ImageMapEnvironment* ImageMapEnvironment::cloneImpl() const
 {
-    return new ImageMapEnvironment(this->texture);
+    return new ImageMapEnvironment(*this);
+}
+
+RGB ImageMapEnvironment::lookup(const Vector2& position) const
+{
+    // Bilinear interpolation between the texel centers, wrapping around horizontally
+    const int width = static_cast<int>(map->width);
+    const int height = static_cast<int>(map->height);
+    const float x = (position.x() * static_cast<float>(width)) - 0.5f;
+    const float y = (position.y() * static_cast<float>(height)) - 0.5f;
+    const float xFloor = std::floor(x);
+    const float yFloor = std::floor(y);
+    const float fx = x - xFloor;
+    const float fy = y - yFloor;
+
+    const int x0 = ((static_cast<int>(xFloor) % width) + width) % width;
+    const int x1 = (x0 + 1) % width;
+    const int y0 = std::clamp(static_cast<int>(yFloor), 0, height - 1);
+    const int y1 = std::clamp(static_cast<int>(yFloor) + 1, 0, height - 1);
+
+    const auto& texels = map->texels;
+    const RGB top = texels[(y0 * width) + x0].scale(1.0f - fx) + texels[(y0 * width) + x1].scale(fx);
+    const RGB bottom = texels[(y1 * width) + x0].scale(1.0f - fx) + texels[(y1 * width) + x1].scale(fx);
+    return top.scale(1.0f - fy) + bottom.scale(fy);
 }
 
 RGB ImageMapEnvironment::getRadiance(const Scene &scene, const Vector3 &direction) const
 {
-    auto latitude = std::asin(direction.y());
-    auto longtitude = M_PI + std::atan2(direction.z()/std::cos(latitude), direction.x()/std::cos(latitude));
+    return lookup(getMapPosition(direction)) * intensity;
+}
 
-    auto x = texture->getWidth() * longtitude/(2.0f*M_PI);
-    auto y = texture->getHeight() * (1.0f - (((M_PI/2.0f) + latitude)/M_PI));
-    return this->texture->get(static_cast<int>(x), static_cast<int>(y)) * intensity;
+RGB ImageMapEnvironment::sample(const Scene& scene, float u1, float u2, Vector3& direction, float& pdf) const
+{
+    float mapPdf;
+    const Vector2 position = map->distribution.sample(u1, u2, mapPdf);
+
+    const float theta = position.y() * PI;
+    const float phi = (position.x() * 2.0f * PI) - PI;
+    const float sinTheta = std::sin(theta);
+    direction = Vector3(sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi));
+    pdf = toSolidAnglePdf(mapPdf, sinTheta);
+    return lookup(position) * intensity;
+}
+
+float ImageMapEnvironment::getPdf(const Vector3& direction) const
+{
+    const Vector2 position = getMapPosition(direction);
+    return toSolidAnglePdf(map->distribution.getPdf(position), std::sin(position.y() * PI));
 }
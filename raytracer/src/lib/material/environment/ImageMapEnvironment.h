@@ -3,17 +3,38 @@
 #include <film/RGB.h>
 #include <scene/renderable/Scene.h>
 #include <material/Texture.h>
+#include <math/PiecewiseConstant.h>
 #include "IEnvironmentMaterial.h"
 
-
+/*
+ * Environment from an equirectangular image, whose top row is straight up (+y). The texels are converted to RGB once,
+ * and interpolated bilinearly. Directions are importance sampled by the luminance of the texels.
+ */
 class ImageMapEnvironment : public IEnvironmentMaterial
 {
 public:
-    explicit ImageMapEnvironment(std::shared_ptr<Texture<float>> environmentMap);
+    explicit ImageMapEnvironment(const std::shared_ptr<Texture<float>>& environmentMap);
     RGB getRadiance(const Scene &scene, const Vector3 &direction) const override;
 
+    bool supportsSampling() const override
+    {
+        return true;
+    }
+    RGB sample(const Scene& scene, float u1, float u2, /* OUT */ Vector3& direction, /* OUT */ float& pdf) const override;
+    float getPdf(const Vector3& direction) const override;
+
     double intensity = 1.0;
 private:
+    struct EnvironmentMap
+    {
+        unsigned int width;
+        unsigned int height;
+        std::vector<RGB> texels; // Row by row
+        PiecewiseConstant2D distribution; // Over the position in the image, proportional to luminance * sin(theta)
+    };
+
     ImageMapEnvironment* cloneImpl() const override;
-    std::shared_ptr<Texture<float>> texture;
+    RGB lookup(const Vector2& position) const;
+
+    std::shared_ptr<const EnvironmentMap> map; // Shared by clones
 };
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <random>
 #include "pcg_random.hpp"
+#include "SampleSequence.h"
+#include "Constants.h"
 
 class RandDeviceSource
 {
@@ -25,24 +29,59 @@ namespace {
 class Rand
 {
 public:
+    // While a sequence is set, all values drawn by this thread are taken from it, one dimension per value.
+    // The renderers set the sample sequence of the pixel sample they are working on and the photon tracer sets one per
+    // photon, which makes their results independent of the thread that does the work.
+    static void setSequence(SampleSequence* sequence)
+    {
+        activeSequence = sequence;
+    }
+
+    static SampleSequence* getSequence()
+    {
+        return activeSequence;
+    }
+
+    static bool hasSequence()
+    {
+        return activeSequence != nullptr;
+    }
+
+    static bool hasStratifiedSequence()
+    {
+        return activeSequence != nullptr && activeSequence->isStratified();
+    }
+
     static float unit()
     {
+        if(activeSequence != nullptr)
+        {
+            return activeSequence->next();
+        }
         return std::uniform_real_distribution<float>(0, 1)(randDevSrc.randDev);
     }
 
     static double unitDouble()
     {
+        if(activeSequence != nullptr)
+        {
+            return activeSequence->next();
+        }
         return std::uniform_real_distribution<double>(0, 1)(randDevSrc.randDev);
     }
 
     static float floatInRange(float a, float b)
     {
+        if(activeSequence != nullptr)
+        {
+            return a + (activeSequence->next() * (b - a));
+        }
         return std::uniform_real_distribution<float>(a, b)(randDevSrc.randDev);
     }
 
     static float floatInRange(float maxValue)
     {
-        return std::uniform_real_distribution<float>(0, maxValue)(randDevSrc.randDev);
+        return floatInRange(0, maxValue);
     }
 
     static unsigned int unsignedInteger()
@@ -52,16 +91,51 @@ public:
 
     static int intInRange(int a, int b)
     {
+        if(activeSequence != nullptr)
+        {
+            return a + std::min(static_cast<int>(activeSequence->next() * static_cast<float>(b - a + 1)), b - a);
+        }
         return std::uniform_int_distribution<int>(a, b)(randDevSrc.randDev);
     }
 
     static int intInRange(int maxValue)
     {
-        return std::uniform_int_distribution<int>(0, maxValue)(randDevSrc.randDev);
+        return intInRange(0, maxValue);
     }
 
     static float sampleStdNormalDist()
     {
+        if(activeSequence != nullptr)
+        {
+            // Box-Muller transform
+            float u1 = 1.0f - activeSequence->next();
+            float u2 = activeSequence->next();
+            return std::sqrt(-2.0f * std::log(u1)) * std::cos(static_cast<float>(2.0 * PI) * u2);
+        }
         return std::normal_distribution<float>(0, 1)(randDevSrc.randDev);
     }
+
+private:
+    static inline thread_local SampleSequence* activeSequence = nullptr;
+};
+
+// Sets the sample sequence of Rand for the lifetime of the scope, the previous one is restored at the end.
+class ScopedSampleSequence
+{
+public:
+    explicit ScopedSampleSequence(SampleSequence* sequence) : previous(Rand::getSequence())
+    {
+        Rand::setSequence(sequence);
+    }
+
+    ~ScopedSampleSequence()
+    {
+        Rand::setSequence(previous);
+    }
+
+    ScopedSampleSequence(const ScopedSampleSequence&) = delete;
+    ScopedSampleSequence& operator=(const ScopedSampleSequence&) = delete;
+
+private:
+    SampleSequence* previous;
 };
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include "Vector2.h"
+#include "Vector3.h"
+
+namespace HalfFloat
+{
+	// Converts to IEEE 754 half precision, rounding to nearest even.
+	inline uint16_t fromFloat(float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		const uint32_t sign = (bits >> 16u) & 0x8000u;
+		bits &= 0x7FFFFFFFu;
+
+		if(bits >= 0x7F800000u) // Infinity or NaN
+		{
+			return static_cast<uint16_t>(sign | 0x7C00u | (bits > 0x7F800000u ? 0x200u : 0u));
+		}
+		if(bits >= 0x47800000u) // Too large, even before rounding
+		{
+			return static_cast<uint16_t>(sign | 0x7C00u);
+		}
+		if(bits < 0x38800000u) // Subnormal in half precision
+		{
+			if(bits < 0x33000000u)
+			{
+				return static_cast<uint16_t>(sign);
+			}
+			const uint32_t mantissa = (bits & 0x7FFFFFu) | 0x800000u;
+			const uint32_t shift = 126u - (bits >> 23u);
+			uint32_t half = mantissa >> shift;
+			const uint32_t remainder = mantissa & ((1u << shift) - 1u);
+			const uint32_t halfway = 1u << (shift - 1u);
+			if(remainder > halfway || (remainder == halfway && (half & 1u)))
+			{
+				half++;
+			}
+			return static_cast<uint16_t>(sign | half);
+		}
+
+		// Rebias the exponent, rounding can carry into the exponent (up to infinity), which is the correct result.
+		uint32_t half = (bits - 0x38000000u) >> 13u;
+		const uint32_t remainder = bits & 0x1FFFu;
+		if(remainder > 0x1000u || (remainder == 0x1000u && (half & 1u)))
+		{
+			half++;
+		}
+		return static_cast<uint16_t>(sign | half);
+	}
+
+	inline float toFloat(uint16_t half)
+	{
+		const uint32_t sign = (half & 0x8000u) << 16u;
+		const uint32_t exponent = (half >> 10u) & 0x1Fu;
+		const uint32_t mantissa = half & 0x3FFu;
+
+		uint32_t bits;
+		if(exponent == 0x1Fu)
+		{
+			bits = sign | 0x7F800000u | (mantissa << 13u);
+		}
+		else if(exponent == 0)
+		{
+			const float value = std::ldexp(static_cast<float>(mantissa), -24);
+			return sign ? -value : value;
+		}
+		else
+		{
+			bits = sign | ((exponent + 112u) << 23u) | (mantissa << 13u);
+		}
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+}
+
+// Texture coordinate stored as two half precision floats
+struct HalfVector2
+{
+	std::array<uint16_t, 2> xy;
+
+	static HalfVector2 encode(const Vector2& vector)
+	{
+		return HalfVector2 { { HalfFloat::fromFloat(vector.x()), HalfFloat::fromFloat(vector.y()) } };
+	}
+
+	Vector2 decode() const
+	{
+		return Vector2(HalfFloat::toFloat(xy[0]), HalfFloat::toFloat(xy[1]));
+	}
+};
+
+// Unit vector stored in 2xBits bits with the octahedral mapping: the vector is projected onto the octahedron
+// |x| + |y| + |z| = 1, the lower half of which is folded over the upper half, and x and y are stored as snorm.
+// With 16 bits the angular error is below 0.01 degrees.
+template<unsigned int Bits>
+struct BasicOctahedralNormal
+{
+	static_assert(Bits >= 2 && Bits <= 16, "The coordinates are stored as 16-bit integers");
+	static constexpr uint32_t Mask = (1u << Bits) - 1u;
+
+	std::array<int16_t, 2> xy;
+
+	static BasicOctahedralNormal encode(const Vector3& normal)
+	{
+		const float l1Norm = std::abs(normal.x()) + std::abs(normal.y()) + std::abs(normal.z());
+		if(l1Norm == 0.0f)
+		{
+			return BasicOctahedralNormal { { 0, 0 } };
+		}
+		float x = normal.x() / l1Norm;
+		float y = normal.y() / l1Norm;
+		if(normal.z() < 0.0f)
+		{
+			const float foldedX = (1.0f - std::abs(y)) * signNotZero(x);
+			const float foldedY = (1.0f - std::abs(x)) * signNotZero(y);
+			x = foldedX;
+			y = foldedY;
+		}
+		return BasicOctahedralNormal { { toSnorm(x), toSnorm(y) } };
+	}
+
+	Vector3 decode() const
+	{
+		float x = xy[0] / MaxValue;
+		float y = xy[1] / MaxValue;
+		const float z = 1.0f - std::abs(x) - std::abs(y);
+		if(z < 0.0f)
+		{
+			const float unfoldedX = (1.0f - std::abs(y)) * signNotZero(x);
+			const float unfoldedY = (1.0f - std::abs(x)) * signNotZero(y);
+			x = unfoldedX;
+			y = unfoldedY;
+		}
+		Vector3 result(x, y, z);
+		result.normalize();
+		return result;
+	}
+
+	// Both coordinates in the low 2 * Bits bits of a word
+	uint32_t pack() const
+	{
+		return (static_cast<uint32_t>(xy[0]) & Mask) | ((static_cast<uint32_t>(xy[1]) & Mask) << Bits);
+	}
+
+	static BasicOctahedralNormal unpack(uint32_t bits)
+	{
+		return BasicOctahedralNormal { { signExtend(bits & Mask), signExtend((bits >> Bits) & Mask) } };
+	}
+
+private:
+	static constexpr float MaxValue = static_cast<float>((1 << (Bits - 1)) - 1);
+
+	static float signNotZero(float value)
+	{
+		return value >= 0.0f ? 1.0f : -1.0f;
+	}
+
+	static int16_t toSnorm(float value)
+	{
+		return static_cast<int16_t>(std::lround(std::clamp(value, -1.0f, 1.0f) * MaxValue));
+	}
+
+	static int16_t signExtend(uint32_t value)
+	{
+		const uint32_t signBit = 1u << (Bits - 1);
+		return static_cast<int16_t>(static_cast<int32_t>(value ^ signBit) - static_cast<int32_t>(signBit));
+	}
+};
+
+using OctahedralNormal = BasicOctahedralNormal<16>;
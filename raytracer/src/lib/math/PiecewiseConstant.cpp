@@ -0,0 +1,82 @@
+#include "PiecewiseConstant.h"
+
+#include <algorithm>
+
+namespace
+{
+    constexpr float OneMinusEpsilon = 0x1.fffffep-1f;
+}
+
+PiecewiseConstant1D::PiecewiseConstant1D(std::vector<float> function)
+    : function(std::move(function))
+{
+    const size_t n = this->function.size();
+    cdf.resize(n + 1);
+    cdf[0] = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+        this->function[i] = std::max(0.0f, this->function[i]);
+        cdf[i + 1] = cdf[i] + (this->function[i] / static_cast<float>(n));
+    }
+    integral = cdf[n];
+
+    for(size_t i = 1; i <= n; i++)
+    {
+        cdf[i] = integral > 0 ? cdf[i] / integral : static_cast<float>(i) / static_cast<float>(n);
+    }
+}
+
+float PiecewiseConstant1D::sample(float u, float& pdf, size_t& piece) const
+{
+    // Last piece whose cdf value is <= u
+    const auto it = std::upper_bound(cdf.begin(), cdf.end(), u);
+    piece = std::clamp<size_t>(std::distance(cdf.begin(), it), 1, function.size()) - 1;
+
+    // Position of u within the piece
+    float offset = u - cdf[piece];
+    const float pieceProbability = cdf[piece + 1] - cdf[piece];
+    if(pieceProbability > 0)
+    {
+        offset /= pieceProbability;
+    }
+
+    pdf = getPdf(piece);
+    return std::min((static_cast<float>(piece) + offset) / static_cast<float>(function.size()), OneMinusEpsilon);
+}
+
+float PiecewiseConstant1D::getPdf(size_t piece) const
+{
+    return integral > 0 ? function[piece] / integral : 1.0f;
+}
+
+PiecewiseConstant2D::PiecewiseConstant2D(const std::vector<float>& function, size_t width, size_t height)
+{
+    conditional.reserve(height);
+    std::vector<float> rowIntegrals;
+    rowIntegrals.reserve(height);
+    for(size_t row = 0; row < height; row++)
+    {
+        conditional.emplace_back(std::vector<float>(function.begin() + (row * width), function.begin() + ((row + 1) * width)));
+        rowIntegrals.push_back(conditional.back().getIntegral());
+    }
+    marginal = PiecewiseConstant1D(std::move(rowIntegrals));
+}
+
+Vector2 PiecewiseConstant2D::sample(float u1, float u2, float& pdf) const
+{
+    float rowPdf, columnPdf;
+    size_t row, column;
+    const float y = marginal.sample(u2, rowPdf, row);
+    const float x = conditional[row].sample(u1, columnPdf, column);
+    pdf = rowPdf * columnPdf;
+    return Vector2(x, y);
+}
+
+float PiecewiseConstant2D::getPdf(const Vector2& point) const
+{
+    const size_t width = conditional[0].size();
+    const size_t height = conditional.size();
+    const auto column = std::min(static_cast<size_t>(std::max(0.0f, point.x()) * static_cast<float>(width)), width - 1);
+    const auto row = std::min(static_cast<size_t>(std::max(0.0f, point.y()) * static_cast<float>(height)), height - 1);
+    return marginal.getPdf(row) * conditional[row].getPdf(column);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "math/Vector2.h"
+
+/*
+ * Probability distribution over [0, 1) proportional to a piecewise constant function with equally wide pieces.
+ * Functions that are zero everywhere are sampled uniformly.
+ */
+class PiecewiseConstant1D
+{
+public:
+    PiecewiseConstant1D() = default;
+    explicit PiecewiseConstant1D(std::vector<float> function);
+
+    // Maps uniform value u to a value in [0, 1) distributed according to the function.
+    // pdf receives the probability density of the result, piece receives the index of the piece it is in.
+    float sample(float u, /* OUT */ float& pdf, /* OUT */ size_t& piece) const;
+
+    // Probability density of the values in the given piece.
+    float getPdf(size_t piece) const;
+
+    // Integral of the function over [0, 1)
+    float getIntegral() const
+    {
+        return integral;
+    }
+
+    size_t size() const
+    {
+        return function.size();
+    }
+
+private:
+    std::vector<float> function;
+    std::vector<float> cdf; // cdf[i] is the probability of the pieces before i, cdf has size() + 1 elements
+    float integral = 0;
+};
+
+/*
+ * Probability distribution over [0, 1)^2 proportional to a piecewise constant function on a width x height grid,
+ * sampled by picking a row from the marginal distribution and then a column from the conditional distribution of the row.
+ */
+class PiecewiseConstant2D
+{
+public:
+    PiecewiseConstant2D() = default;
+    // function holds the values of the cells row by row
+    PiecewiseConstant2D(const std::vector<float>& function, size_t width, size_t height);
+
+    // Maps uniform values u1 (column) and u2 (row) to a point distributed according to the function.
+    // pdf receives the probability density of the point.
+    Vector2 sample(float u1, float u2, /* OUT */ float& pdf) const;
+
+    // Probability density of the given point.
+    float getPdf(const Vector2& point) const;
+
+private:
+    std::vector<PiecewiseConstant1D> conditional;
+    PiecewiseConstant1D marginal;
+};
@@ -3,6 +3,7 @@
 #include <string>
 #include <sstream>
 #include <array>
+#include <cstdint>
 #include "Vector3.h"
 
 class Ray {
@@ -38,3 +39,10 @@ using RayBundle = std::array<Ray, RayBundleSize>;
 using RayBundlePermutation = std::array<RBSize_t, RayBundleSize>;
 template<typename TRayHitInfo>
 using HitBundle = std::array<std::optional<TRayHitInfo>, RayBundleSize>;
+
+// Set of rays of a bundle, bit i refers to ray i.
+using RayBundleMask = uint32_t;
+static_assert(RayBundleSize <= 32, "RayBundleMask needs a bit for every ray in a bundle");
+constexpr RayBundleMask FullRayBundleMask = RayBundleSize == 32 ? ~RayBundleMask(0) : (RayBundleMask(1) << RayBundleSize) - 1;
+// Maximum hit distance for each ray of a bundle
+using RayBundleMaxT = std::array<float, RayBundleSize>;
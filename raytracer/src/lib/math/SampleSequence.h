@@ -0,0 +1,179 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include "utility/Hash.h"
+
+// Base 2 low discrepancy sequence, generated from the direction numbers of the first dimensions of the Sobol sequence.
+namespace Sobol
+{
+    constexpr unsigned int DimensionCount = 4;
+
+    // Direction numbers, with the primitive polynomials and initial numbers of Joe & Kuo (2008).
+    constexpr std::array<std::array<uint32_t, 32>, DimensionCount> makeDirections()
+    {
+        constexpr unsigned int degree[] = {0, 1, 2, 3};
+        constexpr unsigned int coefficients[] = {0, 0, 1, 1};
+        constexpr uint32_t initial[][3] = {{0, 0, 0}, {1, 0, 0}, {1, 3, 0}, {1, 3, 1}};
+
+        std::array<std::array<uint32_t, 32>, DimensionCount> directions {};
+        for(unsigned int i = 0; i < 32; i++)
+        {
+            directions[0][i] = uint32_t(1) << (31 - i);
+        }
+        for(unsigned int dim = 1; dim < DimensionCount; dim++)
+        {
+            const unsigned int s = degree[dim];
+            const unsigned int a = coefficients[dim];
+            auto& v = directions[dim];
+            for(unsigned int i = 0; i < s; i++)
+            {
+                v[i] = initial[dim][i] << (31 - i);
+            }
+            for(unsigned int i = s; i < 32; i++)
+            {
+                v[i] = v[i - s] ^ (v[i - s] >> s);
+                for(unsigned int k = 1; k < s; k++)
+                {
+                    v[i] ^= ((a >> (s - 1 - k)) & 1) * v[i - k];
+                }
+            }
+        }
+        return directions;
+    }
+
+    inline constexpr auto Directions = makeDirections();
+
+    // Point index of the sequence in the given dimension, as a 0.32 fixed point number.
+    inline uint32_t sample(uint32_t index, unsigned int dimension)
+    {
+        uint32_t result = 0;
+        for(unsigned int bit = 0; index != 0; index >>= 1, bit++)
+        {
+            if(index & 1)
+            {
+                result ^= Directions[dimension][bit];
+            }
+        }
+        return result;
+    }
+
+    inline uint32_t reverseBits(uint32_t x)
+    {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+        x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    // Hash based Owen scramble (Burley 2020, "Practical Hash-based Owen Scrambling"): every bit is flipped depending on
+    // the seed and the more significant bits, so the stratification of the points is kept.
+    inline uint32_t owenScramble(uint32_t x, uint32_t seed)
+    {
+        x = reverseBits(x);
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return reverseBits(x);
+    }
+}
+
+enum class SamplerType
+{
+    random, // Independent random values
+    sobol // Owen-scrambled Sobol sequence per pixel, see SampleSequence
+};
+
+/*
+ * Stream of the values of one sample point of a pixel, taken from an Owen-scrambled Sobol sequence.
+ * The values are drawn one dimension at a time. The dimensions are handled in groups of Sobol::DimensionCount, each
+ * group with its own scramble and point order (derived from the seed), so the sequence has any number of dimensions.
+ * The points with the same seed and consecutive indices are stratified in every dimension, and in the first two
+ * dimensions of every group together.
+ * With SamplerType::random the values are independent instead: each value is a hash of (seed, sample index, dimension).
+ * Either way, a value only depends on these keys, never on the order in which samples are taken or on the thread.
+ */
+class SampleSequence
+{
+public:
+    SampleSequence() = default;
+
+    SampleSequence(uint32_t seed, uint32_t sampleIndex, uint32_t dimension = 0, SamplerType type = SamplerType::sobol)
+        : seed(seed), sampleIndex(sampleIndex), dimension(dimension), type(type)
+    { }
+
+    // Seed of the sample points of pixel (x, y) in a render with the given seed, the same for every tile layout.
+    static uint32_t pixelSeed(uint32_t renderSeed, int x, int y)
+    {
+        return static_cast<uint32_t>(Hash::combine(Hash::combine(renderSeed, static_cast<uint32_t>(x)), static_cast<uint32_t>(y)));
+    }
+
+    // Next value, in [0, 1)
+    float next()
+    {
+        const uint32_t group = dimension / Sobol::DimensionCount;
+        if(group != cachedGroup)
+        {
+            loadGroup(group);
+        }
+        const uint32_t value = groupValues[dimension % Sobol::DimensionCount];
+        dimension++;
+        return static_cast<float>(value >> 8) * 0x1p-24f;
+    }
+
+    // Continues at the given dimension, unless it was used already.
+    // Values are never repeated within a sample point, which would correlate them.
+    void skipTo(uint32_t dimension)
+    {
+        if(dimension > this->dimension)
+        {
+            this->dimension = dimension;
+        }
+    }
+
+    uint32_t getDimension() const
+    {
+        return dimension;
+    }
+
+    // True if consecutive sample indices are stratified, so explicit strata are not needed.
+    bool isStratified() const
+    {
+        return type == SamplerType::sobol;
+    }
+
+private:
+    uint32_t seed = 0;
+    uint32_t sampleIndex = 0;
+    uint32_t dimension = 0;
+    SamplerType type = SamplerType::sobol;
+    uint32_t cachedGroup = std::numeric_limits<uint32_t>::max();
+    std::array<uint32_t, Sobol::DimensionCount> groupValues {};
+
+    void loadGroup(uint32_t group)
+    {
+        const auto groupSeed = static_cast<uint32_t>(Hash::combine(seed, group));
+        if(type == SamplerType::random)
+        {
+            const uint64_t pointSeed = Hash::combine(groupSeed, sampleIndex);
+            for(unsigned int i = 0; i < Sobol::DimensionCount; i++)
+            {
+                groupValues[i] = static_cast<uint32_t>(Hash::combine(pointSeed, i));
+            }
+            cachedGroup = group;
+            return;
+        }
+
+        const uint32_t index = Sobol::owenScramble(sampleIndex, groupSeed);
+        for(unsigned int i = 0; i < Sobol::DimensionCount; i++)
+        {
+            const auto dimensionSeed = static_cast<uint32_t>(Hash::combine(groupSeed, i + 1));
+            groupValues[i] = Sobol::owenScramble(Sobol::sample(index, i), dimensionSeed);
+        }
+        cachedGroup = group;
+    }
+};
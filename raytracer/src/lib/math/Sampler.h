@@ -9,10 +9,14 @@
 #include "math/Transformation.h"
 #include "Vector3.h"
 
+// The stratified sampling functions below divide the domain into level strata and place sample sampleI in one of them.
+// When the values come from a stratified sample sequence, that is stratified over all samples already, so the strata
+// are skipped.
+
 // sample square between (0, 0) and (1, 1)
 inline Vector2 sampleUniformStratifiedSquare(int level, float sampleI)
 {
-    if(level < 4)
+    if(level < 4 || Rand::hasStratifiedSequence())
     {
         return Vector2(Rand::unit(), Rand::unit());
     }
@@ -27,6 +31,10 @@ inline Vector2 sampleUniformStratifiedSquare(int level, float sampleI)
 
 inline Vector3 sampleUniformStratifiedCube(float level, float sampleI)
 {
+    if(Rand::hasStratifiedSequence())
+    {
+        return Vector3(Rand::unit(), Rand::unit(), Rand::unit());
+    }
     float binsPerAxis = std::pow(level, 1.0f/3.0f);
     float oneOverBinsPerAxis = 1.0f / binsPerAxis;
     float binX = std::fmod(sampleI, binsPerAxis);
@@ -1,6 +1,6 @@
 #include "Model.h"
 
 Model::Model(std::shared_ptr<IShape> shape, std::shared_ptr<IMaterial> material)
-	: shape(std::move(shape)), material(std::move(material))
+	: shape(std::move(shape)), material(std::move(material)), compiledMaterial(this->material.get())
 { }
 
@@ -5,6 +5,7 @@
 #include "utility/ICloneable.h"
 #include "shape/IShape.h"
 #include "material/IMaterial.h"
+#include "material/CompiledMaterial.h"
 
 class Model : public ICloneable<Model>
 {
@@ -36,9 +37,22 @@ public:
         return this->material;
     }
 
+    // Material as called by the renderer, see CompiledMaterial.
+    const CompiledMaterial& getCompiledMaterial() const
+    {
+        return this->compiledMaterial;
+    }
+
+    // Updates the compiled material after the material was changed. Called when the scene is built.
+    void compileMaterial()
+    {
+        this->compiledMaterial = CompiledMaterial(this->material.get());
+    }
+
 private:
 	std::shared_ptr<IShape> shape;
 	std::shared_ptr<IMaterial> material;
+	CompiledMaterial compiledMaterial;
 
 	Model* cloneImpl() const override
 	{
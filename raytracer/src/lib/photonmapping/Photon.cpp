@@ -0,0 +1,51 @@
+#include "Photon.h"
+
+#include <algorithm>
+#include <cmath>
+
+uint32_t Photon::encodeEnergy(const RGB& energy)
+{
+    // Ward's RGBE: 8 bit mantissas that share the exponent of the largest component
+    const float red = std::max(0.0f, energy.getRed());
+    const float green = std::max(0.0f, energy.getGreen());
+    const float blue = std::max(0.0f, energy.getBlue());
+    const float maxComponent = std::max({red, green, blue});
+    if(!(maxComponent > 1e-32f) || std::isinf(maxComponent))
+    {
+        return 0;
+    }
+
+    int exponent;
+    std::frexp(maxComponent, &exponent);
+    const float scale = std::ldexp(1.0f, 8 - exponent);
+    auto toMantissa = [scale](float value)
+    {
+        return std::min(255u, static_cast<uint32_t>(std::lround(value * scale)));
+    };
+    return toMantissa(red) | (toMantissa(green) << 8) | (toMantissa(blue) << 16) | (static_cast<uint32_t>(exponent + 128) << 24);
+}
+
+RGB Photon::getEnergy() const
+{
+    const uint32_t exponent = energy >> 24;
+    if(exponent == 0)
+    {
+        return RGB();
+    }
+    const float scale = std::ldexp(1.0f, static_cast<int>(exponent) - (128 + 8));
+    return RGB(
+        static_cast<float>(energy & 0xFFu) * scale,
+        static_cast<float>((energy >> 8) & 0xFFu) * scale,
+        static_cast<float>((energy >> 16) & 0xFFu) * scale
+    );
+}
+
+uint32_t Photon::encodeNormal(const Vector3& normal)
+{
+    return PackedNormal::encode(normal).pack();
+}
+
+Vector3 Photon::getSurfaceNormal() const
+{
+    return PackedNormal::unpack(packedNormal).decode();
+}
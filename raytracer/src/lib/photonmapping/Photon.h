@@ -2,31 +2,65 @@
 
 #include <film/RGB.h>
 #include <math/Vector3.h>
+#include <math/Axis.h>
+#include <math/PackedVectors.h>
+#include <cstdint>
 #include <vector>
 
+/*
+ * Compact photon record: the position, the energy as shared exponent RGB (RGBE) and one word that packs the surface
+ * normal (octahedral encoding, 14 bits per coordinate), the split axis of the photon map node and the caustic flag.
+ */
 struct Photon
 {
     Point pos;
-    Vector3 surfaceNormal;
-    RGB energy;
-    bool isCaustic;
 
-    Photon(Point pos, Vector3 incomingDir, Vector3 surfaceNormal, RGB energy, bool isCaustic)
-            : pos(std::move(pos)), surfaceNormal(std::move(surfaceNormal)), energy(std::move(energy)), isCaustic(isCaustic)
+    Photon(const Point& pos, const Vector3& surfaceNormal, const RGB& energy, bool isCaustic)
+            : pos(pos), energy(encodeEnergy(energy)), packedNormal(encodeNormal(surfaceNormal) | (isCaustic ? CausticBit : 0u))
                {}
 
-    Photon() : pos(), surfaceNormal(), energy(), isCaustic(false)
+    Photon() : pos(), energy(0), packedNormal(0)
         {}
 
     const Point& getPosition() const
     {
         return pos;
     }
+
+    Vector3 getSurfaceNormal() const;
+
+    RGB getEnergy() const;
+
+    bool isCaustic() const
+    {
+        return (packedNormal & CausticBit) != 0;
+    }
+
+    // Split axis of the photon map node that holds this photon
+    Axis getSplitAxis() const
+    {
+        return static_cast<Axis>((packedNormal >> AxisShift) & 0x3u);
+    }
+
+    void setSplitAxis(Axis axis)
+    {
+        packedNormal = (packedNormal & ~(0x3u << AxisShift)) | (static_cast<uint32_t>(axis) << AxisShift);
+    }
+
+private:
+    static constexpr uint32_t NormalBits = 14;
+    static constexpr uint32_t AxisShift = 2 * NormalBits;
+    static constexpr uint32_t CausticBit = 1u << (AxisShift + 2);
+    using PackedNormal = BasicOctahedralNormal<NormalBits>;
+
+    uint32_t energy;
+    uint32_t packedNormal;
+
+    static uint32_t encodeEnergy(const RGB& energy);
+    static uint32_t encodeNormal(const Vector3& normal);
 };
 
-#ifdef NO_TBB
+static_assert(sizeof(Photon) == 20, "Photons are stored in bulk, keep the record compact");
+
+// Photon tracing tasks each fill their own list, which are concatenated once, so the photons are stored contiguously.
 using PhotonList = std::vector<Photon>;
-#else
-#include <tbb/tbb.h>
-using PhotonList = tbb::concurrent_vector<Photon>;
-#endif
@@ -0,0 +1,356 @@
+#include "PhotonMap.h"
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include "utility/AtomicFile.h"
+#include "utility/BitOps.h"
+#include "utility/Hash.h"
+#include "utility/MappedFile.h"
+#ifndef NO_TBB
+#include <tbb/parallel_invoke.h>
+#else
+#include "utility/ThreadPool.h"
+#endif
+
+#ifdef ENABLE_SIMD
+#pragma GCC target("avx")  //Enable AVX
+#include <x86intrin.h> //AVX/SSE Extensions
+#endif
+
+namespace
+{
+    constexpr std::array<char, 8> Magic = {'P', 'H', 'O', 'T', 'O', 'N', 'M', 'P'};
+
+    using iterator = PhotonList::iterator;
+
+    // Number of nodes in the left subtree of a left-balanced tree with the given number of nodes
+    size_t getLeftSubtreeSize(size_t nodeCount)
+    {
+        if(nodeCount <= 1)
+        {
+            return 0;
+        }
+
+        // Nodes on the last, incomplete level fill up the left subtree first
+        size_t lastLevelCapacity = 1;
+        while(lastLevelCapacity * 2 <= nodeCount)
+        {
+            lastLevelCapacity *= 2;
+        }
+        const size_t lastLevelCount = nodeCount - (lastLevelCapacity - 1);
+        return (lastLevelCapacity / 2 - 1) + std::min(lastLevelCount, lastLevelCapacity / 2);
+    }
+
+    Axis getLargestExtentAxis(iterator begin, iterator end)
+    {
+        Point min = begin->getPosition();
+        Point max = begin->getPosition();
+        for(auto it = begin + 1; it != end; ++it)
+        {
+            min = min.cwiseMin(it->getPosition());
+            max = max.cwiseMax(it->getPosition());
+        }
+        int axis;
+        (max - min).maxCoeff(&axis);
+        return static_cast<Axis>(axis);
+    }
+
+    // Partitions the photons in [begin, end) into the subtree rooted at nodeIdx of the heap. The node photon of each
+    // subtree ends up between the photons of its children, heapIndices receives its heap index by its offset from first.
+    void buildSubtree(iterator begin, iterator end, iterator first, std::vector<uint32_t>& heapIndices, size_t nodeIdx)
+    {
+        const auto count = static_cast<size_t>(std::distance(begin, end));
+        if(count == 0)
+        {
+            return;
+        }
+
+        const Axis axis = getLargestExtentAxis(begin, end);
+        const int axisIdx = static_cast<int>(axis);
+        const iterator median = begin + getLeftSubtreeSize(count);
+        std::nth_element(begin, median, end, [axisIdx](const Photon& a, const Photon& b){
+            return a.getPosition()[axisIdx] < b.getPosition()[axisIdx];
+        });
+
+        median->setSplitAxis(axis);
+        heapIndices[std::distance(first, median)] = static_cast<uint32_t>(nodeIdx);
+
+        // The subtrees work on disjoint ranges of the photons. Small subtrees are not worth the scheduling overhead.
+        if(count > 10000)
+        {
+#ifndef NO_TBB
+            tbb::parallel_invoke(
+                [&](){ buildSubtree(begin, median, first, heapIndices, (2 * nodeIdx) + 1); },
+                [&](){ buildSubtree(median + 1, end, first, heapIndices, (2 * nodeIdx) + 2); });
+#else
+            auto& pool = ThreadPool::get();
+            ThreadPool::TaskGroup group;
+            pool.submit(group, [&](){ buildSubtree(median + 1, end, first, heapIndices, (2 * nodeIdx) + 2); });
+            buildSubtree(begin, median, first, heapIndices, (2 * nodeIdx) + 1);
+            pool.wait(group);
+#endif
+        }
+        else
+        {
+            buildSubtree(begin, median, first, heapIndices, (2 * nodeIdx) + 1);
+            buildSubtree(median + 1, end, first, heapIndices, (2 * nodeIdx) + 2);
+        }
+    }
+
+    using LaneMask = uint32_t;
+
+    // The targets of a batch query, one lane per target. Unused lanes have a negative search radius.
+    struct TargetLanes
+    {
+        alignas(32) float coords[3][PhotonMap::BatchSize];
+        alignas(32) float maxSqrDistances[PhotonMap::BatchSize];
+    };
+
+    // Lanes whose target is closer to position than its search radius, the squared distances are stored in sqrDistances.
+    LaneMask getLanesInRadius(const TargetLanes& lanes, const Point& position, float* sqrDistances)
+    {
+#ifdef ENABLE_SIMD
+        const __m256 dx = _mm256_sub_ps(_mm256_load_ps(lanes.coords[0]), _mm256_set1_ps(position.x()));
+        const __m256 dy = _mm256_sub_ps(_mm256_load_ps(lanes.coords[1]), _mm256_set1_ps(position.y()));
+        const __m256 dz = _mm256_sub_ps(_mm256_load_ps(lanes.coords[2]), _mm256_set1_ps(position.z()));
+        const __m256 sqrDistance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+        _mm256_storeu_ps(sqrDistances, sqrDistance);
+        return static_cast<LaneMask>(_mm256_movemask_ps(_mm256_cmp_ps(sqrDistance, _mm256_load_ps(lanes.maxSqrDistances), _CMP_LT_OQ)));
+#else
+        LaneMask mask = 0;
+        for(size_t lane = 0; lane < PhotonMap::BatchSize; lane++)
+        {
+            const float dx = lanes.coords[0][lane] - position.x();
+            const float dy = lanes.coords[1][lane] - position.y();
+            const float dz = lanes.coords[2][lane] - position.z();
+            sqrDistances[lane] = (dx * dx) + (dy * dy) + (dz * dz);
+            mask |= static_cast<LaneMask>(sqrDistances[lane] < lanes.maxSqrDistances[lane]) << lane;
+        }
+        return mask;
+#endif
+    }
+
+    // Lanes whose target lies below the split plane, and lanes whose search sphere crosses it.
+    void classifyLanes(const TargetLanes& lanes, int axis, float split, LaneMask& below, LaneMask& crossing)
+    {
+#ifdef ENABLE_SIMD
+        const __m256 planeDistance = _mm256_sub_ps(_mm256_load_ps(lanes.coords[axis]), _mm256_set1_ps(split));
+        const __m256 planeSqrDistance = _mm256_mul_ps(planeDistance, planeDistance);
+        below = static_cast<LaneMask>(_mm256_movemask_ps(_mm256_cmp_ps(planeDistance, _mm256_setzero_ps(), _CMP_LT_OQ)));
+        crossing = static_cast<LaneMask>(_mm256_movemask_ps(_mm256_cmp_ps(planeSqrDistance, _mm256_load_ps(lanes.maxSqrDistances), _CMP_LT_OQ)));
+#else
+        below = 0;
+        crossing = 0;
+        for(size_t lane = 0; lane < PhotonMap::BatchSize; lane++)
+        {
+            const float planeDistance = lanes.coords[axis][lane] - split;
+            below |= static_cast<LaneMask>(planeDistance < 0) << lane;
+            crossing |= static_cast<LaneMask>(planeDistance * planeDistance < lanes.maxSqrDistances[lane]) << lane;
+        }
+#endif
+    }
+}
+
+PhotonMap PhotonMap::build(PhotonList photons, const PhotonMapInfo& info)
+{
+    if(photons.size() > UINT32_MAX)
+    {
+        throw std::runtime_error("Too many photons for a photon map");
+    }
+
+    // The photons are partitioned in place, then moved to their heap index by following the cycles of the
+    // permutation. The heap indices take 4 bytes per photon, instead of a second array of photons.
+    std::vector<uint32_t> heapIndices(photons.size());
+    buildSubtree(photons.begin(), photons.end(), photons.begin(), heapIndices, 0);
+    for(uint32_t i = 0; i < heapIndices.size(); i++)
+    {
+        while(heapIndices[i] != i)
+        {
+            const uint32_t target = heapIndices[i];
+            std::swap(photons[i], photons[target]);
+            std::swap(heapIndices[i], heapIndices[target]);
+        }
+    }
+
+    const size_t photonCount = photons.size();
+    auto heap = std::make_shared<PhotonList>(std::move(photons));
+    const Photon* data = heap->data();
+    return PhotonMap(std::move(heap), data, photonCount, info);
+}
+
+void PhotonMap::save(const std::string& path) const
+{
+    FileHeader header {};
+    header.magic = Magic;
+    header.version = FormatVersion;
+    header.photonSize = sizeof(Photon);
+    header.photonCount = photonCount;
+    header.causticPhotonCount = std::count_if(photons, photons + photonCount, [](const Photon& photon){ return photon.isCaustic(); });
+    header.sceneHash = info.sceneHash;
+    header.mode = static_cast<uint32_t>(info.mode);
+    header.seed = info.seed;
+    header.photonsPerAreaLight = info.photonsPerAreaLight;
+    header.photonsPerPointLight = info.photonsPerPointLight;
+    header.radianceCacheStride = info.radianceCacheStride;
+    header.radianceEstimatePhotonCount = info.radianceEstimatePhotonCount;
+    header.checksum = Hash::bytes(photons, photonCount * sizeof(Photon));
+
+    try
+    {
+        writeFileAtomically(path, [&](std::ostream& out)
+        {
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(photons), photonCount * sizeof(Photon));
+        });
+    }
+    catch(const std::runtime_error& e)
+    {
+        throw std::runtime_error(std::string("Could not write photon map file: ") + e.what());
+    }
+}
+
+PhotonMap PhotonMap::load(const std::string& path)
+{
+    auto file = std::make_shared<MappedFile>(path);
+
+    FileHeader header;
+    if(file->getSize() < sizeof(header))
+    {
+        throw std::runtime_error(path + " is not a photon map file");
+    }
+    std::memcpy(&header, file->getData(), sizeof(header));
+    if(header.magic != Magic)
+    {
+        throw std::runtime_error(path + " is not a photon map file");
+    }
+    if(header.version != FormatVersion || header.photonSize != sizeof(Photon))
+    {
+        throw std::runtime_error(path + " has an unsupported photon map format version (" + std::to_string(header.version) + ")");
+    }
+    if(file->getSize() != sizeof(header) + header.photonCount * sizeof(Photon))
+    {
+        throw std::runtime_error("Photon map file " + path + " is truncated");
+    }
+    static_assert(sizeof(FileHeader) % alignof(Photon) == 0, "The photons must be aligned in the mapped file");
+    const char* data = file->getData() + sizeof(header);
+    if(Hash::bytes(data, header.photonCount * sizeof(Photon)) != header.checksum)
+    {
+        throw std::runtime_error("Photon map file " + path + " is corrupted");
+    }
+    const auto* photons = reinterpret_cast<const Photon*>(data);
+    const auto causticPhotonCount = std::count_if(photons, photons + header.photonCount, [](const Photon& photon){ return photon.isCaustic(); });
+    if(static_cast<uint64_t>(causticPhotonCount) != header.causticPhotonCount)
+    {
+        throw std::runtime_error("Photon map file " + path + " is corrupted");
+    }
+
+    PhotonMapInfo info;
+    info.sceneHash = header.sceneHash;
+    info.mode = static_cast<PhotonMapMode>(header.mode);
+    info.seed = header.seed;
+    info.photonsPerAreaLight = header.photonsPerAreaLight;
+    info.photonsPerPointLight = header.photonsPerPointLight;
+    info.radianceCacheStride = header.radianceCacheStride;
+    info.radianceEstimatePhotonCount = header.radianceEstimatePhotonCount;
+
+    return PhotonMap(std::move(file), photons, header.photonCount, info);
+}
+
+void PhotonMap::getNearestFacing(const Point* targets, const Vector3* directions, size_t targetCount, unsigned int count, float maxRadius,
+                                 Neighbour* results, unsigned int* foundCounts) const
+{
+    assert(targetCount <= BatchSize);
+    TargetLanes lanes;
+    for(size_t lane = 0; lane < BatchSize; lane++)
+    {
+        const bool isUsed = lane < targetCount;
+        for(int axis = 0; axis < 3; axis++)
+        {
+            lanes.coords[axis][lane] = isUsed ? targets[lane][axis] : 0.0f;
+        }
+        lanes.maxSqrDistances[lane] = isUsed ? maxRadius * maxRadius : -1.0f;
+        if(isUsed)
+        {
+            foundCounts[lane] = 0;
+        }
+    }
+    if(photonCount == 0 || count == 0 || targetCount == 0)
+    {
+        return;
+    }
+
+    // Same traversal as getNearest, with a mask of the lanes that still need to visit each node. The lanes are
+    // rechecked when a node is popped, as their search radius may have shrunk since it was pushed.
+    struct PendingBatchNode
+    {
+        size_t nodeIdx;
+        LaneMask lanes;
+    };
+    PendingBatchNode stack[MaxDepth];
+    size_t stackSize = 0;
+    stack[stackSize++] = {0, (LaneMask(1) << targetCount) - 1};
+    alignas(32) float sqrDistances[BatchSize];
+    while(stackSize > 0)
+    {
+        size_t nodeIdx = stack[stackSize - 1].nodeIdx;
+        LaneMask mask = stack[stackSize - 1].lanes;
+        stackSize--;
+        if(nodeIdx > 0)
+        {
+            const Photon& parent = photons[(nodeIdx - 1) / 2];
+            LaneMask below, crossing;
+            classifyLanes(lanes, static_cast<int>(parent.getSplitAxis()), parent.getPosition()[static_cast<int>(parent.getSplitAxis())], below, crossing);
+            const bool isLeftChild = (nodeIdx % 2) == 1;
+            mask &= (isLeftChild ? below : ~below) | crossing;
+        }
+
+        while(mask != 0)
+        {
+            const Photon& photon = photons[nodeIdx];
+            LaneMask candidates = mask & getLanesInRadius(lanes, photon.getPosition(), sqrDistances);
+            if(candidates != 0)
+            {
+                const Vector3 normal = photon.getSurfaceNormal();
+                for(; candidates != 0; candidates &= candidates - 1)
+                {
+                    const auto lane = static_cast<size_t>(BitOps::countTrailingZeros(candidates));
+                    if(directions[lane].dot(normal) >= 0)
+                    {
+                        lanes.maxSqrDistances[lane] = insertNeighbour(results + (lane * count), foundCounts[lane], count, {sqrDistances[lane], &photon}, lanes.maxSqrDistances[lane]);
+                    }
+                }
+            }
+
+            const size_t firstChild = (2 * nodeIdx) + 1;
+            if(firstChild >= photonCount)
+            {
+                break;
+            }
+            const int axis = static_cast<int>(photon.getSplitAxis());
+            LaneMask below, crossing;
+            classifyLanes(lanes, axis, photon.getPosition()[axis], below, crossing);
+            const LaneMask leftLanes = mask & (below | crossing);
+            const LaneMask rightLanes = firstChild + 1 < photonCount ? mask & (~below | crossing) : 0;
+
+            // Continue on the side that contains most targets
+            const bool isLeftNear = BitOps::popcount(mask & below) * 2 >= BitOps::popcount(mask);
+            const size_t nearChild = isLeftNear ? firstChild : firstChild + 1;
+            const size_t farChild = isLeftNear ? firstChild + 1 : firstChild;
+            const LaneMask nearLanes = isLeftNear ? leftLanes : rightLanes;
+            const LaneMask farLanes = isLeftNear ? rightLanes : leftLanes;
+            if(farLanes != 0)
+            {
+                stack[stackSize++] = {farChild, farLanes};
+            }
+            nodeIdx = nearChild;
+            mask = nearLanes;
+        }
+    }
+
+    for(size_t lane = 0; lane < targetCount; lane++)
+    {
+        Neighbour* laneResults = results + (lane * count);
+        std::sort_heap(laneResults, laneResults + foundCounts[lane], isNearer);
+    }
+}
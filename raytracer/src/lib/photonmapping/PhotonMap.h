@@ -1,12 +1,288 @@
 #pragma once
-#include "Photon.h"
-#include "KDTree.h"
 
-using PhotonMap = KDTree<Photon, &Photon::getPosition>;
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Photon.h"
 
 enum class PhotonMapMode
 {
     none,
     caustics,
     full
-};
\ No newline at end of file
+};
+
+// How a photon map was built, stored in the photon map file.
+struct PhotonMapInfo
+{
+    uint64_t sceneHash = 0; // See Scene::getContentHash
+    PhotonMapMode mode = PhotonMapMode::none;
+    uint32_t seed = 0;
+    uint64_t photonsPerAreaLight = 0;
+    uint64_t photonsPerPointLight = 0;
+    // Only set for radiance caches, see RadianceCache: every radianceCacheStride-th photon of the photon map holds the
+    // density estimate of radianceEstimatePhotonCount photons.
+    uint32_t radianceCacheStride = 0;
+    uint32_t radianceEstimatePhotonCount = 0;
+};
+
+/*
+ * Left-balanced KD-tree over photons, stored implicitly as a flat array in heap order (after Jensen): the children
+ * of node i are nodes 2i + 1 and 2i + 2, and each photon holds the split axis of its node. There are no child
+ * pointers, and because the tree is left-balanced the array has no holes.
+ *
+ * Because the tree holds no pointers, a saved photon map is memory-mapped and queried in place, see load(). Render
+ * processes that load the same file share one copy in the page cache.
+ */
+class PhotonMap
+{
+public:
+    PhotonMap() = default;
+
+    static constexpr uint32_t FormatVersion = 3;
+
+    // Builds the tree in the storage of the photons, which the map takes over.
+    static PhotonMap build(PhotonList photons, const PhotonMapInfo& info = {});
+
+    size_t getSize() const
+    {
+        return photonCount;
+    }
+
+    // The photons in heap order
+    const Photon* getPhotons() const
+    {
+        return photons;
+    }
+
+    const PhotonMapInfo& getInfo() const
+    {
+        return info;
+    }
+
+    // Writes the photon map file. The file is written under a temporary name first, so processes that load the file
+    // concurrently never see a partially written map. Throws std::runtime_error if the file can not be written.
+    void save(const std::string& path) const;
+
+    // Maps the photon map file into memory. Throws std::runtime_error if the file can not be read, is of another
+    // format version or is corrupted.
+    static PhotonMap load(const std::string& path);
+
+    // A photon found by a nearest neighbour query
+    struct Neighbour
+    {
+        float sqrDistance;
+        const Photon* photon;
+    };
+
+    // Finds the count photons that are nearest to target, closer than maxRadius and accepted by filter.
+    // results must have room for count neighbours, it receives the photons found sorted by distance.
+    // Returns the number of photons found.
+    template<typename Filter>
+    unsigned int getNearest(const Point& target, unsigned int count, float maxRadius, Filter filter, Neighbour* results) const
+    {
+        if(photonCount == 0 || count == 0)
+        {
+            return 0;
+        }
+
+        // While searching, the results are a max-heap on the distance: once count photons are found, the furthest one
+        // bounds the search radius, and is replaced when a nearer photon is found.
+        unsigned int foundCount = 0;
+        float maxSqrDistance = maxRadius * maxRadius;
+        PendingNode stack[MaxDepth];
+        size_t stackSize = 0;
+        stack[stackSize++] = {0, 0.0f};
+        while(stackSize > 0)
+        {
+            const PendingNode pending = stack[--stackSize];
+            if(pending.planeSqrDistance >= maxSqrDistance)
+            {
+                continue; // The search radius shrank since the node was pushed
+            }
+
+            // Descend along the side of the split planes that contains the target, the results found there shrink the
+            // search radius for the other sides, which are pushed.
+            size_t nodeIdx = pending.nodeIdx;
+            while(true)
+            {
+                const Photon& photon = photons[nodeIdx];
+                const float sqrDistance = (photon.getPosition() - target).squaredNorm();
+                if(sqrDistance < maxSqrDistance && filter(photon))
+                {
+                    maxSqrDistance = insertNeighbour(results, foundCount, count, {sqrDistance, &photon}, maxSqrDistance);
+                }
+
+                const size_t firstChild = (2 * nodeIdx) + 1;
+                if(firstChild >= photonCount)
+                {
+                    break;
+                }
+                const int axis = static_cast<int>(photon.getSplitAxis());
+                const float planeDistance = target[axis] - photon.getPosition()[axis];
+                const float planeSqrDistance = planeDistance * planeDistance;
+                const size_t nearChild = planeDistance < 0 ? firstChild : firstChild + 1;
+                const size_t farChild = planeDistance < 0 ? firstChild + 1 : firstChild;
+                if(farChild < photonCount && planeSqrDistance < maxSqrDistance)
+                {
+                    stack[stackSize++] = {farChild, planeSqrDistance};
+                }
+                if(nearChild >= photonCount)
+                {
+                    break;
+                }
+                nodeIdx = nearChild;
+            }
+        }
+
+        std::sort_heap(results, results + foundCount, isNearer);
+        return foundCount;
+    }
+
+    unsigned int getNearest(const Point& target, unsigned int count, Neighbour* results) const
+    {
+        auto filter = [](const Photon&){return true;};
+        return getNearest(target, count, std::numeric_limits<float>::max(), filter, results);
+    }
+
+    // Maximum number of targets of getNearestFacing
+    static constexpr size_t BatchSize = 8;
+
+    // getNearest for up to BatchSize targets at once, with a filter that accepts the photons whose surface normal lies
+    // on the side of the direction of the target. The batch is traversed as one, with the distances to all targets
+    // tested at once, so targets that lie close together share the node visits.
+    // results must have room for targetCount * count neighbours, those of target i start at i * count.
+    // foundCounts receives the number of photons found per target.
+    void getNearestFacing(const Point* targets, const Vector3* directions, size_t targetCount, unsigned int count, float maxRadius,
+                          Neighbour* results, unsigned int* foundCounts) const;
+
+    // Appends the photons closer than radius to target and accepted by filter to resultsList.
+    template<typename Filter>
+    void getElementsInRadiusFrom(const Point& target, float radius, Filter filter, std::vector<const Photon*>& resultsList) const
+    {
+        const float sqrRadius = radius * radius;
+        size_t stack[MaxDepth];
+        size_t stackSize = 0;
+        if(photonCount > 0)
+        {
+            stack[stackSize++] = 0;
+        }
+        while(stackSize > 0)
+        {
+            const size_t nodeIdx = stack[--stackSize];
+            const Photon& photon = photons[nodeIdx];
+            if((photon.getPosition() - target).squaredNorm() < sqrRadius && filter(photon))
+            {
+                resultsList.push_back(&photon);
+            }
+
+            const size_t firstChild = (2 * nodeIdx) + 1;
+            if(firstChild >= photonCount)
+            {
+                continue;
+            }
+            const int axis = static_cast<int>(photon.getSplitAxis());
+            const float planeDistance = target[axis] - photon.getPosition()[axis];
+            const size_t nearChild = planeDistance < 0 ? firstChild : firstChild + 1;
+            const size_t farChild = planeDistance < 0 ? firstChild + 1 : firstChild;
+            if(farChild < photonCount && planeDistance * planeDistance < sqrRadius)
+            {
+                stack[stackSize++] = farChild;
+            }
+            if(nearChild < photonCount)
+            {
+                stack[stackSize++] = nearChild;
+            }
+        }
+    }
+
+    void getElementsInRadiusFrom(const Point& target, float radius, std::vector<const Photon*>& resultsList) const
+    {
+        auto filter = [](const Photon&){return true;};
+        getElementsInRadiusFrom(target, radius, filter, resultsList);
+    }
+
+private:
+    // A left-balanced tree of 2^64 photons is 64 levels deep
+    static constexpr size_t MaxDepth = 64;
+
+    struct FileHeader
+    {
+        std::array<char, 8> magic;
+        uint32_t version;
+        uint32_t photonSize;
+        uint64_t photonCount;
+        uint64_t causticPhotonCount;
+        uint64_t sceneHash;
+        uint32_t mode;
+        uint32_t seed;
+        uint64_t photonsPerAreaLight;
+        uint64_t photonsPerPointLight;
+        uint32_t radianceCacheStride;
+        uint32_t radianceEstimatePhotonCount;
+        uint64_t checksum; // Hash of the photons
+    };
+
+    PhotonMap(std::shared_ptr<const void> storage, const Photon* photons, size_t photonCount, const PhotonMapInfo& info)
+        : storage(std::move(storage)), photons(photons), photonCount(photonCount), info(info)
+    { }
+
+    // The PhotonList or MappedFile that holds the photons, shared by copies of the map
+    std::shared_ptr<const void> storage;
+    const Photon* photons = nullptr;
+    size_t photonCount = 0;
+    PhotonMapInfo info;
+
+    // Node to visit, with the squared distance from the target to the split plane that separates it from the target
+    struct PendingNode
+    {
+        size_t nodeIdx;
+        float planeSqrDistance;
+    };
+
+    static bool isNearer(const Neighbour& a, const Neighbour& b)
+    {
+        return a.sqrDistance < b.sqrDistance;
+    }
+
+    // Adds the neighbour to the max-heap of size foundCount in results, if the heap is full it replaces the furthest
+    // neighbour. Returns the new search radius.
+    static float insertNeighbour(Neighbour* results, unsigned int& foundCount, unsigned int count, const Neighbour& neighbour, float maxSqrDistance)
+    {
+        if(foundCount < count)
+        {
+            results[foundCount++] = neighbour;
+            std::push_heap(results, results + foundCount, isNearer);
+        }
+        else
+        {
+            // Sift the new neighbour down from the top
+            unsigned int idx = 0;
+            while(true)
+            {
+                unsigned int child = (2 * idx) + 1;
+                if(child >= foundCount)
+                {
+                    break;
+                }
+                if(child + 1 < foundCount && isNearer(results[child], results[child + 1]))
+                {
+                    child++;
+                }
+                if(!isNearer(neighbour, results[child]))
+                {
+                    break;
+                }
+                results[idx] = results[child];
+                idx = child;
+            }
+            results[idx] = neighbour;
+        }
+        return foundCount == count ? results[0].sqrDistance : maxSqrDistance;
+    }
+};
@@ -4,14 +4,12 @@
 #include "math/Sampler.h"
 #include "math/Ray.h"
 #include "Photon.h"
-#include "KDTree.h"
-#include "KDTreeBuilder.h"
 #include <vector>
 #include "PhotonTracer.h"
 
 using size_type = std::vector<Photon>::size_type;
 
-PhotonMap PhotonMapBuilder::buildPhotonMap(const Scene& scene, PhotonMapMode mode, size_t photonsPerAreaLight, size_t photonsPerPointLight, ProgressMonitor progressMon)
+PhotonMap PhotonMapBuilder::buildPhotonMap(const Scene& scene, PhotonMapMode mode, size_t photonsPerAreaLight, size_t photonsPerPointLight, ProgressMonitor progressMon, uint32_t seed)
 {
     ProgressTracker progress(progressMon);
     PhotonList photons{};
@@ -23,6 +21,7 @@ PhotonMap PhotonMapBuilder::buildPhotonMap(const Scene& scene, PhotonMapMode mod
         tracer.photonsPerAreaLight = photonsPerAreaLight;
         tracer.photonsPerPointLight = photonsPerPointLight;
         tracer.mode = mode;
+        tracer.seed = seed;
         tracer.tracePhotons(scene, photons, progressMon);
     }
 
@@ -30,12 +29,14 @@ PhotonMap PhotonMapBuilder::buildPhotonMap(const Scene& scene, PhotonMapMode mod
     std::stringstream msg;
     msg << "Building photon KD-tree (" << photons.size() << " photons)";
     progress.startNewJob(msg.str(), 1);
-    auto tree = KDTreeBuilder::build(photons);
+    PhotonMapInfo info;
+    info.sceneHash = scene.getContentHash();
+    info.mode = mode;
+    info.seed = seed;
+    info.photonsPerAreaLight = photonsPerAreaLight;
+    info.photonsPerPointLight = photonsPerPointLight;
+    auto tree = PhotonMap::build(std::move(photons), info);
     progress.signalTaskFinished();
 
-    /*progress.startNewJob("Packing photon KD-tree", 1);
-    tree.pack();
-    progress.signalTaskFinished();*/
-
     return tree;
 }
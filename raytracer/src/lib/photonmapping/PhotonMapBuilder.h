@@ -6,5 +6,5 @@
 
 class PhotonMapBuilder {
 public:
-    static PhotonMap buildPhotonMap(const Scene& scene, PhotonMapMode mode, size_t photonsPerAreaLight, size_t photonsPerPointLight, ProgressMonitor progressMon);
+    static PhotonMap buildPhotonMap(const Scene& scene, PhotonMapMode mode, size_t photonsPerAreaLight, size_t photonsPerPointLight, ProgressMonitor progressMon, uint32_t seed = 0);
 };
@@ -0,0 +1,114 @@
+#include "PhotonQueryQueue.h"
+
+#include <algorithm>
+#include "math/Constants.h"
+#include "scene/renderable/Scene.h"
+
+namespace
+{
+    RGB getRadianceEstimate(const PhotonMap::Neighbour* neighbours, unsigned int foundCount)
+    {
+        if(foundCount < PhotonQueryQueue::PhotonCount)
+        {
+            return RGB();
+        }
+
+        RGB value {};
+        for(unsigned int i = 0; i < foundCount; i++)
+        {
+            value += neighbours[i].photon->getEnergy();
+        }
+        const float sqrRadius = neighbours[foundCount - 1].sqrDistance;
+        return value.divide(PI * sqrRadius).divide(PI);
+    }
+
+    // Interleaves the lower 10 bits of value with zeros, two zero bits after each bit.
+    uint32_t spreadBits(uint32_t value)
+    {
+        value &= 0x3FFu;
+        value = (value | (value << 16)) & 0x030000FFu;
+        value = (value | (value << 8)) & 0x0300F00Fu;
+        value = (value | (value << 4)) & 0x030C30C3u;
+        value = (value | (value << 2)) & 0x09249249u;
+        return value;
+    }
+}
+
+RGB PhotonQueryQueue::estimate(const PhotonMap& map, const Point& target, const Vector3& direction)
+{
+    PhotonMap::Neighbour neighbours[PhotonCount];
+    const unsigned int foundCount = map.getNearest(target, PhotonCount, 1E9, [&direction](const Photon& photon){
+        return direction.dot(photon.getSurfaceNormal()) >= 0;
+    }, neighbours);
+    return getRadianceEstimate(neighbours, foundCount);
+}
+
+void PhotonQueryQueue::push(const Point& target, const Vector3& direction, float scale, RGB& radiance)
+{
+    targets.push_back(target);
+    directions.push_back(direction);
+    scales.push_back(scale);
+    radiances.push_back(&radiance);
+}
+
+void PhotonQueryQueue::resolve(const Scene& scene)
+{
+    if(!targets.empty())
+    {
+        resolve(*scene.getPhotonMap());
+    }
+}
+
+void PhotonQueryQueue::resolve(const PhotonMap& map)
+{
+    if(targets.empty())
+    {
+        return;
+    }
+
+    // Sort the queries along a Morton curve through their bounding box, so that each batch holds nearby targets,
+    // which visit the same nodes of the tree.
+    Point min = targets[0];
+    Point max = targets[0];
+    for(const Point& target : targets)
+    {
+        min = min.cwiseMin(target);
+        max = max.cwiseMax(target);
+    }
+    const Vector3 extent = max - min;
+    const float scale = 1023.0f / std::max(extent.maxCoeff(), 1e-20f);
+    order.clear();
+    for(size_t i = 0; i < targets.size(); i++)
+    {
+        const Vector3 cell = (targets[i] - min) * scale;
+        const uint32_t key = spreadBits(static_cast<uint32_t>(cell.x())) | (spreadBits(static_cast<uint32_t>(cell.y())) << 1) | (spreadBits(static_cast<uint32_t>(cell.z())) << 2);
+        order.emplace_back(key, static_cast<uint32_t>(i));
+    }
+    std::sort(order.begin(), order.end());
+
+    neighbours.resize(PhotonMap::BatchSize * PhotonCount);
+    for(size_t start = 0; start < order.size(); start += PhotonMap::BatchSize)
+    {
+        const size_t batchSize = std::min(PhotonMap::BatchSize, order.size() - start);
+        Point batchTargets[PhotonMap::BatchSize];
+        Vector3 batchDirections[PhotonMap::BatchSize];
+        for(size_t i = 0; i < batchSize; i++)
+        {
+            batchTargets[i] = targets[order[start + i].second];
+            batchDirections[i] = directions[order[start + i].second];
+        }
+
+        unsigned int foundCounts[PhotonMap::BatchSize];
+        map.getNearestFacing(batchTargets, batchDirections, batchSize, PhotonCount, 1E9, neighbours.data(), foundCounts);
+        for(size_t i = 0; i < batchSize; i++)
+        {
+            const uint32_t queryIdx = order[start + i].second;
+            *radiances[queryIdx] = getRadianceEstimate(neighbours.data() + (i * PhotonCount), foundCounts[i]).scale(scales[queryIdx]);
+        }
+    }
+
+    targets.clear();
+    directions.clear();
+    scales.clear();
+    radiances.clear();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include "PhotonMap.h"
+#include "film/RGB.h"
+
+class Scene;
+
+/*
+ * Photon map radiance estimates whose result is only needed later, the photon map counterpart of ShadowRayQueue.
+ * Queries are collected while shading, sorted so that nearby queries end up next to each other, and resolved in
+ * batches of PhotonMap::BatchSize with PhotonMap::getNearestFacing.
+ * Each query refers to the radiance that receives its estimate, which must stay at the same address until the queue
+ * is resolved.
+ */
+class PhotonQueryQueue
+{
+public:
+    // Number of photons in an estimate
+    static constexpr unsigned int PhotonCount = 20;
+
+    // Density estimate of the PhotonCount photons nearest to target, whose surface normal lies on the side of
+    // direction. Black if fewer photons are found.
+    static RGB estimate(const PhotonMap& map, const Point& target, const Vector3& direction);
+
+    // Queues estimate(map, target, direction) scaled by scale, to be written to radiance.
+    void push(const Point& target, const Vector3& direction, float scale, RGB& radiance);
+
+    // Estimates all queued queries with the photon map and empties the queue.
+    void resolve(const PhotonMap& map);
+
+    // Same as above, with the photon map of the scene
+    void resolve(const Scene& scene);
+
+    size_t size() const
+    {
+        return targets.size();
+    }
+
+    bool empty() const
+    {
+        return targets.empty();
+    }
+
+private:
+    std::vector<Point> targets;
+    std::vector<Vector3> directions;
+    std::vector<float> scales;
+    std::vector<RGB*> radiances;
+
+    // Reused by resolve, so that resolving does not allocate
+    std::vector<std::pair<uint32_t, uint32_t>> order; // Spatial key, query index
+    std::vector<PhotonMap::Neighbour> neighbours;
+};
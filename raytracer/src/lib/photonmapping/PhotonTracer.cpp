@@ -4,6 +4,7 @@
 #include "math/FastRandom.h"
 #include "utility/Task.h"
 #include "utility/Batcher.h"
+#include <deque>
 
 class PhotonDriver
 {
@@ -25,17 +26,17 @@ public:
             auto hitpoint = hit->getHitpoint();
 
             // Calculate bounce/transmission/..
-            auto [newPhotonRayDir, newPhotonEnergy, diffuseness] = hit->getModelNode().getData().getMaterial().interactPhoton(*hit, photonEnergy);
+            auto [newPhotonRayDir, newPhotonEnergy, diffuseness] = hit->getModelNode().getData().getCompiledMaterial().interactPhoton(*hit, photonEnergy);
             newPhotonRayDir.normalize();
 
-            bool isDiffuseTransport = diffuseness >= 0.2;
+            bool isDiffuseTransport = diffuseness >= PhotonTracer::DiffuseThreshold;
             bool isCaustic = isDiffuseTransport && hasPassedSpecular /*&& !hasPassedDiffuse*/;
 
             // Store photon
             if((mode == PhotonMapMode::caustics && isCaustic) ||
                (mode == PhotonMapMode::full && isDiffuseTransport))
             {
-                resultAcc.emplace_back(hitpoint, photonRay.getDirection(), hit->normal, photonEnergy, isCaustic);
+                resultAcc.emplace_back(hitpoint, hit->normal, photonEnergy, isCaustic);
             }
 
             // Update transport variables
@@ -59,81 +60,69 @@ public:
 };
 
 
+// Traces photons startIdx to endIdx of totalPhotonCount photons. Every photon is emitted by a light picked in proportion
+// to its power, so bright lights emit more photons, all carrying about the same energy.
 template<typename Driver>
-class PointLightPhotonTracingTask : public Task
+class LightPhotonTracingTask : public Task
 {
 public:
     using ParticleList = typename Driver::ParticleList;
     using size_type = typename ParticleList::size_type;
 
     std::reference_wrapper<const Scene> scene;
-    std::reference_wrapper<const PointLight> light;
     std::reference_wrapper<ParticleList> photons;
-    ProgressTracker& progress;
     PhotonMapMode mode;
+    ProgressTracker& progress;
     size_type startIdx;
     size_type endIdx;
     size_type totalPhotonCount;
+    uint32_t seed;
 
-    PointLightPhotonTracingTask(const Scene& scene, const PointLight& light, ParticleList& photons,
-                                PhotonMapMode mode, size_type startIdx, size_type endIdx, size_type totalPhotonCount, ProgressTracker& progress)
-            : scene(std::ref(scene)), light(std::ref(light)), photons(photons), mode(mode), startIdx(startIdx),
-              endIdx(endIdx), totalPhotonCount(totalPhotonCount), progress(progress)
+    LightPhotonTracingTask(const Scene& scene, ParticleList& photons, PhotonMapMode mode, size_type startIdx, size_type endIdx,
+                           size_type totalPhotonCount, uint32_t seed, ProgressTracker& progress)
+            : scene(std::ref(scene)), photons(photons), mode(mode), progress(progress), startIdx(startIdx), endIdx(endIdx),
+              totalPhotonCount(totalPhotonCount), seed(seed)
     { }
 
     void execute() override
     {
-        // Trace photons from light source into scene
-        RGB energyPerPhoton = light.get().color * (light.get().intensity / (double)totalPhotonCount);
+        const auto& lightTree = scene.get().getLightTree();
 
         for (size_type photonI = startIdx; photonI < endIdx; ++photonI) {
-            auto photonDir = sampleUniformSphere(1.0);
-
-            Ray photonRay(light.get().pos, photonDir);
-            Driver::trace(scene, photonRay, energyPerPhoton, mode, photons);
-        }
-        progress.signalTaskFinished();
-    }
-};
-
-template<typename Driver>
-class AreaLightPhotonTracingTask : public Task
-{
-public:
-    using ParticleList = typename Driver::ParticleList;
-    using size_type = typename ParticleList::size_type;
+            // The photons are the points of a Sobol sequence, which stratifies the light choice and emission.
+            SampleSequence sequence(seed, static_cast<uint32_t>(photonI), 0, SamplerType::sobol);
+            ScopedSampleSequence sequenceScope(&sequence);
 
-    std::reference_wrapper<const Scene> scene;
-    std::reference_wrapper<const AreaLight> lightRef;
-    std::reference_wrapper<ParticleList> photons;
-    PhotonMapMode mode;
-    ProgressTracker& progress;
-    size_type startIdx;
-    size_type endIdx;
-    size_type totalPhotonCount;
+            auto sampledLight = lightTree.sampleByPower(Rand::unit());
+            if(!sampledLight.has_value())
+            {
+                break;
+            }
+            const float energyScale = 1.0f / (sampledLight->probability * static_cast<float>(totalPhotonCount));
 
-    AreaLightPhotonTracingTask(const Scene& scene, const AreaLight& light, ParticleList& photons,
-                               PhotonMapMode mode, size_type startIdx, size_type endIdx, size_type totalPhotonCount, ProgressTracker& progress)
-            : scene(std::ref(scene)), lightRef(std::ref(light)), photons(photons), mode(mode), startIdx(startIdx),
-              endIdx(endIdx), totalPhotonCount(totalPhotonCount), progress(progress)
-    { }
+            if(sampledLight->light.type == LightTree::LightType::point)
+            {
+                const auto& light = *scene.get().getPointLights()[sampledLight->light.index];
+                RGB photonEnergy = light.color * (light.intensity * energyScale);
+                auto photonDir = sampleUniformSphere(1.0);
 
-    void execute() override
-    {
-        // Trace photons from light source into scene
-        const auto& light = lightRef.get();
-        auto lightEnergy = light.color * light.intensity;
-        RGB energyPerPhoton = lightEnergy.divide((float)totalPhotonCount);
-        OrthonormalBasis basis((light.b - light.a).cross(light.c - light.a));
+                Ray photonRay(light.pos, photonDir);
+                Driver::trace(scene, photonRay, photonEnergy, mode, photons);
+            }
+            else
+            {
+                const auto& light = *scene.get().getAreaLights()[sampledLight->light.index];
+                RGB photonEnergy = light.color * (light.intensity * energyScale);
+                OrthonormalBasis basis((light.b - light.a).cross(light.c - light.a));
 
-        for (size_type photonI = startIdx; photonI < endIdx; ++photonI) {
-            auto photonPos = light.generateStratifiedJitteredRandomPoint(endIdx-startIdx, photonI-startIdx);
-            auto localDir = mapSampleToCosineWeightedHemisphere(Rand::unit(), Rand::unit(), 1.0);
-            Vector3 photonDir = (basis.getU() * localDir.x()) + (basis.getV() * localDir.y()) + (basis.getW() * localDir.z());
-            photonDir.normalize();
+                auto photonPos = light.generateRandomPoint();
+                auto localDir = mapSampleToCosineWeightedHemisphere(Rand::unit(), Rand::unit(), 1.0);
+                Vector3 photonDir = (basis.getU() * localDir.x()) + (basis.getV() * localDir.y()) + (basis.getW() * localDir.z());
+                photonDir.normalize();
 
-            Ray photonRay(photonPos + photonDir*0.0001f, photonDir);
-            Driver::trace(scene, photonRay, energyPerPhoton, mode, photons);
+                Ray photonRay(photonPos + photonDir*0.0001f, photonDir);
+                Driver::trace(scene, photonRay, photonEnergy, mode, photons);
+            }
         }
 
         progress.signalTaskFinished();
@@ -145,28 +134,29 @@ void PhotonTracer::tracePhotons(const Scene &scene, PhotonList& photons, Progres
     ProgressTracker progress(progressMon);
 
     std::vector<std::unique_ptr<Task>> tasks{};
-    size_type taskCount = 0;
 
-    taskCount = 0;
+    // Every batch stores its photons in its own list. The lists are appended in batch order afterwards, so the order
+    // of the photons does not depend on the order in which the batches finish.
+    std::deque<PhotonList> batchPhotons;
+
+    // The photon budget is set per light, but the photons are distributed over the lights by power
+    size_type photonCount = (photonsPerPointLight * scene.getPointLights().size()) + (photonsPerAreaLight * scene.getAreaLights().size());
+    size_type taskCount = createBatches(tasks, photonCount, batchSize,
+        [&batchPhotons](size_type startIdx, size_type endIdx, const Scene& scene, PhotonMapMode mode, size_type totalPhotonCount, uint32_t seed, ProgressTracker& progress){
+            return std::make_unique<LightPhotonTracingTask<PhotonDriver>>(scene, batchPhotons.emplace_back(), mode, startIdx, endIdx, totalPhotonCount, seed, progress);
+        }, scene, mode, photonCount, seed, progress);
+
+    progress.startNewJob("Tracing photons", taskCount);
+    Task::runTasks(tasks);
 
-    // Emit photons from all point light sources
-    for(const auto& light : scene.getPointLights())
+    size_type storedPhotonCount = photons.size();
+    for(const auto& batch : batchPhotons)
     {
-        taskCount += createBatches(tasks, photonsPerPointLight, batchSize,
-            [](size_type startIdx, size_type endIdx, const Scene& scene, const PointLight& light, PhotonList& photons, PhotonMapMode mode, size_type totalPhotonCount, ProgressTracker& progress){
-                return std::make_unique<PointLightPhotonTracingTask<PhotonDriver>>(scene, light, photons, mode, startIdx, endIdx, totalPhotonCount, progress);
-            }, scene, *light, photons, mode, photonsPerPointLight, progress);
+        storedPhotonCount += batch.size();
     }
-
-    // Emit photons from all area light sources
-    for(const auto& light : scene.getAreaLights())
+    photons.reserve(storedPhotonCount);
+    for(const auto& batch : batchPhotons)
     {
-        taskCount += createBatches(tasks, photonsPerPointLight, batchSize,
-           [](size_type startIdx, size_type endIdx, const Scene& scene, const AreaLight& light, PhotonList& photons, PhotonMapMode mode, size_type totalPhotonCount, ProgressTracker& progress){
-               return std::make_unique<AreaLightPhotonTracingTask<PhotonDriver>>(scene, light, photons, mode, startIdx, endIdx, totalPhotonCount, progress);
-           },scene, *light, photons, mode, photonsPerAreaLight, progress);
+        photons.insert(photons.end(), batch.begin(), batch.end());
     }
-
-    progress.startNewJob("Tracing photons", taskCount);
-    Task::runTasks(tasks);
 }
@@ -1,7 +1,7 @@
 #pragma once
 
-#include "KDTree.h"
 #include "Photon.h"
+#include "PhotonMap.h"
 #include "scene/renderable/Scene.h"
 #include "utility/ProgressMonitor.h"
 
@@ -10,10 +10,17 @@ class PhotonTracer
 public:
     using size_type = std::vector<Photon>::size_type;
 
+    // Photon interactions with at least this diffuseness (see IMaterial::interactPhoton) are diffuse, photons are
+    // stored there.
+    static constexpr float DiffuseThreshold = 0.2f;
+
+    // Photons to emit per light. The total is distributed over all lights in proportion to their power.
     size_type photonsPerPointLight = 1E6;
     size_type photonsPerAreaLight = 1E6;
     size_type batchSize = 1000;
     PhotonMapMode mode;
+    // The photons only depend on this seed, not on the number of threads.
+    uint32_t seed = 0;
 
     void tracePhotons(const Scene& scene, PhotonList& photons, ProgressMonitor progress);
 };
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include "RadianceCache.h"
+#include "PhotonQueryQueue.h"
+
+#include <sstream>
+#ifndef NO_TBB
+#include <tbb/parallel_for.h>
+#else
+#include "utility/ThreadPool.h"
+#endif
+
+PhotonMap RadianceCache::build(const PhotonMap& photonMap, uint32_t stride, ProgressMonitor progressMon)
+{
+    ProgressTracker progress(progressMon);
+    const size_t cacheSize = (photonMap.getSize() + stride - 1) / stride;
+    constexpr size_t ChunkSize = 16384;
+    const size_t chunkCount = (cacheSize + ChunkSize - 1) / ChunkSize;
+
+    std::stringstream msg;
+    msg << "Precomputing photon radiance (" << cacheSize << " photons)";
+    progress.startNewJob(msg.str(), static_cast<int>(chunkCount + 1));
+
+    // The estimates of a chunk are queued, so they are resolved in batches of nearby photons.
+    PhotonList radiancePhotons(cacheSize);
+    auto estimateChunk = [&](size_t chunkI)
+    {
+        const size_t begin = chunkI * ChunkSize;
+        const size_t end = std::min(begin + ChunkSize, cacheSize);
+        PhotonQueryQueue queue;
+        std::vector<RGB> radiance(end - begin);
+        std::vector<Vector3> normals(end - begin);
+        for(size_t i = begin; i < end; i++)
+        {
+            const Photon& photon = photonMap.getPhotons()[i * stride];
+            normals[i - begin] = photon.getSurfaceNormal();
+            queue.push(photon.getPosition(), normals[i - begin], 1.0f, radiance[i - begin]);
+        }
+        queue.resolve(photonMap);
+
+        for(size_t i = begin; i < end; i++)
+        {
+            const Photon& photon = photonMap.getPhotons()[i * stride];
+            radiancePhotons[i] = Photon(photon.getPosition(), normals[i - begin], radiance[i - begin], photon.isCaustic());
+        }
+        progress.signalTaskFinished();
+    };
+
+#ifndef NO_TBB
+    tbb::parallel_for(size_t(0), chunkCount, estimateChunk);
+#else
+    auto& pool = ThreadPool::get();
+    ThreadPool::TaskGroup group;
+    for(size_t chunkI = 0; chunkI < chunkCount; chunkI++)
+    {
+        pool.submit(group, [&estimateChunk, chunkI](){ estimateChunk(chunkI); });
+    }
+    pool.wait(group);
+#endif
+
+    PhotonMapInfo info = photonMap.getInfo();
+    info.radianceCacheStride = stride;
+    info.radianceEstimatePhotonCount = PhotonQueryQueue::PhotonCount;
+    auto cache = PhotonMap::build(std::move(radiancePhotons), info);
+    progress.signalTaskFinished();
+    return cache;
+}
+
+bool RadianceCache::isBuiltFrom(const PhotonMap& cache, const PhotonMap& photonMap, uint32_t stride)
+{
+    const PhotonMapInfo& cacheInfo = cache.getInfo();
+    const PhotonMapInfo& mapInfo = photonMap.getInfo();
+    return cacheInfo.radianceCacheStride == stride
+        && cacheInfo.radianceEstimatePhotonCount == PhotonQueryQueue::PhotonCount
+        && cacheInfo.sceneHash == mapInfo.sceneHash
+        && cacheInfo.mode == mapInfo.mode
+        && cacheInfo.seed == mapInfo.seed
+        && cacheInfo.photonsPerAreaLight == mapInfo.photonsPerAreaLight
+        && cacheInfo.photonsPerPointLight == mapInfo.photonsPerPointLight
+        && cache.getSize() == (photonMap.getSize() + stride - 1) / stride;
+}
+
+RGB RadianceCache::lookup(const PhotonMap& cache, const Point& target, const Vector3& direction)
+{
+    PhotonMap::Neighbour nearest;
+    const unsigned int foundCount = cache.getNearest(target, 1, 1E9, [&direction](const Photon& photon){
+        return direction.dot(photon.getSurfaceNormal()) >= 0;
+    }, &nearest);
+    return foundCount == 0 ? RGB() : nearest.photon->getEnergy();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "PhotonMap.h"
+#include "film/RGB.h"
+#include "utility/ProgressMonitor.h"
+
+/*
+ * Precomputed radiance photons (after Christensen, "Faster photon map global illumination"): the photon density
+ * estimate is computed ahead of rendering at a subset of the photons and stored in a photon map of its own, in which
+ * the energy of each photon is the estimated radiance at its position. Looking up the radiance then takes a single
+ * nearest photon query instead of a query for the nearest PhotonQueryQueue::PhotonCount photons and their sum.
+ *
+ * The cache is a regular photon map, so it is saved and loaded like one. Its info is that of the photon map it was
+ * built from, plus the stride.
+ */
+class RadianceCache
+{
+public:
+    RadianceCache() = delete;
+
+    // Estimates the radiance at every stride-th photon of photonMap, stride must not be 0.
+    static PhotonMap build(const PhotonMap& photonMap, uint32_t stride, ProgressMonitor progressMon);
+
+    // Returns true if cache was built from photonMap with the given stride.
+    static bool isBuiltFrom(const PhotonMap& cache, const PhotonMap& photonMap, uint32_t stride);
+
+    // Radiance of the nearest radiance photon whose surface normal lies on the side of direction, black if there is none.
+    static RGB lookup(const PhotonMap& cache, const Point& target, const Vector3& direction);
+};
@@ -1,119 +1,204 @@
-#include <math/Constants.h>
 #include "PPMRenderer.h"
+#include "PathSampler.h"
+#include "camera/ICamera.h"
+#include "math/Constants.h"
+#include "math/FastRandom.h"
+#include "photonmapping/PhotonMap.h"
+#include "photonmapping/PhotonQueryQueue.h"
 #include "photonmapping/PhotonTracer.h"
-#include "photonmapping/KDTreeBuilder.h"
+#include "utility/Hash.h"
+#include "utility/Task.h"
 
-struct HitpointInfo
+namespace
 {
-    SceneRayHitInfo rayhit;
-    RGB weight;
-    float radius = -1;
-    int photonCount;
-    RGB reflectedFlux;
+    // Maximum number of specular bounces from the camera to a visible point
+    constexpr int MaxSpecularDepth = 12;
 
-    HitpointInfo(SceneRayHitInfo rayHitInfo)
-        : rayhit(std::move(rayHitInfo))
-    {}
-};
+    // Statistics of a pixel, kept across passes
+    struct PixelStatistics
+    {
+        // Visible point of the current pass
+        bool hasVisiblePoint = false;
+        Point position;
+        Vector3 direction; // Towards the camera
+        RGB weight; // Throughput from the camera to the visible point, including the albedo there
+
+        float radius = -1; // Gather radius, set by the first pass that finds photons near the visible point
+        float photonCount = 0;
+        RGB flux {}; // Photon flux within the radius, weighted by the throughput of the visible points
+        RGB directRadiance {}; // Sum of the radiance of the camera paths that reach a light or leave the scene
+    };
+
+    // Runs func(x, y) for every pixel of the tile
+    template<typename Func>
+    class PixelTask : public Task
+    {
+    public:
+        PixelTask(const Tile& tile, const Func& func) : tile(tile), func(func)
+        {}
 
-void PPMRenderer::render(const Scene& scene, FrameBuffer& buffer, std::shared_ptr<FrameBuffer>& perfBuffer, const Tile& tile, const RenderSettings& renderSettings, ProgressMonitor progressMon, bool multithreaded)
-{
-    /*std::vector<std::optional<HitpointInfo>> hits;
-    hits.reserve(tile.getWidth() * tile.getHeight());
+        void execute() override
+        {
+            for(int y = tile.getYStart(); y < tile.getYEnd(); ++y)
+            {
+                for(int x = tile.getXStart(); x < tile.getXEnd(); ++x)
+                {
+                    func(x, y);
+                }
+            }
+        }
 
-    const ICamera& camera = findCamera(scene);
+    private:
+        const Tile& tile;
+        const Func& func;
+    };
 
-    for (int y = tile.getYStart(); y < tile.getYEnd(); ++y)
+    template<typename Func>
+    void forEachPixel(const std::vector<Tile>& tiles, const Func& func)
     {
-        for (int x = tile.getXStart(); x < tile.getXEnd(); ++x)
+        std::vector<std::unique_ptr<Task>> tasks;
+        for(const auto& tile : tiles)
         {
-            auto sample = Vector2(x + 0.5, y+0.5);
-            auto ray = camera.generateRay(sample, buffer.getHorizontalResolution(), buffer.getVerticalResolution());
-            auto hit = scene.traceRay(ray);
-            if(hit.has_value())
-            {
-                hits[(y*tile.getWidth()) + x] = HitpointInfo(*hit);
-            }
+            tasks.push_back(std::make_unique<PixelTask<Func>>(tile, func));
         }
+        Task::runTasks(tasks);
     }
+}
 
-    tbb::concurrent_vector<Photon> photons;
-    ProgressTracker progress(progressMon);
+void PPMRenderer::render(const Scene& scene, FrameBuffer& buffer, std::shared_ptr<FrameBuffer>& perfBuffer, const Tile& tile, const RenderSettings& renderSettings, ProgressMonitor progressMon, bool multithreaded)
+{
+    std::vector<Tile> tiles;
+    if(multithreaded)
+    {
+        tiles = subdivideTilePerCores(tile);
+    }
+    else
+    {
+        tiles.push_back(tile);
+    }
 
-    PhotonTracer photonTracer;
-    photonTracer.batchSize = 1000;
-    photonTracer.photonsPerAreaLight = 1E2;
-    photonTracer.photonsPerPointLight = 1E2;
-    int iterations = 500;
+    ProgressTracker progress(progressMon);
+    progress.startNewJob("Progressive photon mapping", passCount);
 
-    auto tiles = subdivideTilePerCores(tile);
+    const ICamera& camera = findCamera(scene);
+    std::vector<PixelStatistics> pixels(static_cast<size_t>(tile.getWidth()) * tile.getHeight());
+    auto getPixel = [&pixels, &tile](int x, int y) -> PixelStatistics&
+    {
+        return pixels[(static_cast<size_t>(y - tile.getYStart()) * tile.getWidth()) + (x - tile.getXStart())];
+    };
 
-    for(int i = 0; i < iterations; i++)
+    for(int pass = 0; pass < passCount; pass++)
     {
-        photons.clear();
-        tbb::task_list taskList;
-        PhotonTracer::size_type taskCount;
-        photonTracer.createPhotonTracingTasks(scene, taskList, taskCount, photons, progress);
-        tbb::task::spawn_root_and_wait(taskList);
+        // Camera pass: follow the camera ray through specular surfaces, up to the first diffuse one
+        forEachPixel(tiles, [&](int x, int y)
+        {
+            PixelStatistics& pixel = getPixel(x, y);
+            pixel.hasVisiblePoint = false;
 
-        auto tree = KDTreeBuilder::build(photons);
+            const uint32_t pixelSeed = SampleSequence::pixelSeed(renderSettings.seed, x, y);
+            Ray ray = generateCameraRay(camera, buffer, renderSettings, x, y, pass);
+            SampleSequence sequence = getPathSequence(pixelSeed, pass, 1, 0, renderSettings.sampler);
+            ScopedSampleSequence sequenceScope(&sequence);
 
-        tbb::parallel_for_each(tiles.begin(), tiles.end(), [&masterTile = tile, &scene, &buffer, &renderSettings, &progress, &camera, &hits, &tree](const Tile& tile)
-        {
-            std::vector<const Photon*> neighbourPhotons;
-            for (int y = tile.getYStart(); y < tile.getYEnd(); ++y)
+            RGB weight(1.0f);
+            for(int depth = 0; depth < MaxSpecularDepth; depth++)
             {
-                for (int x = tile.getXStart(); x < tile.getXEnd(); ++x)
+                auto hit = scene.traceRay(ray);
+                auto directRadiance = getDirectCameraRayRadiance(scene, ray, hit);
+                if(directRadiance.has_value())
                 {
-                    auto& hitinfo = hits[(y*masterTile.getWidth()) + x];
-                    if(!hitinfo.has_value())
-                    {
-                        continue;
-                    }
+                    pixel.directRadiance += weight.multiply(*directRadiance);
+                    break;
+                }
 
-                    auto hitpoint = hitinfo->rayhit.getHitpoint();
+                auto [direction, newWeight, diffuseness] = hit->getModelNode().getData().getCompiledMaterial().interactPhoton(*hit, weight);
+                if(diffuseness >= PhotonTracer::DiffuseThreshold)
+                {
+                    pixel.hasVisiblePoint = true;
+                    pixel.position = hit->getHitpoint();
+                    pixel.direction = -ray.getDirection();
+                    pixel.weight = newWeight;
+                    break;
+                }
 
-                    neighbourPhotons.clear();
-                    if(hitinfo->radius < 0)
-                    {
-                        neighbourPhotons.resize(10);
-                        auto [nbPhotonsFound, newRadius] = tree.getElementsNearestTo(hitpoint, neighbourPhotons.size(), neighbourPhotons);
-                        hitinfo->photonCount = nbPhotonsFound;
-                        hitinfo->radius = newRadius;
-                        //hitinfo->reflectedFlux
-                        //hitinfo->weight
-                        continue;
-                    }
+                weight = newWeight;
+                if(weight.getLuminance() <= 0)
+                {
+                    break;
+                }
+                direction.normalize();
+                ray = Ray(hit->getHitpoint() + direction * 0.00005, direction);
+            }
+        });
 
-                    //Temp
-                    //neighbourPhotons.resize(10);
-                    //hitinfo->radius = tree.getElementsNearestTo(hitpoint, neighbourPhotons.size(), neighbourPhotons);
+        // Photon pass: the photons are stored in the photon map of the pass, which is dropped at the end of the pass
+        PhotonList photons;
+        PhotonTracer tracer{};
+        tracer.batchSize = 10000;
+        tracer.photonsPerAreaLight = photonsPerAreaLight;
+        tracer.photonsPerPointLight = photonsPerPointLight;
+        tracer.mode = PhotonMapMode::full;
+        tracer.seed = static_cast<uint32_t>(Hash::combine(renderSettings.seed, static_cast<uint64_t>(pass)));
+        tracer.tracePhotons(scene, photons, [](const std::string&, float, std::chrono::high_resolution_clock::duration, bool){});
+        const PhotonMap photonMap = PhotonMap::build(std::move(photons));
+
+        // Gather: add the photons within the radius of each visible point, and shrink the radius so that a fraction
+        // alpha of them is kept
+        forEachPixel(tiles, [&](int x, int y)
+        {
+            PixelStatistics& pixel = getPixel(x, y);
+            if(pixel.hasVisiblePoint)
+            {
+                const Vector3 direction = pixel.direction;
+                auto filter = [&direction](const Photon& photon){
+                    return direction.dot(photon.getSurfaceNormal()) >= 0;
+                };
 
-                    auto filter = [&dir = hitinfo->rayhit.normal](const Photon& photon)
-                    {
-                        return dir.dot(-photon.incomingDir) >= 0;
-                    };
-                    tree.getElementsInRadiusFrom(hitpoint, hitinfo->radius, filter, neighbourPhotons);
-                    //auto newDensity = (neighbourPhotons.size() + hitinfo->photonCount) / (PI * pow(hitinfo->radius, 2.0f));
-                    float alfa = 0.8f;
-                    auto n = hitinfo->photonCount;
-                    auto m = neighbourPhotons.size();
-                    auto newRadius = hitinfo->radius * sqrt((n + alfa*m)/(n + m));
-
-                    RGB totalEnergy;
-                    for(const Photon* photon : neighbourPhotons)
+                if(pixel.radius < 0)
+                {
+                    PhotonMap::Neighbour nearest[PhotonQueryQueue::PhotonCount];
+                    const unsigned int foundCount = photonMap.getNearest(pixel.position, PhotonQueryQueue::PhotonCount, 1E9, filter, nearest);
+                    if(foundCount > 0 && nearest[foundCount - 1].sqrDistance > 0)
                     {
-                        totalEnergy += photon->energy.scale(std::max(0.0f, hitinfo->rayhit.normal.dot(-photon->incomingDir)));
+                        pixel.radius = std::sqrt(nearest[foundCount - 1].sqrDistance);
                     }
-                    auto ratio = pow(newRadius, 2.0) / pow(hitinfo->radius, 2.0);
-                    hitinfo->reflectedFlux = (hitinfo->reflectedFlux + totalEnergy) * ratio;
-                    hitinfo->radius = newRadius;
+                }
 
-                    //buffer.setPixel(x, y, hitinfo->reflectedFlux);
-                    //buffer.setPixel(x, y, RGB(hitinfo->radius));
-                    buffer.setPixel(x, y, totalEnergy);
+                if(pixel.radius > 0)
+                {
+                    // Reused by all gathers on this thread
+                    static thread_local std::vector<const Photon*> photonsInRadius;
+                    photonsInRadius.clear();
+                    photonMap.getElementsInRadiusFrom(pixel.position, pixel.radius, filter, photonsInRadius);
+                    if(!photonsInRadius.empty())
+                    {
+                        RGB passFlux {};
+                        for(const Photon* photon : photonsInRadius)
+                        {
+                            passFlux += photon->getEnergy();
+                        }
+
+                        const auto newPhotonCount = static_cast<float>(photonsInRadius.size());
+                        const float keptPhotonCount = pixel.photonCount + (alpha * newPhotonCount);
+                        const float areaRatio = keptPhotonCount / (pixel.photonCount + newPhotonCount);
+                        pixel.radius *= std::sqrt(areaRatio);
+                        pixel.flux = (pixel.flux + pixel.weight.multiply(passFlux)).scale(areaRatio);
+                        pixel.photonCount = keptPhotonCount;
+                    }
                 }
             }
+
+            // Each pass traces the full light power, so the flux is averaged over the passes
+            const float passes = static_cast<float>(pass + 1);
+            RGB radiance = pixel.directRadiance.divide(passes);
+            if(pixel.radius > 0)
+            {
+                radiance += pixel.flux.divide(passes * PI * pixel.radius * pixel.radius).divide(PI);
+            }
+            buffer.setPixel(x, y, radiance);
+            perfBuffer->setPixel(x, y, RGB(passes, std::max(pixel.radius, 0.0f), pixel.photonCount));
         });
-    }*/
+
+        progress.signalTaskFinished();
+    }
 }
@@ -2,9 +2,21 @@
 
 #include "Renderer.h"
 
-// Progressive Photon Mapping Renderer
+// Stochastic progressive photon mapping (Hachisuka and Jensen). Camera passes, which find the first diffuse surface
+// seen through each pixel, alternate with photon passes, which trace a new photon map and add the photons near each
+// visible point to the flux statistics of its pixel. The gather radius of each pixel shrinks with every pass, so the
+// image keeps converging while only the photons of the current pass are held in memory.
 class PPMRenderer : public Renderer
 {
 public:
+    using Renderer::render;
+
+    int passCount = 64;
+    // Photons traced per pass, see PhotonTracer
+    size_t photonsPerAreaLight = 100000;
+    size_t photonsPerPointLight = 100000;
+    // Fraction of the photons of a pass that is kept when the gather radius shrinks
+    float alpha = 0.7f;
+
     void render(const Scene &scene, FrameBuffer &buffer, std::shared_ptr<FrameBuffer>& perfBuffer, const Tile &tile, const RenderSettings &renderSettings, ProgressMonitor progressMon, bool multithreaded) override;
 };
@@ -0,0 +1,214 @@
+#include "PathSampler.h"
+#include "math/FastRandom.h"
+
+PathSampler::PathSampler(const Scene& scene, std::vector<TransportNode>& path, int samplingStartIndex, int maxPathLength, int materialAALevel, int sampleI,
+                         ShadowRayQueue* shadowRays, PhotonQueryQueue* photonQueries)
+    : ctx(scene, path), maxPathLength(maxPathLength), materialAALevel(materialAALevel), sampleI(sampleI)
+{
+    ctx.curI = samplingStartIndex;
+    ctx.shadowRays = shadowRays;
+    ctx.photonQueries = photonQueries;
+    ctx.maxPathLength = maxPathLength;
+    if(samplingStartIndex > 0)
+    {
+        //TODO: should somehow retrieve callback of ctx.curI-1 here
+    }
+}
+
+const CompiledMaterial& PathSampler::getCurrentMaterial() const
+{
+    return ctx.path[ctx.curI].hit.getModelNode().getData().getCompiledMaterial();
+}
+
+Ray PathSampler::getExtensionRay() const
+{
+    const auto& curNode = ctx.path[ctx.curI];
+    return Ray(curNode.hit.getHitpoint() + (curNode.transportDirection * 0.0001f), curNode.transportDirection);
+}
+
+void PathSampler::shade()
+{
+    auto& curNode = ctx.getCurNode();
+    const auto& material = curNode.hit.getModelNode().getData().getCompiledMaterial();
+    bool isFirstNodeWithVariance = firstNodeWithVariance < 0 && material.hasVariance(ctx.path, ctx.curI, ctx.scene);
+    ctx.sampleCount = isFirstNodeWithVariance ? materialAALevel : 1;
+    ctx.sampleI = isFirstNodeWithVariance ? sampleI : 0;
+    if(isFirstNodeWithVariance)
+    {
+        firstNodeWithVariance = ctx.curI;
+    }
+
+    if(sequence.has_value())
+    {
+        sequence->skipTo(CameraDimensionCount + (ctx.curI * DimensionsPerNode));
+    }
+    ScopedSampleSequence sequenceScope(sequence.has_value() ? &*sequence : nullptr);
+
+    const auto& traits = material.getTraits();
+    if(traits.isSpecular && curNodeCallback.has_value())
+    {
+        // The specularity of the node is known before it is sampled. The callback of the previous node may end the
+        // path there (caustics are taken from the photon map), the specular node is then not sampled at all.
+        curNode.specularity = 1.0f;
+        if(runNodeCallback())
+        {
+            state = State::Done;
+            return;
+        }
+    }
+
+    material.sampleTransport(ctx);
+    if(traits.isEmissive)
+    {
+        // The path ends here, no extension ray and no russian roulette
+        if(!runNodeCallback())
+        {
+            ctx.curI++;
+        }
+        state = State::Done;
+        return;
+    }
+
+    std::optional<SceneRayHitInfo> hit = ctx.nextHit;
+    ctx.nextHit.reset();
+
+    if(runNodeCallback())
+    {
+        state = State::Done;
+        return;
+    }
+    curNodeCallback = ctx.nextNodeCallback;
+    ctx.nextNodeCallback.reset();
+
+    pathTerminated = !curNode.isEmissive && ((ctx.curI+1 == maxPathLength) || (Rand::unit() < curNode.pathTerminationChance));
+    if(curNode.isEmissive || pathTerminated)
+    {
+        ctx.curI++;
+        state = State::Done;
+    }
+    else if(hit.has_value())
+    {
+        // The material traced the extension ray itself
+        state = State::Trace;
+        extend(hit);
+    }
+    else
+    {
+        state = State::Trace;
+    }
+}
+
+bool PathSampler::runNodeCallback()
+{
+    if(!curNodeCallback.has_value())
+    {
+        return false;
+    }
+    (*curNodeCallback)();
+    curNodeCallback.reset();
+    return ctx.path[ctx.curI-1].isEmissive || ctx.path[ctx.curI-1].pathTerminationChance == 1.0; //bit of a hack here, I know
+}
+
+void PathSampler::extend(const std::optional<SceneRayHitInfo>& hit)
+{
+    if(hit.has_value())
+    {
+        auto& path = ctx.path;
+        if(path.size() < (ctx.curI+2))
+        {
+            path.emplace_back(*hit);
+        }
+        else
+        {
+            path[ctx.curI+1] = TransportNode(*hit);
+        }
+        state = State::Shade;
+    }
+    else
+    {
+        state = State::Done;
+    }
+    ctx.curI++;
+}
+
+bool PathSampler::finish()
+{
+    ctx.path.erase(ctx.path.begin()+ctx.curI, ctx.path.end());
+    if(firstNodeWithVariance >= ctx.curI)
+    {
+        firstNodeWithVariance = -1;
+    }
+    return pathTerminated;
+}
+
+bool samplePath(std::vector<TransportNode>& path, int samplingStartIndex, int maxPathLength, const Scene& scene, int materialAALevel, int sampleI, const SampleSequence* sequence, int* firstNodeWithVariance,
+                ShadowRayQueue* shadowRays, PhotonQueryQueue* photonQueries)
+{
+    PathSampler sampler(scene, path, samplingStartIndex, maxPathLength, materialAALevel, sampleI, shadowRays, photonQueries);
+    if(sequence != nullptr)
+    {
+        sampler.useSequence(*sequence);
+    }
+    while(sampler.getState() != PathSampler::State::Done)
+    {
+        if(sampler.getState() == PathSampler::State::Shade)
+        {
+            sampler.shade();
+        }
+        else
+        {
+            sampler.extend(scene.traceRay(sampler.getExtensionRay()));
+        }
+    }
+    bool pathTerminated = sampler.finish();
+    if(firstNodeWithVariance != nullptr)
+    {
+        *firstNodeWithVariance = sampler.getFirstNodeWithVariance();
+    }
+    return pathTerminated;
+}
+
+RGB calculatePathEnergy(std::vector<TransportNode>& path, const Scene& scene)
+{
+    // Calculate light transported along this path
+    const auto& lastNode = path[path.size()-1];
+
+    RGB energy;
+    if(scene.hasEnvironmentMaterial() && !lastNode.isEmissive)
+    {
+        energy = scene.getEnvironmentMaterial().getRadiance(scene, lastNode.transportDirection);
+    }
+    for(int pathI = path.size()-1; pathI >= 0; --pathI) //From path end to front
+    {
+        auto& curPathElem = path[pathI];
+        energy = curPathElem.hit.getModelNode().getData().getCompiledMaterial().bsdf(scene, path, pathI, curPathElem, energy);
+        if(!curPathElem.isEmissive)
+        {
+            energy = energy.divide(1.0f-curPathElem.pathTerminationChance);
+        }
+    }
+    return energy;
+}
+
+std::optional<RGB> getDirectCameraRayRadiance(const Scene& scene, const Ray& ray, const std::optional<SceneRayHitInfo>& hit)
+{
+    // Check if there is an area light that gives a closer hit
+    auto lightHit = scene.traceAreaLights(ray, hit.has_value() ? hit->t : INFINITY);
+    if(lightHit.has_value())
+    {
+        const AreaLight& light = *lightHit->light;
+        auto lightEnergy = light.color * light.intensity;
+        auto lightIrradiance = lightEnergy.divide(light.getSurfaceArea());
+        return lightIrradiance.divide(2);
+    }
+
+    if (!hit.has_value())
+    {
+        if(scene.hasEnvironmentMaterial())
+        {
+            return scene.getEnvironmentMaterial().getRadiance(scene, ray.getDirection());
+        }
+        return RGB{};
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+#include "material/IMaterial.h"
+#include "material/CompiledMaterial.h"
+#include "scene/renderable/Scene.h"
+#include "math/SampleSequence.h"
+
+/*
+ * Samples a transport path one node at a time. Tracing the extension rays is left to the caller, so paths can be
+ * built one after the other (samplePath) or many at once, with the rays traced in batches (WavefrontRenderer).
+ *
+ * Material callbacks keep references to the transport context, which is a member: a sampler must not be moved or
+ * copied, and must stay alive until the path is done.
+ */
+class PathSampler
+{
+public:
+    static constexpr int DefaultMaxPathLength = 10;
+
+    // Layout of the dimensions of a sample sequence: the camera ray takes the first dimensions, each path node the
+    // next block of DimensionsPerNode dimensions. A node that needs more values continues into the block of the next one.
+    static constexpr uint32_t CameraDimensionCount = 8;
+    static constexpr uint32_t DimensionsPerNode = 8;
+
+    enum class State
+    {
+        Shade, // The current node must be shaded
+        Trace, // The extension ray from the current node must be traced
+        Done
+    };
+
+    // Samples the path from node samplingStartIndex on, path[samplingStartIndex] must be set.
+    // The path must have capacity for maxPathLength nodes, nodes are referenced by materials while sampling.
+    // If shadowRays is set, next event estimation queues its shadow rays there. The queue must then be resolved before
+    // the energy of the path is calculated. The same goes for photon map lookups and photonQueries.
+    PathSampler(const Scene& scene, std::vector<TransportNode>& path, int samplingStartIndex, int maxPathLength, int materialAALevel, int sampleI,
+                ShadowRayQueue* shadowRays = nullptr, PhotonQueryQueue* photonQueries = nullptr);
+    PathSampler(const PathSampler&) = delete;
+    PathSampler& operator=(const PathSampler&) = delete;
+
+    State getState() const
+    {
+        return state;
+    }
+
+    // Takes all random decisions of the path from the sequence from now on, see Rand::setSequence.
+    void useSequence(const SampleSequence& sequence)
+    {
+        this->sequence = sequence;
+    }
+
+    // Material of the node that is shaded next
+    const CompiledMaterial& getCurrentMaterial() const;
+
+    // Ray to trace when the state is Trace
+    Ray getExtensionRay() const;
+
+    // Samples the transport at the current node, requires state Shade.
+    void shade();
+
+    // Continues the path with the result of tracing the extension ray, requires state Trace.
+    void extend(const std::optional<SceneRayHitInfo>& hit);
+
+    // Removes the unused nodes from the end of the path, requires state Done.
+    // Returns true if the path ended prematurely (maximum length reached or russian roulette).
+    bool finish();
+
+    // Index of the first node shaded by this sampler whose material has variance, -1 if there is none.
+    // Final once the sampler is finished.
+    int getFirstNodeWithVariance() const
+    {
+        return firstNodeWithVariance;
+    }
+
+private:
+    TransportBuildContext ctx;
+    int maxPathLength;
+    int materialAALevel;
+    int sampleI;
+    State state = State::Shade;
+    bool pathTerminated = false;
+    int firstNodeWithVariance = -1;
+    std::optional<NodeCallback> curNodeCallback {};
+    std::optional<SampleSequence> sequence {};
+
+    // Runs the callback that the previous node registered for the current node, if any.
+    // Returns true if the callback ended the path at the previous node.
+    bool runNodeCallback();
+};
+
+// Sample sequence of camera ray cameraSampleI of a pixel.
+inline SampleSequence getCameraSequence(uint32_t pixelSeed, uint32_t cameraSampleI, SamplerType type)
+{
+    return SampleSequence(pixelSeed, cameraSampleI, 0, type);
+}
+
+// Sample sequence of material AA sample materialSampleI of the path started by camera ray cameraSampleI of a pixel.
+// The paths use other dimensions than the camera rays, as their sample indices overlap.
+inline SampleSequence getPathSequence(uint32_t pixelSeed, uint32_t cameraSampleI, int materialAALevel, int materialSampleI, SamplerType type)
+{
+    return SampleSequence(pixelSeed, (cameraSampleI * materialAALevel) + materialSampleI, PathSampler::CameraDimensionCount, type);
+}
+
+// Returns true if the returned path ends prematurely
+// If sequence is set, the path is sampled with it. If firstNodeWithVariance is set, it receives PathSampler::getFirstNodeWithVariance().
+// shadowRays and photonQueries are passed to the sampler, the queues must then be resolved before calculatePathEnergy.
+bool samplePath(std::vector<TransportNode>& path, int samplingStartIndex, int maxPathLength, const Scene& scene, int materialAALevel, int sampleI, const SampleSequence* sequence = nullptr, int* firstNodeWithVariance = nullptr,
+                ShadowRayQueue* shadowRays = nullptr, PhotonQueryQueue* photonQueries = nullptr);
+
+RGB calculatePathEnergy(std::vector<TransportNode>& path, const Scene& scene);
+
+// Radiance along a camera ray that does not start a path: rays that hit an area light first or miss the scene.
+// Returns nothing if a path has to be sampled from the hit.
+std::optional<RGB> getDirectCameraRayRadiance(const Scene& scene, const Ray& ray, const std::optional<SceneRayHitInfo>& hit);
+
+// Running mean and variance (Welford) of the radiance samples of a single pixel.
+class PixelEstimate
+{
+public:
+    void addSample(const RGB& sample)
+    {
+        sampleCount++;
+        sum += sample;
+
+        double lum = sample.getLuminance();
+        double delta = lum - lumMean;
+        lumMean += delta / sampleCount;
+        lumM2 += delta * (lum - lumMean);
+    }
+
+    RGB getMean() const
+    {
+        return sampleCount == 0 ? RGB{} : sum.divide(sampleCount);
+    }
+
+    int getSampleCount() const
+    {
+        return sampleCount;
+    }
+
+    // Returns true if the standard error of the mean luminance, relative to the mean luminance, is below the threshold.
+    bool hasConverged(float threshold) const
+    {
+        if(sampleCount < 2)
+        {
+            return false;
+        }
+        double variance = lumM2 / (sampleCount - 1);
+        double standardError = std::sqrt(variance / sampleCount);
+        // Avoid dividing by ~0 for black pixels, errors below the display precision are irrelevant there.
+        return standardError <= threshold * std::max(lumMean, 1.0/255.0);
+    }
+
+private:
+    int sampleCount = 0;
+    RGB sum{};
+    double lumMean = 0;
+    double lumM2 = 0;
+};
@@ -1,275 +1,254 @@
 #include "Renderer.h"
+#include "PathSampler.h"
+#include <algorithm>
 #include <thread>
-#include <math/Triangle.h>
 #include "math/Ray.h"
 #include "camera/ICamera.h"
 #include "utility/ProgressMonitor.h"
 #include "math/Sampler.h"
 #include "math/FastRandom.h"
 #include "utility/Task.h"
+#include "scene/renderable/ShadowRayQueue.h"
+#include "photonmapping/PhotonQueryQueue.h"
 
 #undef min
 
-// Returns true if the returned path ends prematurely
-bool samplePath(std::vector<TransportNode>& path, int samplingStartIndex, int maxPathLength, const Scene& scene, int materialAALevel, int sampleI)
+class RenderTileTask : public Task
 {
-    TransportBuildContext ctx(scene, path);
-    ctx.curI = samplingStartIndex;
-
-    bool pathDone = false;
-    bool pathTerminated = false; //Max length was reached or russian roulette triggered
-    std::optional<SceneRayHitInfo> hit;
-    std::optional<std::function<void()>> curNodeCallback {};
-    if(samplingStartIndex > 0)
+private:
+    static constexpr int maxPathLength = PathSampler::DefaultMaxPathLength;
+
+    // Maximum amount of camera samples whose paths are kept until their shadow rays are traced. A transport node
+    // takes ~0.5 KB, so this bounds the path state to ~5 MB per task, the same as WavefrontRenderer.
+    static constexpr size_t maxBlockSamples = 1024;
+
+    const Tile& tile;
+    const RenderSettings& renderSettings;
+    const ICamera& camera;
+    const Scene& scene;
+    FrameBuffer& buffer;
+    std::shared_ptr<FrameBuffer>& perfBuffer;
+    ProgressTracker& progress;
+    std::chrono::steady_clock::time_point deadline;
+
+    // Per camera sample state of the current pass
+    std::vector<Ray> rays;
+    std::vector<std::optional<SceneRayHitInfo>> hits;
+    std::vector<size_t> samplePixel;
+    std::vector<uint32_t> sampleSeed; // Seed of the sample sequences of the pixel
+    std::vector<int> sampleCameraIndex; // Index of the camera sample among the camera samples of its pixel
+    std::vector<RGB> sampleRadiance;
+    std::vector<std::vector<TransportNode>> paths;
+    std::vector<int> pathFirstNodeWithVariance; // Node the material AA samples restart from, -1 if there is none
+    std::vector<unsigned char> pathWasTerminated;
+
+    // Per pixel state of the current block of pixels
+    std::vector<PixelEstimate> estimates;
+
+    ShadowRayQueue shadowRays;
+    PhotonQueryQueue photonQueries;
+
+    // Trace one pass of geometryAAModifier camera rays through pixel (x, y), stratified over the pixel, and store
+    // them from camera sample firstRayI on. firstSampleI is the number of camera rays traced through the pixel before.
+    void traceCameraRays(int x, int y, int firstSampleI, size_t firstRayI)
+    {
+        auto rayBundles = renderSettings.geometryAAModifier / RayBundleSize;
+        auto nonbundledRays = renderSettings.geometryAAModifier % RayBundleSize;
+        for(int i = 0; i < rayBundles; i++) {
+            RayBundle bundle;
+            for(RBSize_t rayI = 0; rayI < RayBundleSize; ++rayI)
+            {
+                auto totalRayI = (i * RayBundleSize) + rayI;
+                rays[firstRayI + totalRayI] = generateCameraRay(camera, buffer, renderSettings, x, y, firstSampleI + totalRayI);
+                bundle[rayI] = rays[firstRayI + totalRayI];
+            }
+            auto bundleHits = scene.traceRays(bundle);
+            std::copy(bundleHits.begin(), bundleHits.end(), hits.begin() + firstRayI + (i * RayBundleSize));
+        }
+        for(int i = 0; i < nonbundledRays; i++) {
+            auto totalRayI = (rayBundles * RayBundleSize) + i;
+            rays[firstRayI + totalRayI] = generateCameraRay(camera, buffer, renderSettings, x, y, firstSampleI + totalRayI);
+            hits[firstRayI + totalRayI] = scene.traceRay(rays[firstRayI + totalRayI]);
+        }
+    }
+
+    // Samples material AA sample materialSampleI of the path of camera sample sampleI, from node samplingStartIndex on.
+    // Shadow rays and photon map lookups are queued, the energy of the path is only known once they are resolved.
+    void samplePathOfSample(size_t sampleI, int samplingStartIndex, int materialSampleI)
     {
-        //TODO: should somehow retrieve callback of ctx.curI-1 here
+        SampleSequence sequence = getPathSequence(sampleSeed[sampleI], sampleCameraIndex[sampleI], renderSettings.materialAAModifier, materialSampleI, renderSettings.sampler);
+        int* firstNodeWithVariance = materialSampleI == 0 ? &pathFirstNodeWithVariance[sampleI] : nullptr;
+        pathWasTerminated[sampleI] = samplePath(paths[sampleI], samplingStartIndex, maxPathLength, scene, renderSettings.materialAAModifier, materialSampleI,
+                                                &sequence, firstNodeWithVariance, &shadowRays, &photonQueries);
     }
-    bool hasPassedNodeWithVariance = false;
-    do{
-        auto& curNode = ctx.getCurNode();
-        bool curNodeHasVariance = ctx.getCurNode().hit.getModelNode().getData().getMaterial().hasVariance(ctx.path, ctx.curI, scene);
-        bool isFirstNodeWithVariance = curNodeHasVariance && !hasPassedNodeWithVariance;
-        ctx.sampleCount = isFirstNodeWithVariance ? materialAALevel : 1;
-        ctx.sampleI = isFirstNodeWithVariance ? sampleI : 0;
-        hasPassedNodeWithVariance = hasPassedNodeWithVariance || curNodeHasVariance;
-
-        curNode.hit.getModelNode().getData().getMaterial().sampleTransport(ctx);
-        hit = ctx.nextHit;
-        ctx.nextHit.reset();
-
-        if(curNodeCallback.has_value())
-        {
-            (*curNodeCallback)();
 
-            if(ctx.path[ctx.curI-1].isEmissive || ctx.path[ctx.curI-1].pathTerminationChance == 1.0) //bit of a hack here, I know
+    // Traces the queued shadow rays in bundles and resolves the photon map lookups in batches, then adds the energy of
+    // the paths that were sampled since the last call to the radiance of their camera samples.
+    void accumulatePathEnergies(size_t sampleCount, int materialSampleI)
+    {
+        shadowRays.resolve(scene);
+        photonQueries.resolve(scene);
+        for(size_t sampleI = 0; sampleI < sampleCount; sampleI++)
+        {
+            const bool wasSampled = materialSampleI == 0 || pathFirstNodeWithVariance[sampleI] >= 0;
+            if(!paths[sampleI].empty() && wasSampled && !pathWasTerminated[sampleI])
             {
-                break;
+                sampleRadiance[sampleI] += calculatePathEnergy(paths[sampleI], scene);
             }
         }
-        curNodeCallback = ctx.nextNodeCallback;
-        ctx.nextNodeCallback.reset();
+    }
 
-        pathTerminated = (ctx.curI+1 == maxPathLength) || (!curNode.isEmissive && Rand::unit() < curNode.pathTerminationChance);
-        pathDone = curNode.isEmissive || pathTerminated;
+    // Traces one pass of geometryAAModifier camera rays through each of the given pixels of the block, and estimates
+    // the radiance arriving along them.
+    void renderPass(size_t blockStart, const std::vector<size_t>& activePixels)
+    {
+        const int aaLevel = renderSettings.geometryAAModifier;
+        const size_t sampleCount = activePixels.size() * aaLevel;
+        rays.resize(sampleCount);
+        hits.resize(sampleCount);
+        samplePixel.resize(sampleCount);
+        sampleSeed.resize(sampleCount);
+        sampleCameraIndex.resize(sampleCount);
+        sampleRadiance.assign(sampleCount, RGB{});
+        pathFirstNodeWithVariance.resize(sampleCount);
+        pathWasTerminated.resize(sampleCount);
+        while(paths.size() < sampleCount)
+        {
+            paths.emplace_back().reserve(maxPathLength);
+        }
 
-        if(!pathDone)
+        for(size_t pixelI = 0; pixelI < activePixels.size(); pixelI++)
         {
-            if(!hit.has_value())
+            const size_t pixel = activePixels[pixelI];
+            const int x = tile.getXStart() + static_cast<int>((blockStart + pixel) % tile.getWidth());
+            const int y = tile.getYStart() + static_cast<int>((blockStart + pixel) / tile.getWidth());
+            const uint32_t pixelSeed = SampleSequence::pixelSeed(renderSettings.seed, x, y);
+            const int firstCameraSampleI = estimates[pixel].getSampleCount();
+            for(int i = 0; i < aaLevel; i++)
             {
-                Ray ray(curNode.hit.getHitpoint() + (curNode.transportDirection * 0.0001f), curNode.transportDirection);
-                hit = scene.traceRay(ray);
+                const size_t sampleI = pixelI * aaLevel + i;
+                samplePixel[sampleI] = pixel;
+                sampleSeed[sampleI] = pixelSeed;
+                sampleCameraIndex[sampleI] = firstCameraSampleI + i;
             }
-            if (hit.has_value())
+            traceCameraRays(x, y, firstCameraSampleI, pixelI * aaLevel);
+        }
+
+        // Build new paths
+        for(size_t sampleI = 0; sampleI < sampleCount; sampleI++)
+        {
+            auto& path = paths[sampleI];
+            path.clear();
+            pathFirstNodeWithVariance[sampleI] = -1;
+
+            auto directRadiance = getDirectCameraRayRadiance(scene, rays[sampleI], hits[sampleI]);
+            if(directRadiance.has_value())
             {
-                if(path.size() < (ctx.curI+2))
-                {
-                    path.emplace_back(*hit);
-                }
-                else
-                {
-                    path[ctx.curI+1] = TransportNode(*hit);
-                }
+                sampleRadiance[sampleI] = *directRadiance;
+                continue;
             }
-            else
+
+            path.emplace_back(*hits[sampleI]);
+            samplePathOfSample(sampleI, 0, 0);
+        }
+        accumulatePathEnergies(sampleCount, 0);
+
+        for(int j = 1; j < renderSettings.materialAAModifier; j++)
+        {
+            // From the first geometry hit on, resample the transport path if the bsdf at the hitpoint has variance.
+            for(size_t sampleI = 0; sampleI < sampleCount; sampleI++)
             {
-                pathDone = true;
+                if(!paths[sampleI].empty() && pathFirstNodeWithVariance[sampleI] >= 0)
+                {
+                    samplePathOfSample(sampleI, pathFirstNodeWithVariance[sampleI], j);
+                }
             }
+            accumulatePathEnergies(sampleCount, j);
         }
-        ctx.curI++;
-        /*if(ctx.curI == maxPathLength)
-        {
-            pathDone = true;
-        }*/
-    }while(!pathDone);
 
-    path.erase(path.begin()+ctx.curI, path.end());
-    return pathTerminated;
-}
-
-RGB calculatePathEnergy(std::vector<TransportNode>& path, const Scene& scene)
-{
-    // Calculate light transported along this path
-    const auto& lastNode = path[path.size()-1];
-
-    RGB energy;
-    if(scene.hasEnvironmentMaterial() && !lastNode.isEmissive)
-    {
-        energy = scene.getEnvironmentMaterial().getRadiance(scene, lastNode.transportDirection);
-    }
-    for(int pathI = path.size()-1; pathI >= 0; --pathI) //From path end to front
-    {
-        auto& curPathElem = path[pathI];
-        energy = curPathElem.hit.getModelNode().getData().getMaterial().bsdf(scene, path, pathI, curPathElem, energy);
-        if(!curPathElem.isEmissive)
+        for(size_t sampleI = 0; sampleI < sampleCount; sampleI++)
         {
-            energy = energy.divide(1.0f-curPathElem.pathTerminationChance);
+            if(!paths[sampleI].empty() && pathFirstNodeWithVariance[sampleI] >= 0)
+            {
+                sampleRadiance[sampleI] = sampleRadiance[sampleI].divide(renderSettings.materialAAModifier);
+            }
+            estimates[samplePixel[sampleI]].addSample(sampleRadiance[sampleI]);
         }
     }
-    return energy;
-}
-
-class RenderTileTask : public Task
-{
-private:
-    const Tile& tile;
-    const RenderSettings& renderSettings;
-    const ICamera& camera;
-    const Scene& scene;
-    FrameBuffer& buffer;
-    std::shared_ptr<FrameBuffer>& perfBuffer;
-    ProgressTracker& progress;
 
 public:
-    RenderTileTask(const Tile &tile, const RenderSettings &renderSettings, const ICamera &camera, const Scene &scene, FrameBuffer &buffer, std::shared_ptr<FrameBuffer>& perfBuffer, ProgressTracker &progress)
-                   : tile(tile), renderSettings(renderSettings), camera(camera), scene(scene), buffer(buffer), perfBuffer(perfBuffer), progress(progress)
+    RenderTileTask(const Tile &tile, const RenderSettings &renderSettings, const ICamera &camera, const Scene &scene, FrameBuffer &buffer, std::shared_ptr<FrameBuffer>& perfBuffer, ProgressTracker &progress, std::chrono::steady_clock::time_point deadline)
+                   : tile(tile), renderSettings(renderSettings), camera(camera), scene(scene), buffer(buffer), perfBuffer(perfBuffer), progress(progress), deadline(deadline)
                    {}
 
     void execute() override
     {
-        std::vector<TransportNode> path;
-        const int maxPathLength = 10;
-        path.reserve(maxPathLength);
-
-        std::vector<std::optional<SceneRayHitInfo>> hits(renderSettings.geometryAAModifier);
-
-        for (int y = tile.getYStart(); y < tile.getYEnd(); ++y) {
-            for (int x = tile.getXStart(); x < tile.getXEnd(); ++x) {
-                RGB pixelValue{};
-                RGB perfPixelValue{};
-                unsigned int visited = 0;
-
-                // Trace eye rays
-                /*for(int i = 0; i < renderSettings.geometryAAModifier; i++) {
-                    Ray ray = camera.generateRay(
-                            Vector2(x, y), buffer.getHorizontalResolution(), buffer.getVerticalResolution(),
-                            renderSettings.geometryAAModifier, i
-                    );
-                    hits[i] = scene.traceRay(ray);
-                }*/
-                {
-                    auto rayBundles = renderSettings.geometryAAModifier / RayBundleSize;
-                    auto nonbundledRays = renderSettings.geometryAAModifier % RayBundleSize;
-                    for(int i = 0; i < rayBundles; i++) {
-                        RayBundle rays;
-                        for(RBSize_t rayI = 0; rayI < RayBundleSize; ++rayI)
-                        {
-                            rays[rayI] = camera.generateRay(
-                                    Vector2(x, y), buffer.getHorizontalResolution(), buffer.getVerticalResolution(),
-                                    renderSettings.geometryAAModifier, (i * RayBundleSize) + rayI
-                            );
-                        }
-                        auto bundleHits = scene.traceRays(rays);
-                        std::copy(bundleHits.begin(), bundleHits.end(), hits.begin() + (i * RayBundleSize));
-                    }
-                    for(int i = 0; i < nonbundledRays; i++) {
-                        auto totalRayI = (rayBundles * RayBundleSize) + i;
-                        Ray ray = camera.generateRay(
-                                Vector2(x, y), buffer.getHorizontalResolution(), buffer.getVerticalResolution(),
-                                renderSettings.geometryAAModifier, totalRayI
-                        );
-                        hits[totalRayI] = scene.traceRay(ray);
-                    }
-                }
+        const bool adaptive = renderSettings.noiseThreshold > 0;
+        const int maxSamples = std::max(renderSettings.geometryAAModifier, renderSettings.maxSamplesPerPixel);
+
+        // The tile is rendered in blocks of pixels, whose paths are sampled one after the other. The shadow rays of
+        // all paths of a block are traced together, at most maxBlockSamples camera samples are in flight.
+        const size_t pixelCount = static_cast<size_t>(tile.getWidth()) * tile.getHeight();
+        const size_t blockSize = std::max<size_t>(1, maxBlockSamples / renderSettings.geometryAAModifier);
+        std::vector<size_t> activePixels;
+
+        for(size_t blockStart = 0; blockStart < pixelCount; blockStart += blockSize)
+        {
+            const size_t blockEnd = std::min(pixelCount, blockStart + blockSize);
+            estimates.assign(blockEnd - blockStart, PixelEstimate{});
+            activePixels.clear();
+            for(size_t pixel = 0; pixel < blockEnd - blockStart; pixel++)
+            {
+                activePixels.push_back(pixel);
+            }
 
-                // Path tracing
-                for(int i = 0; i < renderSettings.geometryAAModifier; i++)
+            // Render in passes of geometryAAModifier camera rays. Without adaptive sampling, only one pass is done.
+            do
+            {
+                renderPass(blockStart, activePixels);
+                activePixels.erase(std::remove_if(activePixels.begin(), activePixels.end(), [&](size_t pixel)
                 {
-                    // Build new path
-                    path.clear();
-
-                    auto& hit = hits[i];
-                    auto& ray = hits[i]->ray;
-
-                    // Check if there is an area light that gives a closer hit
-                    {
-                        float bestT = hit.has_value() ? hit->t : INFINITY;
-                        Triangle::TriangleIntersection lightHit;
-                        AreaLight* light = nullptr;
-                        for(const auto& areaLight : scene.getAreaLights())
-                        {
-                            if(Triangle::intersect(ray, areaLight->a, areaLight->b, areaLight->c, lightHit)
-                               && (bestT > lightHit.t))
-                            {
-                                light = &*areaLight;
-                                bestT = lightHit.t;
-                            }
-                        }
-                        if(light != nullptr)
-                        {
-                            auto lightEnergy = light->color * light->intensity;
-                            auto lightIrradiance = lightEnergy.divide(light->getSurfaceArea());
-                            pixelValue = pixelValue.add(lightIrradiance.divide(2));
-                            continue;
-                        }
-                    }
-
-                    bool pathWasTerminated;
-                    if (hit.has_value())
-                    {
-                        auto& pathNode = path.emplace_back(*hit);
-                        pathWasTerminated = samplePath(path, 0, maxPathLength, scene, renderSettings.materialAAModifier, 0);
-
-                        {//PERF
-                            perfPixelValue = perfPixelValue.add(RGB(0, 0, KDTreeDiag::Levels));
-                            KDTreeDiag::Levels = 0;
-                        }
-                    }
-                    else
-                    {
-                        if(scene.hasEnvironmentMaterial())
-                        {
-                            RGB energy = scene.getEnvironmentMaterial().getRadiance(scene, ray.getDirection());
-                            pixelValue = pixelValue.add(energy);
-                        }
-                        continue;
-                    }
-
-                    int firstNodeWithVariance = 0;
-                    for(; firstNodeWithVariance < path.size(); firstNodeWithVariance++)
-                    {
-                        if(path[firstNodeWithVariance].hit.getModelNode().getData().getMaterial().hasVariance(path, firstNodeWithVariance, scene))
-                        {
-                            break;
-                        }
-                    }
-
-                    RGB matSample {};
-                    if(!pathWasTerminated)
-                    {
-                        matSample = calculatePathEnergy(path, scene);
-                    }
-                    if(firstNodeWithVariance < path.size())
-                    {
-                        for(int j = 1; j < renderSettings.materialAAModifier; j++)
-                        {
-                            // From the first geometry hit on, resample the transport path if the bsdf at the hitpoint has variance.
-                            pathWasTerminated = samplePath(path, firstNodeWithVariance, maxPathLength, scene, renderSettings.materialAAModifier, j);
-
-                            {//PERF
-                                perfPixelValue = perfPixelValue.add(RGB(0, 0, KDTreeDiag::Levels));
-                                KDTreeDiag::Levels = 0;
-                            }
-
-                            if(!pathWasTerminated)
-                            {
-                                matSample = matSample.add(calculatePathEnergy(path, scene));
-                            }
-                        }
-                        matSample = matSample.divide(renderSettings.materialAAModifier);
-                    }
-                    pixelValue = pixelValue.add(matSample);
-                }
+                    const auto& estimate = estimates[pixel];
+                    return estimate.getSampleCount() + renderSettings.geometryAAModifier > maxSamples
+                           || estimate.hasConverged(renderSettings.noiseThreshold);
+                }), activePixels.end());
+            } while(adaptive && !activePixels.empty() && std::chrono::steady_clock::now() < deadline);
 
-                buffer.setPixel(x, y, pixelValue.divide(renderSettings.geometryAAModifier));
+            for(size_t pixel = 0; pixel < blockEnd - blockStart; pixel++)
+            {
+                const int x = tile.getXStart() + static_cast<int>((blockStart + pixel) % tile.getWidth());
+                const int y = tile.getYStart() + static_cast<int>((blockStart + pixel) / tile.getWidth());
+                const auto& estimate = estimates[pixel];
+                buffer.setPixel(x, y, estimate.getMean());
+                unsigned int visited = estimate.getSampleCount();
                 float log_visited = visited == 0 ? 0 : (float)std::log((long double)visited);
-                perfPixelValue = perfPixelValue.add(RGB(visited, log_visited, 0));
-                perfBuffer->setPixel(x, y, perfPixelValue);
+                perfBuffer->setPixel(x, y, RGB(visited, log_visited, 0));
             }
         }
         progress.signalTaskFinished();
     }
 };
 
+Ray generateCameraRay(const ICamera& camera, const FrameBuffer& buffer, const RenderSettings& renderSettings, int x, int y, int cameraSampleI)
+{
+    SampleSequence sequence = getCameraSequence(SampleSequence::pixelSeed(renderSettings.seed, x, y), cameraSampleI, renderSettings.sampler);
+    ScopedSampleSequence sequenceScope(&sequence);
+    return camera.generateRay(
+            Vector2(x, y), buffer.getHorizontalResolution(), buffer.getVerticalResolution(),
+            renderSettings.geometryAAModifier, cameraSampleI
+    );
+}
+
+std::chrono::steady_clock::time_point getRenderDeadline(const RenderSettings& renderSettings)
+{
+    if(renderSettings.timeBudget <= 0)
+    {
+        return std::chrono::steady_clock::time_point::max();
+    }
+    auto budget = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(renderSettings.timeBudget));
+    return std::chrono::steady_clock::now() + budget;
+}
+
 void Renderer::render(const Scene &scene, FrameBuffer &buffer, std::shared_ptr<FrameBuffer>& perfBuffer, const Tile &tile, const RenderSettings &renderSettings, ProgressMonitor progressMon, bool multithreaded)
 {
     std::vector<Tile> tiles;
@@ -287,12 +266,13 @@ void Renderer::render(const Scene &scene, FrameBuffer &buffer, std::shared_ptr<F
     progress.startNewJob("Rendering tiles", tiles.size());
 
     const ICamera& camera = findCamera(scene);
+    const auto deadline = getRenderDeadline(renderSettings);
 
     std::vector<std::unique_ptr<Task>> tasks;
     for(const auto& curTile : tiles)
     {
         tasks.push_back(std::make_unique<RenderTileTask>(
-            curTile, renderSettings, camera, scene, buffer, perfBuffer, progress
+            curTile, renderSettings, camera, scene, buffer, perfBuffer, progress, deadline
         ));
     }
     Task::runTasks(tasks);
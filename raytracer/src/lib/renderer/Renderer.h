@@ -4,16 +4,42 @@
 #include "film/FrameBuffer.h"
 #include "utility/ProgressMonitor.h"
 #include "film/Tile.h"
+#include "math/SampleSequence.h"
+#include <chrono>
 
 struct RenderSettings
 {
 	int geometryAAModifier = 4;
     int materialAAModifier = 32;
+    SamplerType sampler = SamplerType::sobol;
+    // All random decisions of a pixel sample are derived from this seed, the pixel and the sample index, so a render
+    // with the same seed is identical for any number of threads and tile layout.
+    uint32_t seed = 0;
+
+    // Adaptive sampling: after the first geometryAAModifier camera rays, pixels keep receiving passes of
+    // geometryAAModifier camera rays until the relative standard error of the pixel luminance drops below
+    // noiseThreshold, or until maxSamplesPerPixel camera rays were traced. A threshold of 0 disables adaptive sampling.
+    float noiseThreshold = 0.0f;
+    int maxSamplesPerPixel = 256;
+    // Adaptive sampling stops adding passes once the render has been running for this many seconds. Pixels that are
+    // in progress finish their current pass. 0 disables the budget. Renders with a budget are not reproducible.
+    float timeBudget = 0.0f;
 };
 
+class ICamera;
+
+// Camera ray cameraSampleI through pixel (x, y), counted over all passes of the pixel.
+// The index selects both the sample sequence and the stratum within the pass of geometryAAModifier rays.
+Ray generateCameraRay(const ICamera& camera, const FrameBuffer& buffer, const RenderSettings& renderSettings, int x, int y, int cameraSampleI);
+
+// Point in time after which adaptive sampling adds no more passes, for a render started now.
+std::chrono::steady_clock::time_point getRenderDeadline(const RenderSettings& renderSettings);
+
 class Renderer
 {
 public:
+    virtual ~Renderer() = default;
+
     virtual void render(const Scene& scene, FrameBuffer& buffer, std::shared_ptr<FrameBuffer>& perfBuffer, const Tile& tile, const RenderSettings& renderSettings, ProgressMonitor progressMon, bool multithreaded);
     virtual void render(const Scene& scene, FrameBuffer& buffer, std::shared_ptr<FrameBuffer>& perfBuffer, const RenderSettings& renderSettings, ProgressMonitor progressMon);
 
@@ -0,0 +1,383 @@
+#include "WavefrontRenderer.h"
+#include "PathSampler.h"
+#include <algorithm>
+#include <memory>
+#include "camera/ICamera.h"
+#include "scene/renderable/ShadowRayQueue.h"
+#include "photonmapping/PhotonQueryQueue.h"
+#include "utility/ProgressMonitor.h"
+#include "utility/Task.h"
+
+#undef min
+#undef max
+
+namespace
+{
+    constexpr int maxPathLength = PathSampler::DefaultMaxPathLength;
+
+    // Maximum amount of camera samples in flight per task. A transport node takes ~0.5 KB, so this bounds the path
+    // state to ~5 MB per task. Larger wavefronts give more coherent batches, but no longer fit in the cache.
+    constexpr size_t maxWavefrontSize = 1024;
+
+    // Sort key that groups similar directions: the octant, followed by the quantized x and y components.
+    uint32_t getDirectionKey(const Vector3& dir)
+    {
+        const uint32_t octant = (dir.x() < 0 ? 1u : 0u) | (dir.y() < 0 ? 2u : 0u) | (dir.z() < 0 ? 4u : 0u);
+        auto quantize = [](float v) { return static_cast<uint32_t>(std::min(std::abs(v), 1.0f) * 511.0f); };
+        return (octant << 18u) | (quantize(dir.x()) << 9u) | quantize(dir.y());
+    }
+
+    class WavefrontTileTask : public Task
+    {
+    private:
+        const Tile& tile;
+        const RenderSettings& renderSettings;
+        const ICamera& camera;
+        const Scene& scene;
+        FrameBuffer& buffer;
+        std::shared_ptr<FrameBuffer>& perfBuffer;
+        ProgressTracker& progress;
+        std::chrono::steady_clock::time_point deadline;
+
+        // Per camera sample state of the current pass
+        std::vector<Ray> rays;
+        std::vector<std::optional<SceneRayHitInfo>> hits;
+        std::vector<size_t> samplePixel;
+        std::vector<uint32_t> sampleSeed; // Seed of the sample sequences of the pixel
+        std::vector<uint32_t> sampleCameraIndex; // Index of the camera sample among the camera samples of its pixel
+        std::vector<RGB> sampleRadiance;
+
+        // Per pixel state of the current block of pixels
+        std::vector<PixelEstimate> estimates;
+
+        // Per path state, indexed by path slot, with one array per field. The stages only read the small fields
+        // they sort by (pathMaterialKind, pathRays) and touch the nodes and samplers of a path when it is processed.
+        // Samplers reference their path, the slots are only reallocated while no sampler is alive.
+        size_t pathSlotCount = 0;
+        std::vector<std::vector<TransportNode>> paths;
+        std::unique_ptr<std::optional<PathSampler>[]> samplers;
+        std::vector<uint32_t> pathMaterialKind; // Kind of the material of the node to shade, set in state Shade
+        std::vector<Ray> pathRays; // Extension ray, set in state Trace
+        std::vector<size_t> pathSample; // Camera sample the path contributes to
+        std::vector<int> pathMaterialSampleI;
+        std::vector<int> pathFirstNodeWithVariance; // Node the material AA samples restart from, -1 if there is none
+        std::vector<RGB> pathEnergy;
+
+        // Queues of path slots
+        std::vector<size_t> shadeQueue;
+        std::vector<size_t> nextShadeQueue;
+        std::vector<size_t> traceQueue;
+        std::vector<size_t> doneQueue;
+        std::vector<std::pair<uint32_t, size_t>> sortedQueue; // Sort key, path slot
+        ShadowRayQueue shadowRays;
+        PhotonQueryQueue photonQueries;
+
+        // Must only be called while no path is in flight.
+        void reservePathSlots(size_t count)
+        {
+            if(pathSlotCount >= count)
+            {
+                return;
+            }
+            pathSlotCount = count;
+            while(paths.size() < count)
+            {
+                paths.emplace_back().reserve(maxPathLength);
+            }
+            samplers = std::make_unique<std::optional<PathSampler>[]>(count);
+            pathMaterialKind.resize(count);
+            pathRays.resize(count);
+            pathSample.resize(count);
+            pathMaterialSampleI.resize(count);
+            pathFirstNodeWithVariance.resize(count);
+            pathEnergy.resize(count);
+        }
+
+        // Traces count rays in bundles of RayBundleSize, the remaining rays are traced one by one.
+        template<typename TGetRay, typename THandleHit>
+        void traceRays(size_t count, const TGetRay& getRay, const THandleHit& handleHit)
+        {
+            const size_t bundledRays = count - (count % RayBundleSize);
+            for(size_t start = 0; start < bundledRays; start += RayBundleSize)
+            {
+                RayBundle bundle;
+                for(RBSize_t rayI = 0; rayI < RayBundleSize; ++rayI)
+                {
+                    bundle[rayI] = getRay(start + rayI);
+                }
+                auto bundleHits = scene.traceRays(bundle);
+                for(RBSize_t rayI = 0; rayI < RayBundleSize; ++rayI)
+                {
+                    handleHit(start + rayI, bundleHits[rayI]);
+                }
+            }
+            for(size_t i = bundledRays; i < count; i++)
+            {
+                handleHit(i, scene.traceRay(getRay(i)));
+            }
+        }
+
+        // Starts sampling material AA sample materialSampleI of the path in the slot from node samplingStartIndex on.
+        void startSampler(size_t slot, int samplingStartIndex, int materialSampleI)
+        {
+            auto& sampler = samplers[slot].emplace(scene, paths[slot], samplingStartIndex, maxPathLength, renderSettings.materialAAModifier, materialSampleI, &shadowRays, &photonQueries);
+            const size_t sampleI = pathSample[slot];
+            sampler.useSequence(getPathSequence(sampleSeed[sampleI], sampleCameraIndex[sampleI], renderSettings.materialAAModifier, materialSampleI, renderSettings.sampler));
+        }
+
+        // Moves the path to the queue of the stage it needs next.
+        void schedule(size_t slot)
+        {
+            switch(samplers[slot]->getState())
+            {
+                case PathSampler::State::Shade:
+                    pathMaterialKind[slot] = samplers[slot]->getCurrentMaterial().getKind();
+                    nextShadeQueue.push_back(slot);
+                    break;
+                case PathSampler::State::Trace:
+                    pathRays[slot] = samplers[slot]->getExtensionRay();
+                    traceQueue.push_back(slot);
+                    break;
+                case PathSampler::State::Done:
+                    doneQueue.push_back(slot);
+                    break;
+            }
+        }
+
+        // Accumulate stage: adds the energy of the finished path to its camera sample, and restarts the path for the
+        // next material AA sample if needed.
+        void accumulate(size_t slot)
+        {
+            auto& path = paths[slot];
+            bool pathWasTerminated = samplers[slot]->finish();
+            if(pathMaterialSampleI[slot] == 0)
+            {
+                pathFirstNodeWithVariance[slot] = samplers[slot]->getFirstNodeWithVariance();
+            }
+            samplers[slot].reset();
+            if(!pathWasTerminated)
+            {
+                pathEnergy[slot] += calculatePathEnergy(path, scene);
+            }
+
+            const int firstNodeWithVariance = pathFirstNodeWithVariance[slot];
+            if(firstNodeWithVariance < 0)
+            {
+                sampleRadiance[pathSample[slot]] = pathEnergy[slot];
+                return;
+            }
+
+            const int nextSampleI = ++pathMaterialSampleI[slot];
+            if(nextSampleI < renderSettings.materialAAModifier)
+            {
+                // From the first geometry hit on, resample the transport path if the bsdf at the hitpoint has variance.
+                startSampler(slot, firstNodeWithVariance, nextSampleI);
+                schedule(slot);
+            }
+            else
+            {
+                sampleRadiance[pathSample[slot]] = pathEnergy[slot].divide(renderSettings.materialAAModifier);
+            }
+        }
+
+        // Shade stage: the paths are grouped by the kind of their material, so consecutive paths run the same material code.
+        void shade()
+        {
+            sortedQueue.clear();
+            for(size_t slot : shadeQueue)
+            {
+                sortedQueue.emplace_back(pathMaterialKind[slot], slot);
+            }
+            std::sort(sortedQueue.begin(), sortedQueue.end());
+
+            traceQueue.clear();
+            nextShadeQueue.clear();
+            doneQueue.clear();
+            for(const auto& entry : sortedQueue)
+            {
+                const size_t slot = entry.second;
+                samplers[slot]->shade();
+                schedule(slot);
+            }
+        }
+
+        // Extend stage: the extension rays are sorted by direction, so the rays in a bundle visit similar BVH nodes.
+        void extend()
+        {
+            sortedQueue.clear();
+            for(size_t slot : traceQueue)
+            {
+                sortedQueue.emplace_back(getDirectionKey(pathRays[slot].getDirection()), slot);
+            }
+            std::sort(sortedQueue.begin(), sortedQueue.end());
+
+            traceRays(sortedQueue.size(),
+                [this](size_t i) { return pathRays[sortedQueue[i].second]; },
+                [this](size_t i, const std::optional<SceneRayHitInfo>& hit)
+                {
+                    const size_t slot = sortedQueue[i].second;
+                    samplers[slot]->extend(hit);
+                    schedule(slot);
+                });
+        }
+
+        // Traces one pass of geometryAAModifier camera rays through each of the given pixels of the block.
+        void renderPass(size_t blockStart, const std::vector<size_t>& activePixels)
+        {
+            const int aaLevel = renderSettings.geometryAAModifier;
+            const size_t sampleCount = activePixels.size() * aaLevel;
+            rays.resize(sampleCount);
+            hits.resize(sampleCount);
+            samplePixel.resize(sampleCount);
+            sampleSeed.resize(sampleCount);
+            sampleCameraIndex.resize(sampleCount);
+            sampleRadiance.assign(sampleCount, RGB{});
+
+            for(size_t pixelI = 0; pixelI < activePixels.size(); pixelI++)
+            {
+                const size_t pixel = activePixels[pixelI];
+                const int x = tile.getXStart() + static_cast<int>((blockStart + pixel) % tile.getWidth());
+                const int y = tile.getYStart() + static_cast<int>((blockStart + pixel) / tile.getWidth());
+                const uint32_t pixelSeed = SampleSequence::pixelSeed(renderSettings.seed, x, y);
+                const int firstCameraSampleI = estimates[pixel].getSampleCount();
+                for(int i = 0; i < aaLevel; i++)
+                {
+                    const size_t sampleI = pixelI * aaLevel + i;
+                    samplePixel[sampleI] = pixel;
+                    sampleSeed[sampleI] = pixelSeed;
+                    sampleCameraIndex[sampleI] = firstCameraSampleI + i;
+                    rays[sampleI] = generateCameraRay(camera, buffer, renderSettings, x, y, firstCameraSampleI + i);
+                }
+            }
+            traceRays(sampleCount,
+                [this](size_t i) { return rays[i]; },
+                [this](size_t i, const std::optional<SceneRayHitInfo>& hit) { hits[i] = hit; });
+
+            // Start a path for each camera ray that hits geometry
+            reservePathSlots(sampleCount);
+            shadeQueue.clear();
+            size_t slot = 0;
+            for(size_t sampleI = 0; sampleI < sampleCount; sampleI++)
+            {
+                auto directRadiance = getDirectCameraRayRadiance(scene, rays[sampleI], hits[sampleI]);
+                if(directRadiance.has_value())
+                {
+                    sampleRadiance[sampleI] = *directRadiance;
+                    continue;
+                }
+
+                paths[slot].clear();
+                paths[slot].emplace_back(*hits[sampleI]);
+                pathSample[slot] = sampleI;
+                startSampler(slot, 0, 0);
+                pathMaterialSampleI[slot] = 0;
+                pathEnergy[slot] = RGB{};
+                pathMaterialKind[slot] = samplers[slot]->getCurrentMaterial().getKind();
+                shadeQueue.push_back(slot);
+                slot++;
+            }
+
+            // Advance all paths by one bounce per iteration
+            while(!shadeQueue.empty())
+            {
+                shade();
+                extend();
+
+                // Shadow stage: the shadow rays of next event estimation are traced in bundles before any path that
+                // queued one is accumulated. Photon map lookups are resolved in batches in the same way.
+                shadowRays.resolve(scene);
+                photonQueries.resolve(scene);
+                for(size_t doneSlot : doneQueue)
+                {
+                    accumulate(doneSlot);
+                }
+
+                std::swap(shadeQueue, nextShadeQueue);
+            }
+
+            for(size_t sampleI = 0; sampleI < sampleCount; sampleI++)
+            {
+                estimates[samplePixel[sampleI]].addSample(sampleRadiance[sampleI]);
+            }
+        }
+
+    public:
+        WavefrontTileTask(const Tile &tile, const RenderSettings &renderSettings, const ICamera &camera, const Scene &scene, FrameBuffer &buffer, std::shared_ptr<FrameBuffer>& perfBuffer, ProgressTracker &progress, std::chrono::steady_clock::time_point deadline)
+                : tile(tile), renderSettings(renderSettings), camera(camera), scene(scene), buffer(buffer), perfBuffer(perfBuffer), progress(progress), deadline(deadline)
+        {}
+
+        void execute() override
+        {
+            const bool adaptive = renderSettings.noiseThreshold > 0;
+            const int maxSamples = std::max(renderSettings.geometryAAModifier, renderSettings.maxSamplesPerPixel);
+
+            const size_t pixelCount = static_cast<size_t>(tile.getWidth()) * tile.getHeight();
+            const size_t blockSize = std::max<size_t>(1, maxWavefrontSize / renderSettings.geometryAAModifier);
+            std::vector<size_t> activePixels;
+
+            for(size_t blockStart = 0; blockStart < pixelCount; blockStart += blockSize)
+            {
+                const size_t blockEnd = std::min(pixelCount, blockStart + blockSize);
+                estimates.assign(blockEnd - blockStart, PixelEstimate{});
+                activePixels.clear();
+                for(size_t pixel = 0; pixel < blockEnd - blockStart; pixel++)
+                {
+                    activePixels.push_back(pixel);
+                }
+
+                // Render in passes of geometryAAModifier camera rays. Without adaptive sampling, only one pass is done.
+                do
+                {
+                    renderPass(blockStart, activePixels);
+                    activePixels.erase(std::remove_if(activePixels.begin(), activePixels.end(), [&](size_t pixel)
+                    {
+                        const auto& estimate = estimates[pixel];
+                        return estimate.getSampleCount() + renderSettings.geometryAAModifier > maxSamples
+                               || estimate.hasConverged(renderSettings.noiseThreshold);
+                    }), activePixels.end());
+                } while(adaptive && !activePixels.empty() && std::chrono::steady_clock::now() < deadline);
+
+                for(size_t pixel = 0; pixel < blockEnd - blockStart; pixel++)
+                {
+                    const int x = tile.getXStart() + static_cast<int>((blockStart + pixel) % tile.getWidth());
+                    const int y = tile.getYStart() + static_cast<int>((blockStart + pixel) / tile.getWidth());
+                    const auto& estimate = estimates[pixel];
+                    buffer.setPixel(x, y, estimate.getMean());
+                    unsigned int visited = estimate.getSampleCount();
+                    float log_visited = visited == 0 ? 0 : (float)std::log((long double)visited);
+                    perfBuffer->setPixel(x, y, RGB(visited, log_visited, 0));
+                }
+            }
+            progress.signalTaskFinished();
+        }
+    };
+}
+
+void WavefrontRenderer::render(const Scene &scene, FrameBuffer &buffer, std::shared_ptr<FrameBuffer>& perfBuffer, const Tile &tile, const RenderSettings &renderSettings, ProgressMonitor progressMon, bool multithreaded)
+{
+    std::vector<Tile> tiles;
+
+    if(multithreaded)
+    {
+        tiles = subdivideTilePerCores(tile);
+    }
+    else
+    {
+        tiles.push_back(tile);
+    }
+
+    ProgressTracker progress(progressMon);
+    progress.startNewJob("Rendering tiles", tiles.size());
+
+    const ICamera& camera = findCamera(scene);
+    const auto deadline = getRenderDeadline(renderSettings);
+
+    std::vector<std::unique_ptr<Task>> tasks;
+    for(const auto& curTile : tiles)
+    {
+        tasks.push_back(std::make_unique<WavefrontTileTask>(
+            curTile, renderSettings, camera, scene, buffer, perfBuffer, progress, deadline
+        ));
+    }
+    Task::runTasks(tasks);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "Renderer.h"
+
+// Breadth-first path tracer: instead of sampling the paths of a pixel one after the other, all camera samples of a
+// block of pixels are advanced together, one bounce per iteration. Each iteration shades all paths grouped by material,
+// traces all extension rays in bundles sorted by direction, and then tests the queued shadow rays in bundles.
+// Produces the same estimate as Renderer.
+class WavefrontRenderer : public Renderer
+{
+public:
+    using Renderer::render;
+    void render(const Scene &scene, FrameBuffer &buffer, std::shared_ptr<FrameBuffer>& perfBuffer, const Tile &tile, const RenderSettings &renderSettings, ProgressMonitor progressMon, bool multithreaded) override;
+};
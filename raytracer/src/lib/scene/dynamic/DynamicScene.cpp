@@ -1,6 +1,7 @@
 #include "DynamicScene.h"
 #include "shape/list/InstancedModelList.h"
 #include "shape/bvh/BVHBuilder.h"
+#include "shape/bvh/BVHCache.h"
 #include "shape/TriangleMesh.h"
 #include "material/CompositeMaterial.h"
 #include <iostream>
@@ -96,7 +97,7 @@ DynamicScene DynamicScene::soupifyScene(Statistics::Collector* stats) const
     return result;
 }
 
-Scene DynamicScene::build(Statistics::Collector* stats) const
+Scene DynamicScene::build(Statistics::Collector* stats, const BVHBuildSettings& bvhSettings) const
 {
 	// Flatten scene
 	std::vector<std::unique_ptr<PointLight>> pointLights{};
@@ -134,7 +135,8 @@ Scene DynamicScene::build(Statistics::Collector* stats) const
 		}
 		if (node.model != nullptr)
 		{
-			models.emplace_back(transform, node.model->clone());
+			auto& model = models.emplace_back(transform, node.model->clone());
+			model.getData().compileMaterial();
 		}
 
 		return std::make_pair(transform, true);
@@ -148,11 +150,29 @@ Scene DynamicScene::build(Statistics::Collector* stats) const
 
 	// Calculate scene BVH
 	InstancedModelList modelList(std::move(models));
-	modelList.buildShapeBVHCache(stats);
+	const uint64_t geometryHash = modelList.getContentHash();
+	std::unique_ptr<BVHCache> bvhCache;
+	if(!bvhSettings.cacheDirectory.empty())
+	{
+		bvhCache = std::make_unique<BVHCache>(bvhSettings.cacheDirectory);
+	}
+	modelList.buildShapeBVHCache(stats, bvhSettings, bvhCache.get());
 
-	auto sceneBVH = BVHBuilder<SceneRayHitInfo>::buildBVH(modelList, stats);
+	auto sceneBVH = bvhCache != nullptr
+		? bvhCache->getOrBuild(modelList, bvhSettings, 4, stats)
+		: BVHBuilder<SceneRayHitInfo>::buildBVH(modelList, stats, bvhSettings);
     LOGSTAT(stats, "TopLevelBVHNodeCount", sceneBVH.getSize());
+    if(!sceneBVH.isPacked())
+    {
+        sceneBVH.pack();
+    }
+    if(bvhCache != nullptr)
+    {
+        LOGSTAT(stats, "BVHCacheHits", bvhCache->getHitCount());
+        LOGSTAT(stats, "BVHCacheMisses", bvhCache->getMissCount());
+    }
 	Scene scene(std::move(pointLights), std::move(areaLights), std::move(directionalLights), std::move(cameras), std::move(sceneBVH));
+	scene.setGeometryHash(geometryHash);
 	if(this->environmentMaterial != nullptr)
     {
         scene.setEnvironmentMaterial(this->environmentMaterial->clone());
@@ -6,6 +6,7 @@
 #include "DynamicSceneNode.h"
 #include "scene/renderable/Scene.h"
 #include "utility/StatCollector.h"
+#include "shape/bvh/BVHBuildSettings.h"
 
 class DynamicScene
 {
@@ -19,7 +20,7 @@ public:
 	}
 
     DynamicScene soupifyScene(Statistics::Collector* stats = nullptr) const;
-    Scene build(Statistics::Collector* stats = nullptr) const;
+    Scene build(Statistics::Collector* stats = nullptr, const BVHBuildSettings& bvhSettings = {}) const;
 
 //private:
 	std::unique_ptr<DynamicSceneNode> root;
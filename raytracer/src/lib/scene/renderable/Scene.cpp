@@ -1,4 +1,26 @@
 #include "Scene.h"
+#include "utility/Hash.h"
+
+namespace
+{
+    template<typename T>
+    uint64_t hashValue(uint64_t seed, const T& value)
+    {
+        return Hash::combine(seed, Hash::bytes(&value, sizeof(value)));
+    }
+
+    uint64_t hashPoint(uint64_t seed, const Vector3& point)
+    {
+        return Hash::combine(seed, Hash::bytes(point.data(), 3 * sizeof(float)));
+    }
+
+    uint64_t hashColor(uint64_t seed, const RGB& color)
+    {
+        seed = hashValue(seed, color.getRed());
+        seed = hashValue(seed, color.getGreen());
+        return hashValue(seed, color.getBlue());
+    }
+}
 
 Scene::Scene(
 	std::vector<std::unique_ptr<PointLight>>&& pointLights,
@@ -8,7 +30,7 @@ Scene::Scene(
 	SceneBVH&& sceneBVH
 )
 	: pointLights(std::move(pointLights)), areaLights(std::move(areaLights)), directionalLights(std::move(directionalLights)),
-	  cameras(std::move(cameras)), sceneBVH(std::move(sceneBVH))
+	  lightTree(this->pointLights, this->areaLights), areaLightBVH(this->areaLights), cameras(std::move(cameras)), sceneBVH(std::move(sceneBVH))
 { }
 
 std::optional<SceneRayHitInfo> Scene::traceRay(const Ray& ray) const
@@ -21,7 +43,39 @@ std::optional<SceneRayHitInfo> Scene::testVisibility(const Ray &ray, float maxT)
     return this->sceneBVH.testVisibility(ray, maxT);
 }
 
+RayBundleMask Scene::testVisibilities(const RayBundle& rays, const RayBundleMaxT& maxT, RayBundleMask rayMask) const
+{
+    return this->sceneBVH.testVisibilities(rays, maxT, rayMask);
+}
+
 HitBundle<SceneRayHitInfo> Scene::traceRays(RayBundle& rays) const
 {
     return this->sceneBVH.traceRays(rays);
 }
+
+uint64_t Scene::getContentHash() const
+{
+    uint64_t hash = hashValue(this->geometryHash, this->pointLights.size());
+    for(const auto& light : this->pointLights)
+    {
+        hash = hashPoint(hash, light->pos);
+        hash = hashColor(hash, light->color);
+        hash = hashValue(hash, light->intensity);
+    }
+    hash = hashValue(hash, this->areaLights.size());
+    for(const auto& light : this->areaLights)
+    {
+        hash = hashPoint(hashPoint(hashPoint(hash, light->a), light->b), light->c);
+        hash = hashColor(hash, light->color);
+        hash = hashValue(hash, light->intensity);
+    }
+    hash = hashValue(hash, this->directionalLights.size());
+    for(const auto& light : this->directionalLights)
+    {
+        hash = hashPoint(hash, light->direction);
+        hash = hashColor(hash, light->color);
+        hash = hashValue(hash, light->intensity);
+        hash = hashValue(hash, light->angle);
+    }
+    return hash;
+}
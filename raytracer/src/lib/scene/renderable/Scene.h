@@ -11,7 +11,10 @@
 #include "light/PointLight.h"
 #include "light/AreaLight.h"
 #include "light/DirectionalLight.h"
+#include "light/LightTree.h"
+#include "light/AreaLightBVH.h"
 #include "material/environment/IEnvironmentMaterial.h"
+#include "material/LightSamplingMode.h"
 #include "photonmapping/PhotonMap.h"
 
 class Scene
@@ -42,6 +45,12 @@ public:
         return this->directionalLights;
     }
 
+    // Hierarchy over the point and area lights, to pick the lights to sample
+    const LightTree& getLightTree() const
+    {
+        return this->lightTree;
+    }
+
 	const std::vector<SceneNode<ICamera>>& getCameras() const
 	{
 		return this->cameras;
@@ -72,6 +81,17 @@ public:
 	    photonMap = std::move(map);
     }
 
+    // Precomputed radiance used instead of density estimates where paths read from the photon map, see RadianceCache
+    const std::optional<PhotonMap>& getRadianceCache() const
+    {
+        return radianceCache;
+    }
+
+    void setRadianceCache(std::optional<PhotonMap> cache)
+    {
+        radianceCache = std::move(cache);
+    }
+
     PhotonMapMode getPhotonMapMode() const
     {
         return photonMappingMode;
@@ -92,21 +112,54 @@ public:
 	    return photonMapDepth;
     }
 
+    // Hash of the placement of the models and of the lights, stable across processes. Cameras and materials are not
+    // included. Used to check that a photon map file was built for this scene.
+    uint64_t getContentHash() const;
+
+    // Content hash of the model list, see IShapeList::getContentHash
+    void setGeometryHash(uint64_t hash)
+    {
+        geometryHash = hash;
+    }
+
+    LightSamplingMode getLightSamplingMode() const
+    {
+        return lightSamplingMode;
+    }
+
+    void setLightSamplingMode(LightSamplingMode mode)
+    {
+        lightSamplingMode = mode;
+    }
+
     // Get first hit
 	std::optional<SceneRayHitInfo> traceRay(const Ray& ray) const;
     HitBundle<SceneRayHitInfo> traceRays(RayBundle& ray) const;
 
+    // Get the closest area light hit by the ray that is closer than maxT. Area lights are not part of the scene BVH.
+    std::optional<AreaLightBVH::Hit> traceAreaLights(const Ray& ray, float maxT = INFINITY) const
+    {
+        return this->areaLightBVH.traceRay(ray, maxT);
+    }
+
 	// Get any hit between origin and maxT
     std::optional<SceneRayHitInfo> testVisibility(const Ray& ray, float maxT) const;
+    // Test the rays of the bundle in rayMask for any hit between their origin and maxT, returns the mask of occluded rays
+    RayBundleMask testVisibilities(const RayBundle& rays, const RayBundleMaxT& maxT, RayBundleMask rayMask = FullRayBundleMask) const;
 
 private:
 	std::vector<std::unique_ptr<PointLight>> pointLights;
 	std::vector<std::unique_ptr<AreaLight>> areaLights;
     std::vector<std::unique_ptr<DirectionalLight>> directionalLights;
+    LightTree lightTree;
+    AreaLightBVH areaLightBVH;
 	std::vector<SceneNode<ICamera>> cameras;
 	std::unique_ptr<IEnvironmentMaterial> environmentMaterial = nullptr;
 	std::optional<PhotonMap> photonMap;
+    std::optional<PhotonMap> radianceCache;
     PhotonMapMode photonMappingMode = PhotonMapMode::none;
     int photonMapDepth = 0;
+    LightSamplingMode lightSamplingMode = LightSamplingMode::alternate;
+    uint64_t geometryHash = 0;
 	SceneBVH sceneBVH;
 };
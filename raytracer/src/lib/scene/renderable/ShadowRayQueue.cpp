@@ -0,0 +1,43 @@
+#include "ShadowRayQueue.h"
+#include "Scene.h"
+
+#undef min
+
+void ShadowRayQueue::push(const Ray& ray, float maxT, RGB& radiance)
+{
+    rays.push_back(ray);
+    maxTs.push_back(maxT);
+    radiances.push_back(&radiance);
+}
+
+size_t ShadowRayQueue::resolve(const Scene& scene)
+{
+    size_t occludedCount = 0;
+    for(size_t start = 0; start < rays.size(); start += RayBundleSize)
+    {
+        const auto bundleSize = static_cast<RBSize_t>(std::min<size_t>(RayBundleSize, rays.size() - start));
+        RayBundle bundle;
+        RayBundleMaxT bundleMaxT {};
+        for(RBSize_t rayI = 0; rayI < bundleSize; ++rayI)
+        {
+            bundle[rayI] = rays[start + rayI];
+            bundleMaxT[rayI] = maxTs[start + rayI];
+        }
+
+        const RayBundleMask rayMask = bundleSize == RayBundleSize ? FullRayBundleMask : (RayBundleMask(1) << bundleSize) - 1;
+        const RayBundleMask occluded = scene.testVisibilities(bundle, bundleMaxT, rayMask);
+        for(RBSize_t rayI = 0; rayI < bundleSize; ++rayI)
+        {
+            if((occluded >> rayI) & 1u)
+            {
+                *radiances[start + rayI] = RGB::BLACK;
+                occludedCount++;
+            }
+        }
+    }
+
+    rays.clear();
+    maxTs.clear();
+    radiances.clear();
+    return occludedCount;
+}
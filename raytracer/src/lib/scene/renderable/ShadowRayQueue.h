@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include "math/Ray.h"
+#include "film/RGB.h"
+
+class Scene;
+
+/*
+ * Occlusion queries whose result is only needed later. Queries are collected while shading, and resolved all at once
+ * with the bundled any-hit traversal of Scene::testVisibilities.
+ * Each query refers to the radiance transported along its ray, which is set to black if the ray turns out to be
+ * occluded. The radiance must stay at the same address until the queue is resolved.
+ */
+class ShadowRayQueue
+{
+public:
+    void push(const Ray& ray, float maxT, RGB& radiance);
+
+    // Tests all queued rays and empties the queue. Returns the amount of occluded rays.
+    size_t resolve(const Scene& scene);
+
+    size_t size() const
+    {
+        return rays.size();
+    }
+
+    bool empty() const
+    {
+        return rays.empty();
+    }
+
+private:
+    std::vector<Ray> rays;
+    std::vector<float> maxTs;
+    std::vector<RGB*> radiances;
+};
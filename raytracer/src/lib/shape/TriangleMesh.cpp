@@ -1,6 +1,7 @@
 #include "TriangleMesh.h"
 #include <Eigen/Dense>
 #include <numeric>
+#include <algorithm>
 
 #define SOASORT_USE_TBB_PARALLEL
 #include "utility/soa_sort.h"
@@ -54,6 +55,50 @@ TriangleMeshData* TriangleMeshData::cloneImpl() const {
     return new TriangleMeshData(*this);
 }
 
+void TriangleMeshData::quantizeAttributes()
+{
+    if(packedNormals.empty() && !normals.empty())
+    {
+        packedNormals.resize(normals.size());
+        std::transform(normals.begin(), normals.end(), packedNormals.begin(), OctahedralNormal::encode);
+        std::vector<Vector3>().swap(normals);
+    }
+    if(packedTexCoords.empty() && !texCoords.empty())
+    {
+        packedTexCoords.resize(texCoords.size());
+        std::transform(texCoords.begin(), texCoords.end(), packedTexCoords.begin(), HalfVector2::encode);
+        std::vector<Vector2>().swap(texCoords);
+    }
+}
+
+void TriangleMeshData::unpackAttributes()
+{
+    if(!packedNormals.empty())
+    {
+        normals.resize(packedNormals.size());
+        std::transform(packedNormals.begin(), packedNormals.end(), normals.begin(), [](const auto& n){ return n.decode(); });
+        std::vector<OctahedralNormal>().swap(packedNormals);
+    }
+    if(!packedTexCoords.empty())
+    {
+        texCoords.resize(packedTexCoords.size());
+        std::transform(packedTexCoords.begin(), packedTexCoords.end(), texCoords.begin(), [](const auto& uv){ return uv.decode(); });
+        std::vector<HalfVector2>().swap(packedTexCoords);
+    }
+}
+
+void TriangleMeshData::shareAttributeIndices()
+{
+    if(!normalIndices.empty() && normalIndices == vertexIndices && getNormalCount() == vertices.size())
+    {
+        std::vector<std::array<uint32_t, 3>>().swap(normalIndices);
+    }
+    if(!texCoordIndices.empty() && texCoordIndices == vertexIndices && getTexCoordCount() == vertices.size())
+    {
+        std::vector<std::array<uint32_t, 3>>().swap(texCoordIndices);
+    }
+}
+
 Point TriangleMesh::getCentroid() const
 {
     if (!this->centroid.has_value())
@@ -98,9 +143,187 @@ AABB TriangleMesh::getAABB() const
 
 std::optional<RayHitInfo> TriangleMesh::intersect(const Ray& ray) const
 {
-	std::optional<RayHitInfo> bestHit;
+    return this->intersectTriangles(ray, this->beginIdx, this->endIdx);
+}
 
-    for(size_type triangleI = this->beginIdx; triangleI < this->endIdx; ++triangleI)
+#ifdef ENABLE_SIMD
+namespace
+{
+    // Intersect the ray with the triangles [begin, end) of the SoA data, 8 triangles at a time (Möller–Trumbore).
+    // Finds the nearest hit with t < maxT, or if AnyHit is set, the first hit with t <= maxT.
+    template<bool AnyHit>
+    bool intersectTriangleSoA(const TriangleSoA& soa, const Ray& ray, size_t begin, size_t end, float maxT,
+                              size_t& hitIdx, Triangle::TriangleIntersection& hit)
+    {
+        // Loading 8 floats at (8 - remaining) gives a mask with the first 'remaining' lanes set.
+        alignas(32) static const int32_t laneMaskTable[16] = {-1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0};
+
+        const auto& o = ray.getOrigin();
+        const auto& d = ray.getDirection();
+        const __m256 ox = _mm256_set1_ps(o.x()), oy = _mm256_set1_ps(o.y()), oz = _mm256_set1_ps(o.z());
+        const __m256 dx = _mm256_set1_ps(d.x()), dy = _mm256_set1_ps(d.y()), dz = _mm256_set1_ps(d.z());
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+
+        float bestT = maxT;
+        bool found = false;
+        alignas(32) std::array<float, 8> tLanes, uLanes, vLanes;
+        for(size_t i = begin; i < end; i += 8)
+        {
+            const __m256 e1x = _mm256_loadu_ps(&soa.e1[0][i]), e1y = _mm256_loadu_ps(&soa.e1[1][i]), e1z = _mm256_loadu_ps(&soa.e1[2][i]);
+            const __m256 e2x = _mm256_loadu_ps(&soa.e2[0][i]), e2y = _mm256_loadu_ps(&soa.e2[1][i]), e2z = _mm256_loadu_ps(&soa.e2[2][i]);
+
+            // p = d x e2, det = e1 . p
+            const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+            const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+            const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+            const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+            const __m256 invDet = _mm256_div_ps(one, det);
+
+            // s = o - v0, u = (s . p) / det
+            const __m256 sx = _mm256_sub_ps(ox, _mm256_loadu_ps(&soa.v0[0][i]));
+            const __m256 sy = _mm256_sub_ps(oy, _mm256_loadu_ps(&soa.v0[1][i]));
+            const __m256 sz = _mm256_sub_ps(oz, _mm256_loadu_ps(&soa.v0[2][i]));
+            const __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), invDet);
+
+            // q = s x e1, v = (d . q) / det, t = (e2 . q) / det
+            const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+            const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+            const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+            const __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+            const __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+            __m256 mask = _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ);
+            mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+            mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+            mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+            mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+            mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(bestT), AnyHit ? _CMP_LE_OQ : _CMP_LT_OQ));
+            if(end - i < 8)
+            {
+                mask = _mm256_and_ps(mask, _mm256_loadu_ps(reinterpret_cast<const float*>(laneMaskTable + 8 - (end - i))));
+            }
+
+            int hitLanes = _mm256_movemask_ps(mask);
+            if(hitLanes == 0)
+            {
+                continue;
+            }
+
+            _mm256_store_ps(tLanes.data(), t);
+            _mm256_store_ps(uLanes.data(), u);
+            _mm256_store_ps(vLanes.data(), v);
+            for(int lane = 0; lane < 8; ++lane)
+            {
+                if(((hitLanes >> lane) & 1) && (AnyHit || tLanes[lane] < bestT))
+                {
+                    bestT = tLanes[lane];
+                    hitIdx = i + lane;
+                    hit.t = tLanes[lane];
+                    hit.beta = uLanes[lane];
+                    hit.gamma = vLanes[lane];
+                    found = true;
+                    if(AnyHit)
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+        return found;
+    }
+}
+#endif
+
+void TriangleMesh::precomputeTraceData()
+{
+#ifdef ENABLE_SIMD
+    const auto triangleCount = data->vertexIndices.size();
+    TriangleSoA soa;
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        // Padding triangles have zero-length edges, the kernel rejects them as degenerate.
+        soa.v0[axis].assign(triangleCount + TriangleSoA::Padding, 0.0f);
+        soa.e1[axis].assign(triangleCount + TriangleSoA::Padding, 0.0f);
+        soa.e2[axis].assign(triangleCount + TriangleSoA::Padding, 0.0f);
+    }
+    for(size_type triangleI = 0; triangleI < triangleCount; ++triangleI)
+    {
+        const auto& indices = data->vertexIndices[triangleI];
+        const auto& a = data->vertices[indices[0]];
+        const auto& b = data->vertices[indices[1]];
+        const auto& c = data->vertices[indices[2]];
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            soa.v0[axis][triangleI] = a[axis];
+            soa.e1[axis][triangleI] = b[axis] - a[axis];
+            soa.e2[axis][triangleI] = c[axis] - a[axis];
+        }
+    }
+    data->triangleSoA = std::move(soa);
+#endif
+}
+
+RayHitInfo TriangleMesh::interpolateHit(const Ray& ray, size_type triangleI, const Triangle::TriangleIntersection& intersection) const
+{
+    const auto& indices = data->vertexIndices[triangleI];
+    const auto& a = data->vertices[indices[0]];
+    const auto& b = data->vertices[indices[1]];
+    const auto& c = data->vertices[indices[2]];
+
+    float alfa = 1.0f - intersection.beta - intersection.gamma;
+
+    const auto& normalIndices = data->getNormalIndices(triangleI);
+    const auto aNormal = data->getNormal(normalIndices[0]);
+    const auto bNormal = data->getNormal(normalIndices[1]);
+    const auto cNormal = data->getNormal(normalIndices[2]);
+    Vector3 normal = (alfa * aNormal) + (intersection.beta * bNormal) + (intersection.gamma * cNormal);
+
+    Vector2 texcoord;
+    Vector3 tangent;
+    if(data->hasTexCoords())
+    {
+        const auto& texCoordIndices = data->getTexCoordIndices(triangleI);
+        const auto aTexCoord = data->getTexCoord(texCoordIndices[0]);
+        const auto bTexCoord = data->getTexCoord(texCoordIndices[1]);
+        const auto cTexCoord = data->getTexCoord(texCoordIndices[2]);
+        texcoord = (alfa * aTexCoord) + (intersection.beta * bTexCoord) + (intersection.gamma * cTexCoord);
+
+        Eigen::Matrix2f uvMat{};
+        uvMat.row(0) = bTexCoord - aTexCoord;
+        uvMat.row(1) = cTexCoord - aTexCoord;
+
+        Eigen::Matrix<float, 2, 3> deltaPosMat {};
+        deltaPosMat.row(0) = b - a;
+        deltaPosMat.row(1) = c - a;
+
+        tangent = (uvMat.inverse() * deltaPosMat).row(0);
+    }else{
+        texcoord = Vector2(0, 0);
+        tangent = b - a;
+    }
+
+    RayHitInfo hit(ray, intersection.t, normal, texcoord, tangent);
+    hit.triangleIndex = triangleI;
+    return hit;
+}
+
+std::optional<RayHitInfo> TriangleMesh::intersectTriangles(const Ray& ray, size_type triangleBegin, size_type triangleEnd) const
+{
+    // Find the nearest triangle first, only interpolate the vertex attributes of that one.
+    bool found = false;
+    size_type bestTriangle = 0;
+    Triangle::TriangleIntersection bestIntersection {};
+
+#ifdef ENABLE_SIMD
+    if(data->triangleSoA.has_value())
+    {
+        found = intersectTriangleSoA<false>(*data->triangleSoA, ray, triangleBegin, triangleEnd, INFINITY, bestTriangle, bestIntersection);
+        return found ? std::make_optional(interpolateHit(ray, bestTriangle, bestIntersection)) : std::nullopt;
+    }
+#endif
+
+    for(size_type triangleI = triangleBegin; triangleI < triangleEnd; ++triangleI)
 	{
 		const auto& indices = data->vertexIndices[triangleI];
 		const auto& a = data->vertices[indices[0]];
@@ -109,51 +332,40 @@ std::optional<RayHitInfo> TriangleMesh::intersect(const Ray& ray) const
 
         Triangle::TriangleIntersection intersection;
 		bool hasIntersection = Triangle::intersect(ray, a, b, c, intersection);
-		if(hasIntersection && (!bestHit.has_value() || bestHit->t > intersection.t))
+		if(hasIntersection && (!found || bestIntersection.t > intersection.t))
 		{
-			float alfa = 1.0f - intersection.beta - intersection.gamma;
-
-			const auto& normalIndices = data->normalIndices[triangleI];
-            const auto& aNormal = data->normals[normalIndices[0]];
-            const auto& bNormal = data->normals[normalIndices[1]];
-            const auto& cNormal = data->normals[normalIndices[2]];
-			Vector3 normal = (alfa * aNormal) + (intersection.beta * bNormal) + (intersection.gamma * cNormal);
-
-			Vector2 texcoord;
-			Vector3 tangent;
-			if(!data->texCoordIndices.empty() && !data->texCoords.empty())
-			{
-				const auto& texCoordIndices = data->texCoordIndices[triangleI];
-                const auto& aTexCoord = data->texCoords[texCoordIndices[0]];
-                const auto& bTexCoord = data->texCoords[texCoordIndices[1]];
-                const auto& cTexCoord = data->texCoords[texCoordIndices[2]];
-				texcoord = (alfa * aTexCoord) + (intersection.beta * bTexCoord) + (intersection.gamma * cTexCoord);
-
-                Eigen::Matrix2f uvMat{};
-                uvMat.row(0) = bTexCoord - aTexCoord;
-                uvMat.row(1) = cTexCoord - aTexCoord;
-
-                Eigen::Matrix<float, 2, 3> deltaPosMat {};
-                deltaPosMat.row(0) = b - a;
-                deltaPosMat.row(1) = c - a;
-
-                tangent = (uvMat.inverse() * deltaPosMat).row(0);
-			}else{
-			    texcoord = Vector2(0, 0);
-			    tangent = b - a;
-			}
-
-			bestHit = RayHitInfo(ray, intersection.t, normal, texcoord, tangent);
-            bestHit->triangleIndex = triangleI;
+		    found = true;
+		    bestTriangle = triangleI;
+		    bestIntersection = intersection;
 		}
 	}
 
-	return bestHit;
+	return found ? std::make_optional(interpolateHit(ray, bestTriangle, bestIntersection)) : std::nullopt;
 }
 
 std::optional<RayHitInfo> TriangleMesh::testVisibility(const Ray& ray, float maxT) const
 {
-    for(size_type triangleI = this->beginIdx; triangleI < this->endIdx; ++triangleI)
+    return this->testVisibilityTriangles(ray, maxT, this->beginIdx, this->endIdx);
+}
+
+std::optional<RayHitInfo> TriangleMesh::testVisibilityTriangles(const Ray& ray, float maxT, size_type triangleBegin, size_type triangleEnd) const
+{
+#ifdef ENABLE_SIMD
+    if(data->triangleSoA.has_value())
+    {
+        size_type triangleI;
+        Triangle::TriangleIntersection intersection {};
+        if(intersectTriangleSoA<true>(*data->triangleSoA, ray, triangleBegin, triangleEnd, maxT, triangleI, intersection))
+        {
+            RayHitInfo hit(ray, intersection.t, Vector3(0, 0, 0), Vector2(0, 0), Vector3(0, 0, 0));
+            hit.triangleIndex = triangleI;
+            return hit;
+        }
+        return std::nullopt;
+    }
+#endif
+
+    for(size_type triangleI = triangleBegin; triangleI < triangleEnd; ++triangleI)
     {
         const auto& indices = data->vertexIndices[triangleI];
         const auto& a = data->vertices[indices[0]];
@@ -211,6 +423,53 @@ Point TriangleMesh::getCentroid(size_type index) const
 	return (p1 + p2 + p3)/3;
 }
 
+namespace
+{
+    // Calls f with iterators to the element at offset of each optional per-triangle array that is present
+    // (normalIndices, texCoordIndices, permutation), so they can be permuted together with vertexIndices.
+    template<int ArrayI = 0, typename F, typename... Iterators>
+    void withTriangleArrays(TriangleMeshData& data, size_t offset, F&& f, Iterators... iterators)
+    {
+        if constexpr(ArrayI == 0)
+        {
+            if(!data.normalIndices.empty())
+            {
+                withTriangleArrays<1>(data, offset, f, iterators..., data.normalIndices.begin() + offset);
+            }
+            else
+            {
+                withTriangleArrays<1>(data, offset, f, iterators...);
+            }
+        }
+        else if constexpr(ArrayI == 1)
+        {
+            if(!data.texCoordIndices.empty())
+            {
+                withTriangleArrays<2>(data, offset, f, iterators..., data.texCoordIndices.begin() + offset);
+            }
+            else
+            {
+                withTriangleArrays<2>(data, offset, f, iterators...);
+            }
+        }
+        else if constexpr(ArrayI == 2)
+        {
+            if(data.permutation.has_value())
+            {
+                withTriangleArrays<3>(data, offset, f, iterators..., data.permutation->begin() + offset);
+            }
+            else
+            {
+                withTriangleArrays<3>(data, offset, f, iterators...);
+            }
+        }
+        else
+        {
+            f(iterators...);
+        }
+    }
+}
+
 template<bool AllowParallelization>
 void TriangleMesh::sortByCentroidImpl(Axis axis)
 {
@@ -236,36 +495,13 @@ void TriangleMesh::sortByCentroidImpl(Axis axis)
         return c1[static_cast<int>(axis)] < c2[static_cast<int>(axis)];
     };
 
+    data->triangleSoA.reset();
+
     auto vertBegin = data->vertexIndices.begin() + this->beginIdx;
     auto vertEnd = data->vertexIndices.begin() + this->endIdx;
-    auto normBegin = data->normalIndices.begin() + this->beginIdx;
-
-    if(data->permutation.has_value()){
-        if (data->texCoordIndices.empty()) {
-            soa_sort::sort_cmp<AllowParallelization>(
-                    vertBegin, vertEnd,
-                    comparator,
-                    normBegin, data->permutation->begin() + this->beginIdx);
-        } else {
-            soa_sort::sort_cmp<AllowParallelization>(
-                    vertBegin, vertEnd,
-                    comparator,
-                    normBegin, data->texCoordIndices.begin() + this->beginIdx,
-                    data->permutation->begin() + this->beginIdx);
-        }
-    }else{
-        if (data->texCoordIndices.empty()) {
-            soa_sort::sort_cmp<AllowParallelization>(
-                    vertBegin, vertEnd,
-                    comparator,
-                    normBegin);
-        } else {
-            soa_sort::sort_cmp<AllowParallelization>(
-                    vertBegin, vertEnd,
-                    comparator,
-                    normBegin, data->texCoordIndices.begin() + this->beginIdx);
-        }
-    }
+    withTriangleArrays(*data, this->beginIdx, [&vertBegin, &vertEnd, &comparator](auto... arrays){
+        soa_sort::sort_cmp<AllowParallelization>(vertBegin, vertEnd, comparator, arrays...);
+    });
 }
 
 void TriangleMesh::sortByCentroid(Axis axis, bool allowParallelization)
@@ -277,6 +513,172 @@ void TriangleMesh::sortByCentroid(Axis axis, bool allowParallelization)
 	}
 }
 
+TriangleMesh::size_type TriangleMesh::partitionByCentroid(const std::function<bool(const Point&)>& isLeft)
+{
+    data->triangleSoA.reset();
+
+    // Hoare-style partition, all per-triangle arrays have to be swapped together.
+    size_type left = 0;
+    size_type right = this->count();
+    while(true)
+    {
+        while(left < right && isLeft(this->getCentroid(left)))
+        {
+            left++;
+        }
+        while(left < right && !isLeft(this->getCentroid(right - 1)))
+        {
+            right--;
+        }
+        if(left >= right)
+        {
+            break;
+        }
+        this->swapTriangles(this->beginIdx + left, this->beginIdx + right - 1);
+        left++;
+        right--;
+    }
+    return left;
+}
+
+void TriangleMesh::swapTriangles(size_type i, size_type j)
+{
+    std::swap(data->vertexIndices[i], data->vertexIndices[j]);
+    if(!data->normalIndices.empty())
+    {
+        std::swap(data->normalIndices[i], data->normalIndices[j]);
+    }
+    if(!data->texCoordIndices.empty())
+    {
+        std::swap(data->texCoordIndices[i], data->texCoordIndices[j]);
+    }
+    if(data->permutation.has_value())
+    {
+        std::swap((*data->permutation)[i], (*data->permutation)[j]);
+    }
+}
+
+std::array<AABB, 2> TriangleMesh::splitElementBounds(size_type index, const AABB& bounds, Axis axis, float position) const
+{
+    const auto axisI = static_cast<int>(axis);
+    const auto& indices = data->vertexIndices[this->beginIdx + index];
+
+    // Bounds of the triangle vertices and the points where the triangle edges cross the plane, per side
+    std::array<Point, 2> start { Point::Constant(std::numeric_limits<float>::max()), Point::Constant(std::numeric_limits<float>::max()) };
+    std::array<Point, 2> end { Point::Constant(std::numeric_limits<float>::lowest()), Point::Constant(std::numeric_limits<float>::lowest()) };
+    auto grow = [&start, &end](int side, const Point& p)
+    {
+        start[side] = start[side].cwiseMin(p);
+        end[side] = end[side].cwiseMax(p);
+    };
+
+    for(int i = 0; i < 3; i++)
+    {
+        const Point& v1 = data->vertices[indices[i]];
+        const Point& v2 = data->vertices[indices[(i + 1) % 3]];
+        if(v1[axisI] <= position)
+        {
+            grow(0, v1);
+        }
+        if(v1[axisI] >= position)
+        {
+            grow(1, v1);
+        }
+        if((v1[axisI] < position && position < v2[axisI]) || (v2[axisI] < position && position < v1[axisI]))
+        {
+            const float t = (position - v1[axisI]) / (v2[axisI] - v1[axisI]);
+            Point crossing = v1 + (v2 - v1) * t;
+            crossing[axisI] = position;
+            grow(0, crossing);
+            grow(1, crossing);
+        }
+    }
+
+    // Clip to the given bounds, using the same padding as getAABB. If no part of the triangle lies on a side
+    // (which can happen in the padding around the triangle), a flat box on the split plane is used.
+    auto sides = bounds.split(axis, position);
+    for(int side = 0; side < 2; side++)
+    {
+        const Point clippedStart = (start[side].array() - 1E-4f).matrix().cwiseMax(sides[side].getStart());
+        const Point clippedEnd = (end[side].array() + 1E-4f).matrix().cwiseMin(sides[side].getEnd());
+        if((clippedStart.array() <= clippedEnd.array()).all())
+        {
+            sides[side] = AABB(clippedStart, clippedEnd);
+        }
+        else
+        {
+            Point planeStart = sides[side].getStart();
+            Point planeEnd = sides[side].getEnd();
+            planeStart[axisI] = planeEnd[axisI] = position;
+            sides[side] = AABB(planeStart, planeEnd);
+        }
+    }
+    return sides;
+}
+
+namespace
+{
+    template<typename T>
+    void rearrangeRange(std::vector<T>& values, size_t begin, size_t end, const std::vector<size_t>& elements)
+    {
+        std::vector<T> rearranged;
+        rearranged.reserve(elements.size());
+        for(auto i : elements)
+        {
+            rearranged.push_back(values[begin + i]);
+        }
+        values.erase(values.begin() + begin, values.begin() + end);
+        values.insert(values.begin() + begin, rearranged.begin(), rearranged.end());
+    }
+}
+
+void TriangleMesh::rearrangeElements(const std::vector<size_type>& elements)
+{
+    data->triangleSoA.reset();
+
+    rearrangeRange(data->vertexIndices, this->beginIdx, this->endIdx, elements);
+    if(!data->normalIndices.empty())
+    {
+        rearrangeRange(data->normalIndices, this->beginIdx, this->endIdx, elements);
+    }
+    if(!data->texCoordIndices.empty())
+    {
+        rearrangeRange(data->texCoordIndices, this->beginIdx, this->endIdx, elements);
+    }
+    if(data->permutation.has_value())
+    {
+        rearrangeRange(*data->permutation, this->beginIdx, this->endIdx, elements);
+    }
+    this->endIdx = this->beginIdx + elements.size();
+}
+
+uint64_t TriangleMesh::getElementId(size_type index) const
+{
+    const auto i = this->beginIdx + index;
+    uint64_t id = Hash::bytes(data->vertexIndices[i].data(), sizeof(data->vertexIndices[i]));
+    if(!data->normalIndices.empty())
+    {
+        id = Hash::combine(id, Hash::bytes(data->normalIndices[i].data(), sizeof(data->normalIndices[i])));
+    }
+    if(!data->texCoordIndices.empty())
+    {
+        id = Hash::combine(id, Hash::bytes(data->texCoordIndices[i].data(), sizeof(data->texCoordIndices[i])));
+    }
+    if(data->permutation.has_value())
+    {
+        id = Hash::combine(id, (*data->permutation)[i]);
+    }
+    return id;
+}
+
+uint64_t TriangleMesh::getContentHash() const
+{
+    // The BVH depends on the exact triangle geometry (spatial splits clip the triangles), so hash the buffers themselves.
+    uint64_t hash = Hash::bytes(data->vertices.data(), data->vertices.size() * sizeof(Point));
+    hash = Hash::combine(hash, Hash::bytes(data->vertexIndices.data() + this->beginIdx, this->count() * sizeof(data->vertexIndices[0])));
+    return hash;
+}
+
 const TriangleMeshData& TriangleMesh::getData() const
 {
 	return *this->data;
@@ -287,12 +689,24 @@ std::optional<RayHitInfo> TriangleMesh::traceRay(const Ray& ray) const
 	return this->intersect(ray);
 }
 
+std::optional<RayHitInfo> TriangleMesh::traceRayInRange(const Ray& ray, size_type first, size_type last) const
+{
+    return this->intersectTriangles(ray, this->beginIdx + first, this->beginIdx + last);
+}
+
+std::optional<RayHitInfo> TriangleMesh::testVisibilityInRange(const Ray& ray, float maxT, size_type first, size_type last) const
+{
+    return this->testVisibilityTriangles(ray, maxT, this->beginIdx + first, this->beginIdx + last);
+}
+
 TriangleMesh* TriangleMesh::cloneImpl() const
 {
 	return new TriangleMesh(*this);
 }
 
 void TriangleMesh::applyTransform(const Transformation& transform) {
+    this->data->triangleSoA.reset();
+
     {
         std::vector<bool> transformed(this->data->vertices.size());
         for(auto i = this->beginIdx; i < this->endIdx; ++i)
@@ -309,14 +723,21 @@ void TriangleMesh::applyTransform(const Transformation& transform) {
     }
 
     {
-        std::vector<bool> transformed(this->data->normals.size());
+        std::vector<bool> transformed(this->data->getNormalCount());
         for(auto i = this->beginIdx; i < this->endIdx; ++i)
         {
-            for(auto idx : this->data->normalIndices[i])
+            for(auto idx : this->data->getNormalIndices(i))
             {
                 if(!transformed[idx])
                 {
-                    this->data->normals[idx] = transform.transform(this->data->normals[idx]);
+                    if(this->data->packedNormals.empty())
+                    {
+                        this->data->normals[idx] = transform.transform(this->data->normals[idx]);
+                    }
+                    else
+                    {
+                        this->data->packedNormals[idx] = OctahedralNormal::encode(transform.transform(this->data->packedNormals[idx].decode()));
+                    }
                     transformed[idx] = true;
                 }
             }
@@ -333,6 +754,51 @@ std::vector<TriangleMesh> TriangleMesh::appendMeshes(const std::vector<TriangleM
 
     std::vector<TriangleMesh> resultingSubMeshes(meshes.size());
 
+    // The merged mesh only keeps the compact attribute layout (shared indices, quantized attributes) if all meshes use it.
+    std::vector<const TriangleMeshData*> sources;
+    if(this->count() > 0)
+    {
+        sources.push_back(this->data.get());
+    }
+    for(const auto* mesh : meshes)
+    {
+        sources.push_back(mesh->data.get());
+    }
+    auto all = [&sources](auto predicate){ return std::all_of(sources.begin(), sources.end(), predicate); };
+    const bool sharedNormalIndices = all([](const auto* d){ return d->normalIndices.empty(); });
+    const bool anyTexCoords = !all([](const auto* d){ return !d->hasTexCoords(); });
+    const bool sharedTexCoordIndices = anyTexCoords && all([](const auto* d){ return d->texCoordIndices.empty(); });
+    const bool packAttributes = all([](const auto* d){
+        return !d->packedNormals.empty() && (!d->hasTexCoords() || !d->packedTexCoords.empty());
+    });
+
+    // Bring the data of this mesh into the layout of the result
+    if(anyTexCoords && !this->data->hasTexCoords() && this->count() > 0)
+    {
+        // Same as for appended meshes without texture coordinates, see below
+        this->data->texCoords.assign(sharedTexCoordIndices ? this->data->vertices.size() : 1, Vector2(0, 0));
+        if(!sharedTexCoordIndices)
+        {
+            this->data->texCoordIndices.assign(this->data->vertexIndices.size(), {0, 0, 0});
+        }
+    }
+    if(!sharedNormalIndices && this->data->normalIndices.empty())
+    {
+        this->data->normalIndices = this->data->vertexIndices;
+    }
+    if(anyTexCoords && !sharedTexCoordIndices && this->data->texCoordIndices.empty() && this->data->hasTexCoords())
+    {
+        this->data->texCoordIndices = this->data->vertexIndices;
+    }
+    if(packAttributes)
+    {
+        this->data->quantizeAttributes();
+    }
+    else
+    {
+        this->data->unpackAttributes();
+    }
+
     // Add entries to permutation vector, if present
     size_t nbAddedTriangles = 0;
     for(const auto* mesh : meshes)
@@ -346,87 +812,150 @@ std::vector<TriangleMesh> TriangleMesh::appendMeshes(const std::vector<TriangleM
         std::iota(data->permutation->begin() + oldTriangleCount, data->permutation->end(), oldTriangleCount);
     }
 
-    // Calculate offsets of entries in mesh data for each new submesh
+    // Calculate offsets of entries in mesh data for each new submesh.
+    // Shared texture coordinates need one entry per vertex, otherwise meshes without texture coordinates get a single (0, 0) entry.
+    auto getTexCoordCount = [sharedTexCoordIndices](const TriangleMeshData& d){
+        return sharedTexCoordIndices ? d.vertices.size() : std::max(1ul, d.getTexCoordCount());
+    };
     std::vector<size_t> triangleOffsets(meshes.size());
     triangleOffsets[0] = this->endIdx;
     std::vector<size_t> vertexOffsets(meshes.size());
     vertexOffsets[0] = this->data->vertices.size();
     std::vector<size_t> texCoordOffsets(meshes.size());
-    texCoordOffsets[0] = this->data->texCoords.size();
+    texCoordOffsets[0] = this->data->getTexCoordCount();
     std::vector<size_t> indicesOffsets(meshes.size());
     indicesOffsets[0] = this->data->vertexIndices.size();
     for(auto i = 1ul; i < meshes.size(); ++i)
     {
         triangleOffsets[i] = triangleOffsets[i-1] + meshes[i-1]->count();
         vertexOffsets[i] = vertexOffsets[i-1] + meshes[i-1]->data->vertices.size();
-        texCoordOffsets[i] = texCoordOffsets[i-1] + std::max(1ul, meshes[i-1]->data->texCoords.size());
+        texCoordOffsets[i] = texCoordOffsets[i-1] + getTexCoordCount(*meshes[i-1]->data);
         indicesOffsets[i] = indicesOffsets[i-1] + meshes[i-1]->data->vertexIndices.size();
     }
 
     // Reserve space for merged mesh data
     auto newVerticesCount = this->data->vertices.size();
-    auto newNormalsCount = this->data->normals.size();
-    auto newTexCoordsCount = this->data->texCoords.size();
+    auto newNormalsCount = this->data->getNormalCount();
+    auto newTexCoordsCount = this->data->getTexCoordCount();
     auto newIndicesCount = this->data->vertexIndices.size();
     for(const auto* mesh : meshes)
     {
         newVerticesCount += mesh->data->vertices.size();
-        newNormalsCount += mesh->data->normals.size();
-        newTexCoordsCount += std::max(1ul, mesh->data->texCoords.size());
+        newNormalsCount += mesh->data->getNormalCount();
+        newTexCoordsCount += getTexCoordCount(*mesh->data);
         newIndicesCount += mesh->data->vertexIndices.size();
     }
     this->data->vertices.resize(newVerticesCount);
-    this->data->normals.resize(newNormalsCount);
-    this->data->texCoords.resize(newTexCoordsCount);
     this->data->vertexIndices.resize(newIndicesCount);
-    this->data->normalIndices.resize(newIndicesCount);
-    this->data->texCoordIndices.resize(newIndicesCount);
+    if(packAttributes)
+    {
+        this->data->packedNormals.resize(newNormalsCount);
+    }
+    else
+    {
+        this->data->normals.resize(newNormalsCount);
+    }
+    if(!sharedNormalIndices)
+    {
+        this->data->normalIndices.resize(newIndicesCount);
+    }
+    if(anyTexCoords)
+    {
+        if(packAttributes)
+        {
+            this->data->packedTexCoords.resize(newTexCoordsCount);
+        }
+        else
+        {
+            this->data->texCoords.resize(newTexCoordsCount);
+        }
+        if(!sharedTexCoordIndices)
+        {
+            this->data->texCoordIndices.resize(newIndicesCount);
+        }
+    }
+
+    auto offsetIndices = [](const std::array<uint32_t, 3>& idx, uint32_t offset){
+        return std::array<uint32_t, 3>{idx[0] + offset, idx[1] + offset, idx[2] + offset};
+    };
 
     // Do appending
 #ifdef NO_TBB
     for(auto i = 0ul; i < meshes.size(); ++i) {
 #else
-    tbb::parallel_for(0ul, meshes.size(), [this, &meshes, &triangleOffsets, &vertexOffsets, &texCoordOffsets, &indicesOffsets, &resultingSubMeshes](auto i) {
+    tbb::parallel_for(0ul, meshes.size(), [&](auto i) {
 #endif
         const TriangleMesh& mesh = *meshes[i];
+        const TriangleMeshData& meshData = *mesh.data;
 
         auto triangleOffset = triangleOffsets[i];
-        auto verticesOffset = vertexOffsets[i];
+        uint32_t verticesOffset = vertexOffsets[i];
         uint32_t texCoordsOffset = texCoordOffsets[i];
         auto indicesOffset = indicesOffsets[i];
 
-        std::copy(mesh.data->vertices.cbegin(), mesh.data->vertices.cend(), this->data->vertices.begin()+verticesOffset);
-        std::transform(mesh.data->vertexIndices.cbegin()+mesh.beginIdx, mesh.data->vertexIndices.cbegin()+mesh.endIdx,
-                       this->data->vertexIndices.begin() + indicesOffset, [verticesOffset](const auto& idx){
-            return std::array<uint32_t, 3>{static_cast<uint32_t>(idx[0] + verticesOffset),
-                                           static_cast<uint32_t>(idx[1] + verticesOffset),
-                                           static_cast<uint32_t>(idx[2] + verticesOffset)};
-        });
-
-        std::copy(mesh.data->normals.cbegin(), mesh.data->normals.cend(), this->data->normals.begin()+verticesOffset);
-        std::transform(mesh.data->normalIndices.cbegin()+mesh.beginIdx, mesh.data->normalIndices.cbegin()+mesh.endIdx,
-                       this->data->normalIndices.begin() + indicesOffset, [verticesOffset](const auto& idx){
-            return std::array<uint32_t, 3>{static_cast<uint32_t>(idx[0] + verticesOffset),
-                                           static_cast<uint32_t>(idx[1] + verticesOffset),
-                                           static_cast<uint32_t>(idx[2] + verticesOffset)};
-        });
+        std::copy(meshData.vertices.cbegin(), meshData.vertices.cend(), this->data->vertices.begin()+verticesOffset);
+        std::transform(meshData.vertexIndices.cbegin()+mesh.beginIdx, meshData.vertexIndices.cbegin()+mesh.endIdx,
+                       this->data->vertexIndices.begin() + indicesOffset, [&](const auto& idx){ return offsetIndices(idx, verticesOffset); });
 
-
-        if(mesh.data->texCoords.empty())
+        if(packAttributes)
         {
-            this->data->texCoords[texCoordsOffset] = Vector2(0, 0);
-            std::fill(this->data->texCoordIndices.begin()+indicesOffset, this->data->texCoordIndices.begin() + indicesOffset + mesh.count(),
-                    std::array<uint32_t, 3>{texCoordsOffset, texCoordsOffset, texCoordsOffset});
+            std::copy(meshData.packedNormals.cbegin(), meshData.packedNormals.cend(), this->data->packedNormals.begin()+verticesOffset);
         }
         else
         {
-            std::copy(mesh.data->texCoords.cbegin(), mesh.data->texCoords.cend(), this->data->texCoords.begin()+texCoordsOffset);
-            std::transform(mesh.data->texCoordIndices.cbegin()+mesh.beginIdx, mesh.data->texCoordIndices.cbegin()+mesh.endIdx,
-                           this->data->texCoordIndices.begin()+indicesOffset, [texCoordsOffset](const auto& idx){
-                return std::array<uint32_t, 3>{static_cast<uint32_t>(idx[0] + texCoordsOffset),
-                                               static_cast<uint32_t>(idx[1] + texCoordsOffset),
-                                               static_cast<uint32_t>(idx[2] + texCoordsOffset)};
-            });
+            for(size_t j = 0; j < meshData.getNormalCount(); ++j)
+            {
+                this->data->normals[verticesOffset + j] = meshData.getNormal(j);
+            }
+        }
+        if(!sharedNormalIndices)
+        {
+            for(auto triangleI = mesh.beginIdx; triangleI < mesh.endIdx; ++triangleI)
+            {
+                this->data->normalIndices[indicesOffset + triangleI - mesh.beginIdx] = offsetIndices(meshData.getNormalIndices(triangleI), verticesOffset);
+            }
+        }
+
+        if(anyTexCoords)
+        {
+            if(!meshData.hasTexCoords())
+            {
+                const auto texCoordCount = getTexCoordCount(meshData);
+                if(packAttributes)
+                {
+                    std::fill_n(this->data->packedTexCoords.begin()+texCoordsOffset, texCoordCount, HalfVector2::encode(Vector2(0, 0)));
+                }
+                else
+                {
+                    std::fill_n(this->data->texCoords.begin()+texCoordsOffset, texCoordCount, Vector2(0, 0));
+                }
+                if(!sharedTexCoordIndices)
+                {
+                    std::fill(this->data->texCoordIndices.begin()+indicesOffset, this->data->texCoordIndices.begin() + indicesOffset + mesh.count(),
+                              std::array<uint32_t, 3>{texCoordsOffset, texCoordsOffset, texCoordsOffset});
+                }
+            }
+            else
+            {
+                if(packAttributes)
+                {
+                    std::copy(meshData.packedTexCoords.cbegin(), meshData.packedTexCoords.cend(), this->data->packedTexCoords.begin()+texCoordsOffset);
+                }
+                else
+                {
+                    for(size_t j = 0; j < meshData.getTexCoordCount(); ++j)
+                    {
+                        this->data->texCoords[texCoordsOffset + j] = meshData.getTexCoord(j);
+                    }
+                }
+                if(!sharedTexCoordIndices)
+                {
+                    for(auto triangleI = mesh.beginIdx; triangleI < mesh.endIdx; ++triangleI)
+                    {
+                        this->data->texCoordIndices[indicesOffset + triangleI - mesh.beginIdx] = offsetIndices(meshData.getTexCoordIndices(triangleI), texCoordsOffset);
+                    }
+                }
+            }
         }
 
         resultingSubMeshes[i] = TriangleMesh(data, triangleOffset, triangleOffset + mesh.count());
@@ -438,6 +967,7 @@ std::vector<TriangleMesh> TriangleMesh::appendMeshes(const std::vector<TriangleM
 #endif
 
     // Update object state
+    this->data->triangleSoA.reset();
     this->aabb = std::nullopt;
     this->centroid = std::nullopt;
     this->endIdx += nbAddedTriangles;
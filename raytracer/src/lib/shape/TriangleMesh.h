@@ -4,17 +4,80 @@
 #include "math/Vector3.h"
 #include "shape/list/IShapeList.h"
 #include "math/Vector2.h"
+#include "math/PackedVectors.h"
+#include "math/Triangle.h"
+
+// Triangle vertices in SoA form, in the same order as TriangleMeshData::vertexIndices: the first vertex and the
+// edges from the first to the second and third vertex, per axis. Used by the SIMD intersection kernel.
+// The arrays are padded with degenerate triangles, so the kernel can always load 8 triangles at once.
+struct TriangleSoA
+{
+    static constexpr size_t Padding = 8;
+
+    std::array<std::vector<float>, 3> v0;
+    std::array<std::vector<float>, 3> e1;
+    std::array<std::vector<float>, 3> e2;
+};
 
 class TriangleMeshData : public ICloneable<TriangleMeshData>
 {
 public:
 	std::vector<Point> vertices;
 	std::vector<std::array<uint32_t, 3>> vertexIndices;
+	// Vertex attributes. When normalIndices or texCoordIndices is empty, the attribute shares vertexIndices (as in glTF).
+	// Use the accessors below instead of reading these directly.
 	std::vector<Vector3> normals;
 	std::vector<std::array<uint32_t, 3>> normalIndices;
 	std::vector<Vector2> texCoords;
 	std::vector<std::array<uint32_t, 3>> texCoordIndices;
+	// Quantized attributes (see quantizeAttributes), which replace normals and texCoords when they are not empty.
+	std::vector<OctahedralNormal> packedNormals;
+	std::vector<HalfVector2> packedTexCoords;
     std::optional<std::vector<uint32_t>> permutation;
+    // Built when the triangle order is final (see TriangleMesh::precomputeTraceData), reset when vertices or triangle order change.
+    std::optional<TriangleSoA> triangleSoA;
+
+    const std::array<uint32_t, 3>& getNormalIndices(size_t triangleI) const
+    {
+        return normalIndices.empty() ? vertexIndices[triangleI] : normalIndices[triangleI];
+    }
+
+    const std::array<uint32_t, 3>& getTexCoordIndices(size_t triangleI) const
+    {
+        return texCoordIndices.empty() ? vertexIndices[triangleI] : texCoordIndices[triangleI];
+    }
+
+    Vector3 getNormal(uint32_t index) const
+    {
+        return packedNormals.empty() ? normals[index] : packedNormals[index].decode();
+    }
+
+    Vector2 getTexCoord(uint32_t index) const
+    {
+        return packedTexCoords.empty() ? texCoords[index] : packedTexCoords[index].decode();
+    }
+
+    size_t getNormalCount() const
+    {
+        return packedNormals.empty() ? normals.size() : packedNormals.size();
+    }
+
+    size_t getTexCoordCount() const
+    {
+        return packedTexCoords.empty() ? texCoords.size() : packedTexCoords.size();
+    }
+
+    bool hasTexCoords() const
+    {
+        return getTexCoordCount() > 0;
+    }
+
+    // Replaces the normals by octahedral 2x16-bit normals and the texture coordinates by half floats.
+    void quantizeAttributes();
+    // Converts quantized attributes back to full precision.
+    void unpackAttributes();
+    // Drops normalIndices and texCoordIndices where they are equal to vertexIndices.
+    void shareAttributeIndices();
 
 private:
     TriangleMeshData* cloneImpl() const override;
@@ -46,6 +109,16 @@ public:
 	
 	Point getCentroid(size_type index) const override;
 	void sortByCentroid(Axis axis, bool allowParallelization) override;
+	size_type partitionByCentroid(const std::function<bool(const Point&)>& isLeft) override;
+
+	bool supportsElementDuplication() const override
+	{
+		return true;
+	}
+	std::array<AABB, 2> splitElementBounds(size_type index, const AABB& bounds, Axis axis, float position) const override;
+	void rearrangeElements(const std::vector<size_type>& elements) override;
+	uint64_t getElementId(size_type index) const override;
+	uint64_t getContentHash() const override;
 
 	const TriangleMeshData& getData() const;
 
@@ -53,6 +126,11 @@ public:
 
     std::optional<RayHitInfo> testVisibility(const Ray &ray, float maxT) const override;
 
+    void precomputeTraceData() override;
+
+    std::optional<RayHitInfo> traceRayInRange(const Ray& ray, size_type first, size_type last) const override;
+    std::optional<RayHitInfo> testVisibilityInRange(const Ray& ray, float maxT, size_type first, size_type last) const override;
+
     void applyTransform(const Transformation& transform);
     std::vector<TriangleMesh> appendMeshes(const std::vector<TriangleMesh*>& meshes);
 
@@ -61,6 +139,14 @@ private:
 	std::pair<IShapeList<RayHitInfo>*, IShapeList<RayHitInfo>*> splitImpl(size_type leftSideElemCount) const override;
 	template<bool AllowParallelization>
     void sortByCentroidImpl(Axis axis);
+    // Swaps triangles i and j (indices into the mesh data) in all per-triangle arrays
+    void swapTriangles(size_type i, size_type j);
+
+    RayHitInfo interpolateHit(const Ray& ray, size_type triangleI, const Triangle::TriangleIntersection& intersection) const;
+
+    // Intersection tests over the triangles [triangleBegin, triangleEnd) of the mesh data
+    std::optional<RayHitInfo> intersectTriangles(const Ray& ray, size_type triangleBegin, size_type triangleEnd) const;
+    std::optional<RayHitInfo> testVisibilityTriangles(const Ray& ray, float maxT, size_type triangleBegin, size_type triangleEnd) const;
 
 	std::shared_ptr<TriangleMeshData> data;
 	mutable std::optional<AABB> aabb;
@@ -1,10 +1,10 @@
 #pragma once
 
 #include <memory>
-#include <queue>
+#include <numeric>
 #include "BVHNode.h"
+#include "FlatBVH.h"
 #include <utility/StatCollector.h>
-#include "utility/raw_pointer.h"
 #include "utility/unique_ptr_template.h"
 
 template<typename TContent, typename TRayHitInfo, size_t Arity>
@@ -12,54 +12,48 @@ class BVH
 {
 public:
 	using LinkedNode = BVHNode<TContent, TRayHitInfo, Arity, unique_pointer>;
-	using PackedNode = BVHNode<TContent, TRayHitInfo, Arity, raw_pointer>;
+	template<size_t Width>
+	using PackedTree = FlatBVH<TContent, TRayHitInfo, Width>;
 
-	explicit BVH(std::unique_ptr<LinkedNode> rootNode, size_t treeSize)
-		: nodes(std::move(rootNode)), treeSize(treeSize)
+	// content is the list the tree was built over, it is required to pack the tree.
+	explicit BVH(std::unique_ptr<LinkedNode> rootNode, size_t treeSize, std::unique_ptr<TContent> content = nullptr)
+		: nodes(std::move(rootNode)), treeSize(treeSize), content(std::move(content))
+	{ }
+
+	template<size_t Width>
+	BVH(PackedTree<Width> tree, size_t treeSize)
+		: nodes(std::move(tree)), treeSize(treeSize)
 	{ }
 
 	std::optional<TRayHitInfo> traceRay(const Ray& ray) const
 	{
-		if(std::holds_alternative<std::unique_ptr<LinkedNode>>(nodes))
-		{
-			return std::get<std::unique_ptr<LinkedNode>>(nodes)->traceRay(ray);
-		}else
-		{
-			return std::get<std::vector<PackedNode>>(nodes)[0].traceRay(ray);
-		}
+		return std::visit([&ray](const auto& tree){ return getTree(tree).traceRay(ray); }, nodes);
 	}
 
     HitBundle<TRayHitInfo> traceRays(RayBundle& rays) const
     {
-        if(std::holds_alternative<std::unique_ptr<LinkedNode>>(nodes))
-        {
-            return std::get<std::unique_ptr<LinkedNode>>(nodes)->traceRays(rays);
-        }else
-        {
-            return std::get<std::vector<PackedNode>>(nodes)[0].traceRays(rays);
-        }
+        HitBundle<TRayHitInfo> result;
+        RayBundlePermutation perm;
+        std::iota(perm.begin(), perm.end(), 0);
+        std::array<bool, RayBundleSize> foundBetterHit {};
+        traceRays(0, RayBundleSize, rays, perm, result, foundBetterHit);
+        return result;
     }
 
     void traceRays(RBSize_t startIdx, RBSize_t endIdx, RayBundle& rays, RayBundlePermutation& perm, HitBundle<TRayHitInfo>& result, std::array<bool, RayBundleSize>& foundBetterHit) const
     {
-        if(std::holds_alternative<std::unique_ptr<LinkedNode>>(nodes))
-        {
-            return std::get<std::unique_ptr<LinkedNode>>(nodes)->traceRays(startIdx, endIdx, rays, perm, result, foundBetterHit);
-        }else
-        {
-            return std::get<std::vector<PackedNode>>(nodes)[0].traceRays(startIdx, endIdx, rays, perm, result, foundBetterHit);
-        }
+        std::visit([&](const auto& tree){ getTree(tree).traceRays(startIdx, endIdx, rays, perm, result, foundBetterHit); }, nodes);
     }
 
     std::optional<TRayHitInfo> testVisibility(const Ray &ray, float maxT) const
     {
-        if(std::holds_alternative<std::unique_ptr<LinkedNode>>(nodes))
-        {
-            return std::get<std::unique_ptr<LinkedNode>>(nodes)->testVisibility(ray, maxT);
-        }else
-        {
-            return std::get<std::vector<PackedNode>>(nodes)[0].testVisibility(ray, maxT);
-        }
+        return std::visit([&ray, maxT](const auto& tree){ return getTree(tree).testVisibility(ray, maxT); }, nodes);
+    }
+
+    // Any-hit test of the rays of the bundle in rayMask, returns the mask of the rays that are occluded before their maxT.
+    RayBundleMask testVisibilities(const RayBundle& rays, const RayBundleMaxT& maxT, RayBundleMask rayMask = FullRayBundleMask) const
+    {
+        return std::visit([&](const auto& tree){ return getTree(tree).testVisibilities(rays, maxT, rayMask); }, nodes);
     }
 
 	size_t getSize() const
@@ -67,55 +61,66 @@ public:
 		return treeSize;
 	}
 
-	void pack()
+	bool isPacked() const
+	{
+		return !std::holds_alternative<std::unique_ptr<LinkedNode>>(nodes);
+	}
+
+	// Width of the packed tree, 0 if the tree is not packed.
+	size_t getPackedWidth() const
 	{
-		if(!std::holds_alternative<std::unique_ptr<LinkedNode>>(nodes))
+		switch(nodes.index())
 		{
-			throw std::runtime_error("BVH is already packed or has no nodes");
+			case 1: return 2;
+			case 2: return 4;
+			case 3: return 8;
+			default: return 0;
 		}
-		std::unique_ptr<LinkedNode> root = std::move(std::get<std::unique_ptr<LinkedNode>>(nodes));
-
-		std::vector<PackedNode> packedNodes;
-		packedNodes.reserve(treeSize);
+	}
 
-		std::queue<std::tuple<std::unique_ptr<LinkedNode>, PackedNode*, int>> remainingNodes;
-		remainingNodes.push(std::make_tuple(std::move(root), nullptr, 0));
+	template<size_t Width>
+	const PackedTree<Width>& getPackedTree() const
+	{
+		return std::get<PackedTree<Width>>(nodes);
+	}
 
-		while(!remainingNodes.empty())
+	// Convert the tree into a flat array of nodes with width (2, 4 or 8) children each, see FlatBVH.
+	void pack(size_t width = 4)
+	{
+		if(isPacked() || content == nullptr)
 		{
-			auto& cur = remainingNodes.front();
-			std::unique_ptr<LinkedNode> node = std::move(std::get<0>(cur));
-			PackedNode* parentNode = std::get<1>(cur);
-			int childI = std::get<2>(cur);
-			remainingNodes.pop();
-
-			if(node->isLeafNode())
-			{
-				packedNodes.emplace_back(node->getAABB(), std::move(node->getLeafDataPtr()));
-			}
-			else
-			{
-				packedNodes.emplace_back(node->getAABB(), node->getSortedAxis());
-				for(int i = 0; i < Arity; i++)
-				{
-					remainingNodes.push(std::make_tuple(std::move(node->getChildPtr(i)), &packedNodes.back(), i));
-				}
-			}
-			PackedNode& curNode = packedNodes.back();
-
-			if(parentNode != nullptr)
-			{
-				parentNode->setChild(childI, raw_pointer(&curNode));
-			}
+			throw std::runtime_error("BVH is already packed or has no nodes");
 		}
+		const LinkedNode& root = *std::get<std::unique_ptr<LinkedNode>>(nodes);
 
-		nodes = std::move(packedNodes);
+		// The linked tree is only released once the packed tree was built successfully.
+		switch(width)
+		{
+			case 2: nodes = PackedTree<2>(root, std::move(content)); break;
+			case 4: nodes = PackedTree<4>(root, std::move(content)); break;
+			case 8: nodes = PackedTree<8>(root, std::move(content)); break;
+			default: throw std::runtime_error("Unsupported BVH width: " + std::to_string(width));
+		}
 	}
 
 private:
+	static const LinkedNode& getTree(const std::unique_ptr<LinkedNode>& root)
+	{
+		return *root;
+	}
+
+	template<size_t Width>
+	static const PackedTree<Width>& getTree(const PackedTree<Width>& tree)
+	{
+		return tree;
+	}
+
 	std::variant<
 		std::unique_ptr<LinkedNode>,
-		std::vector<PackedNode>
+		PackedTree<2>,
+		PackedTree<4>,
+		PackedTree<8>
 	> nodes;
 	size_t treeSize;
+	std::unique_ptr<TContent> content;
 };
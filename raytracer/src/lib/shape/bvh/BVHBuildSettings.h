@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+enum class BVHBuildStrategy
+{
+	// Evaluates the SAH at every split position of the shapes, sorted by centroid on each axis.
+	SweepSAH,
+	// Evaluates the SAH at the boundaries of a fixed amount of centroid buckets per axis and partitions the shapes in place.
+	// Much faster to build on large meshes, at the cost of a slightly worse tree.
+	BinnedSAH,
+	// Binned SAH that also considers spatial splits (SBVH): elements that straddle the split plane are referenced from
+	// both children, with their bounds clipped to each side. Reduces node overlap for scenes with large, thin triangles.
+	// Lists that can not duplicate elements are built with BinnedSAH.
+	SpatialSplitSAH
+};
+
+struct BVHBuildSettings
+{
+	BVHBuildStrategy strategy = BVHBuildStrategy::SweepSAH;
+
+	// SpatialSplitSAH only: spatial splits are only evaluated for nodes where the children of the best object split
+	// overlap by more than this fraction of the root surface area. Lower values allow more spatial splits.
+	float spatialSplitOverlapBudget = 1E-5f;
+
+	// SpatialSplitSAH only: the maximum amount of duplicate element references, relative to the element count.
+	float maxReferenceDuplication = 1.0f;
+
+	// Directory of the on-disk BVH cache (see BVHCache), an empty string disables the cache.
+	std::string cacheDirectory;
+};
@@ -3,12 +3,18 @@
 #include <iostream>
 #include <future>
 #include <mutex>
+#include <atomic>
 
 #ifndef NO_TBB
 #include <tbb/task.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+#else
+#include "utility/ThreadPool.h"
 #endif
 
 #include "BVH.h"
+#include "BVHBuildSettings.h"
 #include "shape/list/IShapeList.h"
 #include "utility/unique_ptr_template.h"
 #include "utility/StatCollector.h"
@@ -22,7 +28,7 @@ class BVHBuilder
 public:
 	friend class NodeBuildingTask<TRayHitInfo>;
 
-	static BVH<IShapeList<TRayHitInfo>, TRayHitInfo, 2> buildBVH(IShapeList<TRayHitInfo>& shapes, Statistics::Collector* stats = nullptr);
+	static BVH<IShapeList<TRayHitInfo>, TRayHitInfo, 2> buildBVH(IShapeList<TRayHitInfo>& shapes, Statistics::Collector* stats = nullptr, const BVHBuildSettings& settings = {});
 
 private:
 	using size_type = typename IShapeList<TRayHitInfo>::size_type;
@@ -39,18 +45,148 @@ private:
 		Axis presortedAxis;
 	};
 
-	BVHBuilder(double costPerIntersection, double costPerTraversal);
+	static constexpr size_t BinCount = 32;
+	// Lists smaller than this are binned on the current thread, the scheduling overhead is not worth it.
+	static constexpr size_type ParallelBinningThreshold = 1u << 14u;
+	static constexpr size_type BinningChunkSize = 1u << 12u;
+
+	struct Bin
+	{
+		AABB bounds;
+		size_type count = 0;
+
+		void add(const AABB& box)
+		{
+			bounds = count == 0 ? box : bounds.merge(box);
+			count++;
+		}
+
+		void add(const Bin& bin)
+		{
+			if(bin.count > 0)
+			{
+				bounds = count == 0 ? bin.bounds : bounds.merge(bin.bounds);
+				count += bin.count;
+			}
+		}
+	};
+
+	struct CentroidBounds
+	{
+		Bin elements; // Bounds of the elements themselves
+		Point centroidMin = Point::Constant(std::numeric_limits<float>::max());
+		Point centroidMax = Point::Constant(std::numeric_limits<float>::lowest());
+	};
+
+	using AxisBins = std::array<std::array<Bin, BinCount>, nbOfAxes>;
+
+	// Best split found by binning the element centroids
+	struct BinnedSplit
+	{
+		AABB bounds; // Bounds of all elements
+		Point centroidMin;
+		std::array<float, nbOfAxes> binScale {};
+
+		double cost = std::numeric_limits<double>::infinity();
+		int axis = 0;
+		size_t splitBin = 0; // Bins [0, splitBin] go left
+		AABB leftBounds;
+		AABB rightBounds;
+
+		bool isValid() const
+		{
+			return cost != std::numeric_limits<double>::infinity();
+		}
+
+		size_t getBinIndex(const Point& centroid, int axisI) const
+		{
+			const float offset = (centroid[axisI] - centroidMin[axisI]) * binScale[axisI];
+			return std::min(BinCount - 1, static_cast<size_t>(std::max(0.0f, offset)));
+		}
+
+		bool isLeft(const Point& centroid) const
+		{
+			return getBinIndex(centroid, axis) <= splitBin;
+		}
+	};
+
+	// Element reference of the spatial split builder, bounds can be a clipped part of the element bounds.
+	struct Reference
+	{
+		size_type index;
+		AABB bounds;
+
+		Point getCentroid() const
+		{
+			return Point((bounds.getStart() + bounds.getEnd()) / 2);
+		}
+	};
+	using ReferenceList = std::vector<Reference>;
+
+	struct SpatialBin
+	{
+		Bin clippedBounds;
+		size_type entries = 0; // References that start in this bin
+		size_type exits = 0; // References that end in this bin
+	};
+	using AxisSpatialBins = std::array<std::array<SpatialBin, BinCount>, nbOfAxes>;
+
+	struct SpatialSplit
+	{
+		double cost = std::numeric_limits<double>::infinity();
+		int axis = 0;
+		float position = 0;
+		AABB leftBounds;
+		AABB rightBounds;
+		size_type leftCount = 0;
+		size_type rightCount = 0;
+	};
+
+	// Tree built by the spatial split builder. Leaves are converted into sublists once all references are known.
+	struct SpatialBuildNode
+	{
+		AABB bounds;
+		Axis axis = Axis::x;
+		std::vector<size_type> elements; // Only used in leaves
+		std::array<std::unique_ptr<SpatialBuildNode>, 2> children;
+	};
+
+	BVHBuilder(double costPerIntersection, double costPerTraversal, const BVHBuildSettings& settings);
 
 	const double costPerIntersection;
 	const double costPerTraversal;
+	const BVHBuildSettings settings;
+
+	// Spatial split builder state
+	double rootSurfaceArea = 0;
+	std::atomic<long long> remainingDuplicates {0};
 
 	double calculateSAH(size_type s1Count, double s1AABBArea, size_type s2Count, double s2AABBArea, double totalAABBArea) const;
 
 	std::variant<NodePtr, IncompleteNode> buildNode(IShapeList<TRayHitInfo>& shapes, Axis presortedAxis, bool allowParallelization);
+	std::variant<NodePtr, IncompleteNode> buildNodeSweep(IShapeList<TRayHitInfo>& shapes, Axis presortedAxis, bool allowParallelization);
+	std::variant<NodePtr, IncompleteNode> buildNodeBinned(IShapeList<TRayHitInfo>& shapes, bool allowParallelization);
+
+	// Folds the elements [0, count) into a value of type TResult. Large ranges are split in chunks that are reduced in parallel.
+	template<typename TResult, typename TAccumulate, typename TCombine>
+	static TResult reduceElements(size_type count, bool allowParallelization, const TResult& identity, TAccumulate accumulate, TCombine combine);
+
+	template<typename TGetBounds, typename TGetCentroid>
+	BinnedSplit findBinnedSplit(size_type count, bool allowParallelization, TGetBounds getBounds, TGetCentroid getCentroid) const;
+
+	SpatialSplit findSpatialSplit(const ShapeList& shapes, const ReferenceList& references, const AABB& nodeBounds, bool allowParallelization) const;
+	std::pair<ReferenceList, ReferenceList> performSpatialSplit(const ShapeList& shapes, const ReferenceList& references, const SpatialSplit& split) const;
+	std::unique_ptr<SpatialBuildNode> buildSpatialNode(const ShapeList& shapes, ReferenceList references, unsigned int depth);
+	std::pair<NodePtr, size_t> buildTreeSpatial(IShapeList<TRayHitInfo>& shapes);
+	static std::pair<NodePtr, size_t> convertSpatialTree(SpatialBuildNode& node, ShapeListPtr& remainingShapes);
+
+	static double getOverlapArea(const AABB& a, const AABB& b);
 
     std::pair<NodePtr, size_t> buildTree(IShapeList<TRayHitInfo>& shapes, Axis presortedAxis);
 #ifndef NO_TBB
 	std::pair<NodePtr, size_t> buildTreeThreaded(IShapeList<TRayHitInfo>& shapes, Axis presortedAxis);
+#else
+	std::pair<NodePtr, size_t> buildTreeThreaded(IShapeList<TRayHitInfo>& shapes, Axis presortedAxis, unsigned int depth = 0);
 #endif
 
 	struct LeafNodeSizeStats {
@@ -128,8 +264,8 @@ public:
 /***********************************/
 
 template <typename TRayHitInfo>
-BVHBuilder<TRayHitInfo>::BVHBuilder(double costPerIntersection, double costPerTraversal)
-	: costPerIntersection(costPerIntersection), costPerTraversal(costPerTraversal)
+BVHBuilder<TRayHitInfo>::BVHBuilder(double costPerIntersection, double costPerTraversal, const BVHBuildSettings& settings)
+	: costPerIntersection(costPerIntersection), costPerTraversal(costPerTraversal), settings(settings)
 {}
 
 template <typename TRayHitInfo>
@@ -143,6 +279,20 @@ inline thread_local std::vector<float> leftArea; // TODO: is this cleaned up?
 template <typename TRayHitInfo>
 std::variant<typename BVHBuilder<TRayHitInfo>::NodePtr, typename BVHBuilder<TRayHitInfo>::IncompleteNode> BVHBuilder<
 	TRayHitInfo>::buildNode(IShapeList<TRayHitInfo>& shapes, Axis presortedAxis, bool allowParallelization)
+{
+	switch(settings.strategy)
+	{
+		// Spatial split builds of lists that do not support element duplication fall back to the binned builder
+		case BVHBuildStrategy::SpatialSplitSAH:
+		case BVHBuildStrategy::BinnedSAH: return buildNodeBinned(shapes, allowParallelization);
+		case BVHBuildStrategy::SweepSAH:
+		default: return buildNodeSweep(shapes, presortedAxis, allowParallelization);
+	}
+}
+
+template <typename TRayHitInfo>
+std::variant<typename BVHBuilder<TRayHitInfo>::NodePtr, typename BVHBuilder<TRayHitInfo>::IncompleteNode> BVHBuilder<
+	TRayHitInfo>::buildNodeSweep(IShapeList<TRayHitInfo>& shapes, Axis presortedAxis, bool allowParallelization)
 {
 	assert(shapes.count() > 0);
 
@@ -273,6 +423,498 @@ std::variant<typename BVHBuilder<TRayHitInfo>::NodePtr, typename BVHBuilder<TRay
 	}
 }
 
+template <typename TRayHitInfo>
+template<typename TResult, typename TAccumulate, typename TCombine>
+TResult BVHBuilder<TRayHitInfo>::reduceElements(size_type count, bool allowParallelization, const TResult& identity, TAccumulate accumulate, TCombine combine)
+{
+	if(!allowParallelization || count < ParallelBinningThreshold)
+	{
+		TResult result = identity;
+		for(size_type i = 0; i < count; i++)
+		{
+			accumulate(result, i);
+		}
+		return result;
+	}
+
+	// Every chunk has its own partial result, so no synchronization is needed until the final combine.
+	const size_type chunkCount = (count + BinningChunkSize - 1) / BinningChunkSize;
+	std::vector<TResult> partialResults(chunkCount, identity);
+	auto reduceChunk = [&](size_type chunkI)
+	{
+		const size_type chunkEnd = std::min(count, (chunkI + 1) * BinningChunkSize);
+		for(size_type i = chunkI * BinningChunkSize; i < chunkEnd; i++)
+		{
+			accumulate(partialResults[chunkI], i);
+		}
+	};
+
+#ifndef NO_TBB
+	tbb::parallel_for(size_type(0), chunkCount, reduceChunk);
+#else
+	auto& pool = ThreadPool::get();
+	ThreadPool::TaskGroup group;
+	for(size_type chunkI = 1; chunkI < chunkCount; chunkI++)
+	{
+		pool.submit(group, [&reduceChunk, chunkI](){ reduceChunk(chunkI); });
+	}
+	reduceChunk(0);
+	pool.wait(group);
+#endif
+
+	TResult result = identity;
+	for(const auto& partialResult : partialResults)
+	{
+		combine(result, partialResult);
+	}
+	return result;
+}
+
+template <typename TRayHitInfo>
+template<typename TGetBounds, typename TGetCentroid>
+typename BVHBuilder<TRayHitInfo>::BinnedSplit BVHBuilder<TRayHitInfo>::findBinnedSplit(size_type count, bool allowParallelization, TGetBounds getBounds, TGetCentroid getCentroid) const
+{
+	// Bounds of the elements, and of their centroids. The centroid bounds define the buckets.
+	const auto bounds = reduceElements(count, allowParallelization, CentroidBounds(),
+		[&getBounds, &getCentroid](CentroidBounds& acc, size_type i)
+		{
+			acc.elements.add(getBounds(i));
+			const Point centroid = getCentroid(i);
+			acc.centroidMin = acc.centroidMin.cwiseMin(centroid);
+			acc.centroidMax = acc.centroidMax.cwiseMax(centroid);
+		},
+		[](CentroidBounds& acc, const CentroidBounds& other)
+		{
+			acc.elements.add(other.elements);
+			acc.centroidMin = acc.centroidMin.cwiseMin(other.centroidMin);
+			acc.centroidMax = acc.centroidMax.cwiseMax(other.centroidMax);
+		});
+
+	BinnedSplit split;
+	split.bounds = bounds.elements.bounds;
+	split.centroidMin = bounds.centroidMin;
+	for (int axisI = 0; axisI < nbOfAxes; axisI++)
+	{
+		const float extent = bounds.centroidMax[axisI] - bounds.centroidMin[axisI];
+		// Axes along which all centroids coincide can not be split
+		split.binScale[axisI] = extent > 0 ? (BinCount * (1.0f - 1E-6f)) / extent : 0.0f;
+	}
+
+	const auto bins = reduceElements(count, allowParallelization, AxisBins(),
+		[&getBounds, &getCentroid, &split](AxisBins& acc, size_type i)
+		{
+			const AABB box = getBounds(i);
+			const Point centroid = getCentroid(i);
+			for (int axisI = 0; axisI < nbOfAxes; axisI++)
+			{
+				if (split.binScale[axisI] > 0)
+				{
+					acc[axisI][split.getBinIndex(centroid, axisI)].add(box);
+				}
+			}
+		},
+		[](AxisBins& acc, const AxisBins& other)
+		{
+			for (int axisI = 0; axisI < nbOfAxes; axisI++)
+			{
+				for (size_t binI = 0; binI < BinCount; binI++)
+				{
+					acc[axisI][binI].add(other[axisI][binI]);
+				}
+			}
+		});
+
+	const double totalAABBSurf = split.bounds.getSurfaceArea();
+	for (int axisI = 0; axisI < nbOfAxes; axisI++)
+	{
+		if (split.binScale[axisI] == 0)
+		{
+			continue;
+		}
+		const auto& axisBins = bins[axisI];
+
+		// Cumulative bounds from the right, rightBins[i] covers bins [i+1, BinCount)
+		std::array<Bin, BinCount> rightBins {};
+		Bin acc;
+		for (size_t binI = BinCount - 1; binI > 0; binI--)
+		{
+			acc.add(axisBins[binI]);
+			rightBins[binI - 1] = acc;
+		}
+
+		acc = Bin();
+		for (size_t binI = 0; binI < BinCount - 1; binI++)
+		{
+			acc.add(axisBins[binI]);
+			const Bin& right = rightBins[binI];
+			if (acc.count == 0 || right.count == 0)
+			{
+				continue;
+			}
+			const double curCost = calculateSAH(acc.count, acc.bounds.getSurfaceArea(), right.count, right.bounds.getSurfaceArea(), totalAABBSurf);
+			if (curCost < split.cost)
+			{
+				split.cost = curCost;
+				split.axis = axisI;
+				split.splitBin = binI;
+				split.leftBounds = acc.bounds;
+				split.rightBounds = right.bounds;
+			}
+		}
+	}
+	return split;
+}
+
+template <typename TRayHitInfo>
+std::variant<typename BVHBuilder<TRayHitInfo>::NodePtr, typename BVHBuilder<TRayHitInfo>::IncompleteNode> BVHBuilder<
+	TRayHitInfo>::buildNodeBinned(IShapeList<TRayHitInfo>& shapes, bool allowParallelization)
+{
+	assert(shapes.count() > 0);
+
+	const size_type shapeCount = shapes.count();
+	if (shapeCount == 1)
+	{
+		// Create leaf node
+		return std::make_unique<Node>(shapes.getAABB(0), shapes.clone());
+	}
+
+	const auto split = findBinnedSplit(shapeCount, allowParallelization,
+		[&shapes](size_type i){ return shapes.getAABB(i); },
+		[&shapes](size_type i){ return shapes.getCentroid(i); });
+
+	// Choose optimal split point or choose leaf mode
+	const double leafCost = shapeCount * costPerIntersection;
+	if (!split.isValid() || split.cost >= leafCost)
+	{
+		// Create leaf node
+		return std::make_unique<Node>(split.bounds, shapes.clone());
+	}
+
+	// The partition uses the same bin mapping as the binning pass, so both sides are non-empty.
+	const size_type leftCount = shapes.partitionByCentroid([&split](const Point& centroid)
+	{
+		return split.isLeft(centroid);
+	});
+	assert(leftCount > 0 && leftCount < shapeCount);
+
+	const Axis bestAxis = static_cast<Axis>(split.axis);
+	auto [listA, listB] = shapes.split(leftCount);
+	return IncompleteNode{ std::make_unique<Node>(split.bounds, bestAxis), std::move(listA), std::move(listB), bestAxis };
+}
+
+template <typename TRayHitInfo>
+double BVHBuilder<TRayHitInfo>::getOverlapArea(const AABB& a, const AABB& b)
+{
+	const Point start = a.getStart().cwiseMax(b.getStart());
+	const Point end = a.getEnd().cwiseMin(b.getEnd());
+	if (!(start.array() <= end.array()).all())
+	{
+		return 0.0;
+	}
+	return AABB(start, end).getSurfaceArea();
+}
+
+template <typename TRayHitInfo>
+typename BVHBuilder<TRayHitInfo>::SpatialSplit BVHBuilder<TRayHitInfo>::findSpatialSplit(const ShapeList& shapes, const ReferenceList& references, const AABB& nodeBounds, bool allowParallelization) const
+{
+	const Point& origin = nodeBounds.getStart();
+	const Vector3 extent(nodeBounds.getEnd() - nodeBounds.getStart());
+	auto getBinIndex = [&origin, &extent](float coordinate, int axisI)
+	{
+		const float offset = (coordinate - origin[axisI]) * (BinCount / extent[axisI]);
+		return std::min(BinCount - 1, static_cast<size_t>(std::max(0.0f, offset)));
+	};
+	auto getBinStart = [&origin, &extent](size_t binI, int axisI)
+	{
+		return origin[axisI] + (extent[axisI] * binI) / BinCount;
+	};
+
+	// Every reference is chopped into the bins it overlaps, and counted as an entry in its first bin and an exit in its last.
+	const auto bins = reduceElements(references.size(), allowParallelization, AxisSpatialBins(),
+		[&](AxisSpatialBins& acc, size_type i)
+		{
+			const auto& ref = references[i];
+			for (int axisI = 0; axisI < nbOfAxes; axisI++)
+			{
+				if (extent[axisI] <= 0)
+				{
+					continue;
+				}
+				const auto axis = static_cast<Axis>(axisI);
+				const size_t firstBin = getBinIndex(ref.bounds.getStart()[axisI], axisI);
+				const size_t lastBin = getBinIndex(ref.bounds.getEnd()[axisI], axisI);
+
+				AABB remainder = ref.bounds;
+				for (size_t binI = firstBin; binI < lastBin; binI++)
+				{
+					const auto [left, right] = shapes.splitElementBounds(ref.index, remainder, axis, getBinStart(binI + 1, axisI));
+					acc[axisI][binI].clippedBounds.add(left);
+					remainder = right;
+				}
+				acc[axisI][lastBin].clippedBounds.add(remainder);
+				acc[axisI][firstBin].entries++;
+				acc[axisI][lastBin].exits++;
+			}
+		},
+		[](AxisSpatialBins& acc, const AxisSpatialBins& other)
+		{
+			for (int axisI = 0; axisI < nbOfAxes; axisI++)
+			{
+				for (size_t binI = 0; binI < BinCount; binI++)
+				{
+					acc[axisI][binI].clippedBounds.add(other[axisI][binI].clippedBounds);
+					acc[axisI][binI].entries += other[axisI][binI].entries;
+					acc[axisI][binI].exits += other[axisI][binI].exits;
+				}
+			}
+		});
+
+	SpatialSplit split;
+	const double totalAABBSurf = nodeBounds.getSurfaceArea();
+	for (int axisI = 0; axisI < nbOfAxes; axisI++)
+	{
+		if (extent[axisI] <= 0)
+		{
+			continue;
+		}
+		const auto& axisBins = bins[axisI];
+
+		// Cumulative bounds and exit counts from the right, covering bins [i+1, BinCount)
+		std::array<Bin, BinCount> rightBins {};
+		std::array<size_type, BinCount> rightCount {};
+		Bin acc;
+		size_type countAcc = 0;
+		for (size_t binI = BinCount - 1; binI > 0; binI--)
+		{
+			acc.add(axisBins[binI].clippedBounds);
+			countAcc += axisBins[binI].exits;
+			rightBins[binI - 1] = acc;
+			rightCount[binI - 1] = countAcc;
+		}
+
+		acc = Bin();
+		countAcc = 0;
+		for (size_t binI = 0; binI < BinCount - 1; binI++)
+		{
+			acc.add(axisBins[binI].clippedBounds);
+			countAcc += axisBins[binI].entries;
+			if (countAcc == 0 || rightCount[binI] == 0)
+			{
+				continue;
+			}
+			const double curCost = calculateSAH(countAcc, acc.bounds.getSurfaceArea(), rightCount[binI], rightBins[binI].bounds.getSurfaceArea(), totalAABBSurf);
+			if (curCost < split.cost)
+			{
+				split.cost = curCost;
+				split.axis = axisI;
+				split.position = getBinStart(binI + 1, axisI);
+				split.leftBounds = acc.bounds;
+				split.rightBounds = rightBins[binI].bounds;
+				split.leftCount = countAcc;
+				split.rightCount = rightCount[binI];
+			}
+		}
+	}
+	return split;
+}
+
+template <typename TRayHitInfo>
+std::pair<typename BVHBuilder<TRayHitInfo>::ReferenceList, typename BVHBuilder<TRayHitInfo>::ReferenceList> BVHBuilder<TRayHitInfo>::performSpatialSplit(const ShapeList& shapes, const ReferenceList& references, const SpatialSplit& split) const
+{
+	const auto axis = static_cast<Axis>(split.axis);
+	const double leftArea = split.leftBounds.getSurfaceArea();
+	const double rightArea = split.rightBounds.getSurfaceArea();
+	const double leftCount = split.leftCount;
+	const double rightCount = split.rightCount;
+
+	ReferenceList left;
+	ReferenceList right;
+	for (const auto& ref : references)
+	{
+		if (ref.bounds.getEnd()[split.axis] <= split.position)
+		{
+			left.push_back(ref);
+		}
+		else if (ref.bounds.getStart()[split.axis] >= split.position)
+		{
+			right.push_back(ref);
+		}
+		else
+		{
+			// Reference unsplitting: if moving the whole reference to one side is cheaper than duplicating it, do that instead.
+			const double splitCost = leftArea * leftCount + rightArea * rightCount;
+			const double allLeftCost = split.leftBounds.merge(ref.bounds).getSurfaceArea() * leftCount + rightArea * (rightCount - 1);
+			const double allRightCost = leftArea * (leftCount - 1) + split.rightBounds.merge(ref.bounds).getSurfaceArea() * rightCount;
+			if (allLeftCost < splitCost && allLeftCost <= allRightCost)
+			{
+				left.push_back(ref);
+			}
+			else if (allRightCost < splitCost)
+			{
+				right.push_back(ref);
+			}
+			else
+			{
+				const auto [leftBounds, rightBounds] = shapes.splitElementBounds(ref.index, ref.bounds, axis, split.position);
+				left.push_back(Reference{ ref.index, leftBounds });
+				right.push_back(Reference{ ref.index, rightBounds });
+			}
+		}
+	}
+	return std::make_pair(std::move(left), std::move(right));
+}
+
+template <typename TRayHitInfo>
+std::unique_ptr<typename BVHBuilder<TRayHitInfo>::SpatialBuildNode> BVHBuilder<TRayHitInfo>::buildSpatialNode(const ShapeList& shapes, ReferenceList references, unsigned int depth)
+{
+	assert(!references.empty());
+
+	const bool allowParallelization = depth < 2;
+	auto node = std::make_unique<SpatialBuildNode>();
+
+	const auto objectSplit = findBinnedSplit(references.size(), allowParallelization,
+		[&references](size_type i){ return references[i].bounds; },
+		[&references](size_type i){ return references[i].getCentroid(); });
+	node->bounds = objectSplit.bounds;
+
+	double bestCost = references.size() * costPerIntersection;
+	ReferenceList leftRefs;
+	ReferenceList rightRefs;
+
+	// Spatial splits are only worth evaluating if the children of the best object split overlap significantly.
+	// If no object split exists (all centroids coincide), the whole node counts as overlap.
+	const double overlapArea = objectSplit.isValid() ? getOverlapArea(objectSplit.leftBounds, objectSplit.rightBounds) : objectSplit.bounds.getSurfaceArea();
+	if (references.size() > 1 && overlapArea / rootSurfaceArea > settings.spatialSplitOverlapBudget && remainingDuplicates.load() > 0)
+	{
+		const auto spatialSplit = findSpatialSplit(shapes, references, node->bounds, allowParallelization);
+		if (spatialSplit.cost < bestCost && spatialSplit.cost < objectSplit.cost)
+		{
+			auto [left, right] = performSpatialSplit(shapes, references, spatialSplit);
+			const long long duplicates = static_cast<long long>(left.size() + right.size()) - static_cast<long long>(references.size());
+			if (!left.empty() && !right.empty())
+			{
+				if (remainingDuplicates.fetch_sub(duplicates) >= duplicates)
+				{
+					bestCost = spatialSplit.cost;
+					node->axis = static_cast<Axis>(spatialSplit.axis);
+					leftRefs = std::move(left);
+					rightRefs = std::move(right);
+				}
+				else
+				{
+					// Out of budget, give the duplicates back
+					remainingDuplicates.fetch_add(duplicates);
+				}
+			}
+		}
+	}
+
+	if (leftRefs.empty() && objectSplit.isValid() && objectSplit.cost < bestCost)
+	{
+		node->axis = static_cast<Axis>(objectSplit.axis);
+		auto middle = std::partition(references.begin(), references.end(), [&objectSplit](const Reference& ref)
+		{
+			return objectSplit.isLeft(ref.getCentroid());
+		});
+		leftRefs.assign(references.begin(), middle);
+		rightRefs.assign(middle, references.end());
+	}
+
+	if (leftRefs.empty())
+	{
+		// Create leaf node
+		node->elements.reserve(references.size());
+		for (const auto& ref : references)
+		{
+			node->elements.push_back(ref.index);
+		}
+		return node;
+	}
+
+	const size_type largestChildSize = std::max(leftRefs.size(), rightRefs.size());
+	ReferenceList().swap(references);
+
+	// Small subtrees are not worth the scheduling overhead
+	if (largestChildSize > 1000)
+	{
+#ifndef NO_TBB
+		tbb::parallel_invoke(
+			[&](){ node->children[0] = buildSpatialNode(shapes, std::move(leftRefs), depth + 1); },
+			[&](){ node->children[1] = buildSpatialNode(shapes, std::move(rightRefs), depth + 1); });
+#else
+		auto& pool = ThreadPool::get();
+		ThreadPool::TaskGroup group;
+		pool.submit(group, [&](){ node->children[1] = buildSpatialNode(shapes, std::move(rightRefs), depth + 1); });
+		node->children[0] = buildSpatialNode(shapes, std::move(leftRefs), depth + 1);
+		pool.wait(group);
+#endif
+	}
+	else
+	{
+		node->children[0] = buildSpatialNode(shapes, std::move(leftRefs), depth + 1);
+		node->children[1] = buildSpatialNode(shapes, std::move(rightRefs), depth + 1);
+	}
+	return node;
+}
+
+template <typename TRayHitInfo>
+std::pair<std::unique_ptr<typename BVHBuilder<TRayHitInfo>::Node>, size_t> BVHBuilder<TRayHitInfo>::convertSpatialTree(SpatialBuildNode& node, ShapeListPtr& remainingShapes)
+{
+	if (node.children[0] == nullptr)
+	{
+		// The leaves appear in the rearranged list in depth first order, so each leaf is the start of the remaining list.
+		auto [leafShapes, rest] = remainingShapes->split(node.elements.size());
+		remainingShapes = std::move(rest);
+		return std::make_pair(std::make_unique<Node>(node.bounds, std::move(leafShapes)), 1);
+	}
+
+	auto result = std::make_unique<Node>(node.bounds, node.axis);
+	auto [childA, childASize] = convertSpatialTree(*node.children[0], remainingShapes);
+	auto [childB, childBSize] = convertSpatialTree(*node.children[1], remainingShapes);
+	result->setChild(0, std::move(childA));
+	result->setChild(1, std::move(childB));
+	return std::make_pair(std::move(result), childASize + childBSize + 1);
+}
+
+template <typename TRayHitInfo>
+std::pair<std::unique_ptr<typename BVHBuilder<TRayHitInfo>::Node>, size_t> BVHBuilder<TRayHitInfo>::buildTreeSpatial(IShapeList<TRayHitInfo>& shapes)
+{
+	ReferenceList references;
+	references.reserve(shapes.count());
+	AABB rootBounds = shapes.getAABB(0);
+	for (size_type i = 0; i < shapes.count(); i++)
+	{
+		references.push_back(Reference{ i, shapes.getAABB(i) });
+		rootBounds = rootBounds.merge(references.back().bounds);
+	}
+	rootSurfaceArea = rootBounds.getSurfaceArea();
+	remainingDuplicates = static_cast<long long>(shapes.count() * settings.maxReferenceDuplication);
+
+	auto root = buildSpatialNode(shapes, std::move(references), 0);
+
+	// Lay out the leaf references in depth first order, duplicating the elements that are referenced from multiple leaves
+	std::vector<size_type> elements;
+	std::vector<SpatialBuildNode*> stack { root.get() };
+	while (!stack.empty())
+	{
+		auto* node = stack.back();
+		stack.pop_back();
+		if (node->children[0] == nullptr)
+		{
+			elements.insert(elements.end(), node->elements.begin(), node->elements.end());
+		}
+		else
+		{
+			stack.push_back(node->children[1].get());
+			stack.push_back(node->children[0].get());
+		}
+	}
+	shapes.rearrangeElements(elements);
+
+	ShapeListPtr remainingShapes = shapes.clone();
+	return convertSpatialTree(*root, remainingShapes);
+}
+
 template <typename TRayHitInfo>
 std::pair<std::unique_ptr<typename BVHBuilder<TRayHitInfo>::Node>, size_t> BVHBuilder<TRayHitInfo>::buildTree(IShapeList<TRayHitInfo> & shapes, Axis presortedAxis)
 {
@@ -289,7 +931,7 @@ std::pair<std::unique_ptr<typename BVHBuilder<TRayHitInfo>::Node>, size_t> BVHBu
 		node->setChild(0, std::move(childA));
         auto [childB, childBSize] = this->buildTree(*incompleteNode.rightSubList, incompleteNode.presortedAxis);
         node->setChild(1, std::move(childB));
-		return std::make_pair(std::move(node), childASize + childBSize);
+		return std::make_pair(std::move(node), childASize + childBSize + 1);
 	}
 }
 
@@ -303,6 +945,47 @@ std::pair<std::unique_ptr<typename BVHBuilder<TRayHitInfo>::Node>, size_t> BVHBu
 	tbb::task::spawn_root_and_wait(task);
 	return std::make_pair(std::move(node), size);
 }
+#else
+template <typename TRayHitInfo>
+std::pair<std::unique_ptr<typename BVHBuilder<TRayHitInfo>::Node>, size_t> BVHBuilder<TRayHitInfo>::buildTreeThreaded(IShapeList<TRayHitInfo>& shapes, Axis presortedAxis, unsigned int depth)
+{
+	bool allowParallelization = depth < 2;
+	auto result = buildNode(shapes, presortedAxis, allowParallelization);
+	if (std::holds_alternative<NodePtr>(result))
+	{
+		return std::make_pair(std::move(std::get<NodePtr>(result)), 1);
+	}
+
+	auto& incompleteNode = std::get<IncompleteNode>(result);
+	NodePtr node(std::move(incompleteNode.node));
+
+	NodePtr subNodeA;
+	size_t subNodeSizeA;
+	NodePtr subNodeB;
+	size_t subNodeSizeB;
+
+	// Small subtrees are not worth the scheduling overhead
+	bool useSubTasksForSubLists = incompleteNode.leftSubList->count() > 1000 || incompleteNode.rightSubList->count() > 1000;
+	if(useSubTasksForSubLists)
+	{
+		auto& pool = ThreadPool::get();
+		ThreadPool::TaskGroup group;
+		pool.submit(group, [this, &incompleteNode, &subNodeB, &subNodeSizeB, depth](){
+			std::tie(subNodeB, subNodeSizeB) = this->buildTreeThreaded(*incompleteNode.rightSubList, incompleteNode.presortedAxis, depth+1);
+		});
+		std::tie(subNodeA, subNodeSizeA) = this->buildTreeThreaded(*incompleteNode.leftSubList, incompleteNode.presortedAxis, depth+1);
+		pool.wait(group);
+	}
+	else
+	{
+		std::tie(subNodeA, subNodeSizeA) = this->buildTree(*incompleteNode.leftSubList, incompleteNode.presortedAxis);
+		std::tie(subNodeB, subNodeSizeB) = this->buildTree(*incompleteNode.rightSubList, incompleteNode.presortedAxis);
+	}
+
+	node->setChild(0, std::move(subNodeA));
+	node->setChild(1, std::move(subNodeB));
+	return std::make_pair(std::move(node), subNodeSizeA + subNodeSizeB + 1);
+}
 #endif
 
 template<typename TRayHitInfo>
@@ -338,25 +1021,37 @@ void BVHBuilder<TRayHitInfo>::logLeafNodeSizes(const BVHBuilder::Node &bvh, Stat
 
 
 template <typename TRayHitInfo>
-BVH<IShapeList<TRayHitInfo>, TRayHitInfo, 2> BVHBuilder<TRayHitInfo>::buildBVH(IShapeList<TRayHitInfo> & shapes, Statistics::Collector* stats)
+BVH<IShapeList<TRayHitInfo>, TRayHitInfo, 2> BVHBuilder<TRayHitInfo>::buildBVH(IShapeList<TRayHitInfo> & shapes, Statistics::Collector* stats, const BVHBuildSettings& settings)
 {
-	shapes.sortByCentroid(Axis::x, true);
+	if(settings.strategy == BVHBuildStrategy::SweepSAH)
+	{
+		shapes.sortByCentroid(Axis::x, true);
+	}
 
 	std::lock_guard lock(exec_mutex);
 
 	auto intersectionCost = 1;
 	auto traversalCost = 4;
-	BVHBuilder builder(intersectionCost, traversalCost);
-#ifdef NO_TBB
-	auto [rootNode, size] = builder.buildTree(shapes, Axis::x);
-#else
-    auto [rootNode, size] = builder.buildTreeThreaded(shapes, Axis::x);
-#endif
+	BVHBuilder builder(intersectionCost, traversalCost, settings);
+
+	NodePtr rootNode;
+	size_t size;
+	if(settings.strategy == BVHBuildStrategy::SpatialSplitSAH && shapes.supportsElementDuplication())
+	{
+		const auto elementCount = shapes.count();
+		std::tie(rootNode, size) = builder.buildTreeSpatial(shapes);
+		LOGSTAT(stats, "BVHDuplicatedReferenceCount", shapes.count() - elementCount);
+	}
+	else
+	{
+		std::tie(rootNode, size) = builder.buildTreeThreaded(shapes, Axis::x);
+	}
+
 	if(stats != nullptr)
     {
         logLeafNodeSizes(*rootNode, stats);
     }
+	shapes.precomputeTraceData();
 
-	return BVH<ShapeList, TRayHitInfo, 2>(std::move(rootNode), size);
+	return BVH<ShapeList, TRayHitInfo, 2>(std::move(rootNode), size, shapes.clone());
 }
-
@@ -0,0 +1,143 @@
+#include "BVHCache.h"
+
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include "FlatBVH.h"
+#include "utility/AtomicFile.h"
+#include "utility/Hash.h"
+
+namespace
+{
+    constexpr std::array<char, 8> Magic = {'B', 'V', 'H', 'C', 'A', 'C', 'H', 'E'};
+
+    template<typename T>
+    uint64_t hashValue(uint64_t seed, const T& value)
+    {
+        return Hash::combine(seed, Hash::bytes(&value, sizeof(value)));
+    }
+}
+
+BVHCache::BVHCache(std::string directory)
+    : directory(std::move(directory))
+{
+    std::error_code err;
+    std::filesystem::create_directories(this->directory, err);
+}
+
+uint64_t BVHCache::getKey(uint64_t contentHash, const BVHBuildSettings& settings, size_t width)
+{
+    uint64_t key = hashValue(contentHash, FormatVersion);
+    key = hashValue(key, static_cast<uint32_t>(width));
+    key = hashValue(key, getNodeSize(width));
+    key = hashValue(key, static_cast<uint32_t>(settings.strategy));
+    if(settings.strategy == BVHBuildStrategy::SpatialSplitSAH)
+    {
+        key = hashValue(key, settings.spatialSplitOverlapBudget);
+        key = hashValue(key, settings.maxReferenceDuplication);
+    }
+    return key;
+}
+
+uint32_t BVHCache::getNodeSize(size_t width)
+{
+    switch(width)
+    {
+        case 2: return sizeof(FlatBVHNode<2>);
+        case 4: return sizeof(FlatBVHNode<4>);
+        case 8: return sizeof(FlatBVHNode<8>);
+        default: throw std::runtime_error("Unsupported BVH width: " + std::to_string(width));
+    }
+}
+
+size_t BVHCache::getNodeOffset(uint64_t elementCount)
+{
+    // Nodes are 64-byte aligned in memory, keep them aligned in the (page aligned) mapping too.
+    const size_t orderEnd = sizeof(FileHeader) + elementCount * sizeof(uint32_t);
+    return (orderEnd + 63) / 64 * 64;
+}
+
+std::string BVHCache::getPath(uint64_t key) const
+{
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key << ".bvh";
+    return (std::filesystem::path(this->directory) / name.str()).string();
+}
+
+std::unique_ptr<MappedFile> BVHCache::openEntry(uint64_t key, size_t width, uint64_t inputElementCount) const
+{
+    const auto path = getPath(key);
+    std::error_code err;
+    if(!std::filesystem::is_regular_file(path, err))
+    {
+        return nullptr;
+    }
+
+    std::unique_ptr<MappedFile> file;
+    try
+    {
+        file = std::make_unique<MappedFile>(path);
+    }
+    catch(const std::runtime_error& e)
+    {
+        std::cerr << "Ignoring BVH cache entry: " << e.what() << std::endl;
+        return nullptr;
+    }
+
+    FileHeader header;
+    if(file->getSize() < sizeof(header))
+    {
+        return nullptr;
+    }
+    std::memcpy(&header, file->getData(), sizeof(header));
+
+    const bool headerMatches = header.magic == Magic && header.version == FormatVersion && header.key == key
+        && header.width == width && header.nodeSize == getNodeSize(width) && header.inputElementCount == inputElementCount
+        && header.nodeCount > 0 && header.elementCount < (1ull << 32u);
+    if(!headerMatches || file->getSize() != getNodeOffset(header.elementCount) + header.nodeCount * header.nodeSize)
+    {
+        return nullptr;
+    }
+
+    // Protects against truncated or corrupted files, and against the element order pointing outside of the list.
+    if(Hash::bytes(file->getData() + sizeof(header), file->getSize() - sizeof(header)) != header.checksum)
+    {
+        std::cerr << "Ignoring corrupted BVH cache entry " << path << std::endl;
+        return nullptr;
+    }
+    const auto* elementOrder = reinterpret_cast<const uint32_t*>(file->getData() + sizeof(header));
+    if(std::any_of(elementOrder, elementOrder + header.elementCount, [inputElementCount](uint32_t i){ return i >= inputElementCount; }))
+    {
+        return nullptr;
+    }
+
+    return file;
+}
+
+void BVHCache::writeEntry(FileHeader header, const std::vector<uint32_t>& elementOrder, const void* nodes) const
+{
+    header.magic = Magic;
+    header.version = FormatVersion;
+    header.nodeSize = getNodeSize(header.width);
+
+    const size_t nodeOffset = getNodeOffset(header.elementCount);
+    std::vector<char> payload(nodeOffset - sizeof(header) + header.nodeCount * header.nodeSize, 0);
+    std::memcpy(payload.data(), elementOrder.data(), elementOrder.size() * sizeof(uint32_t));
+    std::memcpy(payload.data() + nodeOffset - sizeof(header), nodes, header.nodeCount * header.nodeSize);
+    header.checksum = Hash::bytes(payload.data(), payload.size());
+
+    // Written through a temporary file, so concurrent runs never read a partially written entry.
+    try
+    {
+        writeFileAtomically(getPath(header.key), [&](std::ostream& out)
+        {
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(payload.data(), payload.size());
+        });
+    }
+    catch(const std::runtime_error& e)
+    {
+        std::cerr << "Could not write BVH cache entry: " << e.what() << std::endl;
+    }
+}
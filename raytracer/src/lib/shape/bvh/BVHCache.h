@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <cstring>
+#include "BVH.h"
+#include "BVHBuilder.h"
+#include "BVHBuildSettings.h"
+#include "utility/MappedFile.h"
+#include "utility/StatCollector.h"
+
+/*
+ * On-disk cache of packed BVHs, so geometry that did not change since the last run does not have to be rebuilt.
+ *
+ * Every BVH is stored in a separate file in the cache directory, named after its key: the content hash of the shape list
+ * (see IShapeList::getContentHash) combined with the build settings, the tree width and the file format version.
+ * Besides the nodes, the file holds the order of the list elements after the build, as indices into the list as it was
+ * before the build. On a cache hit, the file is memory-mapped and this order is applied to the list instead of building.
+ */
+class BVHCache
+{
+public:
+    static constexpr uint32_t FormatVersion = 1;
+
+    explicit BVHCache(std::string directory);
+
+    // Returns the BVH over shapes, packed with the given width (2, 4 or 8). On a cache hit, the list is rearranged into
+    // the element order of the cached tree. On a miss, the tree is built and stored in the cache.
+    template<typename TRayHitInfo>
+    BVH<IShapeList<TRayHitInfo>, TRayHitInfo, 2> getOrBuild(IShapeList<TRayHitInfo>& shapes, const BVHBuildSettings& settings, size_t width, Statistics::Collector* stats = nullptr);
+
+    size_t getHitCount() const
+    {
+        return hitCount;
+    }
+
+    size_t getMissCount() const
+    {
+        return missCount;
+    }
+
+private:
+    struct FileHeader
+    {
+        std::array<char, 8> magic;
+        uint32_t version;
+        uint32_t width;
+        uint32_t nodeSize;
+        uint32_t reserved;
+        uint64_t key;
+        uint64_t inputElementCount;
+        uint64_t elementCount;
+        uint64_t nodeCount;
+        uint64_t treeSize;
+        uint64_t checksum; // Hash of everything after the header
+    };
+
+    static uint64_t getKey(uint64_t contentHash, const BVHBuildSettings& settings, size_t width);
+    static uint32_t getNodeSize(size_t width);
+    // Offset of the node array in the file, the element order is stored right after the header.
+    static size_t getNodeOffset(uint64_t elementCount);
+    std::string getPath(uint64_t key) const;
+
+    // Returns the mapped file of the entry with the given key, or nullptr if there is no valid entry that matches the arguments.
+    std::unique_ptr<MappedFile> openEntry(uint64_t key, size_t width, uint64_t inputElementCount) const;
+    void writeEntry(FileHeader header, const std::vector<uint32_t>& elementOrder, const void* nodes) const;
+
+    template<typename TRayHitInfo, size_t Width>
+    static BVH<IShapeList<TRayHitInfo>, TRayHitInfo, 2> loadTree(IShapeList<TRayHitInfo>& shapes, const MappedFile& file);
+
+    template<typename TRayHitInfo, size_t Width>
+    void storeTree(uint64_t key, uint64_t inputElementCount, const std::vector<uint32_t>& elementOrder, const BVH<IShapeList<TRayHitInfo>, TRayHitInfo, 2>& bvh) const;
+
+    std::string directory;
+    size_t hitCount = 0;
+    size_t missCount = 0;
+};
+
+template<typename TRayHitInfo, size_t Width>
+BVH<IShapeList<TRayHitInfo>, TRayHitInfo, 2> BVHCache::loadTree(IShapeList<TRayHitInfo>& shapes, const MappedFile& file)
+{
+    using Tree = BVH<IShapeList<TRayHitInfo>, TRayHitInfo, 2>;
+    using Node = typename Tree::template PackedTree<Width>::Node;
+
+    FileHeader header;
+    std::memcpy(&header, file.getData(), sizeof(header));
+
+    const auto* elementOrder = reinterpret_cast<const uint32_t*>(file.getData() + sizeof(FileHeader));
+    shapes.rearrangeElements(std::vector<typename IShapeList<TRayHitInfo>::size_type>(elementOrder, elementOrder + header.elementCount));
+    shapes.precomputeTraceData();
+
+    std::vector<Node> nodes(header.nodeCount);
+    std::memcpy(static_cast<void*>(nodes.data()), file.getData() + getNodeOffset(header.elementCount), header.nodeCount * sizeof(Node));
+    return Tree(typename Tree::template PackedTree<Width>(std::move(nodes), shapes.clone()), header.treeSize);
+}
+
+template<typename TRayHitInfo, size_t Width>
+void BVHCache::storeTree(uint64_t key, uint64_t inputElementCount, const std::vector<uint32_t>& elementOrder, const BVH<IShapeList<TRayHitInfo>, TRayHitInfo, 2>& bvh) const
+{
+    const auto& nodes = bvh.template getPackedTree<Width>().getNodes();
+
+    FileHeader header {};
+    header.width = Width;
+    header.key = key;
+    header.inputElementCount = inputElementCount;
+    header.elementCount = elementOrder.size();
+    header.nodeCount = nodes.size();
+    header.treeSize = bvh.getSize();
+    writeEntry(header, elementOrder, nodes.data());
+}
+
+template<typename TRayHitInfo>
+BVH<IShapeList<TRayHitInfo>, TRayHitInfo, 2> BVHCache::getOrBuild(IShapeList<TRayHitInfo>& shapes, const BVHBuildSettings& settings, size_t width, Statistics::Collector* stats)
+{
+    // Restoring the element order requires rearrangeElements
+    if(!shapes.supportsElementDuplication())
+    {
+        missCount++;
+        auto bvh = BVHBuilder<TRayHitInfo>::buildBVH(shapes, stats, settings);
+        bvh.pack(width);
+        return bvh;
+    }
+
+    const uint64_t key = getKey(shapes.getContentHash(), settings, width);
+    const uint64_t inputElementCount = shapes.count();
+    if(auto file = openEntry(key, width, inputElementCount))
+    {
+        hitCount++;
+        switch(width)
+        {
+            case 2: return loadTree<TRayHitInfo, 2>(shapes, *file);
+            case 4: return loadTree<TRayHitInfo, 4>(shapes, *file);
+            default: return loadTree<TRayHitInfo, 8>(shapes, *file);
+        }
+    }
+    missCount++;
+
+    // Element identifiers before the build, sorted for lookup, so the order after the build can be expressed in input indices.
+    std::vector<std::pair<uint64_t, uint32_t>> inputIds(inputElementCount);
+    for(uint32_t i = 0; i < inputElementCount; i++)
+    {
+        inputIds[i] = std::make_pair(shapes.getElementId(i), i);
+    }
+    std::sort(inputIds.begin(), inputIds.end());
+
+    auto bvh = BVHBuilder<TRayHitInfo>::buildBVH(shapes, stats, settings);
+    bvh.pack(width);
+
+    std::vector<uint32_t> elementOrder(shapes.count());
+    for(size_t i = 0; i < elementOrder.size(); i++)
+    {
+        const uint64_t id = shapes.getElementId(i);
+        auto it = std::lower_bound(inputIds.begin(), inputIds.end(), std::make_pair(id, uint32_t(0)));
+        if(it == inputIds.end() || it->first != id)
+        {
+            // Should not happen, but then the order can not be restored and the tree is not cached.
+            return bvh;
+        }
+        elementOrder[i] = it->second;
+    }
+
+    switch(width)
+    {
+        case 2: storeTree<TRayHitInfo, 2>(key, inputElementCount, elementOrder, bvh); break;
+        case 4: storeTree<TRayHitInfo, 4>(key, inputElementCount, elementOrder, bvh); break;
+        default: storeTree<TRayHitInfo, 8>(key, inputElementCount, elementOrder, bvh); break;
+    }
+    return bvh;
+}
@@ -445,6 +445,36 @@ public:
         return std::nullopt;
     }
 
+    // Bundled any-hit test: each child is only visited by the rays that hit its box and are not occluded yet.
+    RayBundleMask testVisibilities(const RayBundle& rays, const RayBundleMaxT& maxT, RayBundleMask rayMask) const
+    {
+        if(isLeafNode())
+        {
+            return leafData().testVisibilities(rays, maxT, rayMask);
+        }
+
+        RayBundleMask occluded = 0;
+        for(int i = 0; i < Arity; ++i)
+        {
+            const RayBundleMask activeRays = rayMask & ~occluded;
+            RayBundleMask childMask = 0;
+            for(RBSize_t rayI = 0; rayI < RayBundleSize; ++rayI)
+            {
+                float t0, t1;
+                if(((activeRays >> rayI) & 1u)
+                   && getChild(i).boundingBox.getIntersections(rays[rayI], t0, t1) && t0 <= maxT[rayI])
+                {
+                    childMask |= RayBundleMask(1) << rayI;
+                }
+            }
+            if(childMask != 0)
+            {
+                occluded |= getChild(i).testVisibilities(rays, maxT, childMask);
+            }
+        }
+        return occluded;
+    }
+
 private:
 	AABB boundingBox;
 	std::variant<BVHSubnodeArray, TContentPtr> data;
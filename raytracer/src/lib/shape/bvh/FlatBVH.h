@@ -0,0 +1,788 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <cstdint>
+#include "shape/AABB.h"
+#include "math/Ray.h"
+#include "utility/BitOps.h"
+
+#ifdef ENABLE_SIMD
+#include <xmmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#define FLAT_BVH_AVX_PACKETS
+#endif
+#endif
+
+/*
+ * Node of a packed BVH with up to Width children.
+ *
+ * The bounding boxes of the children are stored inline, as separate min/max arrays per axis, so a ray can be tested
+ * against all children of a node at once without loading the child nodes. Inner children are referenced by their
+ * index in the node array. Leaf children reference a range of elements in the shape list the BVH was built over.
+ * Nodes are 64-byte aligned: a binary node fills exactly one cache line, 4- and 8-wide nodes fill two and four.
+ */
+template<size_t Width>
+struct alignas(64) FlatBVHNode
+{
+    static constexpr uint32_t EmptySlot = std::numeric_limits<uint32_t>::max();
+
+    std::array<float, Width> minX, minY, minZ;
+    std::array<float, Width> maxX, maxY, maxZ;
+    // Index of the child node, or the index of the first element if the child is a leaf.
+    std::array<uint32_t, Width> child;
+    // Amount of elements in the leaf, 0 if the child is an inner node.
+    std::array<uint32_t, Width> leafSize;
+
+    FlatBVHNode()
+    {
+        // Empty slots get an inverted box that can never be hit.
+        minX.fill(INFINITY); minY.fill(INFINITY); minZ.fill(INFINITY);
+        maxX.fill(-INFINITY); maxY.fill(-INFINITY); maxZ.fill(-INFINITY);
+        child.fill(EmptySlot);
+        leafSize.fill(0);
+    }
+
+    void setBounds(size_t i, const AABB& box)
+    {
+        minX[i] = box.getStart().x(); minY[i] = box.getStart().y(); minZ[i] = box.getStart().z();
+        maxX[i] = box.getEnd().x(); maxY[i] = box.getEnd().y(); maxZ[i] = box.getEnd().z();
+    }
+};
+
+// Ray data in the form used by the slab tests of FlatBVHNode.
+struct FlatBVHRay
+{
+    FlatBVHRay() = default;
+
+    explicit FlatBVHRay(const Ray& ray)
+    {
+        for(int i = 0; i < 3; ++i)
+        {
+            origin[i] = ray.getOrigin()[i];
+            invDir[i] = 1.0f / ray.getDirection()[i];
+            isNegative[i] = invDir[i] < 0;
+        }
+    }
+
+    std::array<float, 3> origin;
+    std::array<float, 3> invDir;
+    std::array<bool, 3> isNegative;
+};
+
+// Slab test of the ray against all child boxes of the node. For every child that is hit in [0, maxT], the
+// corresponding bit in the returned mask is set and the entry distance is written to tEntry.
+template<size_t Width>
+inline uint32_t intersectChildren(const FlatBVHNode<Width>& node, const FlatBVHRay& ray, float maxT, std::array<float, Width>& tEntry)
+{
+    const float* nearX = ray.isNegative[0] ? node.maxX.data() : node.minX.data();
+    const float* farX = ray.isNegative[0] ? node.minX.data() : node.maxX.data();
+    const float* nearY = ray.isNegative[1] ? node.maxY.data() : node.minY.data();
+    const float* farY = ray.isNegative[1] ? node.minY.data() : node.maxY.data();
+    const float* nearZ = ray.isNegative[2] ? node.maxZ.data() : node.minZ.data();
+    const float* farZ = ray.isNegative[2] ? node.minZ.data() : node.maxZ.data();
+
+    uint32_t mask = 0;
+#ifdef ENABLE_SIMD
+    if constexpr (Width % 4 == 0)
+    {
+        const __m128 ox = _mm_set1_ps(ray.origin[0]), oy = _mm_set1_ps(ray.origin[1]), oz = _mm_set1_ps(ray.origin[2]);
+        const __m128 ix = _mm_set1_ps(ray.invDir[0]), iy = _mm_set1_ps(ray.invDir[1]), iz = _mm_set1_ps(ray.invDir[2]);
+        const __m128 tLow = _mm_setzero_ps(), tHigh = _mm_set1_ps(maxT);
+        for(size_t i = 0; i < Width; i += 4)
+        {
+            __m128 tMin = _mm_max_ps(
+                _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearX + i), ox), ix), _mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearY + i), oy), iy)),
+                _mm_max_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearZ + i), oz), iz), tLow));
+            __m128 tMax = _mm_min_ps(
+                _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(farX + i), ox), ix), _mm_mul_ps(_mm_sub_ps(_mm_load_ps(farY + i), oy), iy)),
+                _mm_min_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(farZ + i), oz), iz), tHigh));
+            _mm_storeu_ps(&tEntry[i], tMin);
+            mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tMin, tMax))) << i;
+        }
+        return mask;
+    }
+#endif
+    for(size_t i = 0; i < Width; ++i)
+    {
+        float tMin = std::max(
+            std::max((nearX[i] - ray.origin[0]) * ray.invDir[0], (nearY[i] - ray.origin[1]) * ray.invDir[1]),
+            std::max((nearZ[i] - ray.origin[2]) * ray.invDir[2], 0.0f));
+        float tMax = std::min(
+            std::min((farX[i] - ray.origin[0]) * ray.invDir[0], (farY[i] - ray.origin[1]) * ray.invDir[1]),
+            std::min((farZ[i] - ray.origin[2]) * ray.invDir[2], maxT));
+        tEntry[i] = tMin;
+        mask |= static_cast<uint32_t>(tMin <= tMax) << i;
+    }
+    return mask;
+}
+
+/*
+ * Traversal stack of FlatBVH. The first InlineSize entries live on the call stack, deeper trees spill over into a
+ * heap allocated vector. Entries in the overflow are always newer than the inline ones, so they are popped first.
+ */
+template<typename T, size_t InlineSize>
+class FlatBVHStack
+{
+public:
+    bool empty() const
+    {
+        return inlineCount == 0;
+    }
+
+    void push(const T& entry)
+    {
+        if(inlineCount < InlineSize)
+        {
+            inlineEntries[inlineCount++] = entry;
+        }
+        else
+        {
+            overflow.push_back(entry);
+        }
+    }
+
+    T pop()
+    {
+        if(!overflow.empty())
+        {
+            T entry = overflow.back();
+            overflow.pop_back();
+            return entry;
+        }
+        return inlineEntries[--inlineCount];
+    }
+
+private:
+    std::array<T, InlineSize> inlineEntries;
+    size_t inlineCount = 0;
+    std::vector<T> overflow;
+};
+
+/*
+ * BVH stored as a contiguous array of FlatBVHNodes, built by collapsing a linked BVH.
+ * The tree owns a (shallow) copy of the shape list it was built over, the leaves are element ranges in that list.
+ */
+template<typename TContent, typename TRayHitInfo, size_t Width>
+class FlatBVH
+{
+public:
+    using Node = FlatBVHNode<Width>;
+
+    template<typename TLinkedNode>
+    FlatBVH(const TLinkedNode& root, std::unique_ptr<TContent> content)
+        : content(std::move(content))
+    {
+        uint32_t elementOffset = 0;
+        flattenNode(root, elementOffset);
+        if(elementOffset != this->content->count())
+        {
+            throw std::runtime_error("BVH leaves do not cover the shape list");
+        }
+    }
+
+    // Restores a tree from the nodes of another FlatBVH (see getNodes), over content with the same element order.
+    FlatBVH(std::vector<Node> nodes, std::unique_ptr<TContent> content)
+        : nodes(std::move(nodes)), content(std::move(content))
+    { }
+
+    size_t getNodeCount() const
+    {
+        return nodes.size();
+    }
+
+    const std::vector<Node>& getNodes() const
+    {
+        return nodes;
+    }
+
+    std::optional<TRayHitInfo> traceRay(const Ray& ray) const
+    {
+        return traceRayFrom(ray, StackEntry{0, 0, 0.0f});
+    }
+
+    std::optional<TRayHitInfo> testVisibility(const Ray& ray, float maxT) const
+    {
+        FlatBVHRay flatRay(ray);
+        FlatBVHStack<uint32_t, StackSize> stack;
+        stack.push(0);
+
+        std::array<float, Width> tEntry;
+        while(!stack.empty())
+        {
+            const Node& node = nodes[stack.pop()];
+            uint32_t mask = intersectChildren(node, flatRay, maxT, tEntry);
+            for(size_t i = 0; mask != 0; ++i, mask >>= 1u)
+            {
+                if((mask & 1u) == 0)
+                {
+                    continue;
+                }
+                if(node.leafSize[i] > 0)
+                {
+                    auto hit = content->testVisibilityInRange(ray, maxT, node.child[i], node.child[i] + node.leafSize[i]);
+                    if(hit.has_value())
+                    {
+                        return hit;
+                    }
+                }
+                else
+                {
+                    stack.push(node.child[i]);
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Bundled any-hit traversal. The rays that visit a node are tracked as a mask, so rays are not reordered and
+    // occluded rays drop out of all pending nodes at once.
+    RayBundleMask testVisibilities(const RayBundle& rays, const RayBundleMaxT& maxT, RayBundleMask rayMask) const
+    {
+        std::array<FlatBVHRay, RayBundleSize> flatRays;
+        for(RBSize_t rayI = 0; rayI < RayBundleSize; ++rayI)
+        {
+            if((rayMask >> rayI) & 1u)
+            {
+                flatRays[rayI] = FlatBVHRay(rays[rayI]);
+            }
+        }
+
+        struct MaskStackEntry
+        {
+            uint32_t node;
+            RayBundleMask rayMask;
+        };
+        FlatBVHStack<MaskStackEntry, StackSize> stack;
+        stack.push(MaskStackEntry{0, rayMask});
+
+        RayBundleMask occluded = 0;
+        std::array<float, Width> tEntry;
+        while(!stack.empty())
+        {
+            const MaskStackEntry cur = stack.pop();
+            const RayBundleMask activeRays = cur.rayMask & ~occluded;
+            if(activeRays == 0)
+            {
+                continue;
+            }
+
+            const Node& node = nodes[cur.node];
+            std::array<RayBundleMask, Width> childMasks {};
+            for(RBSize_t rayI = 0; rayI < RayBundleSize; ++rayI)
+            {
+                if(((activeRays >> rayI) & 1u) == 0)
+                {
+                    continue;
+                }
+                uint32_t mask = intersectChildren(node, flatRays[rayI], maxT[rayI], tEntry);
+                for(size_t i = 0; mask != 0; ++i, mask >>= 1u)
+                {
+                    if(mask & 1u)
+                    {
+                        childMasks[i] |= RayBundleMask(1) << rayI;
+                    }
+                }
+            }
+
+            for(size_t i = 0; i < Width; ++i)
+            {
+                const RayBundleMask childRays = childMasks[i] & ~occluded;
+                if(childRays == 0)
+                {
+                    continue;
+                }
+                if(node.leafSize[i] > 0)
+                {
+                    occluded |= content->testVisibilitiesInRange(rays, maxT, childRays, node.child[i], node.child[i] + node.leafSize[i]);
+                }
+                else
+                {
+                    stack.push(MaskStackEntry{node.child[i], childRays});
+                }
+            }
+        }
+        return occluded;
+    }
+
+    void traceRays(RBSize_t startIdx, RBSize_t endIdx, RayBundle& rays, RayBundlePermutation& perm,
+                   HitBundle<TRayHitInfo>& result, std::array<bool, RayBundleSize>& foundBetterHit) const
+    {
+#ifdef FLAT_BVH_AVX_PACKETS
+        for(RBSize_t packetStart = startIdx; packetStart < endIdx; packetStart += PacketSize)
+        {
+            auto packetEnd = static_cast<RBSize_t>(std::min<int>(packetStart + PacketSize, endIdx));
+            tracePacket(packetStart, packetEnd, rays, perm, result, foundBetterHit);
+        }
+#else
+        traceRaysFrom(0, startIdx, endIdx, rays, perm, result, foundBetterHit);
+#endif
+    }
+
+private:
+    // Traversal stack entries kept on the call stack, deeper trees spill over to the heap.
+    static constexpr size_t StackSize = 256;
+
+    struct StackEntry
+    {
+        uint32_t child;
+        uint32_t leafSize;
+        float tEntry;
+    };
+
+    std::vector<Node> nodes;
+    std::unique_ptr<TContent> content;
+
+    // Returns the index of the new node. The children of the linked node are replaced by their own children, largest
+    // surface area first, until the node has Width children. Leaves are visited left to right, so the element offset
+    // of each leaf follows from the sizes of the leaves before it.
+    template<typename TLinkedNode>
+    uint32_t flattenNode(const TLinkedNode& linkedNode, uint32_t& elementOffset)
+    {
+        std::vector<const TLinkedNode*> children;
+        if(linkedNode.isLeafNode())
+        {
+            children.push_back(&linkedNode);
+        }
+        else
+        {
+            addChildren(linkedNode, children, children.end());
+        }
+
+        while(true)
+        {
+            int bestI = -1;
+            double bestArea = -1;
+            for(size_t i = 0; i < children.size(); ++i)
+            {
+                if(!children[i]->isLeafNode() && children.size() - 1 + childCount(*children[i]) <= Width)
+                {
+                    double area = children[i]->getAABB().getSurfaceArea();
+                    if(area > bestArea)
+                    {
+                        bestI = static_cast<int>(i);
+                        bestArea = area;
+                    }
+                }
+            }
+            if(bestI == -1)
+            {
+                break;
+            }
+            const TLinkedNode* opened = children[bestI];
+            auto it = children.erase(children.begin() + bestI);
+            addChildren(*opened, children, it);
+        }
+
+        auto nodeIdx = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        for(size_t i = 0; i < children.size(); ++i)
+        {
+            const TLinkedNode& child = *children[i];
+            nodes[nodeIdx].setBounds(i, child.getAABB());
+            if(child.isLeafNode())
+            {
+                auto size = static_cast<uint32_t>(child.leafData().count());
+                nodes[nodeIdx].child[i] = elementOffset;
+                nodes[nodeIdx].leafSize[i] = size;
+                elementOffset += size;
+            }
+            else
+            {
+                // Don't keep a reference into nodes here, the recursive call may reallocate it.
+                auto childIdx = flattenNode(child, elementOffset);
+                nodes[nodeIdx].child[i] = childIdx;
+            }
+        }
+        return nodeIdx;
+    }
+
+    template<typename TLinkedNode>
+    static size_t childCount(const TLinkedNode& node)
+    {
+        return std::tuple_size<typename TLinkedNode::BVHSubnodeArray>::value;
+    }
+
+    template<typename TLinkedNode>
+    static void addChildren(const TLinkedNode& node, std::vector<const TLinkedNode*>& children, typename std::vector<const TLinkedNode*>::iterator pos)
+    {
+        for(size_t i = childCount(node); i > 0; --i)
+        {
+            pos = children.insert(pos, &node.getChild(i - 1));
+        }
+    }
+
+    // Closest hit traversal, starting with the given stack entry. Children are visited nearest first, and subtrees
+    // that start beyond the best hit found so far are skipped.
+    std::optional<TRayHitInfo> traceRayFrom(const Ray& ray, StackEntry start, float maxT = INFINITY) const
+    {
+        FlatBVHRay flatRay(ray);
+        std::optional<TRayHitInfo> bestHit;
+        float bestT = maxT;
+
+        FlatBVHStack<StackEntry, StackSize> stack;
+        stack.push(start);
+
+        std::array<float, Width> tEntry;
+        std::array<StackEntry, Width> hitChildren;
+        while(!stack.empty())
+        {
+            StackEntry cur = stack.pop();
+            if(cur.tEntry > bestT)
+            {
+                continue;
+            }
+
+            if(cur.leafSize > 0)
+            {
+                auto hit = content->traceRayInRange(ray, cur.child, cur.child + cur.leafSize);
+                if(hit.has_value() && hit->t < bestT)
+                {
+                    bestT = hit->t;
+                    bestHit = hit;
+                }
+                continue;
+            }
+
+            const Node& node = nodes[cur.child];
+            uint32_t mask = intersectChildren(node, flatRay, bestT, tEntry);
+
+            // Sort the hit children by entry distance (insertion sort, at most Width elements), then push them
+            // far to near so the nearest child is popped first.
+            size_t hitCount = 0;
+            for(size_t i = 0; mask != 0; ++i, mask >>= 1u)
+            {
+                if((mask & 1u) == 0)
+                {
+                    continue;
+                }
+                StackEntry entry{node.child[i], node.leafSize[i], tEntry[i]};
+                size_t j = hitCount++;
+                for(; j > 0 && hitChildren[j - 1].tEntry < entry.tEntry; --j)
+                {
+                    hitChildren[j] = hitChildren[j - 1];
+                }
+                hitChildren[j] = entry;
+            }
+            for(size_t i = 0; i < hitCount; ++i)
+            {
+                stack.push(hitChildren[i]);
+            }
+        }
+        return bestHit;
+    }
+
+#ifdef FLAT_BVH_AVX_PACKETS
+    static constexpr RBSize_t PacketSize = 8;
+
+    // Up to 8 rays in SoA form, one ray per AVX lane.
+    struct RayPacket
+    {
+        __m256 originX, originY, originZ;
+        __m256 invDirX, invDirY, invDirZ;
+        alignas(32) std::array<float, PacketSize> tMax;
+        std::array<RBSize_t, PacketSize> rayIdx;
+        uint32_t validMask;
+
+        // Set if all rays have the same direction sign on each axis. Only then the near/far planes of a box are the
+        // same for all rays, and the packet can be bounded by intervals of origins and inverse directions.
+        bool isCoherent;
+        std::array<bool, 3> isNegative;
+        std::array<float, 3> minOrigin, maxOrigin;
+        std::array<float, 3> minInvDir, maxInvDir;
+    };
+
+    // Returns false if the rays are not coherent enough for packet traversal.
+    static bool initPacket(RayPacket& packet, RBSize_t packetStart, RBSize_t packetEnd, const RayBundle& rays,
+                           const RayBundlePermutation& perm, const HitBundle<TRayHitInfo>& result)
+    {
+        alignas(32) std::array<std::array<float, PacketSize>, 6> soa;
+        packet.validMask = 0;
+        packet.isCoherent = true;
+        for(RBSize_t lane = 0; lane < PacketSize; ++lane)
+        {
+            // Padding lanes repeat the first ray, but are never marked as valid.
+            RBSize_t rayI = packetStart + lane < packetEnd ? packetStart + lane : packetStart;
+            FlatBVHRay ray(rays[rayI]);
+            packet.rayIdx[lane] = rayI;
+            packet.tMax[lane] = getBestT(result, perm[rayI]);
+            for(int axis = 0; axis < 3; ++axis)
+            {
+                soa[axis][lane] = ray.origin[axis];
+                soa[3 + axis][lane] = ray.invDir[axis];
+
+                if(lane == 0)
+                {
+                    packet.isNegative[axis] = ray.isNegative[axis];
+                    packet.minOrigin[axis] = packet.maxOrigin[axis] = ray.origin[axis];
+                    packet.minInvDir[axis] = packet.maxInvDir[axis] = ray.invDir[axis];
+                }
+                packet.isCoherent = packet.isCoherent && ray.isNegative[axis] == packet.isNegative[axis] && std::isfinite(ray.invDir[axis]);
+                packet.minOrigin[axis] = std::min(packet.minOrigin[axis], ray.origin[axis]);
+                packet.maxOrigin[axis] = std::max(packet.maxOrigin[axis], ray.origin[axis]);
+                packet.minInvDir[axis] = std::min(packet.minInvDir[axis], ray.invDir[axis]);
+                packet.maxInvDir[axis] = std::max(packet.maxInvDir[axis], ray.invDir[axis]);
+            }
+            if(packetStart + lane < packetEnd)
+            {
+                packet.validMask |= 1u << lane;
+            }
+        }
+        packet.originX = _mm256_load_ps(soa[0].data());
+        packet.originY = _mm256_load_ps(soa[1].data());
+        packet.originZ = _mm256_load_ps(soa[2].data());
+        packet.invDirX = _mm256_load_ps(soa[3].data());
+        packet.invDirY = _mm256_load_ps(soa[4].data());
+        packet.invDirZ = _mm256_load_ps(soa[5].data());
+        return packet.isCoherent;
+    }
+
+    // Conservative test with interval arithmetic: returns false only if none of the rays in the packet can hit the
+    // box of the child before the largest tMax of the packet.
+    static bool packetMayHit(const RayPacket& packet, const Node& node, size_t childI, float packetTMax)
+    {
+        const std::array<float, 3> boxMin {node.minX[childI], node.minY[childI], node.minZ[childI]};
+        const std::array<float, 3> boxMax {node.maxX[childI], node.maxY[childI], node.maxZ[childI]};
+        float tNear = 0.0f;
+        float tFar = packetTMax;
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            float nearPlane = packet.isNegative[axis] ? boxMax[axis] : boxMin[axis];
+            float farPlane = packet.isNegative[axis] ? boxMin[axis] : boxMax[axis];
+            // Bounds of (plane - origin) * invDir over the origin and invDir intervals are found in the corners.
+            float n0 = (nearPlane - packet.maxOrigin[axis]) * packet.minInvDir[axis];
+            float n1 = (nearPlane - packet.maxOrigin[axis]) * packet.maxInvDir[axis];
+            float n2 = (nearPlane - packet.minOrigin[axis]) * packet.minInvDir[axis];
+            float n3 = (nearPlane - packet.minOrigin[axis]) * packet.maxInvDir[axis];
+            float f0 = (farPlane - packet.maxOrigin[axis]) * packet.minInvDir[axis];
+            float f1 = (farPlane - packet.maxOrigin[axis]) * packet.maxInvDir[axis];
+            float f2 = (farPlane - packet.minOrigin[axis]) * packet.minInvDir[axis];
+            float f3 = (farPlane - packet.minOrigin[axis]) * packet.maxInvDir[axis];
+            tNear = std::max(tNear, std::min({n0, n1, n2, n3}));
+            tFar = std::min(tFar, std::max({f0, f1, f2, f3}));
+        }
+        return tNear <= tFar;
+    }
+
+    // Slab test of all rays in the packet against one child box. Returns the mask of lanes that hit the box.
+    static uint32_t intersectPacket(const RayPacket& packet, const Node& node, size_t childI, __m256 tMax, __m256& tEntry)
+    {
+        const bool negX = packet.isNegative[0], negY = packet.isNegative[1], negZ = packet.isNegative[2];
+        const __m256 nearX = _mm256_set1_ps(negX ? node.maxX[childI] : node.minX[childI]);
+        const __m256 farX = _mm256_set1_ps(negX ? node.minX[childI] : node.maxX[childI]);
+        const __m256 nearY = _mm256_set1_ps(negY ? node.maxY[childI] : node.minY[childI]);
+        const __m256 farY = _mm256_set1_ps(negY ? node.minY[childI] : node.maxY[childI]);
+        const __m256 nearZ = _mm256_set1_ps(negZ ? node.maxZ[childI] : node.minZ[childI]);
+        const __m256 farZ = _mm256_set1_ps(negZ ? node.minZ[childI] : node.maxZ[childI]);
+
+        __m256 tMin = _mm256_max_ps(
+            _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(nearX, packet.originX), packet.invDirX), _mm256_mul_ps(_mm256_sub_ps(nearY, packet.originY), packet.invDirY)),
+            _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(nearZ, packet.originZ), packet.invDirZ), _mm256_setzero_ps()));
+        __m256 tExit = _mm256_min_ps(
+            _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(farX, packet.originX), packet.invDirX), _mm256_mul_ps(_mm256_sub_ps(farY, packet.originY), packet.invDirY)),
+            _mm256_min_ps(_mm256_mul_ps(_mm256_sub_ps(farZ, packet.originZ), packet.invDirZ), tMax));
+        tEntry = tMin;
+        return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tMin, tExit, _CMP_LE_OQ)));
+    }
+
+    void traceSingleRay(RayPacket& packet, RBSize_t lane, StackEntry start, const RayBundle& rays, const RayBundlePermutation& perm,
+                        HitBundle<TRayHitInfo>& result, std::array<bool, RayBundleSize>& foundBetterHit) const
+    {
+        auto rayI = packet.rayIdx[lane];
+        mergeHit(result, foundBetterHit, perm[rayI], traceRayFrom(rays[rayI], start, packet.tMax[lane]));
+        packet.tMax[lane] = getBestT(result, perm[rayI]);
+    }
+
+    void tracePacket(RBSize_t packetStart, RBSize_t packetEnd, const RayBundle& rays, const RayBundlePermutation& perm,
+                     HitBundle<TRayHitInfo>& result, std::array<bool, RayBundleSize>& foundBetterHit) const
+    {
+        RayPacket packet;
+        if(!initPacket(packet, packetStart, packetEnd, rays, perm, result))
+        {
+            // Incoherent rays would visit the union of their paths through the tree, trace them one by one.
+            for(RBSize_t lane = 0; lane < packetEnd - packetStart; ++lane)
+            {
+                traceSingleRay(packet, lane, StackEntry{0, 0, 0.0f}, rays, perm, result, foundBetterHit);
+            }
+            return;
+        }
+
+        struct PacketStackEntry
+        {
+            uint32_t child;
+            uint32_t leafSize;
+            uint32_t rayMask; // rays that intersect this node
+        };
+        FlatBVHStack<PacketStackEntry, StackSize> stack;
+        stack.push(PacketStackEntry{0, 0, packet.validMask});
+
+        alignas(32) std::array<float, PacketSize> tEntryLanes;
+        std::array<std::pair<float, PacketStackEntry>, Width> hitChildren;
+        while(!stack.empty())
+        {
+            PacketStackEntry cur = stack.pop();
+
+            if(BitOps::popcount(cur.rayMask) == 1)
+            {
+                // Only one ray of the packet is left in this subtree, continue without the packet overhead.
+                traceSingleRay(packet, BitOps::countTrailingZeros(cur.rayMask), StackEntry{cur.child, cur.leafSize, 0.0f}, rays, perm, result, foundBetterHit);
+                continue;
+            }
+
+            if(cur.leafSize > 0)
+            {
+                for(uint32_t mask = cur.rayMask; mask != 0; mask &= mask - 1)
+                {
+                    RBSize_t lane = BitOps::countTrailingZeros(mask);
+                    auto rayI = packet.rayIdx[lane];
+                    auto hit = content->traceRayInRange(rays[rayI], cur.child, cur.child + cur.leafSize);
+                    if(hit.has_value() && hit->t < packet.tMax[lane])
+                    {
+                        packet.tMax[lane] = hit->t;
+                        mergeHit(result, foundBetterHit, perm[rayI], std::move(hit));
+                    }
+                }
+                continue;
+            }
+
+            const Node& node = nodes[cur.child];
+            const __m256 tMax = _mm256_load_ps(packet.tMax.data());
+            float packetTMax = *std::max_element(packet.tMax.begin(), packet.tMax.end());
+            size_t hitCount = 0;
+            for(size_t childI = 0; childI < Width; ++childI)
+            {
+                if(node.child[childI] == Node::EmptySlot || !packetMayHit(packet, node, childI, packetTMax))
+                {
+                    continue;
+                }
+                __m256 tEntry;
+                uint32_t mask = intersectPacket(packet, node, childI, tMax, tEntry) & cur.rayMask;
+                if(mask == 0)
+                {
+                    continue;
+                }
+
+                // Order by the nearest entry point of any ray in the packet.
+                _mm256_store_ps(tEntryLanes.data(), tEntry);
+                float nearest = INFINITY;
+                for(uint32_t m = mask; m != 0; m &= m - 1)
+                {
+                    nearest = std::min(nearest, tEntryLanes[BitOps::countTrailingZeros(m)]);
+                }
+                std::pair<float, PacketStackEntry> entry {nearest, PacketStackEntry{node.child[childI], node.leafSize[childI], mask}};
+                size_t j = hitCount++;
+                for(; j > 0 && hitChildren[j - 1].first < nearest; --j)
+                {
+                    hitChildren[j] = hitChildren[j - 1];
+                }
+                hitChildren[j] = entry;
+            }
+            for(size_t i = 0; i < hitCount; ++i)
+            {
+                stack.push(hitChildren[i].second);
+            }
+        }
+    }
+#endif
+
+    static float getBestT(const HitBundle<TRayHitInfo>& result, RBSize_t resultIdx)
+    {
+        const auto& hit = result[resultIdx];
+        return hit.has_value() ? hit->t : INFINITY;
+    }
+
+    static void mergeHit(HitBundle<TRayHitInfo>& result, std::array<bool, RayBundleSize>& foundBetterHit, RBSize_t resultIdx, std::optional<TRayHitInfo>&& hit)
+    {
+        if(hit.has_value())
+        {
+            auto& entry = result[resultIdx];
+            if(!entry.has_value() || entry->t > hit->t)
+            {
+                entry = std::move(hit);
+                foundBetterHit[resultIdx] = true;
+            }
+        }
+    }
+
+    // Packet traversal: the rays [startIdx, endIdx) of the bundle all intersect this node. For every child, the rays
+    // that intersect it are moved to the front of the range and traced through the child as a smaller packet.
+    void traceRaysFrom(uint32_t nodeIdx, RBSize_t startIdx, RBSize_t endIdx, RayBundle& rays, RayBundlePermutation& perm,
+                       HitBundle<TRayHitInfo>& result, std::array<bool, RayBundleSize>& foundBetterHit) const
+    {
+        if(startIdx >= endIdx)
+        {
+            return;
+        }
+
+        const Node& node = nodes[nodeIdx];
+        std::array<float, Width> tEntry;
+
+        // Visit the children in the order of the first ray, rays in a bundle are usually coherent.
+        std::array<size_t, Width> childOrder;
+        size_t orderedCount = 0;
+        {
+            FlatBVHRay firstRay(rays[startIdx]);
+            intersectChildren(node, firstRay, INFINITY, tEntry);
+            for(size_t i = 0; i < Width; ++i)
+            {
+                if(node.child[i] == Node::EmptySlot)
+                {
+                    continue;
+                }
+                size_t j = orderedCount++;
+                for(; j > 0 && tEntry[childOrder[j - 1]] > tEntry[i]; --j)
+                {
+                    childOrder[j] = childOrder[j - 1];
+                }
+                childOrder[j] = i;
+            }
+        }
+
+        for(size_t orderI = 0; orderI < orderedCount; ++orderI)
+        {
+            size_t childI = childOrder[orderI];
+
+            RBSize_t hitEnd = startIdx;
+            for(RBSize_t rayI = startIdx; rayI < endIdx; ++rayI)
+            {
+                FlatBVHRay flatRay(rays[rayI]);
+                uint32_t mask = intersectChildren(node, flatRay, getBestT(result, perm[rayI]), tEntry);
+                if((mask >> childI) & 1u)
+                {
+                    std::swap(rays[rayI], rays[hitEnd]);
+                    std::swap(perm[rayI], perm[hitEnd]);
+                    hitEnd++;
+                }
+            }
+
+            RBSize_t hitCount = hitEnd - startIdx;
+            if(hitCount == 0)
+            {
+                continue;
+            }
+
+            if(node.leafSize[childI] > 0)
+            {
+                auto first = node.child[childI];
+                content->traceRaysInRange(first, first + node.leafSize[childI], startIdx, hitEnd, rays, perm, result, foundBetterHit);
+            }
+            else if(hitCount == 1)
+            {
+                auto resultIdx = perm[startIdx];
+                mergeHit(result, foundBetterHit, resultIdx,
+                         traceRayFrom(rays[startIdx], StackEntry{node.child[childI], 0, 0.0f}, getBestT(result, resultIdx)));
+            }
+            else
+            {
+                traceRaysFrom(node.child[childI], startIdx, hitEnd, rays, perm, result, foundBetterHit);
+            }
+        }
+    }
+};
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <vector>
+#include <functional>
+#include <stdexcept>
 #include "math/Vector3.h"
 #include "math/Axis.h"
 #include "shape/Box.h"
 #include "utility/ICloneable.h"
+#include "utility/Hash.h"
 
 template<typename TRayHitInfo>
 class IShapeList : public ICloneable<IShapeList<TRayHitInfo>>
@@ -29,6 +32,54 @@ public:
 	}
 
 	virtual void sortByCentroid(Axis axis, bool allowParallelization) = 0;
+
+	// Reorders the elements in place so the elements whose centroid satisfies isLeft come first.
+	// Returns the amount of elements for which isLeft holds. The relative order within each side is not preserved.
+	virtual size_type partitionByCentroid(const std::function<bool(const Point&)>& isLeft) = 0;
+
+	// Spatial split support, used by the SBVH builder.
+	// Lists that support it can contain the same element more than once, see rearrangeElements.
+	virtual bool supportsElementDuplication() const
+	{
+		return false;
+	}
+
+	// Returns the bounds of the part of the element that lies within bounds, on either side of the plane at position along axis.
+	// The default implementation just splits bounds, lists can override this to clip the element itself.
+	virtual std::array<AABB, 2> splitElementBounds(size_type /*index*/, const AABB& bounds, Axis axis, float position) const
+	{
+		return bounds.split(axis, position);
+	}
+
+	// Replaces the elements of this list by the given elements, in order. Elements can occur more than once.
+	// Only supported if supportsElementDuplication() returns true, and only for lists that are not a sublist.
+	virtual void rearrangeElements(const std::vector<size_type>& /*elements*/)
+	{
+		throw std::runtime_error("This shape list does not support element duplication");
+	}
+
+	// Identifier of the element, derived from its contents: elements with the same identifier are interchangeable.
+	// Identifiers only have to be stable within a process. The BVH cache uses them to find out how a build reordered the list.
+	virtual uint64_t getElementId(size_type index) const = 0;
+
+	// Hash of everything a BVH build over this list depends on, stable across processes. Used as BVH cache key.
+	// The default implementation hashes the bounds and centroids of the elements, in order.
+	virtual uint64_t getContentHash() const
+	{
+		uint64_t hash = Hash::combine(0, this->count());
+		for(size_type i = 0; i < this->count(); i++)
+		{
+			const AABB box = this->getAABB(i);
+			const Point centroid = this->getCentroid(i);
+			hash = Hash::combine(hash, Hash::bytes(box.getStart().data(), 3 * sizeof(float)));
+			hash = Hash::combine(hash, Hash::bytes(box.getEnd().data(), 3 * sizeof(float)));
+			hash = Hash::combine(hash, Hash::bytes(centroid.data(), 3 * sizeof(float)));
+		}
+		return hash;
+	}
+
+	// Called by the BVH builder once the order of the elements is final. Lists can precompute data for tracing here.
+	virtual void precomputeTraceData() {}
 	
 	virtual std::optional<TRayHitInfo> traceRay(const Ray& ray) const = 0;
     virtual void traceRays(RBSize_t startIdx, RBSize_t endIdx, RayBundle& rays, RayBundlePermutation& perm, HitBundle<TRayHitInfo>& result, std::array<bool, RayBundleSize>& foundBetterHit) const
@@ -58,4 +109,64 @@ public:
         }
         return std::nullopt;
     }
+
+    // Any-hit test of the rays of the bundle in rayMask, ray i only hits elements closer than maxT[i].
+    // Returns the mask of the rays that hit an element. The default implementation tests the rays one by one.
+    virtual RayBundleMask testVisibilities(const RayBundle& rays, const RayBundleMaxT& maxT, RayBundleMask rayMask) const
+    {
+        RayBundleMask occluded = 0;
+        for(RBSize_t rayI = 0; rayI < RayBundleSize; ++rayI)
+        {
+            if(((rayMask >> rayI) & 1u) && testVisibility(rays[rayI], maxT[rayI]).has_value())
+            {
+                occluded |= RayBundleMask(1) << rayI;
+            }
+        }
+        return occluded;
+    }
+
+    // Same as traceRay, traceRays, testVisibility and testVisibilities, but only the elements [first, last) of this list are considered.
+    // Packed BVHs reference their leaves as element ranges in the list they were built over, instead of storing a sublist per leaf.
+    virtual std::optional<TRayHitInfo> traceRayInRange(const Ray& ray, size_type first, size_type last) const = 0;
+
+    virtual void traceRaysInRange(size_type first, size_type last, RBSize_t startIdx, RBSize_t endIdx, RayBundle& rays, RayBundlePermutation& perm, HitBundle<TRayHitInfo>& result, std::array<bool, RayBundleSize>& foundBetterHit) const
+    {
+        for(RBSize_t rayI = startIdx; rayI < endIdx; ++rayI)
+        {
+            const auto &ray = rays[rayI];
+            auto hit = traceRayInRange(ray, first, last);
+            if(hit.has_value())
+            {
+                auto& entry = result[perm[rayI]];
+                if(!entry.has_value() || entry->t > hit->t)
+                {
+                    entry = hit;
+                    foundBetterHit[perm[rayI]] = true;
+                }
+            }
+        }
+    }
+
+    virtual std::optional<TRayHitInfo> testVisibilityInRange(const Ray& ray, float maxT, size_type first, size_type last) const
+    {
+        auto hit = traceRayInRange(ray, first, last);
+        if(hit.has_value() && hit->t <= maxT)
+        {
+            return hit;
+        }
+        return std::nullopt;
+    }
+
+    virtual RayBundleMask testVisibilitiesInRange(const RayBundle& rays, const RayBundleMaxT& maxT, RayBundleMask rayMask, size_type first, size_type last) const
+    {
+        RayBundleMask occluded = 0;
+        for(RBSize_t rayI = 0; rayI < RayBundleSize; ++rayI)
+        {
+            if(((rayMask >> rayI) & 1u) && testVisibilityInRange(rays[rayI], maxT[rayI], first, last).has_value())
+            {
+                occluded |= RayBundleMask(1) << rayI;
+            }
+        }
+        return occluded;
+    }
 };
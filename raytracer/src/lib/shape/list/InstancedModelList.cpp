@@ -1,5 +1,6 @@
 #include "InstancedModelList.h"
 #include "shape/bvh/BVHBuilder.h"
+#include "shape/bvh/BVHCache.h"
 #include "scene/renderable/SceneNode.h"
 #include "model/Model.h"
 #include <utility>
@@ -25,11 +26,18 @@ AABB InstancedModelList::getAABB(size_type index) const
 	return aabb.getAABBOfTransformed(node.getTransform());
 }
 
+namespace
+{
+	Point getNodeCentroid(const SceneNode<Model>& node)
+	{
+		const Point centroid = node.getData().getShape().getCentroid();
+		return node.getTransform().transform(centroid);
+	}
+}
+
 Point InstancedModelList::getCentroid(size_type index) const
 {
-	const auto& node = this->begin[index];
-	const Point centroid = node.getData().getShape().getCentroid();
-	return node.getTransform().transform(centroid);
+	return getNodeCentroid(this->begin[index]);
 }
 
 InstancedModelList::size_type InstancedModelList::count() const
@@ -57,7 +65,46 @@ void InstancedModelList::sortByCentroid(Axis axis, bool allowParallelization)
 	});
 }
 
-void InstancedModelList::buildShapeBVHCache(Statistics::Collector* stats) const
+InstancedModelList::size_type InstancedModelList::partitionByCentroid(const std::function<bool(const Point&)>& isLeft)
+{
+	auto middle = std::partition(this->begin, this->end, [&isLeft](const auto& node)
+	{
+		return isLeft(getNodeCentroid(node));
+	});
+	return std::distance(this->begin, middle);
+}
+
+void InstancedModelList::rearrangeElements(const std::vector<size_type>& elements)
+{
+	// Duplicate nodes share the shape and material of the original, and thereby also the shape BVH.
+	ModelVector rearranged;
+	rearranged.reserve(elements.size());
+	for (auto i : elements)
+	{
+		const auto& node = this->begin[i];
+		rearranged.emplace_back(node.getTransform(), node.getData().clone());
+	}
+
+	auto& nodes = this->data->shapes;
+	const auto beginIdx = std::distance(nodes.begin(), this->begin);
+	nodes.erase(this->begin, this->end);
+	nodes.insert(nodes.begin() + beginIdx, std::make_move_iterator(rearranged.begin()), std::make_move_iterator(rearranged.end()));
+	this->begin = nodes.begin() + beginIdx;
+	this->end = this->begin + elements.size();
+}
+
+uint64_t InstancedModelList::getElementId(size_type index) const
+{
+	// Nodes with the same shape, material and transformation are interchangeable, like the duplicates made by rearrangeElements.
+	const auto& node = this->begin[index];
+	const auto& matrix = node.getTransform().getMatrix();
+	uint64_t id = Hash::bytes(matrix.data(), matrix.size() * sizeof(matrix(0, 0)));
+	id = Hash::combine(id, reinterpret_cast<uintptr_t>(node.getData().getShapePtr().get()));
+	id = Hash::combine(id, reinterpret_cast<uintptr_t>(node.getData().getMaterialPtr().get()));
+	return id;
+}
+
+void InstancedModelList::buildShapeBVHCache(Statistics::Collector* stats, const BVHBuildSettings& settings, BVHCache* bvhCache) const
 {
 	// Calculate shape BVHs
 	for (auto& modelNode : this->data->shapes)
@@ -69,9 +116,17 @@ void InstancedModelList::buildShapeBVHCache(Statistics::Collector* stats) const
             auto it = this->data->shapeBVHs.find(shape);
             if(it == this->data->shapeBVHs.end())
             {
-                auto bvh = BVHBuilder<RayHitInfo>::buildBVH(*list, stats);
 #ifdef ENABLE_L2_BVH_PACK
-                bvh.pack();
+                auto bvh = bvhCache != nullptr
+                    ? bvhCache->getOrBuild(*list, settings, 4, stats)
+                    : BVHBuilder<RayHitInfo>::buildBVH(*list, stats, settings);
+                if(!bvh.isPacked())
+                {
+                    bvh.pack();
+                }
+#else
+                // The cache only stores packed trees
+                auto bvh = BVHBuilder<RayHitInfo>::buildBVH(*list, stats, settings);
 #endif
                 LOGSTAT(stats, "SecondLevelBVHNodeCount", bvh.getSize());
                 this->data->shapeBVHs.insert({ shape, std::move(bvh) });
@@ -97,10 +152,20 @@ std::optional<std::reference_wrapper<InstancedModelListData::ShapeBVH>> Instance
 }
 
 std::optional<SceneRayHitInfo> InstancedModelList::traceRay(const Ray & ray) const
+{
+    return this->traceRay(ray, this->begin, this->end);
+}
+
+std::optional<SceneRayHitInfo> InstancedModelList::traceRayInRange(const Ray& ray, size_type first, size_type last) const
+{
+    return this->traceRay(ray, this->begin + first, this->begin + last);
+}
+
+std::optional<SceneRayHitInfo> InstancedModelList::traceRay(const Ray& ray, ModelVector::iterator rangeBegin, ModelVector::iterator rangeEnd) const
 {
 	std::optional<RayHitInfo> closestHit;
 	SceneNode<Model>* node;
-	for(ModelVector::iterator it = begin; it < end; ++it)
+	for(ModelVector::iterator it = rangeBegin; it < rangeEnd; ++it)
 	{
 	    auto& modelNode = *it;
 
@@ -138,11 +203,21 @@ std::optional<SceneRayHitInfo> InstancedModelList::traceRay(const Ray & ray) con
 }
 
 void InstancedModelList::traceRays(RBSize_t startIdx, RBSize_t endIdx, RayBundle &rays, RayBundlePermutation &perm, HitBundle<SceneRayHitInfo> &result, std::array<bool, RayBundleSize>& foundBetterHit) const
+{
+    this->traceRays(this->begin, this->end, startIdx, endIdx, rays, perm, result, foundBetterHit);
+}
+
+void InstancedModelList::traceRaysInRange(size_type first, size_type last, RBSize_t startIdx, RBSize_t endIdx, RayBundle& rays, RayBundlePermutation& perm, HitBundle<SceneRayHitInfo>& result, std::array<bool, RayBundleSize>& foundBetterHit) const
+{
+    this->traceRays(this->begin + first, this->begin + last, startIdx, endIdx, rays, perm, result, foundBetterHit);
+}
+
+void InstancedModelList::traceRays(ModelVector::iterator rangeBegin, ModelVector::iterator rangeEnd, RBSize_t startIdx, RBSize_t endIdx, RayBundle &rays, RayBundlePermutation &perm, HitBundle<SceneRayHitInfo> &result, std::array<bool, RayBundleSize>& foundBetterHit) const
 {
     HitBundle<RayHitInfo> closestHits {};
     std::array<SceneNode<Model>*, RayBundleSize> nodes {};
 
-    for(ModelVector::iterator it = begin; it < end; ++it)
+    for(ModelVector::iterator it = rangeBegin; it < rangeEnd; ++it)
     {
         auto& modelNode = *it;
 
@@ -204,7 +279,17 @@ void InstancedModelList::traceRays(RBSize_t startIdx, RBSize_t endIdx, RayBundle
 
 std::optional<SceneRayHitInfo> InstancedModelList::testVisibility(const Ray &ray, float maxT) const
 {
-    for(ModelVector::iterator it = begin; it < end; ++it)
+    return this->testVisibility(ray, maxT, this->begin, this->end);
+}
+
+std::optional<SceneRayHitInfo> InstancedModelList::testVisibilityInRange(const Ray& ray, float maxT, size_type first, size_type last) const
+{
+    return this->testVisibility(ray, maxT, this->begin + first, this->begin + last);
+}
+
+std::optional<SceneRayHitInfo> InstancedModelList::testVisibility(const Ray &ray, float maxT, ModelVector::iterator rangeBegin, ModelVector::iterator rangeEnd) const
+{
+    for(ModelVector::iterator it = rangeBegin; it < rangeEnd; ++it)
     {
         auto& modelNode = *it;
         const auto transformedRay = modelNode.getTransform().transformInverse(ray);
@@ -232,6 +317,56 @@ std::optional<SceneRayHitInfo> InstancedModelList::testVisibility(const Ray &ray
     return std::nullopt;
 }
 
+RayBundleMask InstancedModelList::testVisibilities(const RayBundle& rays, const RayBundleMaxT& maxT, RayBundleMask rayMask) const
+{
+    return this->testVisibilities(rays, maxT, rayMask, this->begin, this->end);
+}
+
+RayBundleMask InstancedModelList::testVisibilitiesInRange(const RayBundle& rays, const RayBundleMaxT& maxT, RayBundleMask rayMask, size_type first, size_type last) const
+{
+    return this->testVisibilities(rays, maxT, rayMask, this->begin + first, this->begin + last);
+}
+
+RayBundleMask InstancedModelList::testVisibilities(const RayBundle& rays, const RayBundleMaxT& maxT, RayBundleMask rayMask, ModelVector::iterator rangeBegin, ModelVector::iterator rangeEnd) const
+{
+    RayBundleMask occluded = 0;
+    for(ModelVector::iterator it = rangeBegin; it < rangeEnd && rayMask != 0; ++it)
+    {
+        auto& modelNode = *it;
+
+        // The transformation does not normalize the direction, so the maxT values still apply to the transformed rays
+        RayBundle transformedRays;
+        for(RBSize_t i = 0; i < RayBundleSize; ++i)
+        {
+            if((rayMask >> i) & 1u)
+            {
+                transformedRays[i] = modelNode.getTransform().transformInverse(rays[i]);
+            }
+        }
+
+        auto bvh = this->data->findShapeBVH(modelNode.getData().getShape());
+
+        RayBundleMask hits = 0;
+        if(bvh.has_value())
+        {
+            hits = bvh->get().testVisibilities(transformedRays, maxT, rayMask);
+        }
+        else
+        {
+            for(RBSize_t i = 0; i < RayBundleSize; ++i)
+            {
+                if(((rayMask >> i) & 1u) && modelNode.getData().getShape().testVisibility(transformedRays[i], maxT[i]).has_value())
+                {
+                    hits |= RayBundleMask(1) << i;
+                }
+            }
+        }
+        occluded |= hits;
+        rayMask &= ~hits;
+    }
+    return occluded;
+}
+
 InstancedModelList* InstancedModelList::cloneImpl() const
 {
     return new InstancedModelList(*this);
@@ -8,6 +8,9 @@
 #include "model/Model.h"
 #include "scene/renderable/SceneRayHitInfo.h"
 #include "shape/bvh/BVH.h"
+#include "shape/bvh/BVHBuildSettings.h"
+
+class BVHCache;
 
 struct InstancedModelListData
 {
@@ -34,14 +37,34 @@ public:
 	size_type count() const override;
 	
 	void sortByCentroid(Axis axis, bool allowParallelization) override;
+	size_type partitionByCentroid(const std::function<bool(const Point&)>& isLeft) override;
+
+	bool supportsElementDuplication() const override
+	{
+		return true;
+	}
+	void rearrangeElements(const std::vector<size_type>& elements) override;
+	uint64_t getElementId(size_type index) const override;
 
-	void buildShapeBVHCache(Statistics::Collector* stats = nullptr) const;
+	// Builds the BVHs of the shapes, or loads them from bvhCache if it is not null and the shape BVHs are packed.
+	void buildShapeBVHCache(Statistics::Collector* stats = nullptr, const BVHBuildSettings& settings = {}, BVHCache* bvhCache = nullptr) const;
 
 	std::optional<SceneRayHitInfo> traceRay(const Ray& ray) const override;
     void traceRays(RBSize_t startIdx, RBSize_t endIdx, RayBundle& rays, RayBundlePermutation& perm, HitBundle<SceneRayHitInfo>& result, std::array<bool, RayBundleSize>& foundBetterHit) const override;
     std::optional<SceneRayHitInfo> testVisibility(const Ray &ray, float maxT) const override;
+    RayBundleMask testVisibilities(const RayBundle& rays, const RayBundleMaxT& maxT, RayBundleMask rayMask) const override;
+
+    std::optional<SceneRayHitInfo> traceRayInRange(const Ray& ray, size_type first, size_type last) const override;
+    void traceRaysInRange(size_type first, size_type last, RBSize_t startIdx, RBSize_t endIdx, RayBundle& rays, RayBundlePermutation& perm, HitBundle<SceneRayHitInfo>& result, std::array<bool, RayBundleSize>& foundBetterHit) const override;
+    std::optional<SceneRayHitInfo> testVisibilityInRange(const Ray& ray, float maxT, size_type first, size_type last) const override;
+    RayBundleMask testVisibilitiesInRange(const RayBundle& rays, const RayBundleMaxT& maxT, RayBundleMask rayMask, size_type first, size_type last) const override;
 
 private:
+    std::optional<SceneRayHitInfo> traceRay(const Ray& ray, ModelVector::iterator rangeBegin, ModelVector::iterator rangeEnd) const;
+    void traceRays(ModelVector::iterator rangeBegin, ModelVector::iterator rangeEnd, RBSize_t startIdx, RBSize_t endIdx, RayBundle& rays, RayBundlePermutation& perm, HitBundle<SceneRayHitInfo>& result, std::array<bool, RayBundleSize>& foundBetterHit) const;
+    std::optional<SceneRayHitInfo> testVisibility(const Ray& ray, float maxT, ModelVector::iterator rangeBegin, ModelVector::iterator rangeEnd) const;
+    RayBundleMask testVisibilities(const RayBundle& rays, const RayBundleMaxT& maxT, RayBundleMask rayMask, ModelVector::iterator rangeBegin, ModelVector::iterator rangeEnd) const;
+
 	InstancedModelList* cloneImpl() const override;
 	std::pair<IShapeList<SceneRayHitInfo>*, IShapeList<SceneRayHitInfo>*> splitImpl(size_type leftSideElemCount) const override;
 
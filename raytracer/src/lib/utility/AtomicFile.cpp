@@ -0,0 +1,58 @@
+#include "AtomicFile.h"
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+unsigned long getProcessId()
+{
+#ifdef _WIN32
+    return static_cast<unsigned long>(_getpid());
+#else
+    return static_cast<unsigned long>(getpid());
+#endif
+}
+
+void writeFileAtomically(const std::string& path, const std::function<void(std::ostream&)>& write)
+{
+    // Unique per process and per write, so concurrent writers of the same file never share a temporary file.
+    static std::atomic<unsigned int> writeCounter {0};
+    const auto tmpPath = path + ".tmp" + std::to_string(getProcessId()) + "_" + std::to_string(writeCounter++);
+
+    std::error_code err;
+    {
+        std::ofstream out(tmpPath, std::ios::out | std::ios::trunc | std::ios::binary);
+        try
+        {
+            write(out);
+        }
+        catch(...)
+        {
+            out.close();
+            std::filesystem::remove(tmpPath, err);
+            throw;
+        }
+        out.flush();
+        if(!out)
+        {
+            out.close();
+            std::filesystem::remove(tmpPath, err);
+            throw std::runtime_error("Could not write " + tmpPath);
+        }
+    }
+
+    std::filesystem::rename(tmpPath, path, err);
+    if(err)
+    {
+        const auto message = err.message();
+        std::filesystem::remove(tmpPath, err);
+        throw std::runtime_error("Could not write " + path + ": " + message);
+    }
+}
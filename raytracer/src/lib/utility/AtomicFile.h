@@ -0,0 +1,13 @@
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <string>
+
+// Id of the current process, used to give temporary files unique names.
+unsigned long getProcessId();
+
+// Writes the file at path through write(). The data goes to a temporary file next to it first, which is renamed to
+// path once it is complete, so concurrent readers never see a partially written file.
+// Throws std::runtime_error if the file can not be written. The temporary file is removed in that case.
+void writeFileAtomically(const std::string& path, const std::function<void(std::ostream&)>& write);
@@ -10,13 +10,5 @@ size_t createBatches(std::vector<Batch>& batches, size_t totalCount, size_t batc
         batches.push_back(makeBatch(i, endIdx, std::forward<MakeBatchFuncArgs>(args)...));
         batchCount++;
     }
-    auto remainingItems = totalCount % batchSize;
-    if(remainingItems > 0)
-    {
-        auto startIdx = totalCount - remainingItems;
-        auto endIdx = totalCount;
-        batches.push_back(makeBatch(startIdx, endIdx, std::forward<MakeBatchFuncArgs>(args)...));
-        batchCount++;
-    }
     return batchCount;
 }
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Bit counting helpers, mapped to the compiler intrinsics.
+namespace BitOps
+{
+    inline int popcount(uint32_t value)
+    {
+#ifdef _MSC_VER
+        return static_cast<int>(__popcnt(value));
+#else
+        return __builtin_popcount(value);
+#endif
+    }
+
+    // Index of the lowest set bit, value must not be 0.
+    inline int countTrailingZeros(uint32_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, value);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(value);
+#endif
+    }
+}
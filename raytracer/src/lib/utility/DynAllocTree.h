@@ -3,86 +3,71 @@
 #include <array>
 #include <assert.h>
 #include <cmath>
-
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+/*
+ * Fixed size tree of objects, stored inline. Only trivially destructible objects can be stored, so the tree is
+ * trivially copyable and constructing or copying it never allocates.
+ */
 template<size_t MaxObjectSize, size_t MaxTreeDepth, size_t MaxBranchingFactor, typename PointerType = unsigned int>
 class DynAllocTree {
-#pragma pack(push, 1)
-    struct EntryHeader
-    {
-        bool occupied = false;
-        PointerType parent;
-        //std::type_info type;
-        void(*destroy)(const void*) = nullptr;
-    };
-#pragma pack(pop)
-
     static constexpr size_t pow(size_t x, size_t y) noexcept
     {
         return y == 0 ? 1 : x * pow(x, y-1);
     }
 
     static constexpr size_t NbElements = pow(MaxBranchingFactor, MaxTreeDepth) - 1;
-    static constexpr size_t ElementByteSize = sizeof(EntryHeader) + MaxObjectSize;
-    static constexpr size_t BufferLength = NbElements * ElementByteSize;
+    static constexpr size_t BufferLength = NbElements * MaxObjectSize;
+
+    using OccupancyMask = uint32_t;
 
     PointerType index = 0;
     PointerType levelsDeep = 0;
-    std::array<char, BufferLength> buffer;
-
-public:
+    OccupancyMask occupied = 0; // Bit i is set if element i holds an object
+    // The elements are only initialized when they are allocated
+    std::array<PointerType, NbElements> parents;
+    alignas(std::max_align_t) std::array<char, BufferLength> buffer;
 
-    DynAllocTree() : buffer()
+    static constexpr OccupancyMask bit(PointerType i)
     {
-        static_assert(NbElements - 1 <= std::numeric_limits<PointerType>().max());
+        return OccupancyMask(1) << i;
     }
 
-    ~DynAllocTree()
+public:
+
+    DynAllocTree()
     {
-        clear();
+        static_assert(NbElements - 1 <= std::numeric_limits<PointerType>().max());
+        static_assert(NbElements <= sizeof(OccupancyMask) * 8, "Too many elements for the occupancy mask.");
     }
 
     template<typename T, typename ... Args>
     T* alloc(Args&& ... args)
     {
         static_assert(sizeof(T) <= MaxObjectSize, "Type T is too large to fit in the tree node. Decrease the type size or increase the max tree object size.");
+        static_assert(std::is_trivially_destructible_v<T>, "Type T must be trivially destructible, objects in the tree are never destroyed.");
 
-        auto pointer = index * ElementByteSize;
-
-        auto* header = reinterpret_cast<EntryHeader*>(&buffer[pointer]);
-        if(header->occupied)
-        {
-            header->destroy(reinterpret_cast<void*>(buffer.data() + pointer));
-        }
-
-        header->occupied = true;
-        //header->type = typeid(T);
-        header->destroy = [](const void* x) { static_cast<const T*>(x)->~T(); };
-        return new(&buffer[pointer+sizeof(EntryHeader)]) T(std::forward<Args>(args)...);
+        occupied |= bit(index);
+        return new(&buffer[index * MaxObjectSize]) T(std::forward<Args>(args)...);
     }
 
     void dealloc()
     {
-        auto pointer = index * ElementByteSize;
-
-        auto* header = reinterpret_cast<EntryHeader*>(&buffer[pointer]);
-        if(header->occupied)
-        {
-            header->destroy(reinterpret_cast<void*>(buffer.data() + pointer));
-        }
+        occupied &= ~bit(index);
     }
 
     template<typename T>
     T* tryRead()
     {
-        auto pointer = index * ElementByteSize;
-
-        auto* header = reinterpret_cast<EntryHeader*>(&buffer[pointer]);
-        if(!header->occupied /*|| header->type != typeid(T)*/)
+        if(!hasValue<T>())
         {
             return nullptr;
         }
 
-        return reinterpret_cast<T*>(&buffer[pointer+sizeof(EntryHeader)]);
+        return std::launder(reinterpret_cast<T*>(&buffer[index * MaxObjectSize]));
     }
 
     template <typename T, typename ... Args>
@@ -101,9 +86,7 @@ public:
     template<typename T>
     bool hasValue()
     {
-        auto pointer = index * ElementByteSize;
-        auto* header = reinterpret_cast<EntryHeader*>(&buffer[pointer]);
-        return header->occupied /*&& header->type == typeid(T)*/;
+        return (occupied & bit(index)) != 0;
     }
 
     void branch(size_t childIndex)
@@ -113,18 +96,14 @@ public:
 
         auto parent = index;
         levelsDeep++;
-        auto childSize = std::pow(MaxBranchingFactor, MaxTreeDepth - levelsDeep) - 1;
+        auto childSize = pow(MaxBranchingFactor, MaxTreeDepth - levelsDeep) - 1;
         index += 1 + (childIndex * childSize);
-        auto pointer = index * ElementByteSize;
-        auto* header = reinterpret_cast<EntryHeader*>(&buffer[pointer]);
-        header->parent = parent;
+        parents[index] = parent;
     }
 
     void up()
     {
-        auto pointer = index * ElementByteSize;
-        auto* header = reinterpret_cast<EntryHeader*>(&buffer[pointer]);
-        index = header->parent;
+        index = parents[index];
         levelsDeep--;
     }
 
@@ -136,17 +115,6 @@ public:
 
     void clear()
     {
-        size_t pointer = 0;
-        for(PointerType i = 0; i < NbElements; i++)
-        {
-            auto* header = reinterpret_cast<EntryHeader*>(&buffer[pointer]);
-            if(header->occupied)
-            {
-                header->destroy(static_cast<void*>(buffer.data() + pointer));
-                header->destroy = nullptr;
-                header->occupied = false;
-            }
-            pointer += ElementByteSize;
-        }
+        occupied = 0;
     }
 };
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+// Fast, non-cryptographic 64-bit hashing of raw buffers, for cache keys and checksums.
+// Four independent accumulators are used so long buffers hash at close to memory speed.
+namespace Hash
+{
+    constexpr uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+    constexpr uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr uint64_t Prime3 = 0x165667B19E3779F9ULL;
+
+    inline uint64_t rotl(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    inline uint64_t round(uint64_t acc, uint64_t input)
+    {
+        return rotl(acc + input * Prime2, 31) * Prime1;
+    }
+
+    inline uint64_t finalize(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= Prime2;
+        h ^= h >> 29;
+        h *= Prime3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    inline uint64_t load64(const unsigned char* p)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline uint64_t bytes(const void* data, size_t size, uint64_t seed = 0)
+    {
+        const auto* p = static_cast<const unsigned char*>(data);
+        const auto* end = p + size;
+
+        uint64_t acc[4] = { seed + Prime1 + Prime2, seed + Prime2, seed, seed - Prime1 };
+        while(end - p >= 32)
+        {
+            for(int i = 0; i < 4; i++)
+            {
+                acc[i] = round(acc[i], load64(p + 8 * i));
+            }
+            p += 32;
+        }
+
+        uint64_t h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18) + size;
+        while(end - p >= 8)
+        {
+            h = rotl(h ^ round(0, load64(p)), 27) * Prime1 + Prime3;
+            p += 8;
+        }
+        if(p < end)
+        {
+            uint64_t tail = 0;
+            std::memcpy(&tail, p, end - p);
+            h = rotl(h ^ round(0, tail), 27) * Prime1 + Prime3;
+        }
+        return finalize(h);
+    }
+
+    inline uint64_t combine(uint64_t seed, uint64_t value)
+    {
+        return finalize(seed ^ round(0, value));
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template<typename Signature, size_t Capacity>
+class InlineFunction;
+
+/*
+ * Callable wrapper with the callable stored inline, in a buffer of Capacity bytes.
+ * Unlike std::function it never allocates, and it is trivially copyable so it can be kept in plain per-path state.
+ * In return, only trivially copyable callables that fit the buffer are accepted, e.g. lambdas that capture references
+ * and pointers.
+ */
+template<typename R, typename... Args, size_t Capacity>
+class InlineFunction<R(Args...), Capacity>
+{
+public:
+    InlineFunction() = default;
+
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineFunction>>>
+    InlineFunction(F func)
+    {
+        static_assert(sizeof(F) <= Capacity, "Callable is too large for the inline buffer. Capture less or increase the capacity.");
+        static_assert(alignof(F) <= alignof(std::max_align_t), "Callable is overaligned.");
+        static_assert(std::is_trivially_copyable_v<F> && std::is_trivially_destructible_v<F>, "Callable must be trivially copyable, capture references or pointers instead of objects.");
+
+        new(buffer) F(func);
+        invoker = [](void* callable, Args... args) -> R
+        {
+            return (*static_cast<F*>(callable))(std::forward<Args>(args)...);
+        };
+    }
+
+    R operator()(Args... args) const
+    {
+        return invoker(const_cast<unsigned char*>(buffer), std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const
+    {
+        return invoker != nullptr;
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char buffer[Capacity];
+    R(*invoker)(void*, Args...) = nullptr;
+};
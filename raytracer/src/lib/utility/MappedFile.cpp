@@ -0,0 +1,142 @@
+#include "MappedFile.h"
+
+#include <fstream>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILE_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // Reads the complete file into a new buffer, for files that can not be mapped.
+    std::unique_ptr<char[]> readFile(const std::string& path, /* OUT */ size_t& size)
+    {
+        std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+        if(!in)
+        {
+            throw std::runtime_error("Could not open " + path);
+        }
+        size = static_cast<size_t>(in.tellg());
+        in.seekg(0);
+
+        auto buffer = std::make_unique<char[]>(size);
+        if(!in.read(buffer.get(), size))
+        {
+            throw std::runtime_error("Could not read " + path);
+        }
+        return buffer;
+    }
+}
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile(const std::string& path)
+{
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+
+    LARGE_INTEGER fileSize {};
+    if(!GetFileSizeEx(file, &fileSize))
+    {
+        CloseHandle(file);
+        throw std::runtime_error("Could not read the size of " + path);
+    }
+    this->size = static_cast<size_t>(fileSize.QuadPart);
+
+    // Empty files can not be mapped
+    if(this->size > 0)
+    {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(mapping != nullptr)
+        {
+            this->data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            CloseHandle(mapping);
+        }
+    }
+
+    // The view stays valid after the file and mapping handles are closed
+    CloseHandle(file);
+
+    if(this->size > 0 && this->data == nullptr)
+    {
+        // Some file systems do not support mapping, read the file instead
+        this->buffer = readFile(path, this->size);
+        this->data = this->buffer.get();
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if(this->data != nullptr && this->buffer == nullptr)
+    {
+        UnmapViewOfFile(this->data);
+    }
+}
+
+#elif defined(MAPPED_FILE_POSIX)
+
+MappedFile::MappedFile(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        throw std::runtime_error("Could not open " + path);
+    }
+
+    struct stat fileStat {};
+    if(fstat(fd, &fileStat) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("Could not read the size of " + path);
+    }
+    this->size = static_cast<size_t>(fileStat.st_size);
+
+    if(this->size > 0)
+    {
+        void* mapping = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping == MAP_FAILED)
+        {
+            // Some file systems do not support mapping, read the file instead
+            close(fd);
+            this->buffer = readFile(path, this->size);
+            this->data = this->buffer.get();
+            return;
+        }
+        this->data = static_cast<const char*>(mapping);
+    }
+
+    // The mapping stays valid after the file descriptor is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if(this->data != nullptr && this->buffer == nullptr)
+    {
+        munmap(const_cast<char*>(this->data), this->size);
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path)
+{
+    this->buffer = readFile(path, this->size);
+    this->data = this->size > 0 ? this->buffer.get() : nullptr;
+}
+
+MappedFile::~MappedFile() = default;
+
+#endif
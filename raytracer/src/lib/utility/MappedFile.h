@@ -0,0 +1,34 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstddef>
+
+// Read-only memory mapping of a complete file. The mapping is released when the object is destroyed.
+// Files that can not be mapped, and all files on platforms without memory mapping support, are read into a buffer instead.
+class MappedFile
+{
+public:
+    // Throws std::runtime_error if the file can not be opened or read.
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* getData() const
+    {
+        return data;
+    }
+
+    size_t getSize() const
+    {
+        return size;
+    }
+
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+    // Owns the data if the file was read instead of mapped
+    std::unique_ptr<char[]> buffer;
+};
@@ -1,55 +1,20 @@
 #include "Task.h"
 
 #ifdef NO_TBB
-#include <thread>
-
-class SuperTask : public Task
-{
-public:
-    std::vector<std::unique_ptr<Task>>::iterator begin;
-    std::vector<std::unique_ptr<Task>>::iterator end;
-
-    SuperTask(const std::vector<std::unique_ptr<Task>>::iterator& begin,
-              const std::vector<std::unique_ptr<Task>>::iterator& end) : begin(begin), end(end) {}
-
-    void execute() override
-    {
-        for(auto it = begin; it < end; ++it)
-        {
-            (*it)->execute();
-        }
-    }
-};
+#include "ThreadPool.h"
 
 void Task::runTasks(std::vector<std::unique_ptr<Task>>& tasks)
 {
-    using size_type = std::vector<std::unique_ptr<Task>>::size_type;
-
-    auto threadCount = std::thread::hardware_concurrency();
-    auto batchSize = std::max(size_type(1), tasks.size() / threadCount);
-
-    std::vector<SuperTask> superTasks;
-    for(size_type i = 0; i < tasks.size(); i += batchSize)
-    {
-        auto endIdx = std::min(i+batchSize, tasks.size());
-        bool isLastTask = endIdx+batchSize > tasks.size();
-        if(isLastTask)
-        {
-            endIdx = tasks.size();
-        }
-        superTasks.emplace_back(tasks.begin()+i, tasks.begin()+endIdx);
-    }
-
-    std::vector<std::thread> threads;
-    threads.reserve(superTasks.size());
-    for(auto& superTask : superTasks)
-    {
-        threads.emplace_back(&SuperTask::execute, &superTask);
-    }
-    for(auto& thread : threads)
+    // Each task is queued separately, so idle workers can steal the remaining tasks of busy workers.
+    auto& pool = ThreadPool::get();
+    ThreadPool::TaskGroup group;
+    for(auto& task : tasks)
     {
-        thread.join();
+        pool.submit(group, [curTask = task.get()](){
+            curTask->execute();
+        });
     }
+    pool.wait(group);
 }
 #else
 #include <tbb/tbb.h>
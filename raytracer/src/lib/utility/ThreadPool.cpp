@@ -0,0 +1,167 @@
+#include "ThreadPool.h"
+
+namespace
+{
+    // Index of the worker that runs on the current thread, or -1 for threads that are not owned by the pool.
+    thread_local int currentWorkerIdx = -1;
+    thread_local const ThreadPool* currentWorkerPool = nullptr;
+}
+
+ThreadPool::ThreadPool(unsigned int workerCount)
+    : queuedJobCount(0), nextExternalQueue(0), stopping(false)
+{
+    workerCount = std::max(1u, workerCount);
+
+    queues.reserve(workerCount);
+    for(unsigned int i = 0; i < workerCount; ++i)
+    {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    workers.reserve(workerCount);
+    for(unsigned int i = 0; i < workerCount; ++i)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(sleepMutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+
+    for(auto& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::get()
+{
+    static ThreadPool pool(std::thread::hardware_concurrency());
+    return pool;
+}
+
+unsigned int ThreadPool::getCurrentQueueIndex()
+{
+    if(currentWorkerPool == this)
+    {
+        return static_cast<unsigned int>(currentWorkerIdx);
+    }
+
+    // Spread jobs submitted from outside the pool over all queues, the workers will balance the remainder by stealing.
+    return nextExternalQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+}
+
+void ThreadPool::submit(TaskGroup& group, std::function<void()> job)
+{
+    group.pendingJobs.fetch_add(1, std::memory_order_relaxed);
+
+    auto& queue = *queues[getCurrentQueueIndex()];
+    {
+        std::lock_guard lock(queue.mutex);
+        queue.jobs.push_back(Job{std::move(job), &group});
+    }
+    queuedJobCount.fetch_add(1);
+
+    {
+        // Acquire the sleep mutex to make sure a worker that is about to sleep does not miss this notification.
+        std::lock_guard lock(sleepMutex);
+    }
+    wakeup.notify_one();
+}
+
+void ThreadPool::wait(TaskGroup& group)
+{
+    auto queueIdx = getCurrentQueueIndex();
+    while(group.pendingJobs.load(std::memory_order_acquire) > 0)
+    {
+        if(tryRunJob(queueIdx))
+        {
+            continue;
+        }
+
+        // The remaining jobs of the group are running on other threads. Sleep until the last one finishes, or until
+        // new jobs are queued that this thread can help with.
+        std::unique_lock lock(sleepMutex);
+        wakeup.wait(lock, [this, &group](){
+            return group.pendingJobs.load(std::memory_order_acquire) == 0 || queuedJobCount.load() > 0;
+        });
+    }
+}
+
+bool ThreadPool::tryPopOwn(unsigned int queueIdx, Job& job)
+{
+    auto& queue = *queues[queueIdx];
+    std::lock_guard lock(queue.mutex);
+    if(queue.jobs.empty())
+    {
+        return false;
+    }
+    job = std::move(queue.jobs.back());
+    queue.jobs.pop_back();
+    return true;
+}
+
+bool ThreadPool::trySteal(unsigned int thiefQueueIdx, Job& job)
+{
+    const auto queueCount = static_cast<unsigned int>(queues.size());
+    for(unsigned int offset = 1; offset < queueCount; ++offset)
+    {
+        auto& victim = *queues[(thiefQueueIdx + offset) % queueCount];
+        std::lock_guard lock(victim.mutex);
+        if(!victim.jobs.empty())
+        {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::tryRunJob(unsigned int preferredQueueIdx)
+{
+    Job job;
+    if(!tryPopOwn(preferredQueueIdx, job) && !trySteal(preferredQueueIdx, job))
+    {
+        return false;
+    }
+    queuedJobCount.fetch_sub(1);
+
+    job.func();
+    if(job.group->pendingJobs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        // Wake the threads that wait for the group. The group may be destroyed as soon as they see it is done, so it
+        // must not be touched anymore. Acquiring the sleep mutex makes sure a waiter that is about to sleep sees it.
+        {
+            std::lock_guard lock(sleepMutex);
+        }
+        wakeup.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::workerLoop(unsigned int workerIdx)
+{
+    currentWorkerIdx = static_cast<int>(workerIdx);
+    currentWorkerPool = this;
+
+    while(true)
+    {
+        if(tryRunJob(workerIdx))
+        {
+            continue;
+        }
+
+        std::unique_lock lock(sleepMutex);
+        wakeup.wait(lock, [this](){ return stopping || queuedJobCount.load() > 0; });
+        if(stopping)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Work-stealing thread pool.
+ *
+ * Every worker owns a deque of jobs. A worker pushes and pops jobs at the back of its own deque (LIFO, good locality
+ * for nested fork-join work) and steals from the front of the deques of other workers when its own deque is empty.
+ * Threads that wait on a TaskGroup execute queued jobs while waiting, so jobs can safely spawn and wait for subjobs.
+ *
+ * A single pool is created on first use (see get()) and reused for all parallel jobs of the process.
+ */
+class ThreadPool
+{
+public:
+    class TaskGroup
+    {
+    public:
+        TaskGroup() : pendingJobs(0) {}
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+    private:
+        friend class ThreadPool;
+        std::atomic<size_t> pendingJobs;
+    };
+
+    explicit ThreadPool(unsigned int workerCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    static ThreadPool& get();
+
+    // Queue a job as part of the specified group. The job may run on any worker thread.
+    void submit(TaskGroup& group, std::function<void()> job);
+
+    // Block until all jobs in the group have finished. The calling thread helps executing queued jobs, and sleeps while
+    // there are none.
+    void wait(TaskGroup& group);
+
+    unsigned int getWorkerCount() const
+    {
+        return static_cast<unsigned int>(workers.size());
+    }
+
+private:
+    struct Job
+    {
+        std::function<void()> func;
+        TaskGroup* group;
+    };
+
+    struct WorkerQueue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::atomic<size_t> queuedJobCount;
+    std::atomic<unsigned int> nextExternalQueue;
+    std::atomic<bool> stopping;
+    std::mutex sleepMutex;
+    std::condition_variable wakeup;
+
+    void workerLoop(unsigned int workerIdx);
+    bool tryRunJob(unsigned int preferredQueueIdx);
+    bool tryPopOwn(unsigned int queueIdx, Job& job);
+    bool trySteal(unsigned int thiefQueueIdx, Job& job);
+    unsigned int getCurrentQueueIndex();
+};
@@ -221,8 +221,7 @@ API_EXPORT void startRender(Settings* settings, std::shared_ptr<FrameBuffer>* bu
             if(settings->loadPhotonMapFromFile)
             {
                 std::cout << "Loading photon map..." << std::endl;
-                std::fstream in(photonMapFilePath, std::fstream::in | std::fstream::binary);
-                photonMap = PhotonMap::deserialize(in);
+                photonMap = PhotonMap::load(photonMapFilePath.string());
                 std::cout << "Loaded " << photonMap.getSize() << " photons" << std::endl;
             }
             else
@@ -236,8 +235,7 @@ API_EXPORT void startRender(Settings* settings, std::shared_ptr<FrameBuffer>* bu
             if(settings->savePhotonMapToFile)
             {
                 std::cout << "Saving photon map..." << std::endl;
-                std::fstream out(photonMapFilePath, std::fstream::out | std::fstream::binary);
-                photonMap.serialize(out);
+                photonMap.save(photonMapFilePath.string());
             }
 
             scene.setPhotonMap(std::move(photonMap));
@@ -0,0 +1,82 @@
+#include "AllocationCounter.h"
+
+#include <cstdlib>
+#include <new>
+
+// The replacements live in their own translation unit, so the compiler never pairs the malloc and free calls below
+// with new-expressions and delete-expressions of the tests.
+
+void countAllocation();
+
+namespace
+{
+	thread_local ScopedAllocationCounter* activeCounter = nullptr;
+
+	void* allocate(size_t size, size_t alignment)
+	{
+		countAllocation();
+		size = size == 0 ? 1 : size;
+		void* ptr = alignment <= alignof(std::max_align_t)
+			? std::malloc(size)
+			: std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+		if(ptr == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+		return ptr;
+	}
+}
+
+void countAllocation()
+{
+	if(activeCounter != nullptr)
+	{
+		activeCounter->count++;
+	}
+}
+
+ScopedAllocationCounter::ScopedAllocationCounter() : previous(activeCounter)
+{
+	activeCounter = this;
+}
+
+ScopedAllocationCounter::~ScopedAllocationCounter()
+{
+	activeCounter = previous;
+}
+
+size_t ScopedAllocationCounter::getCount() const
+{
+	return count;
+}
+
+// The array and nothrow forms call these.
+void* operator new(size_t size)
+{
+	return allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	return allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept
+{
+	std::free(ptr);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+
+// Counts the heap allocations made by the current thread while it is alive. The counting is done by the replacement
+// of the global operator new in AllocationCounter.cpp, which only does the bookkeeping while a counter is active.
+class ScopedAllocationCounter
+{
+public:
+	ScopedAllocationCounter();
+	~ScopedAllocationCounter();
+
+	ScopedAllocationCounter(const ScopedAllocationCounter&) = delete;
+	ScopedAllocationCounter& operator=(const ScopedAllocationCounter&) = delete;
+
+	size_t getCount() const;
+
+private:
+	ScopedAllocationCounter* previous;
+	size_t count = 0;
+
+	friend void countAllocation();
+};
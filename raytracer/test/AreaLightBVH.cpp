@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <random>
+#include "light/AreaLightBVH.h"
+#include "math/Triangle.h"
+
+using namespace testing;
+
+TEST(AreaLightBVH, MatchesBruteForce)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> coord(-10.0f, 10.0f);
+	std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+
+	std::vector<std::unique_ptr<AreaLight>> lights;
+	for(int i = 0; i < 300; i++)
+	{
+		auto light = std::make_unique<AreaLight>();
+		light->a = Point(coord(rng), coord(rng), coord(rng));
+		if(i % 3 == 0)
+		{
+			// Axis aligned panels, these have flat bounds
+			light->b = light->a + Vector3(1, 0, 0);
+			light->c = light->a + Vector3(0, 0, 1);
+		}
+		else
+		{
+			light->b = light->a + Vector3(offset(rng), offset(rng), offset(rng));
+			light->c = light->a + Vector3(offset(rng), offset(rng), offset(rng));
+		}
+		lights.push_back(std::move(light));
+	}
+	AreaLightBVH bvh(lights);
+	ASSERT_EQ(bvh.getLights().size(), lights.size());
+
+	int hitCount = 0;
+	for(int i = 0; i < 5000; i++)
+	{
+		Vector3 direction(offset(rng), offset(rng), offset(rng));
+		if(i % 5 == 0)
+		{
+			direction = Vector3(0, -1, 0);
+		}
+		Ray ray(Point(coord(rng), coord(rng), coord(rng)), direction.normalized());
+		const float maxT = (i % 2 == 0) ? INFINITY : 8.0f;
+
+		const AreaLight* expected = nullptr;
+		double bestT = maxT;
+		for(const auto& light : lights)
+		{
+			Triangle::TriangleIntersection intersection;
+			if(Triangle::intersect(ray, light->a, light->b, light->c, intersection) && intersection.t < bestT)
+			{
+				expected = &*light;
+				bestT = intersection.t;
+			}
+		}
+
+		auto hit = bvh.traceRay(ray, maxT);
+		ASSERT_EQ(hit.has_value(), expected != nullptr);
+		if(hit.has_value())
+		{
+			ASSERT_EQ(hit->light, expected);
+			ASSERT_FLOAT_EQ(hit->t, static_cast<float>(bestT));
+			hitCount++;
+		}
+	}
+	ASSERT_GT(hitCount, 100);
+
+	ASSERT_FALSE(AreaLightBVH().traceRay(Ray(Point(0, 0, 0), Vector3(0, 1, 0))).has_value());
+}
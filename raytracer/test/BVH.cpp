@@ -3,10 +3,15 @@
 #include "shape/Sphere.h"
 #include "shape/bvh/BVH.h"
 #include "shape/bvh/BVHBuilder.h"
+#include "shape/bvh/BVHCache.h"
 #include "shape/list/InstancedModelList.h"
 #include "shape/list/InstancedModelList.h"
 #include "material/NormalMaterial.h"
 #include "scene/renderable/SceneNode.h"
+#include "shape/TriangleMesh.h"
+#include <random>
+#include <filesystem>
+#include <fstream>
 
 using namespace testing;
 
@@ -79,4 +84,410 @@ TEST(BVH, TriangleMesh)
 		ASSERT_TRUE(hit.has_value());
 		ASSERT_EQ(&hit->getModelNode().getData().getShape(), &*sphere2);
 	}
-}
\ No newline at end of file
+}
+TEST(BVH, TwoSpheresPacked)
+{
+	std::vector<SceneNode<Model>> models;
+	auto sphereModel1 = make_sphere();
+	auto sphere1 = sphereModel1->getShapePtr();
+	models.emplace_back(Transformation::translate(-2, 0, 0), std::move(sphereModel1));
+	auto sphereModel2 = make_sphere();
+	auto sphere2 = sphereModel2->getShapePtr();
+	models.emplace_back(Transformation::translate(2, 0, 0), std::move(sphereModel2));
+	auto bvh = [&models](){
+		InstancedModelList list(std::move(models));
+		auto bvh = BVHBuilder<SceneRayHitInfo>::buildBVH(list);
+		bvh.pack();
+		return bvh;
+	}();
+
+	Ray ray1(Point(0, 0, 0), Vector3(-1, 0, 0));
+	auto hit = bvh.traceRay(ray1);
+	ASSERT_TRUE(hit.has_value());
+	ASSERT_EQ(&hit->getModelNode().getData().getShape(), &*sphere1);
+	ASSERT_TRUE(bvh.testVisibility(ray1, 10).has_value());
+
+	Ray ray2(Point(0, 0, 0), Vector3(1, 0, 0));
+	hit = bvh.traceRay(ray2);
+	ASSERT_TRUE(hit.has_value());
+	ASSERT_EQ(&hit->getModelNode().getData().getShape(), &*sphere2);
+
+	ASSERT_FALSE(bvh.traceRay(Ray(Point(0, 0, 0), Vector3(0, 1, 0))).has_value());
+}
+
+// Small triangles scattered through the scene, followed by longTriangleCount long, thin triangles that span it
+TriangleMesh make_random_triangles(size_t count, std::mt19937& rng, size_t longTriangleCount = 0)
+{
+	std::uniform_real_distribution<float> pos(-10, 10);
+	std::uniform_real_distribution<float> offset(-1, 1);
+	std::vector<Point> vertices;
+	std::vector<std::array<uint32_t, 3>> indices;
+	for(uint32_t i = 0; i < count; i++)
+	{
+		Point center(pos(rng), pos(rng), pos(rng));
+		for(int j = 0; j < 3; j++)
+		{
+			vertices.push_back(center + Vector3(offset(rng), offset(rng), offset(rng)));
+		}
+		indices.push_back({3*i, 3*i+1, 3*i+2});
+	}
+	for(uint32_t i = count; i < count + longTriangleCount; i++)
+	{
+		Point start(-10, pos(rng), pos(rng));
+		vertices.push_back(start);
+		vertices.push_back(start + Vector3(20, offset(rng), offset(rng)));
+		vertices.push_back(start + Vector3(offset(rng), 0.1f, offset(rng) * 0.1f));
+		indices.push_back({3*i, 3*i+1, 3*i+2});
+	}
+	std::vector<Vector3> normals(vertices.size(), Vector3(0, 0, 1));
+	return TriangleMesh(vertices, indices, normals, indices, {}, {});
+}
+
+// Reference result, using the scalar triangle test on every triangle
+std::optional<RayHitInfo> trace_brute_force(const TriangleMesh& mesh, const Ray& ray)
+{
+	std::optional<RayHitInfo> best;
+	const auto& data = mesh.getData();
+	for(uint32_t i = 0; i < data.vertexIndices.size(); i++)
+	{
+		const auto& idx = data.vertexIndices[i];
+		Triangle::TriangleIntersection intersection;
+		if(Triangle::intersect(ray, data.vertices[idx[0]], data.vertices[idx[1]], data.vertices[idx[2]], intersection)
+			&& (!best.has_value() || best->t > intersection.t))
+		{
+			best = RayHitInfo(ray, intersection.t, Vector3(), Vector2(), Vector3(), i);
+		}
+	}
+	return best;
+}
+
+// Compares the bundled any-hit test to the closest hits, with maxT just beyond the hit for even rays and just before it for odd rays
+template<typename TBVH>
+void check_bundle_visibility(const TBVH& bvh, const TriangleMesh& mesh, const RayBundle& bundle)
+{
+	RayBundleMaxT maxT;
+	RayBundleMask expected = 0;
+	for(RBSize_t j = 0; j < RayBundleSize; j++)
+	{
+		auto hit = trace_brute_force(mesh, bundle[j]);
+		maxT[j] = 1000.0f;
+		if(hit.has_value())
+		{
+			maxT[j] = j % 2 == 0 ? hit->t + 0.01f : hit->t * 0.99f;
+			expected |= (j % 2 == 0 ? RayBundleMask(1) : RayBundleMask(0)) << j;
+		}
+	}
+	ASSERT_EQ(bvh.testVisibilities(bundle, maxT), expected);
+
+	// Rays outside of the mask are not tested
+	const RayBundleMask rayMask = 0x0F0F0F0Fu & FullRayBundleMask;
+	ASSERT_EQ(bvh.testVisibilities(bundle, maxT, rayMask), expected & rayMask);
+}
+
+void test_packed_bvh(size_t width, BVHBuildStrategy strategy = BVHBuildStrategy::SweepSAH, size_t triangleCount = 3000, size_t longTriangleCount = 0)
+{
+	std::mt19937 rng(1234);
+	auto mesh = make_random_triangles(triangleCount, rng, longTriangleCount);
+	BVHBuildSettings settings;
+	settings.strategy = strategy;
+	auto bvh = BVHBuilder<RayHitInfo>::buildBVH(mesh, nullptr, settings);
+	if(strategy == BVHBuildStrategy::SpatialSplitSAH)
+	{
+		// The long triangles should have been split
+		ASSERT_GT(mesh.count(), triangleCount + longTriangleCount);
+	}
+	bvh.pack(width);
+	ASSERT_TRUE(bvh.isPacked());
+
+	std::uniform_real_distribution<float> pos(-12, 12);
+	RayBundle bundle;
+	for(int i = 0; i < 320; i++)
+	{
+		Point origin(pos(rng), pos(rng), pos(rng));
+		Vector3 dir(pos(rng), pos(rng), pos(rng));
+		dir.normalize();
+		Ray ray(origin, dir);
+		bundle[i % RayBundleSize] = ray;
+
+		auto expected = trace_brute_force(mesh, ray);
+		auto hit = bvh.traceRay(ray);
+		ASSERT_EQ(expected.has_value(), hit.has_value());
+		if(expected.has_value())
+		{
+			ASSERT_EQ(mesh.getData().vertexIndices[expected->triangleIndex], mesh.getData().vertexIndices[hit->triangleIndex]);
+			ASSERT_NEAR(expected->t, hit->t, 1E-4);
+			ASSERT_TRUE(bvh.testVisibility(ray, expected->t + 0.01f).has_value());
+			ASSERT_FALSE(bvh.testVisibility(ray, expected->t * 0.99f).has_value());
+		}
+		else
+		{
+			ASSERT_FALSE(bvh.testVisibility(ray, 1000).has_value());
+		}
+
+		if(i % RayBundleSize == RayBundleSize - 1)
+		{
+			check_bundle_visibility(bvh, mesh, bundle);
+
+			RayBundle rays = bundle;
+			auto hits = bvh.traceRays(rays);
+			for(RBSize_t j = 0; j < RayBundleSize; j++)
+			{
+				auto expectedHit = trace_brute_force(mesh, bundle[j]);
+				ASSERT_EQ(expectedHit.has_value(), hits[j].has_value());
+				if(expectedHit.has_value())
+				{
+					ASSERT_EQ(mesh.getData().vertexIndices[expectedHit->triangleIndex], mesh.getData().vertexIndices[hits[j]->triangleIndex]);
+				}
+			}
+		}
+	}
+
+	// Coherent bundles, like the camera rays through a pixel
+	int coherentHitCount = 0;
+	for(int i = 0; i < 20; i++)
+	{
+		Point origin(pos(rng), pos(rng), -15);
+		Vector3 baseDir(pos(rng) * 0.05f, pos(rng) * 0.05f, 1);
+		RayBundle rays;
+		for(RBSize_t j = 0; j < RayBundleSize; j++)
+		{
+			Vector3 dir = baseDir + Vector3((j % 6) * 0.003f, (j / 6) * 0.003f, 0);
+			dir.normalize();
+			rays[j] = Ray(origin, dir);
+		}
+		RayBundle original = rays;
+		auto hits = bvh.traceRays(rays);
+		for(RBSize_t j = 0; j < RayBundleSize; j++)
+		{
+			auto expectedHit = trace_brute_force(mesh, original[j]);
+			ASSERT_EQ(expectedHit.has_value(), hits[j].has_value());
+			if(expectedHit.has_value())
+			{
+				ASSERT_EQ(mesh.getData().vertexIndices[expectedHit->triangleIndex], mesh.getData().vertexIndices[hits[j]->triangleIndex]);
+				coherentHitCount++;
+			}
+		}
+	}
+	ASSERT_GT(coherentHitCount, 0);
+}
+
+TEST(BVH, Packed2)
+{
+	test_packed_bvh(2);
+}
+
+TEST(BVH, Packed4)
+{
+	test_packed_bvh(4);
+}
+
+TEST(BVH, Packed8)
+{
+	test_packed_bvh(8);
+}
+
+TEST(BVH, BinnedSAH)
+{
+	// Large enough for the bins of the top nodes to be gathered in parallel
+	test_packed_bvh(4, BVHBuildStrategy::BinnedSAH, 40000);
+}
+
+TEST(BVH, SpatialSplitSAH)
+{
+	test_packed_bvh(4, BVHBuildStrategy::SpatialSplitSAH, 20000, 200);
+}
+
+TEST(BVH, DeepPackedTree)
+{
+	// A stack of large triangles, one per z level, in a chain of nodes that each hold one triangle and the rest of
+	// the tree. Rays from above pass the triangles of all levels, so the traversal stacks grow with the depth of the
+	// packed tree, far beyond what they hold inline.
+	const uint32_t levelCount = 1000;
+	std::vector<Point> vertices;
+	std::vector<std::array<uint32_t, 3>> indices;
+	for(uint32_t i = 0; i < levelCount; i++)
+	{
+		vertices.push_back(Point(-10, -10, i * 0.01f));
+		vertices.push_back(Point(10, -10, i * 0.01f));
+		vertices.push_back(Point(-10, 10, i * 0.01f));
+		indices.push_back({3*i, 3*i+1, 3*i+2});
+	}
+	std::vector<Vector3> normals(vertices.size(), Vector3(0, 0, 1));
+	TriangleMesh mesh(vertices, indices, normals, indices, {}, {});
+
+	using ShapeList = IShapeList<RayHitInfo>;
+	using LinkedNode = BVH<ShapeList, RayHitInfo, 2>::LinkedNode;
+	auto get_bounds = [](const ShapeList& list)
+	{
+		AABB bounds = list.getAABB(0);
+		for(ShapeList::size_type i = 1; i < list.count(); i++)
+		{
+			bounds = bounds.merge(list.getAABB(i));
+		}
+		return bounds;
+	};
+
+	std::mt19937 rng(77);
+	std::uniform_real_distribution<float> pos(-5, 0);
+	for(size_t width : {2, 4, 8})
+	{
+		std::unique_ptr<ShapeList> rest = mesh.clone();
+		auto root = std::make_unique<LinkedNode>(get_bounds(*rest));
+		LinkedNode* node = root.get();
+		while(rest->count() > 2)
+		{
+			auto [leaf, tail] = rest->split(1);
+			node->setChild(0, std::make_unique<LinkedNode>(get_bounds(*leaf), std::move(leaf)));
+			node->setChild(1, std::make_unique<LinkedNode>(get_bounds(*tail)));
+			node = &node->getChild(1);
+			rest = std::move(tail);
+		}
+		auto [leaf, tail] = rest->split(1);
+		node->setChild(0, std::make_unique<LinkedNode>(get_bounds(*leaf), std::move(leaf)));
+		node->setChild(1, std::make_unique<LinkedNode>(get_bounds(*tail), std::move(tail)));
+
+		BVH<ShapeList, RayHitInfo, 2> bvh(std::move(root), mesh.count(), mesh.clone());
+		bvh.pack(width);
+		ASSERT_TRUE(bvh.isPacked());
+
+		RayBundle bundle;
+		for(RBSize_t j = 0; j < RayBundleSize; j++)
+		{
+			Vector3 dir(pos(rng) * 0.01f, pos(rng) * 0.01f, -1);
+			dir.normalize();
+			bundle[j] = Ray(Point(pos(rng), pos(rng), 20), dir);
+
+			auto hit = bvh.traceRay(bundle[j]);
+			ASSERT_TRUE(hit.has_value());
+			ASSERT_EQ(hit->triangleIndex, levelCount - 1);
+		}
+		check_bundle_visibility(bvh, mesh, bundle);
+
+		RayBundle rays = bundle;
+		auto hits = bvh.traceRays(rays);
+		for(RBSize_t j = 0; j < RayBundleSize; j++)
+		{
+			ASSERT_TRUE(hits[j].has_value());
+			ASSERT_EQ(hits[j]->triangleIndex, levelCount - 1);
+		}
+	}
+}
+
+void test_bvh_cache(BVHBuildStrategy strategy, size_t longTriangleCount)
+{
+	auto cacheDir = std::filesystem::temp_directory_path() / ("bvhcache_test_" + std::to_string(static_cast<int>(strategy)));
+	std::filesystem::remove_all(cacheDir);
+	BVHBuildSettings settings;
+	settings.strategy = strategy;
+
+	std::mt19937 rng(4321);
+	auto builtMesh = make_random_triangles(3000, rng, longTriangleCount);
+	rng.seed(4321);
+	auto loadedMesh = make_random_triangles(3000, rng, longTriangleCount);
+
+	BVHCache cache(cacheDir.string());
+	auto builtBVH = cache.getOrBuild(builtMesh, settings, 4);
+	ASSERT_EQ(cache.getMissCount(), 1);
+	auto loadedBVH = cache.getOrBuild(loadedMesh, settings, 4);
+	ASSERT_EQ(cache.getHitCount(), 1);
+	ASSERT_EQ(builtBVH.getSize(), loadedBVH.getSize());
+	ASSERT_EQ(builtMesh.count(), loadedMesh.count());
+	ASSERT_EQ(builtMesh.getData().vertexIndices, loadedMesh.getData().vertexIndices);
+
+	// Different settings use a different entry
+	BVHBuildSettings otherSettings;
+	otherSettings.strategy = strategy == BVHBuildStrategy::BinnedSAH ? BVHBuildStrategy::SweepSAH : BVHBuildStrategy::BinnedSAH;
+	rng.seed(4321);
+	auto otherMesh = make_random_triangles(3000, rng, longTriangleCount);
+	cache.getOrBuild(otherMesh, otherSettings, 4);
+	ASSERT_EQ(cache.getMissCount(), 2);
+
+	std::uniform_real_distribution<float> pos(-12, 12);
+	for(int i = 0; i < 300; i++)
+	{
+		Point origin(pos(rng), pos(rng), pos(rng));
+		Vector3 dir(pos(rng), pos(rng), pos(rng));
+		dir.normalize();
+		Ray ray(origin, dir);
+
+		auto expected = trace_brute_force(loadedMesh, ray);
+		auto hit = loadedBVH.traceRay(ray);
+		ASSERT_EQ(expected.has_value(), hit.has_value());
+		if(expected.has_value())
+		{
+			ASSERT_EQ(loadedMesh.getData().vertexIndices[expected->triangleIndex], loadedMesh.getData().vertexIndices[hit->triangleIndex]);
+			ASSERT_NEAR(expected->t, hit->t, 1E-4);
+		}
+	}
+
+	// Corrupted entries are rebuilt
+	for(const auto& entry : std::filesystem::directory_iterator(cacheDir))
+	{
+		std::fstream file(entry.path(), std::ios::in | std::ios::out | std::ios::binary);
+		file.seekp(-1, std::ios::end);
+		file.put('\x5A');
+	}
+	rng.seed(4321);
+	auto rebuiltMesh = make_random_triangles(3000, rng, longTriangleCount);
+	BVHCache reopenedCache(cacheDir.string());
+	reopenedCache.getOrBuild(rebuiltMesh, settings, 4);
+	ASSERT_EQ(reopenedCache.getHitCount(), 0);
+	ASSERT_EQ(reopenedCache.getMissCount(), 1);
+
+	std::filesystem::remove_all(cacheDir);
+}
+
+TEST(BVH, CacheBinnedSAH)
+{
+	test_bvh_cache(BVHBuildStrategy::BinnedSAH, 0);
+}
+
+TEST(BVH, CacheSpatialSplitSAH)
+{
+	// Cached trees restore the duplicated references
+	test_bvh_cache(BVHBuildStrategy::SpatialSplitSAH, 200);
+}
+
+TEST(BVH, BundleVisibility)
+{
+	std::mt19937 rng(98);
+	auto mesh = make_random_triangles(2000, rng);
+	auto bvh = BVHBuilder<RayHitInfo>::buildBVH(mesh);
+	ASSERT_FALSE(bvh.isPacked());
+
+	std::uniform_real_distribution<float> pos(-12, 12);
+	for(int i = 0; i < 10; i++)
+	{
+		RayBundle bundle;
+		for(RBSize_t j = 0; j < RayBundleSize; j++)
+		{
+			Vector3 dir(pos(rng), pos(rng), pos(rng));
+			dir.normalize();
+			bundle[j] = Ray(Point(pos(rng), pos(rng), pos(rng)), dir);
+		}
+		check_bundle_visibility(bvh, mesh, bundle);
+	}
+
+	// Instanced models, the rays are transformed per instance
+	std::vector<SceneNode<Model>> models;
+	models.emplace_back(Transformation::translate(-2, 0, 0), make_sphere());
+	models.emplace_back(Transformation::translate(2, 0, 0), make_sphere());
+	InstancedModelList list(std::move(models));
+	auto sceneBVH = BVHBuilder<SceneRayHitInfo>::buildBVH(list);
+	sceneBVH.pack();
+	RayBundle bundle;
+	RayBundleMaxT maxT;
+	for(RBSize_t j = 0; j < RayBundleSize; j++)
+	{
+		// Rays towards the left sphere, the right sphere, or in between them
+		float x = (j % 3 == 0) ? -1 : (j % 3 == 1) ? 1 : 0;
+		bundle[j] = Ray(Point(0, 0, 0), x == 0 ? Vector3(0, 1, 0) : Vector3(x, 0, 0));
+		maxT[j] = j % 2 == 0 ? 10.0f : 0.5f;
+	}
+	const RayBundleMask occluded = sceneBVH.testVisibilities(bundle, maxT);
+	for(RBSize_t j = 0; j < RayBundleSize; j++)
+	{
+		ASSERT_EQ(((occluded >> j) & 1u) != 0, sceneBVH.testVisibility(bundle[j], maxT[j]).has_value());
+		ASSERT_EQ(((occluded >> j) & 1u) != 0, j % 3 != 2 && j % 2 == 0);
+	}
+}
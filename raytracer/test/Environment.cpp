@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <random>
+#include "math/PiecewiseConstant.h"
+#include "math/Constants.h"
+#include "material/environment/ImageMapEnvironment.h"
+#include "scene/dynamic/DynamicScene.h"
+#include "material/DiffuseMaterial.h"
+#include "shape/Sphere.h"
+
+using namespace testing;
+
+namespace
+{
+	// Dim equirectangular image with a bright spot in the upper hemisphere
+	std::shared_ptr<Texture<float>> createEnvironmentTexture()
+	{
+		const unsigned int width = 64;
+		const unsigned int height = 32;
+		std::vector<float> data(width * height * 4);
+		for(unsigned int y = 0; y < height; y++)
+		{
+			for(unsigned int x = 0; x < width; x++)
+			{
+				const bool isSpot = (x >= 20 && x < 23 && y >= 8 && y < 10);
+				const float value = isSpot ? 500.0f : 0.2f + (0.01f * static_cast<float>(y));
+				float* texel = &data[((y * width) + x) * 4];
+				texel[0] = value;
+				texel[1] = value * 0.9f;
+				texel[2] = value * 0.8f;
+				texel[3] = 1.0f;
+			}
+		}
+		return std::make_shared<Texture<float>>(std::move(data), width, height, 1.0f);
+	}
+}
+
+TEST(Environment, PiecewiseConstantPdf)
+{
+	PiecewiseConstant1D distribution({1.0f, 0.0f, 3.0f, 4.0f});
+	ASSERT_FLOAT_EQ(distribution.getIntegral(), 2.0f);
+
+	float pdf;
+	size_t piece;
+	const float x = distribution.sample(0.3125f, pdf, piece);
+	ASSERT_EQ(piece, 2);
+	ASSERT_FLOAT_EQ(pdf, 1.5f);
+	ASSERT_FLOAT_EQ(x, 0.625f);
+
+	// The empty piece is never sampled
+	for(float u = 0; u < 1.0f; u += 0.01f)
+	{
+		distribution.sample(u, pdf, piece);
+		ASSERT_NE(piece, 1);
+		ASSERT_FLOAT_EQ(pdf, distribution.getPdf(piece));
+	}
+
+	PiecewiseConstant1D zero({0.0f, 0.0f});
+	ASSERT_FLOAT_EQ(zero.sample(0.75f, pdf, piece), 0.75f);
+	ASSERT_FLOAT_EQ(pdf, 1.0f);
+
+	PiecewiseConstant2D distribution2D({1, 2, 0, 0, 3, 4}, 2, 3);
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	for(int i = 0; i < 1000; i++)
+	{
+		const Vector2 point = distribution2D.sample(uniform(rng), uniform(rng), pdf);
+		ASSERT_FALSE(point.y() >= 1.0f/3.0f && point.y() < 2.0f/3.0f);
+		ASSERT_FLOAT_EQ(pdf, distribution2D.getPdf(point));
+	}
+}
+
+TEST(Environment, ImageMapSamplingMatchesIntegral)
+{
+	ImageMapEnvironment environment(createEnvironmentTexture());
+	environment.intensity = 2.0;
+	DynamicScene dynamicScene;
+	auto node = std::make_unique<DynamicSceneNode>();
+	node->model = std::make_unique<Model>(std::make_shared<Sphere>(), std::make_shared<DiffuseMaterial>());
+	dynamicScene.root->children.push_back(std::move(node));
+	Scene scene = dynamicScene.build();
+
+	// Reference: integral of the radiance over the sphere by quadrature
+	const int steps = 1024;
+	double reference = 0;
+	for(int i = 0; i < steps; i++)
+	{
+		const double theta = PI * (i + 0.5) / steps;
+		for(int j = 0; j < 2 * steps; j++)
+		{
+			const double phi = PI * (j + 0.5) / steps;
+			const Vector3 direction(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+			reference += environment.getRadiance(scene, direction).getLuminance() * std::sin(theta);
+		}
+	}
+	reference *= (PI / steps) * (PI / steps);
+
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	const int sampleCount = 100000;
+	double estimate = 0;
+	int mismatchCount = 0;
+	for(int i = 0; i < sampleCount; i++)
+	{
+		Vector3 direction;
+		float pdf;
+		const RGB radiance = environment.sample(scene, uniform(rng), uniform(rng), direction, pdf);
+		ASSERT_GT(pdf, 0);
+		ASSERT_NEAR(direction.norm(), 1.0f, 1e-4f);
+		// Samples on the edge of a texel may round to the neighbouring texel when mapped back
+		if(std::abs(pdf - environment.getPdf(direction)) > pdf * 1e-2f)
+		{
+			mismatchCount++;
+		}
+		ASSERT_NEAR(radiance.getLuminance(), environment.getRadiance(scene, direction).getLuminance(), 1e-2 * radiance.getLuminance());
+		estimate += radiance.getLuminance() / pdf;
+	}
+	estimate /= sampleCount;
+	ASSERT_LT(mismatchCount, sampleCount / 1000);
+	ASSERT_NEAR(estimate, reference, reference * 0.02);
+
+	// Clones share the image and keep the intensity
+	auto clone = environment.clone();
+	const Vector3 up(0, 1, 0);
+	ASSERT_FLOAT_EQ(clone->getRadiance(scene, up).getLuminance(), environment.getRadiance(scene, up).getLuminance());
+}
@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "io/GLTF.h"
+#include "shape/TriangleMesh.h"
+#include "utility/AtomicFile.h"
+
+using namespace testing;
+
+namespace
+{
+	template<typename T>
+	void append_bytes(std::vector<unsigned char>& bytes, const T& value)
+	{
+		const auto* begin = reinterpret_cast<const unsigned char*>(&value);
+		bytes.insert(bytes.end(), begin, begin + sizeof(value));
+	}
+
+	// Triangle with positions and normals interleaved in one buffer view, texture coordinates in a buffer view with
+	// a stride larger than the element, and 16-bit indices.
+	std::vector<unsigned char> make_triangle_buffer()
+	{
+		std::vector<unsigned char> bin;
+		const float positions[3][3] = {{0, 0, 0}, {1, 0, 0}, {0, 1, 0}};
+		for(const auto& position : positions)
+		{
+			for(float v : {position[0], position[1], position[2], 0.0f, 0.0f, 1.0f})
+			{
+				append_bytes(bin, v);
+			}
+		}
+		const float texCoords[3][2] = {{0, 0}, {1, 0}, {0, 1}};
+		for(const auto& texCoord : texCoords)
+		{
+			// The third value is not part of the accessor, it pads the element to the stride
+			for(float v : {texCoord[0], texCoord[1], -1.0f})
+			{
+				append_bytes(bin, v);
+			}
+		}
+		for(uint16_t i : {0, 1, 2})
+		{
+			append_bytes(bin, i);
+		}
+		return bin;
+	}
+
+	std::string make_triangle_json(size_t binLength, int positionCount)
+	{
+		return R"({"asset": {"version": "2.0"}, "scene": 0, "scenes": [{"nodes": [0]}], "nodes": [{"mesh": 0}],
+			"meshes": [{"primitives": [{"attributes": {"POSITION": 0, "NORMAL": 1, "TEXCOORD_0": 2}, "indices": 3}]}],
+			"buffers": [{"byteLength": )" + std::to_string(binLength) + R"(}],
+			"bufferViews": [
+				{"buffer": 0, "byteOffset": 0, "byteLength": 72, "byteStride": 24},
+				{"buffer": 0, "byteOffset": 72, "byteLength": 36, "byteStride": 12},
+				{"buffer": 0, "byteOffset": 108, "byteLength": 6}],
+			"accessors": [
+				{"bufferView": 0, "byteOffset": 0, "componentType": 5126, "count": )" + std::to_string(positionCount) + R"(, "type": "VEC3"},
+				{"bufferView": 0, "byteOffset": 12, "componentType": 5126, "count": 3, "type": "VEC3"},
+				{"bufferView": 1, "componentType": 5126, "count": 3, "type": "VEC2"},
+				{"bufferView": 2, "componentType": 5123, "count": 3, "type": "SCALAR"}]})";
+	}
+
+	void write_glb(const std::string& path, std::string json, std::vector<unsigned char> bin)
+	{
+		while(json.size() % 4 != 0)
+		{
+			json += ' ';
+		}
+		while(bin.size() % 4 != 0)
+		{
+			bin.push_back(0);
+		}
+
+		std::vector<unsigned char> glb;
+		append_bytes(glb, uint32_t(0x46546C67)); // "glTF"
+		append_bytes(glb, uint32_t(2));
+		append_bytes(glb, uint32_t(12 + 8 + json.size() + 8 + bin.size()));
+		append_bytes(glb, uint32_t(json.size()));
+		append_bytes(glb, uint32_t(0x4E4F534A)); // "JSON"
+		glb.insert(glb.end(), json.begin(), json.end());
+		append_bytes(glb, uint32_t(bin.size()));
+		append_bytes(glb, uint32_t(0x004E4942)); // "BIN"
+		glb.insert(glb.end(), bin.begin(), bin.end());
+
+		std::ofstream out(path, std::ios::out | std::ios::trunc | std::ios::binary);
+		out.write(reinterpret_cast<const char*>(glb.data()), glb.size());
+	}
+}
+
+TEST(GLTF, LoadsInterleavedAndStridedAccessors)
+{
+	const auto path = (std::filesystem::temp_directory_path() / ("gltf_test_" + std::to_string(getProcessId()) + ".glb")).string();
+	auto bin = make_triangle_buffer();
+	write_glb(path, make_triangle_json(bin.size(), 3), bin);
+
+	DynamicScene scene = loadGLTFScene(path, 1.0f);
+	std::filesystem::remove(path);
+
+	ASSERT_EQ(scene.root->children.size(), 1u);
+	ASSERT_TRUE(scene.root->children[0]->model != nullptr);
+	const auto& mesh = dynamic_cast<const TriangleMesh&>(scene.root->children[0]->model->getShape());
+	const auto& data = mesh.getData();
+	ASSERT_EQ(mesh.count(), 1u);
+	ASSERT_EQ(data.vertexIndices[0], (std::array<uint32_t, 3>{0, 1, 2}));
+	ASSERT_EQ(data.vertices.size(), 3u);
+	ASSERT_EQ(data.vertices[1], Point(1, 0, 0));
+	ASSERT_EQ(data.vertices[2], Point(0, 1, 0));
+	ASSERT_EQ(data.normals.size(), 3u);
+	for(const auto& normal : data.normals)
+	{
+		ASSERT_EQ(normal, Vector3(0, 0, 1));
+	}
+	ASSERT_EQ(data.texCoords.size(), 3u);
+	ASSERT_EQ(data.texCoords[1], Vector2(1, 0));
+	ASSERT_EQ(data.texCoords[2], Vector2(0, 1));
+}
+
+TEST(GLTF, RejectsAccessorOutsideOfBufferView)
+{
+	const auto path = (std::filesystem::temp_directory_path() / ("gltf_test_range_" + std::to_string(getProcessId()) + ".glb")).string();
+	auto bin = make_triangle_buffer();
+	write_glb(path, make_triangle_json(bin.size(), 4), bin);
+
+	std::string error;
+	try
+	{
+		loadGLTFScene(path, 1.0f);
+	}
+	catch(const std::runtime_error& e)
+	{
+		error = e.what();
+	}
+	std::filesystem::remove(path);
+	ASSERT_THAT(error, HasSubstr("Accessor exceeds its buffer"));
+}
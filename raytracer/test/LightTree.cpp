@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "light/LightTree.h"
+#include "material/NextEventEstimation.h"
+#include "material/DiffuseMaterial.h"
+#include "scene/dynamic/DynamicScene.h"
+#include "shape/Sphere.h"
+#include "math/Constants.h"
+
+using namespace testing;
+
+namespace
+{
+	std::unique_ptr<PointLight> make_point_light(Point pos, double intensity)
+	{
+		auto light = std::make_unique<PointLight>();
+		light->pos = pos;
+		light->intensity = intensity;
+		light->color = RGB(1, 1, 1);
+		return light;
+	}
+
+	std::unique_ptr<AreaLight> make_area_light(Point a, Point b, Point c, double intensity)
+	{
+		auto light = std::make_unique<AreaLight>();
+		light->a = a;
+		light->b = b;
+		light->c = c;
+		light->intensity = intensity;
+		return light;
+	}
+
+	// Grid of point lights with varying power, and a row of area lights facing down
+	void make_lights(std::vector<std::unique_ptr<PointLight>>& pointLights, std::vector<std::unique_ptr<AreaLight>>& areaLights)
+	{
+		for(int x = 0; x < 8; x++)
+		{
+			for(int z = 0; z < 8; z++)
+			{
+				pointLights.push_back(make_point_light(Point(x * 2.0f, 1.0f, z * 2.0f), 1.0 + ((x * 8 + z) % 5)));
+			}
+		}
+		for(int x = 0; x < 6; x++)
+		{
+			areaLights.push_back(make_area_light(Point(x * 3.0f, 4, 0), Point(x * 3.0f + 1, 4, 0), Point(x * 3.0f, 4, 1), 5.0));
+		}
+	}
+}
+
+TEST(LightTree, ProbabilitiesMatchSampling)
+{
+	std::vector<std::unique_ptr<PointLight>> pointLights;
+	std::vector<std::unique_ptr<AreaLight>> areaLights;
+	make_lights(pointLights, areaLights);
+	LightTree tree(pointLights, areaLights);
+	ASSERT_EQ(tree.getLights().size(), pointLights.size() + areaLights.size());
+	ASSERT_EQ(tree.getNodes().size(), (2 * tree.getLights().size()) - 1);
+
+	for(const auto& [point, normal] : {std::make_pair(Point(3, 0, 3), Vector3(0, 1, 0)), std::make_pair(Point(-5, 2, 7), Vector3(0, 0, 0)), std::make_pair(Point(9, 3, 0.5f), Vector3(1, 0, 0))})
+	{
+		float total = 0;
+		for(size_t i = 0; i < tree.getLights().size(); i++)
+		{
+			total += tree.getProbability(point, normal, i);
+		}
+		ASSERT_NEAR(total, 1.0f, 1e-4f);
+
+		for(int i = 0; i < 100; i++)
+		{
+			auto sampled = tree.sample(point, normal, (i + 0.5f) / 100.0f);
+			ASSERT_TRUE(sampled.has_value());
+			auto lightIt = std::find_if(tree.getLights().begin(), tree.getLights().end(), [&](const auto& light){
+				return light.type == sampled->light.type && light.index == sampled->light.index;
+			});
+			ASSERT_NEAR(sampled->probability, tree.getProbability(point, normal, std::distance(tree.getLights().begin(), lightIt)), 1e-5f);
+		}
+	}
+}
+
+TEST(LightTree, ImportanceIsConservative)
+{
+	std::vector<std::unique_ptr<PointLight>> pointLights;
+	std::vector<std::unique_ptr<AreaLight>> areaLights;
+	pointLights.push_back(make_point_light(Point(0, 1, 0), 1.0));
+	pointLights.push_back(make_point_light(Point(20, 1, 0), 1.0));
+	// Emits downwards, to -y
+	areaLights.push_back(make_area_light(Point(0, 3, 0), Point(1, 3, 0), Point(0, 3, 1), 1.0));
+	LightTree tree(pointLights, areaLights);
+
+	// A nearby light is picked more often than an equal light further away
+	ASSERT_GT(tree.getProbability(Point(0, 0, 0), Vector3(0, 1, 0), 0), tree.getProbability(Point(0, 0, 0), Vector3(0, 1, 0), 1));
+
+	// Area lights are never picked for points behind them, and always for points they may light
+	ASSERT_EQ(tree.getProbability(Point(0.2f, 5, 0.2f), Vector3(0, 1, 0), 2), 0.0f);
+	for(const auto& point : {Point(0.2f, 2.9f, 0.2f), Point(30, 2.99f, 30), Point(-10, -10, 4)})
+	{
+		ASSERT_GT(tree.getProbability(point, Vector3(0, 1, 0), 2), 0.0f);
+		ASSERT_GT(tree.getProbability(point, Vector3(0, 0, 0), 2), 0.0f);
+	}
+}
+
+TEST(LightTree, SampleByPower)
+{
+	std::vector<std::unique_ptr<PointLight>> pointLights;
+	std::vector<std::unique_ptr<AreaLight>> areaLights;
+	pointLights.push_back(make_point_light(Point(0, 1, 0), 1.0));
+	pointLights.push_back(make_point_light(Point(20, 1, 0), 3.0));
+	pointLights.push_back(make_point_light(Point(20, 1, 0), 0.0));
+	LightTree tree(pointLights, areaLights);
+	ASSERT_EQ(tree.getLights().size(), 2);
+
+	auto first = tree.sampleByPower(0.2f);
+	ASSERT_EQ(first->light.index, 0u);
+	ASSERT_FLOAT_EQ(first->probability, 0.25f);
+	auto second = tree.sampleByPower(0.3f);
+	ASSERT_EQ(second->light.index, 1u);
+	ASSERT_FLOAT_EQ(second->probability, 0.75f);
+}
+
+TEST(LightTree, NextEventEstimationIsUnbiased)
+{
+	DynamicScene dynamicScene;
+	auto sphere = std::make_unique<DynamicSceneNode>();
+	sphere->model = std::make_unique<Model>(std::make_shared<Sphere>(), std::make_shared<DiffuseMaterial>());
+	sphere->transform = Transformation::translate(100, 100, 100);
+	dynamicScene.root->children.push_back(std::move(sphere));
+	for(int i = 0; i < 40; i++)
+	{
+		auto light = std::make_unique<DynamicSceneNode>();
+		light->pointLight = make_point_light(Point((i % 7) * 1.5f, 2.0f + (i % 3), (i / 7) * 1.5f), 1.0 + (i % 4));
+		dynamicScene.root->children.push_back(std::move(light));
+	}
+	Scene scene = dynamicScene.build();
+
+	const Point hitpoint(2, 0, 3);
+	const Vector3 normal(0, 1, 0);
+	double expected = 0;
+	for(const auto& light : scene.getPointLights())
+	{
+		expected += light->intensity / (4.0 * PI * (light->pos - hitpoint).squaredNorm());
+	}
+
+	const int sampleCount = 200000;
+	double sum = 0;
+	for(int i = 0; i < sampleCount; i++)
+	{
+		Vector3 lightDirection;
+		sum += NextEventEstimation::sample(scene, hitpoint, normal, 0, 1, lightDirection).getRed();
+	}
+	ASSERT_NEAR(sum / sampleCount, expected, expected * 0.01);
+}
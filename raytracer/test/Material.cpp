@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "material/AddMaterial.h"
+#include "material/CompositeMaterial.h"
+#include "material/DiffuseMaterial.h"
+#include "material/EmissiveMaterial.h"
+#include "material/GlossyMaterial.h"
+#include "material/MixMaterial.h"
+#include "material/TransparentMaterial.h"
+#include "math/FastRandom.h"
+#include "model/Model.h"
+#include "shape/Sphere.h"
+#include "TestScenes.h"
+
+using namespace testing;
+
+namespace
+{
+	std::shared_ptr<EmissiveMaterial> make_emissive(const RGB& color)
+	{
+		auto material = std::make_shared<EmissiveMaterial>();
+		material->color = color;
+		return material;
+	}
+}
+
+TEST(Material, CompiledMaterialTraits)
+{
+	auto glossy = std::make_shared<GlossyMaterial>();
+	Model model(std::make_shared<Sphere>(), glossy);
+	ASSERT_EQ(model.getCompiledMaterial().getTraits().variance, MaterialVariance::none);
+	ASSERT_TRUE(model.getCompiledMaterial().getTraits().isSpecular);
+	ASSERT_EQ(model.getCompiledMaterial().getMaterial(), glossy.get());
+
+	// Traits are only updated when the material is compiled again, as done by the scene build.
+	glossy->roughness = 0.5f;
+	model.compileMaterial();
+	ASSERT_EQ(model.getCompiledMaterial().getTraits().variance, MaterialVariance::always);
+	ASSERT_FALSE(model.getCompiledMaterial().getTraits().isSpecular);
+
+	Model diffuseModel(std::make_shared<Sphere>(), std::make_shared<DiffuseMaterial>());
+	ASSERT_EQ(diffuseModel.getCompiledMaterial().getTraits().variance, MaterialVariance::perNode);
+	ASSERT_FALSE(diffuseModel.getCompiledMaterial().getTraits().isEmissive);
+
+	Model emissiveModel(std::make_shared<Sphere>(), std::make_shared<EmissiveMaterial>());
+	ASSERT_EQ(emissiveModel.getCompiledMaterial().getTraits().variance, MaterialVariance::none);
+	ASSERT_TRUE(emissiveModel.getCompiledMaterial().getTraits().isEmissive);
+}
+
+TEST(Material, CompiledCombinedMaterialTraits)
+{
+	auto mix = std::make_shared<ConstMixMaterial>();
+	mix->first = make_emissive(RGB(1, 0, 0));
+	mix->second = make_emissive(RGB(0, 0, 1));
+	mix->mixFactor = 0.5;
+	CompiledMaterial compiledMix(mix.get());
+	ASSERT_EQ(compiledMix.getTraits().variance, MaterialVariance::always);
+	ASSERT_TRUE(compiledMix.getTraits().isEmissive);
+
+	mix->mixFactor = 0.0;
+	ASSERT_EQ(CompiledMaterial(mix.get()).getTraits().variance, MaterialVariance::none);
+
+	auto add = std::make_shared<AddMaterial>();
+	add->first = std::make_shared<TransparentMaterial>();
+	add->second = std::make_shared<DiffuseMaterial>();
+	CompiledMaterial compiledAdd(add.get());
+	ASSERT_EQ(compiledAdd.getTraits().variance, MaterialVariance::perNode);
+	ASSERT_FALSE(compiledAdd.getTraits().isSpecular);
+
+	auto composite = std::make_shared<CompositeMaterial>();
+	composite->addMaterial(0, 10, std::make_shared<TransparentMaterial>());
+	composite->addMaterial(20, 10, std::make_shared<GlossyMaterial>());
+	CompiledMaterial compiledComposite(composite.get());
+	ASSERT_EQ(compiledComposite.getTraits().variance, MaterialVariance::none);
+	ASSERT_TRUE(compiledComposite.getTraits().isSpecular);
+	ASSERT_FALSE(compiledComposite.getTraits().isEmissive);
+
+	// The kind only depends on the type of the root material
+	auto emissive = make_emissive(RGB(0, 1, 0));
+	ASSERT_EQ(CompiledMaterial(emissive.get()).getKind(), CompiledMaterial(mix->first.get()).getKind());
+	ASSERT_NE(compiledMix.getKind(), compiledAdd.getKind());
+	ASSERT_NE(compiledMix.getKind(), CompiledMaterial(mix->first.get()).getKind());
+}
+
+TEST(Material, CompiledMixMatchesVirtualCalls)
+{
+	Scene scene = make_lit_scene();
+	auto hit = scene.traceRay(Ray(Point(0, 0, 5), Vector3(0, 0, -1)));
+	ASSERT_TRUE(hit.has_value());
+
+	auto mix = std::make_shared<ConstMixMaterial>();
+	mix->first = make_emissive(RGB(1, 0, 0));
+	mix->second = make_emissive(RGB(0, 0, 1));
+	mix->mixFactor = 0.3;
+	CompiledMaterial compiled(mix.get());
+
+	// Samples the node with the given sequence, returns its radiance
+	auto shade = [&](auto sampleTransport, auto bsdf, uint32_t sampleI)
+	{
+		std::vector<TransportNode> path;
+		path.emplace_back(*hit);
+		TransportBuildContext ctx(scene, path);
+		SampleSequence sequence(7, sampleI);
+		ScopedSampleSequence sequenceScope(&sequence);
+		sampleTransport(ctx);
+		EXPECT_TRUE(path[0].isEmissive);
+		return bsdf(path, path[0]);
+	};
+
+	int firstCount = 0;
+	for(uint32_t i = 0; i < 64; i++)
+	{
+		RGB expected = shade([&](TransportBuildContext& ctx){ mix->sampleTransport(ctx); },
+		                     [&](auto& path, auto& node){ return mix->bsdf(scene, path, 0, node, RGB()); }, i);
+		RGB actual = shade([&](TransportBuildContext& ctx){ compiled.sampleTransport(ctx); },
+		                   [&](auto& path, auto& node){ return compiled.bsdf(scene, path, 0, node, RGB()); }, i);
+		ASSERT_EQ(actual.getRed(), expected.getRed());
+		ASSERT_EQ(actual.getBlue(), expected.getBlue());
+		firstCount += actual.getRed() > 0 ? 1 : 0;
+	}
+	// Both materials are picked, the first one about 70% of the time
+	ASSERT_GT(firstCount, 32);
+	ASSERT_LT(firstCount, 64);
+}
@@ -0,0 +1,266 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <random>
+#include "renderer/PathSampler.h"
+#include "scene/renderable/ShadowRayQueue.h"
+#include "photonmapping/PhotonQueryQueue.h"
+#include "scene/dynamic/DynamicScene.h"
+#include "material/DiffuseMaterial.h"
+#include "material/GlossyMaterial.h"
+#include "material/environment/ImageMapEnvironment.h"
+#include "math/Constants.h"
+#include "shape/Sphere.h"
+#include "photonmapping/PhotonMapBuilder.h"
+#include "photonmapping/RadianceCache.h"
+#include "AllocationCounter.h"
+#include "TestScenes.h"
+
+using namespace testing;
+
+// Samples paths from a single camera ray, returns the number of heap allocations made while sampling, after warming up.
+size_t count_path_allocations(const Scene& scene)
+{
+	int maxPathLength = PathSampler::DefaultMaxPathLength;
+	std::vector<TransportNode> path;
+	path.reserve(maxPathLength);
+	ShadowRayQueue shadowRays;
+	PhotonQueryQueue photonQueries;
+
+	auto samplePaths = [&](int count)
+	{
+		RGB energy;
+		for(int i = 0; i < count; ++i)
+		{
+			Ray ray(Point(0.3f, 0.2f, 5), Vector3(0, 0, -1));
+			auto hit = scene.traceRay(ray);
+			ASSERT_TRUE(hit.has_value());
+			path.clear();
+			path.emplace_back(*hit);
+
+			PathSampler sampler(scene, path, 0, maxPathLength, 4, i % 4, &shadowRays, &photonQueries);
+			while(sampler.getState() != PathSampler::State::Done)
+			{
+				if(sampler.getState() == PathSampler::State::Shade)
+				{
+					sampler.shade();
+				}
+				else
+				{
+					sampler.extend(scene.traceRay(sampler.getExtensionRay()));
+				}
+			}
+			sampler.finish();
+			shadowRays.resolve(scene);
+			photonQueries.resolve(scene);
+			energy += calculatePathEnergy(path, scene);
+		}
+		ASSERT_GT(energy.getLuminance(), 0);
+	};
+
+	// The first paths may grow the path, the shadow ray queue and the photon lookup buffers to their final size.
+	samplePaths(100);
+
+	ScopedAllocationCounter allocations;
+	samplePaths(1000);
+	return allocations.getCount();
+}
+
+TEST(PathSampler, ShadingDoesNotAllocate)
+{
+	{
+		// Make sure the counter sees allocations, otherwise the tests below pass trivially
+		ScopedAllocationCounter allocations;
+		std::vector<TransportNode> path;
+		path.reserve(1);
+		ASSERT_EQ(allocations.getCount(), 1u);
+	}
+
+	Scene scene = make_lit_scene();
+	ASSERT_EQ(count_path_allocations(scene), 0);
+}
+
+TEST(PathSampler, PhotonMapShadingDoesNotAllocate)
+{
+	Scene scene = make_lit_scene();
+	auto progress = [](const std::string&, float, std::chrono::high_resolution_clock::duration, bool){};
+	for(auto mode : {PhotonMapMode::caustics, PhotonMapMode::full})
+	{
+		scene.setPhotonMap(PhotonMapBuilder::buildPhotonMap(scene, mode, 10000, 0, progress));
+		scene.setPhotonMapMode(mode);
+		scene.setPhotonMapDepth(1);
+		ASSERT_EQ(count_path_allocations(scene), 0);
+
+		scene.setRadianceCache(RadianceCache::build(*scene.getPhotonMap(), 4, progress));
+		ASSERT_EQ(count_path_allocations(scene), 0);
+		scene.setRadianceCache(std::nullopt);
+	}
+}
+
+TEST(PathSampler, QueuedPhotonLookupsMatchImmediateLookups)
+{
+	Scene scene = make_lit_scene();
+	auto progress = [](const std::string&, float, std::chrono::high_resolution_clock::duration, bool){};
+	scene.setPhotonMap(PhotonMapBuilder::buildPhotonMap(scene, PhotonMapMode::full, 10000, 0, progress, 1));
+	const PhotonMap& photonMap = *scene.getPhotonMap();
+
+	std::mt19937 rng(4);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	PhotonQueryQueue queue;
+	std::vector<RGB> queued(333);
+	std::vector<RGB> expected;
+	for(size_t i = 0; i < queued.size(); i++)
+	{
+		const Point target(unit(rng) * 3.0f, -1.0f + unit(rng) * 0.1f, unit(rng) * 3.0f);
+		const Vector3 direction = Vector3(unit(rng), unit(rng), unit(rng)).normalized();
+		queue.push(target, direction, 0.5f, queued[i]);
+		expected.push_back(PhotonQueryQueue::estimate(photonMap, target, direction).scale(0.5f));
+	}
+	ASSERT_EQ(queue.size(), queued.size());
+	queue.resolve(scene);
+	ASSERT_TRUE(queue.empty());
+
+	float totalLuminance = 0;
+	for(size_t i = 0; i < queued.size(); i++)
+	{
+		ASSERT_FLOAT_EQ(queued[i].getRed(), expected[i].getRed());
+		ASSERT_FLOAT_EQ(queued[i].getGreen(), expected[i].getGreen());
+		ASSERT_FLOAT_EQ(queued[i].getBlue(), expected[i].getBlue());
+		totalLuminance += queued[i].getLuminance();
+	}
+	ASSERT_GT(totalLuminance, 0);
+}
+
+TEST(PathSampler, MISMatchesAlternateLightSampling)
+{
+	// Diffuse floor under an area light, so all light arriving at the floor comes straight from the light
+	DynamicScene dynamicScene;
+	auto material = std::make_shared<DiffuseMaterial>();
+	material->diffuseColor = RGB(0.8, 0.8, 0.8);
+	auto floor = std::make_unique<DynamicSceneNode>();
+	floor->model = std::make_unique<Model>(std::make_shared<Sphere>(), material);
+	floor->transform = Transformation::translate(0, -101, 0).append(Transformation::scale(100, 100, 100));
+	dynamicScene.root->children.push_back(std::move(floor));
+	auto light = std::make_unique<DynamicSceneNode>();
+	light->areaLight = std::make_unique<AreaLight>();
+	light->areaLight->a = Point(-2, 1, -2);
+	light->areaLight->b = Point(2, 1, -2);
+	light->areaLight->c = Point(-2, 1, 2);
+	light->areaLight->intensity = 20;
+	dynamicScene.root->children.push_back(std::move(light));
+	Scene scene = dynamicScene.build();
+
+	auto hit = scene.traceRay(Ray(Point(0.3f, 0.5f, 0.2f), Vector3(0, -1, 0)));
+	ASSERT_TRUE(hit.has_value());
+
+	// Mean and variance of the luminance of the paths from the hit
+	auto estimate = [&](LightSamplingMode mode)
+	{
+		scene.setLightSamplingMode(mode);
+		const int sampleCount = 50000;
+		std::vector<TransportNode> path;
+		path.reserve(PathSampler::DefaultMaxPathLength);
+		double sum = 0;
+		double sqrSum = 0;
+		for(int i = 0; i < sampleCount; i++)
+		{
+			path.clear();
+			path.emplace_back(*hit);
+			SampleSequence sequence(7, i, 0, SamplerType::random);
+			double value = 0;
+			if(!samplePath(path, 0, PathSampler::DefaultMaxPathLength, scene, 1, 0, &sequence))
+			{
+				value = calculatePathEnergy(path, scene).getLuminance();
+			}
+			sum += value;
+			sqrSum += value * value;
+		}
+		const double mean = sum / sampleCount;
+		return std::make_pair(mean, (sqrSum / sampleCount) - (mean * mean));
+	};
+	auto [alternateMean, alternateVariance] = estimate(LightSamplingMode::alternate);
+	auto [misMean, misVariance] = estimate(LightSamplingMode::mis);
+	ASSERT_GT(alternateMean, 0);
+	ASSERT_NEAR(misMean, alternateMean, alternateMean * 0.02);
+	ASSERT_LT(misVariance, alternateVariance / 2);
+}
+
+TEST(PathSampler, MISMatchesAlternateEnvironmentLighting)
+{
+	// Diffuse floor lit by an environment map with a small bright spot
+	const unsigned int width = 64;
+	const unsigned int height = 32;
+	std::vector<float> data(width * height * 4, 1.0f);
+	for(unsigned int y = 0; y < height; y++)
+	{
+		for(unsigned int x = 0; x < width; x++)
+		{
+			const float value = (x >= 10 && x < 12 && y >= 6 && y < 8) ? 200.0f : 0.1f;
+			std::fill_n(&data[((y * width) + x) * 4], 3, value);
+		}
+	}
+
+	DynamicScene dynamicScene;
+	auto material = std::make_shared<DiffuseMaterial>();
+	material->diffuseColor = RGB(0.8, 0.8, 0.8);
+	auto floor = std::make_unique<DynamicSceneNode>();
+	floor->model = std::make_unique<Model>(std::make_shared<Sphere>(), material);
+	floor->transform = Transformation::translate(0, -101, 0).append(Transformation::scale(100, 100, 100));
+	dynamicScene.root->children.push_back(std::move(floor));
+	dynamicScene.environmentMaterial = std::make_unique<ImageMapEnvironment>(std::make_shared<Texture<float>>(std::move(data), width, height, 1.0f));
+	Scene scene = dynamicScene.build();
+
+	auto hit = scene.traceRay(Ray(Point(0.3f, 0.5f, 0.2f), Vector3(0, -1, 0)));
+	ASSERT_TRUE(hit.has_value());
+
+	auto estimate = [&](LightSamplingMode mode)
+	{
+		scene.setLightSamplingMode(mode);
+		const int sampleCount = 50000;
+		std::vector<TransportNode> path;
+		path.reserve(PathSampler::DefaultMaxPathLength);
+		double sum = 0;
+		double sqrSum = 0;
+		for(int i = 0; i < sampleCount; i++)
+		{
+			path.clear();
+			path.emplace_back(*hit);
+			SampleSequence sequence(11, i, 0, SamplerType::random);
+			double value = 0;
+			if(!samplePath(path, 0, PathSampler::DefaultMaxPathLength, scene, 1, 0, &sequence))
+			{
+				value = calculatePathEnergy(path, scene).getLuminance();
+			}
+			sum += value;
+			sqrSum += value * value;
+		}
+		const double mean = sum / sampleCount;
+		return std::make_pair(mean, (sqrSum / sampleCount) - (mean * mean));
+	};
+	// The floor is convex, so all light arriving at the hit comes straight from the environment:
+	// reflectance / pi * integral of radiance * cos over the hemisphere
+	const Vector3 normal = hit->normal;
+	const int steps = 512;
+	double reference = 0;
+	for(int i = 0; i < steps; i++)
+	{
+		const double theta = PI * (i + 0.5) / steps;
+		for(int j = 0; j < 2 * steps; j++)
+		{
+			const double phi = PI * (j + 0.5) / steps;
+			const Vector3 direction(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+			const float cos = direction.dot(normal);
+			if(cos > 0)
+			{
+				reference += scene.getEnvironmentMaterial().getRadiance(scene, direction).getLuminance() * cos * std::sin(theta);
+			}
+		}
+	}
+	reference *= (PI / steps) * (PI / steps) * 0.8 / PI;
+
+	auto [misMean, misVariance] = estimate(LightSamplingMode::mis);
+	ASSERT_NEAR(misMean, reference, reference * 0.02);
+
+	// Diffuse paths in alternate mode only find the spot by chance
+	auto [alternateMean, alternateVariance] = estimate(LightSamplingMode::alternate);
+	ASSERT_LT(misVariance, alternateVariance / 2);
+}
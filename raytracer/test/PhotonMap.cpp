@@ -0,0 +1,290 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <random>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "utility/AtomicFile.h"
+#include "photonmapping/PhotonMap.h"
+#include "photonmapping/PhotonQueryQueue.h"
+#include "photonmapping/PhotonMapBuilder.h"
+#include "photonmapping/RadianceCache.h"
+#include "TestScenes.h"
+
+using namespace testing;
+
+namespace
+{
+	PhotonList createPhotons(size_t count, std::mt19937& rng)
+	{
+		std::uniform_real_distribution<float> coord(-10.0f, 10.0f);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		PhotonList photons;
+		for(size_t i = 0; i < count; i++)
+		{
+			Vector3 normal(unit(rng), unit(rng), unit(rng));
+			photons.emplace_back(Point(coord(rng), coord(rng), coord(rng)), normal.normalized(), RGB(0.01f), i % 3 == 0);
+		}
+		return photons;
+	}
+}
+
+TEST(PhotonMap, PhotonEncoding)
+{
+	std::mt19937 rng(5);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> magnitude(-20.0f, 10.0f);
+	for(int i = 0; i < 10000; i++)
+	{
+		const Vector3 normal = Vector3(unit(rng), unit(rng), unit(rng)).normalized();
+		const float scale = std::exp2(magnitude(rng));
+		const RGB energy(scale * (unit(rng) + 1.0f), scale * (unit(rng) + 1.0f), scale * (unit(rng) + 1.0f));
+		Photon photon(Point(1, 2, 3), normal, energy, i % 2 == 0);
+		photon.setSplitAxis(Axes[i % 3]);
+
+		ASSERT_GT(photon.getSurfaceNormal().dot(normal), 0.99999f);
+		ASSERT_EQ(photon.isCaustic(), i % 2 == 0);
+		ASSERT_EQ(photon.getSplitAxis(), Axes[i % 3]);
+
+		// The components share the exponent of the largest one, which has 8 significant bits
+		const float maxComponent = std::max({energy.getRed(), energy.getGreen(), energy.getBlue()});
+		const RGB decoded = photon.getEnergy();
+		ASSERT_NEAR(decoded.getRed(), energy.getRed(), maxComponent / 128);
+		ASSERT_NEAR(decoded.getGreen(), energy.getGreen(), maxComponent / 128);
+		ASSERT_NEAR(decoded.getBlue(), energy.getBlue(), maxComponent / 128);
+	}
+
+	ASSERT_FLOAT_EQ(Photon(Point(0, 0, 0), Vector3(0, 0, -1), RGB(), false).getEnergy().getLuminance(), 0);
+	ASSERT_LT(Photon(Point(0, 0, 0), Vector3(0, 0, -1), RGB(), false).getSurfaceNormal().z(), -0.9999f);
+}
+
+TEST(PhotonMap, MatchesBruteForce)
+{
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> coord(-12.0f, 12.0f);
+	for(size_t photonCount : {1, 2, 3, 7, 1000, 30000})
+	{
+		PhotonList photons = createPhotons(photonCount, rng);
+		const PhotonList reference = photons;
+		PhotonMap map = PhotonMap::build(photons);
+		ASSERT_EQ(map.getSize(), photonCount);
+
+		const Vector3 up(0, 1, 0);
+		auto filter = [&up](const Photon& photon){ return photon.getSurfaceNormal().dot(up) >= 0; };
+		for(int i = 0; i < 200; i++)
+		{
+			const Point target(coord(rng), coord(rng), coord(rng));
+
+			std::vector<float> distances;
+			for(const Photon& photon : reference)
+			{
+				if(filter(photon))
+				{
+					distances.push_back((photon.getPosition() - target).norm());
+				}
+			}
+			std::sort(distances.begin(), distances.end());
+
+			std::vector<PhotonMap::Neighbour> results(20);
+			unsigned int foundCount = map.getNearest(target, results.size(), 1E9, filter, results.data());
+			ASSERT_EQ(foundCount, std::min<size_t>(results.size(), distances.size()));
+			for(unsigned int j = 0; j < foundCount; j++)
+			{
+				ASSERT_FLOAT_EQ((results[j].photon->getPosition() - target).norm(), distances[j]);
+				ASSERT_FLOAT_EQ(std::sqrt(results[j].sqrDistance), distances[j]);
+			}
+
+			// The search radius limits the results
+			if(foundCount > 1)
+			{
+				const float maxRadius = (distances[foundCount / 2 - 1] + distances[foundCount / 2]) / 2;
+				const auto expectedCount = std::count_if(distances.begin(), distances.end(), [maxRadius](float distance){ return distance < maxRadius; });
+				ASSERT_EQ(map.getNearest(target, results.size(), maxRadius, filter, results.data()), expectedCount);
+			}
+
+			const float radius = 3.0f;
+			std::vector<const Photon*> inRadius;
+			map.getElementsInRadiusFrom(target, radius, filter, inRadius);
+			const auto expectedCount = std::count_if(distances.begin(), distances.end(), [radius](float distance){ return distance < radius; });
+			ASSERT_EQ(inRadius.size(), expectedCount);
+		}
+	}
+}
+
+TEST(PhotonMap, BatchMatchesSingleQueries)
+{
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	for(size_t photonCount : {1, 5, 30000})
+	{
+		PhotonList photons = createPhotons(photonCount, rng);
+		PhotonMap map = PhotonMap::build(photons);
+		for(int batchI = 0; batchI < 100; batchI++)
+		{
+			// Some batches are spread out over the whole map, others are clustered
+			const size_t targetCount = 1 + (batchI % PhotonMap::BatchSize);
+			const float spread = batchI % 2 == 0 ? 10.0f : 0.5f;
+			const Point center(unit(rng) * 10.0f, unit(rng) * 10.0f, unit(rng) * 10.0f);
+			Point targets[PhotonMap::BatchSize];
+			Vector3 directions[PhotonMap::BatchSize];
+			for(size_t i = 0; i < targetCount; i++)
+			{
+				targets[i] = center + (Vector3(unit(rng), unit(rng), unit(rng)) * spread);
+				directions[i] = Vector3(unit(rng), unit(rng), unit(rng)).normalized();
+			}
+
+			const unsigned int count = 20;
+			const float maxRadius = batchI % 3 == 0 ? 2.0f : 1E9f;
+			std::vector<PhotonMap::Neighbour> results(targetCount * count);
+			unsigned int foundCounts[PhotonMap::BatchSize];
+			map.getNearestFacing(targets, directions, targetCount, count, maxRadius, results.data(), foundCounts);
+
+			for(size_t i = 0; i < targetCount; i++)
+			{
+				const Vector3 dir = directions[i];
+				std::vector<PhotonMap::Neighbour> expected(count);
+				const unsigned int expectedCount = map.getNearest(targets[i], count, maxRadius, [&dir](const Photon& photon){
+					return dir.dot(photon.getSurfaceNormal()) >= 0;
+				}, expected.data());
+				ASSERT_EQ(foundCounts[i], expectedCount);
+				for(unsigned int j = 0; j < expectedCount; j++)
+				{
+					ASSERT_FLOAT_EQ(results[(i * count) + j].sqrDistance, expected[j].sqrDistance);
+				}
+			}
+		}
+	}
+}
+
+TEST(PhotonMap, FileRoundTrip)
+{
+	std::mt19937 rng(3);
+	PhotonList photons = createPhotons(500, rng);
+	PhotonMapInfo info;
+	info.sceneHash = 0x1234567890ABCDEFULL;
+	info.mode = PhotonMapMode::caustics;
+	info.seed = 42;
+	info.photonsPerAreaLight = 1000;
+	PhotonMap map = PhotonMap::build(photons, info);
+
+	const auto path = (std::filesystem::temp_directory_path() / ("photonmap_test_" + std::to_string(getProcessId()))).string();
+	map.save(path);
+	{
+		PhotonMap loaded = PhotonMap::load(path);
+		ASSERT_EQ(loaded.getSize(), map.getSize());
+		ASSERT_EQ(loaded.getInfo().sceneHash, info.sceneHash);
+		ASSERT_EQ(loaded.getInfo().mode, info.mode);
+		ASSERT_EQ(loaded.getInfo().seed, info.seed);
+		ASSERT_EQ(loaded.getInfo().photonsPerAreaLight, info.photonsPerAreaLight);
+		ASSERT_EQ(std::memcmp(loaded.getPhotons(), map.getPhotons(), map.getSize() * sizeof(Photon)), 0);
+
+		// Queries run on the mapped photons, copies of the map share them
+		PhotonMap copy = loaded;
+		PhotonMap::Neighbour results[5];
+		ASSERT_EQ(copy.getNearest(Point(0, 0, 0), 5, results), 5);
+		ASSERT_GE(results[0].photon, loaded.getPhotons());
+		ASSERT_LT(results[0].photon, loaded.getPhotons() + loaded.getSize());
+	}
+
+	// The caustic photon count of the header (after the magic, version, photon size and photon count) must match
+	// the photons
+	{
+		std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+		uint64_t causticPhotonCount;
+		file.seekg(24);
+		file.read(reinterpret_cast<char*>(&causticPhotonCount), sizeof(causticPhotonCount));
+		ASSERT_EQ(causticPhotonCount, static_cast<uint64_t>(std::count_if(map.getPhotons(), map.getPhotons() + map.getSize(), [](const Photon& photon){ return photon.isCaustic(); })));
+		causticPhotonCount++;
+		file.seekp(24);
+		file.write(reinterpret_cast<const char*>(&causticPhotonCount), sizeof(causticPhotonCount));
+	}
+	ASSERT_THROW(PhotonMap::load(path), std::runtime_error);
+	map.save(path);
+
+	// Flip a byte of a photon
+	{
+		std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+		file.seekp(-10, std::ios::end);
+		file.put('\x5A');
+	}
+	ASSERT_THROW(PhotonMap::load(path), std::runtime_error);
+
+	std::filesystem::resize_file(path, 100);
+	ASSERT_THROW(PhotonMap::load(path), std::runtime_error);
+	std::filesystem::remove(path);
+}
+
+TEST(PhotonMap, RadianceCache)
+{
+	std::mt19937 rng(8);
+	PhotonList photons = createPhotons(30001, rng);
+	PhotonMapInfo info;
+	info.seed = 7;
+	PhotonMap map = PhotonMap::build(photons, info);
+
+	auto progress = [](const std::string&, float, std::chrono::high_resolution_clock::duration, bool){};
+	const uint32_t stride = 4;
+	PhotonMap cache = RadianceCache::build(map, stride, progress);
+	ASSERT_EQ(cache.getSize(), 7501);
+	ASSERT_EQ(cache.getInfo().radianceCacheStride, stride);
+	ASSERT_EQ(cache.getInfo().seed, info.seed);
+	ASSERT_TRUE(RadianceCache::isBuiltFrom(cache, map, stride));
+	ASSERT_FALSE(RadianceCache::isBuiltFrom(cache, map, 2));
+	ASSERT_FALSE(RadianceCache::isBuiltFrom(map, map, stride));
+
+	// Each radiance photon holds the density estimate at a photon of the map, which a lookup at its position returns.
+	// Only the first photons are checked, finding their source photons is quadratic.
+	std::vector<const Photon*> sources;
+	for(size_t i = 0; i < map.getSize(); i += stride)
+	{
+		sources.push_back(&map.getPhotons()[i]);
+	}
+	for(size_t i = 0; i < 500; i++)
+	{
+		const Photon& radiancePhoton = cache.getPhotons()[i];
+		const Vector3 normal = radiancePhoton.getSurfaceNormal();
+		const auto source = std::find_if(sources.begin(), sources.end(), [&radiancePhoton](const Photon* photon){
+			return photon->getPosition() == radiancePhoton.getPosition();
+		});
+		ASSERT_NE(source, sources.end());
+
+		const RGB expected = PhotonQueryQueue::estimate(map, (*source)->getPosition(), (*source)->getSurfaceNormal());
+		const RGB cached = RadianceCache::lookup(cache, radiancePhoton.getPosition(), normal);
+		const float maxComponent = std::max({expected.getRed(), expected.getGreen(), expected.getBlue()});
+		ASSERT_GT(maxComponent, 0);
+		ASSERT_NEAR(cached.getRed(), expected.getRed(), maxComponent / 128);
+		ASSERT_NEAR(cached.getGreen(), expected.getGreen(), maxComponent / 128);
+		ASSERT_NEAR(cached.getBlue(), expected.getBlue(), maxComponent / 128);
+	}
+
+	// The cache is stored like a photon map
+	const auto path = (std::filesystem::temp_directory_path() / ("radiancecache_test_" + std::to_string(getProcessId()))).string();
+	cache.save(path);
+	PhotonMap loaded = PhotonMap::load(path);
+	std::filesystem::remove(path);
+	ASSERT_TRUE(RadianceCache::isBuiltFrom(loaded, map, stride));
+	ASSERT_EQ(loaded.getInfo().radianceEstimatePhotonCount, PhotonQueryQueue::PhotonCount);
+}
+
+TEST(PhotonMap, SeededPhotonMapIsReproducible)
+{
+	Scene scene = make_lit_scene();
+	auto progress = [](const std::string&, float, std::chrono::high_resolution_clock::duration, bool){};
+	// Photon positions in the order in which the tree is traversed, so the tree structure is compared too.
+	auto get_photon_positions = [&](uint32_t seed)
+	{
+		auto photonMap = PhotonMapBuilder::buildPhotonMap(scene, PhotonMapMode::full, 25000, 0, progress, seed);
+		std::vector<const Photon*> photons;
+		photonMap.getElementsInRadiusFrom(Point(0, 0, 0), 1000.0f, photons);
+		std::vector<float> positions;
+		for(const auto* photon : photons)
+		{
+			positions.insert(positions.end(), {photon->pos.x(), photon->pos.y(), photon->pos.z()});
+		}
+		return positions;
+	};
+	auto reference = get_photon_positions(42);
+	ASSERT_FALSE(reference.empty());
+	ASSERT_EQ(reference, get_photon_positions(42));
+	ASSERT_NE(reference, get_photon_positions(43));
+}
@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "renderer/Renderer.h"
+#include "renderer/WavefrontRenderer.h"
+#include "renderer/PPMRenderer.h"
+#include "TestScenes.h"
+
+using namespace testing;
+
+namespace
+{
+	const int Width = 24;
+	const int Height = 16;
+
+	// Renders the image in tilesX x tilesY tiles, returns the pixel values.
+	std::vector<RGB> render_image(Renderer& renderer, const Scene& scene, const RenderSettings& settings, int tilesX, int tilesY, bool multithreaded)
+	{
+		FrameBuffer buffer(Width, Height);
+		auto perfBuffer = std::make_shared<FrameBuffer>(Width, Height);
+		auto progress = [](const std::string&, float, std::chrono::high_resolution_clock::duration, bool){};
+		for(int tileY = 0; tileY < tilesY; tileY++)
+		{
+			for(int tileX = 0; tileX < tilesX; tileX++)
+			{
+				Tile tile(tileX * Width / tilesX, tileY * Height / tilesY, (tileX + 1) * Width / tilesX, (tileY + 1) * Height / tilesY);
+				renderer.render(scene, buffer, perfBuffer, tile, settings, progress, multithreaded);
+			}
+		}
+
+		std::vector<RGB> pixels;
+		for(int y = 0; y < Height; y++)
+		{
+			for(int x = 0; x < Width; x++)
+			{
+				pixels.push_back(buffer.getPixel(x, y));
+			}
+		}
+		return pixels;
+	}
+
+	bool equal_images(const std::vector<RGB>& a, const std::vector<RGB>& b)
+	{
+		for(size_t i = 0; i < a.size(); i++)
+		{
+			if(a[i].getRed() != b[i].getRed() || a[i].getGreen() != b[i].getGreen() || a[i].getBlue() != b[i].getBlue())
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+TEST(Renderer, SeededRenderIsReproducible)
+{
+	Scene scene = make_lit_scene();
+	Renderer renderer;
+	WavefrontRenderer wavefrontRenderer;
+	for(auto sampler : {SamplerType::random, SamplerType::sobol})
+	{
+		RenderSettings settings;
+		settings.geometryAAModifier = 4;
+		settings.materialAAModifier = 4;
+		settings.sampler = sampler;
+		settings.seed = 42;
+
+		auto reference = render_image(renderer, scene, settings, 1, 1, false);
+		ASSERT_TRUE(equal_images(reference, render_image(renderer, scene, settings, 1, 1, true)));
+		ASSERT_TRUE(equal_images(reference, render_image(renderer, scene, settings, 3, 2, false)));
+		ASSERT_TRUE(equal_images(reference, render_image(wavefrontRenderer, scene, settings, 2, 2, true)));
+
+		settings.seed = 43;
+		ASSERT_FALSE(equal_images(reference, render_image(renderer, scene, settings, 1, 1, true)));
+	}
+}
+
+TEST(Renderer, SeededPPMRenderIsReproducible)
+{
+	Scene scene = make_lit_scene();
+	PPMRenderer renderer;
+	renderer.passCount = 4;
+	renderer.photonsPerAreaLight = 5000;
+	RenderSettings settings;
+	settings.seed = 42;
+
+	auto reference = render_image(renderer, scene, settings, 1, 1, false);
+	ASSERT_TRUE(equal_images(reference, render_image(renderer, scene, settings, 1, 1, true)));
+	ASSERT_TRUE(equal_images(reference, render_image(renderer, scene, settings, 3, 2, false)));
+
+	settings.seed = 43;
+	ASSERT_FALSE(equal_images(reference, render_image(renderer, scene, settings, 1, 1, true)));
+}
+
+TEST(Renderer, PPMConvergesToPathTracedImage)
+{
+	Scene scene = make_lit_scene();
+	scene.setLightSamplingMode(LightSamplingMode::mis);
+	RenderSettings settings;
+	settings.geometryAAModifier = 16;
+	settings.materialAAModifier = 16;
+	Renderer pathTracer;
+	auto reference = render_image(pathTracer, scene, settings, 1, 1, true);
+
+	// Mean absolute difference of the pixel luminances, relative to the mean luminance of the reference
+	auto get_error = [&reference](const std::vector<RGB>& image)
+	{
+		double difference = 0;
+		double total = 0;
+		for(size_t i = 0; i < image.size(); i++)
+		{
+			difference += std::abs(image[i].getLuminance() - reference[i].getLuminance());
+			total += reference[i].getLuminance();
+		}
+		return difference / total;
+	};
+
+	PPMRenderer renderer;
+	renderer.photonsPerAreaLight = 20000;
+	renderer.passCount = 2;
+	const double fewPassesError = get_error(render_image(renderer, scene, settings, 1, 1, true));
+	renderer.passCount = 48;
+	const double manyPassesError = get_error(render_image(renderer, scene, settings, 1, 1, true));
+	ASSERT_LT(manyPassesError, fewPassesError);
+	ASSERT_LT(manyPassesError, 0.1);
+}
+
+TEST(Renderer, AdaptiveSamplingStopsAtTimeBudget)
+{
+	Scene scene = make_lit_scene();
+	Renderer renderer;
+	WavefrontRenderer wavefrontRenderer;
+	RenderSettings settings;
+	settings.geometryAAModifier = 4;
+	settings.materialAAModifier = 4;
+	settings.noiseThreshold = 1E-6;
+	settings.maxSamplesPerPixel = 1 << 14;
+	settings.timeBudget = 0.2f;
+
+	for(Renderer* curRenderer : {&renderer, static_cast<Renderer*>(&wavefrontRenderer)})
+	{
+		auto start = std::chrono::steady_clock::now();
+		render_image(*curRenderer, scene, settings, 1, 1, true);
+		ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+	}
+}
@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <set>
+#include "math/SampleSequence.h"
+#include "math/FastRandom.h"
+
+using namespace testing;
+
+TEST(SampleSequence, SobolDirections)
+{
+	// First direction numbers of the second, third and fourth dimension of the Sobol sequence
+	ASSERT_THAT(std::vector<uint32_t>(Sobol::Directions[1].begin(), Sobol::Directions[1].begin() + 4), ElementsAre(0x80000000u, 0xc0000000u, 0xa0000000u, 0xf0000000u));
+	ASSERT_THAT(std::vector<uint32_t>(Sobol::Directions[2].begin(), Sobol::Directions[2].begin() + 4), ElementsAre(0x80000000u, 0xc0000000u, 0x60000000u, 0x90000000u));
+	ASSERT_THAT(std::vector<uint32_t>(Sobol::Directions[3].begin(), Sobol::Directions[3].begin() + 4), ElementsAre(0x80000000u, 0xc0000000u, 0x20000000u, 0x50000000u));
+}
+
+TEST(SampleSequence, Stratified)
+{
+	const uint32_t pointCount = 16;
+	const uint32_t dimensionCount = 12;
+	for(int pixel = 0; pixel < 8; pixel++)
+	{
+		std::vector<std::vector<float>> points;
+		for(uint32_t i = 0; i < pointCount; i++)
+		{
+			SampleSequence sequence(SampleSequence::pixelSeed(0, pixel, 3), i);
+			auto& point = points.emplace_back();
+			for(uint32_t dim = 0; dim < dimensionCount; dim++)
+			{
+				float value = sequence.next();
+				ASSERT_GE(value, 0.0f);
+				ASSERT_LT(value, 1.0f);
+				point.push_back(value);
+			}
+		}
+
+		// Every dimension has one point in each of pointCount intervals
+		for(uint32_t dim = 0; dim < dimensionCount; dim++)
+		{
+			std::set<int> strata;
+			for(const auto& point : points)
+			{
+				strata.insert(static_cast<int>(point[dim] * pointCount));
+			}
+			ASSERT_EQ(strata.size(), pointCount);
+		}
+
+		// The first two dimensions of every group have one point in each cell of a 4x4 grid
+		for(uint32_t dim = 0; dim < dimensionCount; dim += Sobol::DimensionCount)
+		{
+			std::set<int> strata;
+			for(const auto& point : points)
+			{
+				strata.insert(static_cast<int>(point[dim] * 4) * 4 + static_cast<int>(point[dim + 1] * 4));
+			}
+			ASSERT_EQ(strata.size(), pointCount);
+		}
+	}
+}
+
+TEST(SampleSequence, Deterministic)
+{
+	SampleSequence a(1234, 7);
+	SampleSequence b(1234, 7);
+	SampleSequence otherPixel(4321, 7);
+	bool differs = false;
+	for(int i = 0; i < 20; i++)
+	{
+		float value = a.next();
+		ASSERT_EQ(value, b.next());
+		differs = differs || value != otherPixel.next();
+	}
+	ASSERT_TRUE(differs);
+
+	// Skipping to a dimension gives the same values as drawing up to it
+	SampleSequence skipped(1234, 7);
+	skipped.skipTo(19);
+	SampleSequence drawn(1234, 7);
+	for(int i = 0; i < 19; i++)
+	{
+		drawn.next();
+	}
+	ASSERT_EQ(skipped.next(), drawn.next());
+
+	// Dimensions are never used twice
+	skipped.skipTo(5);
+	ASSERT_EQ(skipped.getDimension(), 20u);
+}
+
+TEST(SampleSequence, RandUsesSequence)
+{
+	SampleSequence sequence(99, 3);
+	SampleSequence expected(99, 3);
+	{
+		ScopedSampleSequence scope(&sequence);
+		ASSERT_TRUE(Rand::hasSequence());
+		ASSERT_EQ(Rand::unit(), expected.next());
+		ASSERT_FLOAT_EQ(Rand::floatInRange(2.0f, 4.0f), 2.0f + 2.0f * expected.next());
+		int value = Rand::intInRange(3, 5);
+		ASSERT_EQ(value, 3 + static_cast<int>(expected.next() * 3));
+	}
+	ASSERT_FALSE(Rand::hasSequence());
+	ASSERT_EQ(sequence.getDimension(), 3u);
+}
+
+TEST(SampleSequence, NestedScopesRestoreTheSequence)
+{
+	SampleSequence outer(99, 3);
+	SampleSequence inner(99, 4);
+	ScopedSampleSequence outerScope(&outer);
+	{
+		ScopedSampleSequence innerScope(&inner);
+		ASSERT_EQ(Rand::getSequence(), &inner);
+	}
+	ASSERT_EQ(Rand::getSequence(), &outer);
+}
+
+TEST(SampleSequence, RandomValues)
+{
+	// Independent values only depend on the seed, sample index and dimension
+	SampleSequence a(1234, 7, 0, SamplerType::random);
+	SampleSequence skipped(1234, 7, 0, SamplerType::random);
+	skipped.skipTo(5);
+	std::set<float> values;
+	for(int i = 0; i < 5; i++)
+	{
+		values.insert(a.next());
+	}
+	ASSERT_EQ(a.next(), skipped.next());
+	ASSERT_EQ(values.size(), 5u);
+	ASSERT_NE(SampleSequence(1234, 8, 0, SamplerType::random).next(), SampleSequence(1234, 7, 0, SamplerType::random).next());
+	ASSERT_NE(SampleSequence(1235, 7, 0, SamplerType::random).next(), SampleSequence(1234, 7, 0, SamplerType::random).next());
+
+	// Stratified sampling functions keep their own strata
+	ScopedSampleSequence scope(&a);
+	ASSERT_TRUE(Rand::hasSequence());
+	ASSERT_FALSE(Rand::hasStratifiedSequence());
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "scene/dynamic/DynamicScene.h"
+#include "camera/PerspectiveCamera.h"
+#include "material/DiffuseMaterial.h"
+#include "shape/Sphere.h"
+
+// Diffuse sphere on a diffuse floor, lit by a small area light above it and seen by a camera in front of it.
+inline Scene make_lit_scene()
+{
+	DynamicScene scene;
+	auto material = std::make_shared<DiffuseMaterial>();
+	material->diffuseColor = RGB(0.8, 0.8, 0.8);
+	auto shape = std::make_shared<Sphere>();
+
+	auto sphere = std::make_unique<DynamicSceneNode>();
+	sphere->model = std::make_unique<Model>(shape, material);
+	scene.root->children.push_back(std::move(sphere));
+
+	auto floor = std::make_unique<DynamicSceneNode>();
+	floor->model = std::make_unique<Model>(shape, material);
+	floor->transform = Transformation::translate(0, -101, 0).append(Transformation::scale(100, 100, 100));
+	scene.root->children.push_back(std::move(floor));
+
+	auto light = std::make_unique<DynamicSceneNode>();
+	light->areaLight = std::make_unique<AreaLight>();
+	light->areaLight->a = Point(-1, 3, -1);
+	light->areaLight->b = Point(1, 3, -1);
+	light->areaLight->c = Point(-1, 3, 1);
+	light->areaLight->intensity = 20;
+	scene.root->children.push_back(std::move(light));
+
+	auto camera = std::make_unique<DynamicSceneNode>();
+	camera->camera = std::make_unique<PerspectiveCamera>(60);
+	camera->transform = Transformation::translate(0, 0, 5);
+	scene.root->children.push_back(std::move(camera));
+
+	return scene.build();
+}
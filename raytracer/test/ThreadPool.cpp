@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include "utility/ThreadPool.h"
+
+using namespace testing;
+
+TEST(ThreadPool, RunsAllJobs)
+{
+	ThreadPool pool(4);
+	ThreadPool::TaskGroup group;
+	std::atomic<int> counter(0);
+	for(int i = 0; i < 1000; ++i)
+	{
+		pool.submit(group, [&counter](){ counter++; });
+	}
+	pool.wait(group);
+	ASSERT_EQ(counter.load(), 1000);
+}
+
+TEST(ThreadPool, NestedJobs)
+{
+	ThreadPool pool(2);
+	ThreadPool::TaskGroup group;
+	std::atomic<int> counter(0);
+	for(int i = 0; i < 16; ++i)
+	{
+		pool.submit(group, [&pool, &counter](){
+			ThreadPool::TaskGroup subGroup;
+			for(int j = 0; j < 16; ++j)
+			{
+				pool.submit(subGroup, [&counter](){ counter++; });
+			}
+			pool.wait(subGroup);
+		});
+	}
+	pool.wait(group);
+	ASSERT_EQ(counter.load(), 256);
+}
+
+TEST(ThreadPool, WaitSleepsWhileJobsRun)
+{
+	ThreadPool pool(2);
+	ThreadPool::TaskGroup group;
+	pool.submit(group, [](){ std::this_thread::sleep_for(std::chrono::milliseconds(300)); });
+
+	// Let a worker pick up the job, so that the waiting thread has nothing to help with
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	const std::clock_t cpuStart = std::clock();
+	pool.wait(group);
+	const double cpuSeconds = static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+	ASSERT_LT(cpuSeconds, 0.1);
+}
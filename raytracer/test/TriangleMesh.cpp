@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "shape/TriangleMesh.h"
+#include "math/PackedVectors.h"
+#include <random>
+
+using namespace testing;
+
+TEST(TriangleMesh, HalfFloat)
+{
+	for(float value : {0.0f, -0.0f, 1.0f, -2.5f, 0.333251953125f, 65504.0f, 6.103515625E-5f, 5.9604644775390625E-8f})
+	{
+		ASSERT_EQ(HalfFloat::toFloat(HalfFloat::fromFloat(value)), value);
+	}
+	ASSERT_TRUE(std::isinf(HalfFloat::toFloat(HalfFloat::fromFloat(65520.0f))));
+	ASSERT_EQ(HalfFloat::toFloat(HalfFloat::fromFloat(1E-9f)), 0.0f);
+	// Rounds to nearest even
+	ASSERT_EQ(HalfFloat::toFloat(HalfFloat::fromFloat(1.0f + 1.0f/2048.0f)), 1.0f);
+	ASSERT_EQ(HalfFloat::toFloat(HalfFloat::fromFloat(1.0f + 3.0f/2048.0f)), 1.0f + 2.0f/1024.0f);
+}
+
+TEST(TriangleMesh, OctahedralNormal)
+{
+	std::mt19937 rng(42);
+	std::normal_distribution<float> dist;
+	for(int i = 0; i < 10000; i++)
+	{
+		Vector3 normal(dist(rng), dist(rng), dist(rng));
+		normal.normalize();
+		auto decoded = OctahedralNormal::encode(normal).decode();
+		ASSERT_NEAR(decoded.norm(), 1.0f, 1E-5f);
+		ASSERT_LT((decoded - normal).norm(), 1E-4f);
+	}
+	for(const auto& axis : {Vector3(1, 0, 0), Vector3(0, -1, 0), Vector3(0, 0, 1), Vector3(0, 0, -1)})
+	{
+		ASSERT_LT((OctahedralNormal::encode(axis).decode() - axis).norm(), 1E-6f);
+	}
+}
+
+// Grid of triangles in the z=0 plane, with per-vertex normals and texture coordinates, all attributes sharing the vertex indices
+std::shared_ptr<TriangleMeshData> make_grid(uint32_t size, float offset)
+{
+	auto data = std::make_shared<TriangleMeshData>();
+	for(uint32_t y = 0; y <= size; y++)
+	{
+		for(uint32_t x = 0; x <= size; x++)
+		{
+			data->vertices.emplace_back(x + offset, y, 0);
+			Vector3 normal(0.1f * x, -0.2f * y, 1);
+			normal.normalize();
+			data->normals.push_back(normal);
+			data->texCoords.emplace_back(x / float(size), y / float(size));
+		}
+	}
+	for(uint32_t y = 0; y < size; y++)
+	{
+		for(uint32_t x = 0; x < size; x++)
+		{
+			uint32_t i = y * (size + 1) + x;
+			data->vertexIndices.push_back({i, i + 1, i + size + 1});
+			data->vertexIndices.push_back({i + 1, i + size + 2, i + size + 1});
+		}
+	}
+	return data;
+}
+
+void expect_same_hits(const TriangleMesh& expected, const TriangleMesh& actual, float offset, float tolerance)
+{
+	for(float x = 0.05f; x < 4; x += 0.3f)
+	{
+		for(float y = 0.05f; y < 4; y += 0.3f)
+		{
+			Ray ray(Point(x + offset, y, 1), Vector3(0, 0, -1));
+			auto expectedHit = expected.intersect(ray);
+			auto hit = actual.intersect(ray);
+			ASSERT_EQ(expectedHit.has_value(), hit.has_value());
+			if(hit.has_value())
+			{
+				ASSERT_NEAR(expectedHit->t, hit->t, 1E-5);
+				ASSERT_LT((expectedHit->normal - hit->normal).norm(), tolerance);
+				ASSERT_LT((expectedHit->texCoord - hit->texCoord).norm(), tolerance);
+			}
+		}
+	}
+}
+
+TEST(TriangleMesh, SharedAttributeIndices)
+{
+	auto data = make_grid(4u, 0);
+	auto explicitData = std::make_shared<TriangleMeshData>(*data);
+	explicitData->normalIndices = explicitData->vertexIndices;
+	explicitData->texCoordIndices = explicitData->vertexIndices;
+	TriangleMesh explicitMesh(explicitData, 0, explicitData->vertexIndices.size());
+
+	TriangleMesh mesh(data, 0, data->vertexIndices.size());
+	mesh.sortByCentroid(Axis::x, false);
+	mesh.partitionByCentroid([](const Point& p){ return p.y() < 2; });
+	ASSERT_TRUE(data->normalIndices.empty());
+	expect_same_hits(explicitMesh, mesh, 0, 1E-6f);
+
+	data->quantizeAttributes();
+	ASSERT_TRUE(data->normals.empty());
+	ASSERT_TRUE(data->texCoords.empty());
+	expect_same_hits(explicitMesh, mesh, 0, 1E-3f);
+
+	explicitData->shareAttributeIndices();
+	ASSERT_TRUE(explicitData->normalIndices.empty());
+	ASSERT_TRUE(explicitData->texCoordIndices.empty());
+}
+
+TEST(TriangleMesh, AppendMeshes)
+{
+	auto compactData = make_grid(4u, 0);
+	compactData->quantizeAttributes();
+	TriangleMesh compact(compactData, 0, compactData->vertexIndices.size());
+
+	auto explicitData = make_grid(4u, 10);
+	explicitData->normalIndices = explicitData->vertexIndices;
+	explicitData->texCoordIndices = explicitData->vertexIndices;
+	TriangleMesh explicitMesh(explicitData, 0, explicitData->vertexIndices.size());
+
+	// Compact meshes stay compact
+	TriangleMesh merged(true);
+	auto subMeshes = merged.appendMeshes({&compact, &compact});
+	ASSERT_EQ(merged.count(), 2 * compact.count());
+	ASSERT_TRUE(merged.getData().normalIndices.empty());
+	ASSERT_TRUE(merged.getData().texCoordIndices.empty());
+	ASSERT_FALSE(merged.getData().packedNormals.empty());
+	ASSERT_FALSE(merged.getData().packedTexCoords.empty());
+	expect_same_hits(compact, subMeshes[1], 0, 1E-6f);
+
+	// Mixing layouts falls back to separate indices and full precision attributes
+	auto mixedSubMeshes = merged.appendMeshes({&explicitMesh});
+	ASSERT_EQ(merged.count(), 2 * compact.count() + explicitMesh.count());
+	ASSERT_EQ(merged.getData().normalIndices.size(), merged.count());
+	ASSERT_EQ(merged.getData().texCoordIndices.size(), merged.count());
+	ASSERT_TRUE(merged.getData().packedNormals.empty());
+	expect_same_hits(compact, subMeshes[0], 0, 1E-6f);
+	expect_same_hits(explicitMesh, mixedSubMeshes[0], 10, 1E-6f);
+}